@@ -1,31 +1,94 @@
 #include "atmosphere.h"
 
 #include <glad/glad.h>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <thread>
 
 #include "cmake_source_dir.h"
+#include "profiler.h"
+
+unsigned int Atmosphere::UPLOAD_BYTES = 0;
 
 void Atmosphere::init()
 {
+    // ground and ocean sample node heightmaps, share the tile size with them
+    const ShaderDefines tileDefines = Node::shader_defines();
     m_shSkyFromSpace         .reload_shader_program_from_files(FP("renderer/atmosphere/SkyFromSpace.vert"          ),FP("renderer/atmosphere/SkyFromSpace.frag"         ));
     m_shSkyFromAtmosphere    .reload_shader_program_from_files(FP("renderer/atmosphere/SkyFromAtmosphere.vert"     ),FP("renderer/atmosphere/SkyFromAtmosphere.frag"    ));
-    m_shGroundFromSpace      .reload_shader_program_from_files(FP("renderer/atmosphere/GroundFromSpace.vert"       ),FP("renderer/atmosphere/GroundFromSpace.frag"      ));
-    m_shGroundFromAtmosphere .reload_shader_program_from_files(FP("renderer/atmosphere/GroundFromAtmosphere.vert"  ),FP("renderer/atmosphere/GroundFromAtmosphere.frag" ));
+    m_shGroundFromSpace      .reload_shader_program_from_files(FP("renderer/atmosphere/GroundFromSpace.vert"       ),FP("renderer/atmosphere/GroundFromSpace.frag"      ), nullptr, tileDefines);
+    m_shGroundFromAtmosphere .reload_shader_program_from_files(FP("renderer/atmosphere/GroundFromAtmosphere.vert"  ),FP("renderer/atmosphere/GroundFromAtmosphere.frag" ), nullptr, tileDefines);
     //m_shSpaceFromSpace       .reload_shader_program_from_files(FP("renderer/atmosphere/SpaceFromSpace.vert"        ),FP("renderer/atmosphere/SpaceFromSpace.frag"       ));
     //m_shSpaceFromAtmosphere  .reload_shader_program_from_files(FP("renderer/atmosphere/SpaceFromAtmosphere.vert"   ),FP("renderer/atmosphere/SpaceFromAtmosphere.frag"  ));
-    m_shOceanFromSpace       .reload_shader_program_from_files(FP("renderer/atmosphere/OceanFromSpace.vert"        ),FP("renderer/atmosphere/OceanFromSpace.frag"       ));
-    m_shOceanFromAtmosphere  .reload_shader_program_from_files(FP("renderer/atmosphere/OceanFromAtmosphere.vert"   ),FP("renderer/atmosphere/OceanFromAtmosphere.frag"  ));
+    m_shOceanFromSpace       .reload_shader_program_from_files(FP("renderer/atmosphere/OceanFromSpace.vert"        ),FP("renderer/atmosphere/OceanFromSpace.frag"       ), nullptr, tileDefines);
+    m_shOceanFromAtmosphere  .reload_shader_program_from_files(FP("renderer/atmosphere/OceanFromAtmosphere.vert"   ),FP("renderer/atmosphere/OceanFromAtmosphere.frag"  ), nullptr, tileDefines);
+    m_shSkyRaymarch          .reload_shader_program_from_files(FP("renderer/atmosphere/Fullscreen.vert"            ),FP("renderer/atmosphere/SkyRaymarch.frag"          ));
+    m_shSkyUpsample          .reload_shader_program_from_files(FP("renderer/atmosphere/Fullscreen.vert"            ),FP("renderer/atmosphere/SkyUpsample.frag"          ));
+
+    // scattering constants live in one uniform buffer shared by all programs,
+    // sampler units never change so they are set once here
+    Shader* programs[] = {&m_shSkyFromSpace, &m_shSkyFromAtmosphere,
+                          &m_shGroundFromSpace, &m_shGroundFromAtmosphere,
+                          &m_shOceanFromSpace, &m_shOceanFromAtmosphere,
+                          &m_shSkyRaymarch};
+    for(auto* shader : programs)
+    {
+        shader->setUniformBlockBinding("AtmosphereParams", PARAMS_BINDING);
+        shader->use();
+        shader->setInt("opticalTex", 6);
+    }
+    for(auto* shader : {&m_shGroundFromSpace, &m_shGroundFromAtmosphere})
+    {
+        shader->use();
+        shader->setInt("heightmap", 0);
+        shader->setInt("heightmapParent", 1);
+        shader->setInt("s2Tex1", 2);
+        shader->setInt("s2Tex2", 3);
+        shader->setInt("normalmap", 4);
+        shader->setInt("normalmapParent", 5);
+        shader->setInt("s2TexTest", 10);
+    }
+    for(auto* shader : {&m_shOceanFromSpace, &m_shOceanFromAtmosphere})
+    {
+        shader->use();
+        shader->setInt("s2TexTest", 11);
+    }
+    m_shSkyRaymarch.use();
+    m_shSkyRaymarch.setInt("depthTex", 7);
+    m_shSkyUpsample.use();
+    m_shSkyUpsample.setInt("skyTex", 8);
+
+    // the fullscreen passes generate their vertices from gl_VertexID
+    if(!m_vaoFullscreen)
+        glGenVertexArrays(1, &m_vaoFullscreen);
+    if(!m_qSkyTime)
+        glGenQueries(1, &m_qSkyTime);
+
+    if(!m_uboParams)
+        glGenBuffers(1, &m_uboParams);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uboParams);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(AtmosphereParams), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    m_nParamsUploads = 0;
 
 
     m_tEarth = Geocube();
 
-    m_tSky = Geocube();
-    m_tSky.subdivision(3);
-    m_tSky.releaseAllTextureHandles();
+    // --- sky and ocean shells: no quadtree, no textures, one indexed draw each
+    if(!m_pShell)
+        m_pShell.reset(new Icosphere(SHELL_SUBDIVISION));
 
-    m_tOcean = Geocube();
-    m_tOcean.subdivision(3);
-    m_tOcean.releaseAllTextureHandles();
+    // the shell is already a unit sphere, the cube projection is the identity
+    Shader* shellShaders[] = {&m_shSkyFromSpace, &m_shSkyFromAtmosphere,
+                              &m_shOceanFromSpace, &m_shOceanFromAtmosphere};
+    for(Shader* shader : shellShaders)
+    {
+        shader->use();
+        shader->setMat4("m4CubeProjMatrix", glm::mat4(1.0f));
+    }
 
+    m_dirty = DIRTY_ALL;
     update();
 }
 
@@ -53,8 +116,42 @@ Shader& Atmosphere::getOceanShader(const glm::vec3& pos)
         return m_shOceanFromSpace;
 }
 
+void Atmosphere::bindParams()
+{
+    AtmosphereParams params;
+    params.v3LightDir = m_vLightDirection;
+    params.fESun = m_ESun;
+    params.v3InvWavelength = glm::vec3(1.0/m_fWavelength4[0], 1.0/m_fWavelength4[1], 1.0/m_fWavelength4[2]);
+    params.fOuterRadius = m_fOuterRadius;
+    params.fOuterRadius2 = m_fOuterRadius*m_fOuterRadius;
+    params.fInnerRadius = m_fInnerRadius;
+    params.fInnerRadius2 = m_fInnerRadius*m_fInnerRadius;
+    params.fKrESun = m_Kr*m_ESun;
+    params.fKmESun = m_Km*m_ESun;
+    params.fKr4PI = m_Kr4PI;
+    params.fKm4PI = m_Km4PI;
+    params.fScale = 1.0f / (m_fOuterRadius - m_fInnerRadius);
+    params.fScaleDepth = m_fRayleighScaleDepth;
+    params.fScaleOverScaleDepth = (1.0f / (m_fOuterRadius - m_fInnerRadius)) / m_fRayleighScaleDepth;
+    params.g = m_g;
+    params.g2 = m_g*m_g;
+
+    // steady state: nothing changed, only the binding is refreshed
+    if(m_nParamsUploads == 0 || memcmp(&params, &m_uploadedParams, sizeof(AtmosphereParams)) != 0)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uboParams);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(AtmosphereParams), &params);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        m_uploadedParams = params;
+        m_nParamsUploads++;
+        UPLOAD_BYTES += sizeof(AtmosphereParams);
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, PARAMS_BINDING, m_uboParams);
+}
+
 void Atmosphere::drawGround(Camera& camera)
 {
+    PROFILE_GPU_SCOPE("Atmosphere::drawGround");
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
     glEnable(GL_CULL_FACE);
@@ -63,35 +160,14 @@ void Atmosphere::drawGround(Camera& camera)
     const auto& vCamera = m_3DCamera.Position;
     Shader& pGroundShader = getGroundShader(vCamera);
 
+    pollOpticalDepthBuffer();
+
     // Draw ground
     pGroundShader.use();
+    bindParams();
     pGroundShader.setVec3("v3CameraPos", vCamera.x, vCamera.y, vCamera.z);
-    pGroundShader.setVec3("v3LightDir", m_vLightDirection);
-    pGroundShader.setVec3("v3InvWavelength", 1.0/m_fWavelength4[0], 1.0/m_fWavelength4[1], 1.0/m_fWavelength4[2]);
     pGroundShader.setFloat("fCameraHeight", glm::length(vCamera));
     pGroundShader.setFloat("fCameraHeight2", glm::length2(vCamera));
-    pGroundShader.setFloat("fInnerRadius", m_fInnerRadius);
-    pGroundShader.setFloat("fInnerRadius2", m_fInnerRadius*m_fInnerRadius);
-    pGroundShader.setFloat("fOuterRadius", m_fOuterRadius);
-    pGroundShader.setFloat("fOuterRadius2", m_fOuterRadius*m_fOuterRadius);
-    pGroundShader.setFloat("fKrESun", m_Kr*m_ESun);
-    pGroundShader.setFloat("fKmESun", m_Km*m_ESun);
-    pGroundShader.setFloat("fKr4PI", m_Kr4PI);
-    pGroundShader.setFloat("fKm4PI", m_Km4PI);
-    pGroundShader.setFloat("fScale", 1.0f / (m_fOuterRadius - m_fInnerRadius));
-    pGroundShader.setFloat("fScaleDepth", m_fRayleighScaleDepth);
-    pGroundShader.setFloat("fScaleOverScaleDepth", (1.0f / (m_fOuterRadius - m_fInnerRadius)) / m_fRayleighScaleDepth);
-    pGroundShader.setFloat("g", m_g);
-    pGroundShader.setFloat("g2", m_g*m_g);
-    pGroundShader.setFloat("fESun",m_ESun);
-    pGroundShader.setInt("heightmap", 0);
-    pGroundShader.setInt("heightmapParent", 1);
-    pGroundShader.setInt("s2Tex1", 2);
-    pGroundShader.setInt("s2Tex2", 3);
-    pGroundShader.setInt("normalmap", 4);
-    pGroundShader.setInt("normalmapParent", 5);
-    pGroundShader.setInt("opticalTex", 6);
-    pGroundShader.setInt("s2TexTest", 10);
 
 
 
@@ -106,6 +182,7 @@ void Atmosphere::drawGround(Camera& camera)
 
 void Atmosphere::drawSky(Camera& camera)
 {
+    PROFILE_GPU_SCOPE("Atmosphere::drawSky");
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
     glEnable(GL_CULL_FACE);
@@ -114,28 +191,15 @@ void Atmosphere::drawSky(Camera& camera)
     const auto& vCamera = m_3DCamera.Position;
     Shader& pSkyShader = getSkyShader(vCamera);
 
+    pollOpticalDepthBuffer();
+
     {
         // Draw sky
         pSkyShader.use();
+        bindParams();
         pSkyShader.setVec3("v3CameraPos", vCamera.x, vCamera.y, vCamera.z);
-        pSkyShader.setVec3("v3LightDir", m_vLightDirection);
-        pSkyShader.setVec3("v3InvWavelength", 1.0/m_fWavelength4[0], 1.0/m_fWavelength4[1], 1.0/m_fWavelength4[2]);
         pSkyShader.setFloat("fCameraHeight", glm::length(vCamera));
         pSkyShader.setFloat("fCameraHeight2", glm::length2(vCamera));
-        pSkyShader.setFloat("fInnerRadius", m_fInnerRadius);
-        pSkyShader.setFloat("fInnerRadius2", m_fInnerRadius*m_fInnerRadius);
-        pSkyShader.setFloat("fOuterRadius", m_fOuterRadius);
-        pSkyShader.setFloat("fOuterRadius2", m_fOuterRadius*m_fOuterRadius);
-        pSkyShader.setFloat("fKrESun", m_Kr*m_ESun);
-        pSkyShader.setFloat("fKmESun", m_Km*m_ESun);
-        pSkyShader.setFloat("fKr4PI", m_Kr4PI);
-        pSkyShader.setFloat("fKm4PI", m_Km4PI);
-        pSkyShader.setFloat("fScale", 1.0f / (m_fOuterRadius - m_fInnerRadius));
-        pSkyShader.setFloat("fScaleDepth", m_fRayleighScaleDepth);
-        pSkyShader.setFloat("fScaleOverScaleDepth", (1.0f / (m_fOuterRadius - m_fInnerRadius)) / m_fRayleighScaleDepth);
-        pSkyShader.setFloat("g", m_g);
-        pSkyShader.setFloat("g2", m_g*m_g);
-        pSkyShader.setInt("opticalTex", 6);
 
 
         pSkyShader.setMat4("m4ModelViewProjectionMatrix",
@@ -148,12 +212,220 @@ void Atmosphere::drawSky(Camera& camera)
         glFrontFace(GL_CW);
         glEnable(GL_BLEND);
         glBlendFunc(GL_ONE, GL_ONE);
-        m_tSky.draw(pSkyShader, camera);
+        pSkyShader.setMat4("m4ModelMatrix", glm::scale(glm::mat4(1.0f), glm::vec3(m_fOuterRadius)));
+        m_pShell->draw();
         glDisable(GL_BLEND);
         glFrontFace(GL_CCW);
     }
 }
 
+void Atmosphere::resizeSkyTarget(int width, int height)
+{
+    int w = (width + m_nSkyDownsample - 1) / m_nSkyDownsample;
+    int h = (height + m_nSkyDownsample - 1) / m_nSkyDownsample;
+    if(m_fboSky && w == m_nSkyWidth && h == m_nSkyHeight)
+        return;
+
+    if(!m_fboSky)
+    {
+        glGenFramebuffers(1, &m_fboSky);
+        glGenTextures(1, &m_tSkyColor);
+    }
+    glBindTexture(GL_TEXTURE_2D, m_tSkyColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fboSky);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_tSkyColor, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "Sky framebuffer not complete!" << std::endl;
+    m_nSkyWidth = w;
+    m_nSkyHeight = h;
+}
+
+void Atmosphere::raymarchSky(int downsample, unsigned int depthTexture)
+{
+    PROFILE_GPU_SCOPE("Atmosphere::raymarchSky");
+    const auto& vCamera = m_3DCamera.Position;
+    m_shSkyRaymarch.use();
+    bindParams();
+    m_shSkyRaymarch.setVec3("v3CameraPos", vCamera);
+    m_shSkyRaymarch.setFloat("fCameraHeight", glm::length(vCamera));
+    m_shSkyRaymarch.setFloat("fCameraHeight2", glm::length2(vCamera));
+    m_shSkyRaymarch.setMat4("m4InvViewProjection", glm::inverse(m_3DCamera.GetPerspectiveMatrix(1.0f, 10.0f)
+                                                                 * m_3DCamera.GetViewMatrixOriginBased()));
+    m_shSkyRaymarch.setInt("nDownsample", downsample);
+
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, m_tOpticalDepthBuffer);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+
+    glBindVertexArray(m_vaoFullscreen);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+}
+
+void Atmosphere::drawSkyPass(Camera& camera, unsigned int depthTexture, unsigned int targetFBO, int width, int height)
+{
+    PROFILE_GPU_SCOPE("Atmosphere::drawSkyPass");
+    if(!m_bRaymarchSky)
+    {
+        drawSky(camera);
+        return;
+    }
+    pollOpticalDepthBuffer();
+    resizeSkyTarget(width, height);
+
+    // GPU time of the previous pass, read once available so the pipeline never stalls
+    if(m_bSkyQueryPending)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(m_qSkyTime, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available)
+        {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(m_qSkyTime, GL_QUERY_RESULT, &ns);
+            m_fSkyTime = ns * 1e-6;
+            m_bSkyQueryPending = false;
+        }
+    }
+    // elapsed queries do not nest: the frame measureSkyError times its reference in goes
+    // untimed, which also keeps the reference march out of the pass time
+    bool timed = !m_bSkyQueryPending && !m_bMeasureSkyError;
+    if(timed)
+        glBeginQuery(GL_TIME_ELAPSED, m_qSkyTime);
+
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+
+    // 1. radiance and sky coverage at reduced resolution
+    glDisable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fboSky);
+    glViewport(0, 0, m_nSkyWidth, m_nSkyHeight);
+    raymarchSky(m_nSkyDownsample, depthTexture);
+
+    if(m_bMeasureSkyError)
+    {
+        measureSkyError(depthTexture, width, height);
+        m_bMeasureSkyError = false;
+    }
+
+    // 2. upsample into the pixels the terrain left empty
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+    glViewport(0, 0, width, height);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    m_shSkyUpsample.use();
+    m_shSkyUpsample.setInt("nDownsample", m_nSkyDownsample);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, m_tSkyColor);
+    glBindVertexArray(m_vaoFullscreen);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_CULL_FACE);
+
+    if(timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_bSkyQueryPending = true;
+    }
+}
+
+void Atmosphere::measureSkyError(unsigned int depthTexture, int width, int height)
+{
+    // full resolution reference, timed synchronously
+    unsigned int fbo, reference, query;
+    glGenFramebuffers(1, &fbo);
+    glGenTextures(1, &reference);
+    glGenQueries(1, &query);
+    glBindTexture(GL_TEXTURE_2D, reference);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, reference, 0);
+    glViewport(0, 0, width, height);
+
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    raymarchSky(1, depthTexture);
+    glEndQuery(GL_TIME_ELAPSED);
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+    m_fSkyReferenceTime = ns * 1e-6;
+
+    std::vector<float> full(4*width*height), low(4*m_nSkyWidth*m_nSkyHeight), depth(width*height);
+    glBindTexture(GL_TEXTURE_2D, reference);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &full[0]);
+    glBindTexture(GL_TEXTURE_2D, m_tSkyColor);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &low[0]);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, &depth[0]);
+
+    glDeleteQueries(1, &query);
+    glDeleteTextures(1, &reference);
+    glDeleteFramebuffers(1, &fbo);
+
+    // same weights as SkyUpsample.frag, compared after the hdr.fs tonemap
+    auto tonemap = [this](float c) { return powf(1.0f - expf(-c * m_fExposure), 1.0f / 2.2f); };
+    const int d = m_nSkyDownsample;
+    double sum = 0.0;
+    float maxError = 0.0f;
+    int nSky = 0;
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; x++)
+        {
+            if(depth[y*width + x] < 1.0f)
+                continue;
+            float px = (x + 0.5f) / d - 0.5f, py = (y + 0.5f) / d - 0.5f;
+            int x0 = int(floorf(px)), y0 = int(floorf(py));
+            float fx = px - x0, fy = py - y0;
+            float rgb[3] = {0, 0, 0}, weight = 0;
+            for(int j = 0; j < 2; j++)
+                for(int i = 0; i < 2; i++)
+                {
+                    int sx = std::min(std::max(x0 + i, 0), m_nSkyWidth - 1);
+                    int sy = std::min(std::max(y0 + j, 0), m_nSkyHeight - 1);
+                    const float* texel = &low[4*(sy*m_nSkyWidth + sx)];
+                    float w = (i ? fx : 1.0f - fx) * (j ? fy : 1.0f - fy) * texel[3];
+                    for(int c = 0; c < 3; c++)
+                        rgb[c] += texel[c] * w;
+                    weight += w;
+                }
+            float error = 0.0f;
+            for(int c = 0; c < 3; c++)
+                error = std::max(error, fabsf(tonemap(rgb[c] / std::max(weight, 1e-4f)) - tonemap(full[4*(y*width + x) + c])));
+            sum += error;
+            maxError = std::max(maxError, error);
+            nSky++;
+        }
+    m_fSkyMeanError = nSky ? float(sum / nSky) : 0.0f;
+    m_fSkyMaxError = maxError;
+
+    printf("Sky pass 1/%d: mean error %.5f, max error %.5f over %d sky pixels; GPU %.3f ms vs %.3f ms full resolution\n",
+           d, m_fSkyMeanError, m_fSkyMaxError, nSky, m_fSkyTime, m_fSkyReferenceTime);
+
+    // keep the sky within the error bound
+    if(m_fSkyMeanError > m_fSkyErrorBound && m_nSkyDownsample > 1)
+    {
+        m_nSkyDownsample /= 2;
+        printf("Sky error above %.5f, resolution divisor lowered to %d\n", m_fSkyErrorBound, m_nSkyDownsample);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fboSky);
+    glViewport(0, 0, m_nSkyWidth, m_nSkyHeight);
+}
+
 void Atmosphere::drawOcean(Camera& camera)
 {
     glEnable(GL_DEPTH_TEST);
@@ -164,29 +436,14 @@ void Atmosphere::drawOcean(Camera& camera)
     const auto& vCamera = m_3DCamera.Position;
     Shader& pOceanShader = getOceanShader(vCamera);
 
+    pollOpticalDepthBuffer();
+
     // Draw ground
     pOceanShader.use();
+    bindParams();
     pOceanShader.setVec3("v3CameraPos", vCamera.x, vCamera.y, vCamera.z);
-    pOceanShader.setVec3("v3LightDir", m_vLightDirection);
-    pOceanShader.setVec3("v3InvWavelength", 1.0/m_fWavelength4[0], 1.0/m_fWavelength4[1], 1.0/m_fWavelength4[2]);
     pOceanShader.setFloat("fCameraHeight", glm::length(vCamera));
     pOceanShader.setFloat("fCameraHeight2", glm::length2(vCamera));
-    pOceanShader.setFloat("fInnerRadius", m_fInnerRadius);
-    pOceanShader.setFloat("fInnerRadius2", m_fInnerRadius*m_fInnerRadius);
-    pOceanShader.setFloat("fOuterRadius", m_fOuterRadius);
-    pOceanShader.setFloat("fOuterRadius2", m_fOuterRadius*m_fOuterRadius);
-    pOceanShader.setFloat("fKrESun", m_Kr*m_ESun);
-    pOceanShader.setFloat("fKmESun", m_Km*m_ESun);
-    pOceanShader.setFloat("fKr4PI", m_Kr4PI);
-    pOceanShader.setFloat("fKm4PI", m_Km4PI);
-    pOceanShader.setFloat("fScale", 1.0f / (m_fOuterRadius - m_fInnerRadius));
-    pOceanShader.setFloat("fScaleDepth", m_fRayleighScaleDepth);
-    pOceanShader.setFloat("fScaleOverScaleDepth", (1.0f / (m_fOuterRadius - m_fInnerRadius)) / m_fRayleighScaleDepth);
-    pOceanShader.setFloat("g", m_g);
-    pOceanShader.setFloat("g2", m_g*m_g);
-    pOceanShader.setFloat("fESun",m_ESun);
-    pOceanShader.setInt("opticalTex", 6);
-    pOceanShader.setInt("s2TexTest", 11);
 
 
 
@@ -196,114 +453,130 @@ void Atmosphere::drawOcean(Camera& camera)
     glActiveTexture(GL_TEXTURE6);
     glBindTexture(GL_TEXTURE_2D, m_tOpticalDepthBuffer);
 
-    m_tOcean.draw(pOceanShader, camera);
+    pOceanShader.setMat4("m4ModelMatrix", glm::scale(glm::mat4(1.0f), glm::vec3(m_fInnerRadius)));
+    m_pShell->draw();
 }
 
-void Atmosphere::MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight)
+Atmosphere::OpticalDepthResult Atmosphere::buildOpticalDepth(const OpticalDepthParams& params, bool persist)
 {
-    const float DELTA = 1e-6;
-    const int m_nChannels = 4;
-    const int nSize = m_nODBSize;
-    const int nSamples = m_nODBSamples;
-    const float fScale = 1.0f / (fOuterRadius - fInnerRadius);
+    auto start = std::chrono::high_resolution_clock::now();
 
+    OpticalDepthResult result;
+    result.params = params;
+    result.cached = OpticalDepth::Load("lut_cache", params, result.buffer);
+    if(!result.cached)
+    {
+        OpticalDepth::Compute(params, result.buffer);
+        if(persist)
+            OpticalDepth::Save("lut_cache", params, result.buffer);
+    }
 
-    std::vector<float> m_pBuffer(m_nChannels*nSize*nSize);
-    //Init(nSize, nSize, 1, 4, GL_RGBA, GL_FLOAT);
-    int nIndex = 0;
-    float fPrev = 0;
-    for(int nAngle=0; nAngle<nSize; nAngle++)
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return result;
+}
+
+void Atmosphere::MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight)
+{
+    OpticalDepthParams params;
+    params.fInnerRadius = fInnerRadius;
+    params.fOuterRadius = fOuterRadius;
+    params.fRayleighScaleHeight = fRayleighScaleHeight;
+    params.fMieScaleHeight = fMieScaleHeight;
+    params.nSize = m_nODBSize;
+    params.nSamples = m_nODBSamples;
+    m_odbWanted = params;
+
+    // nothing to show yet: the first table is built in place
+    if(!m_tOpticalDepthBuffer)
     {
-        // As the y tex coord goes from 0 to 1, the angle goes from 0 to 180 degrees
-        float fCos = 1.0f - (nAngle+nAngle) / (float)nSize;
-        float fAngle = acosf(fCos);
-        glm::vec3 vRay(sinf(fAngle), cosf(fAngle), 0);	// Ray pointing to the viewpoint
-
-        float fFirst = 0;
-        std::vector<float> rd;
-        for(int nHeight=0; nHeight<nSize; nHeight++)
-        {
-            // As the x tex coord goes from 0 to 1, the height goes from the bottom of the atmosphere to the top
-            float fHeight = DELTA + fInnerRadius + ((fOuterRadius - fInnerRadius) * nHeight) / nSize;
-            glm::vec3 vPos(0, fHeight, 0);				// The position of the camera
-
-            // If the ray from vPos heading in the vRay direction intersects the inner radius (i.e. the planet), then this spot is not visible from the viewpoint
-            float B = 2.0f * glm::dot(vPos, vRay);
-            float Bsq = B * B;
-            float Cpart = glm::dot(vPos, vPos);
-            float C = Cpart - fInnerRadius*fInnerRadius;
-            float fDet = Bsq - 4.0f * C;
-            bool bVisible = (fDet < 0 || ((0.5f * (-B - sqrtf(fDet)) <= 0) && (0.5f * (-B + sqrtf(fDet)) <= 0)));
-            float fRayleighDensityRatio;
-            float fMieDensityRatio;
-            if(bVisible)
-            {
-                fRayleighDensityRatio = expf(-(fHeight - fInnerRadius) * fScale / fRayleighScaleHeight);
-                fMieDensityRatio = expf(-(fHeight - fInnerRadius) * fScale / fMieScaleHeight);
-            }
-            else
-            {
-                // Smooth the transition from light to shadow (it is a soft shadow after all)
-                fRayleighDensityRatio = (m_pBuffer)[nIndex - nSize*m_nChannels] * 0.5f;
-                fMieDensityRatio = (m_pBuffer)[nIndex+2 - nSize*m_nChannels] * 0.5f;
-            }
+        OpticalDepthResult result = buildOpticalDepth(params, true);
+        uploadOpticalDepthBuffer(result.params, result.buffer);
+        m_fODBTime = result.ms;
+        m_bODBCached = result.cached;
+        return;
+    }
 
-            // Determine where the ray intersects the outer radius (the top of the atmosphere)
-            // This is the end of our ray for determining the optical depth (vPos is the start)
-            C = Cpart - fOuterRadius*fOuterRadius;
-            fDet = Bsq - 4.0f * C;
-            float fFar = 0.5f * (-B + sqrtf(fDet));
-
-            // Next determine the length of each sample, scale the sample ray, and make sure position checks are at the center of a sample ray
-            float fSampleLength = fFar / nSamples;
-            float fScaledLength = fSampleLength * fScale;
-            glm::vec3 vSampleRay = vRay * fSampleLength;
-            vPos += vSampleRay * 0.5f;
-
-            // Iterate through the samples to sum up the optical depth for the distance the ray travels through the atmosphere
-            float fRayleighDepth = 0;
-            float fMieDepth = 0;
-            for(int i=0; i<nSamples; i++)
-            {
-                float fHeight = glm::length(vPos);
-                float fAltitude = (fHeight - fInnerRadius) * fScale;
-                fRayleighDepth += expf(-fAltitude / fRayleighScaleHeight);
-                fMieDepth += expf(-fAltitude / fMieScaleHeight);
-                vPos += vSampleRay;
-            }
+    // a running job is followed up by pollOpticalDepthBuffer once it lands
+    if(!m_odbJob.valid())
+        launchOpticalDepthJob();
+}
 
-            // Multiply the sums by the length the ray traveled
-            fRayleighDepth *= fScaledLength;
-            fMieDepth *= fScaledLength;
+static OpticalDepthParams coarseOpticalDepth(const OpticalDepthParams& params)
+{
+    OpticalDepthParams coarse = params;
+    coarse.nSize = std::max(16, params.nSize / 4);
+    coarse.nSamples = std::max(8, params.nSamples / 4);
+    return coarse;
+}
 
-            // happens on the back side
-            //if(!_finite(fRayleighDepth) || fRayleighDepth > 1.0e25f)
-            //    fRayleighDepth = 0;
-            //if(!_finite(fMieDepth) || fMieDepth > 1.0e25f)
-            //    fMieDepth = 0;
+void Atmosphere::launchOpticalDepthJob()
+{
+    if(m_odbBound == m_odbWanted)
+        return;
+
+    // progressive refinement: a coarse table first, the full one once the coarse
+    // table for the same parameters is on screen; while a slider is dragged only
+    // coarse tables are built
+    OpticalDepthParams coarse = coarseOpticalDepth(m_odbWanted);
+    if(m_odbBound == coarse)
+        m_odbJob = std::async(std::launch::async, buildOpticalDepth, m_odbWanted, true);
+    else
+        m_odbJob = std::async(std::launch::async, buildOpticalDepth, coarse, false);
+}
 
-            // Store the results for Rayleigh to the light source, Rayleigh to the camera, Mie to the light source, and Mie to the camera
-            (m_pBuffer)[nIndex++] = fRayleighDensityRatio;
-            (m_pBuffer)[nIndex++] = fRayleighDepth;
-            (m_pBuffer)[nIndex++] = fMieDensityRatio;
-            (m_pBuffer)[nIndex++] = /*fMieDepth*/ 1.0;
+void Atmosphere::pollOpticalDepthBuffer()
+{
+    if(!m_odbJob.valid() || m_odbJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
 
-            //rd.push_back(fRayleighDepth);
+    OpticalDepthResult result = m_odbJob.get();
+    uploadOpticalDepthBuffer(result.params, result.buffer);
+    m_fODBTime = result.ms;
+    m_bODBCached = result.cached;
 
-        }
-        //ofGraph << std::endl;
-    }
+    launchOpticalDepthJob();
+}
 
-    if(m_tOpticalDepthBuffer)
-        glDeleteTextures(1,&m_tOpticalDepthBuffer);
-    glGenTextures(1, &m_tOpticalDepthBuffer);
+void Atmosphere::uploadOpticalDepthBuffer(const OpticalDepthParams& params, const std::vector<float>& buffer)
+{
+    // the texture name is kept, only its storage is replaced
+    if(!m_tOpticalDepthBuffer)
+        glGenTextures(1, &m_tOpticalDepthBuffer);
     glBindTexture(GL_TEXTURE_2D, m_tOpticalDepthBuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, nSize, nSize, 0, GL_RGBA, GL_FLOAT, &m_pBuffer[0]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, params.nSize, params.nSize, 0, GL_RGBA, GL_FLOAT, &buffer[0]);
+    UPLOAD_BYTES += buffer.size()*sizeof(float);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    m_odbBound = params;
+}
 
+void Atmosphere::benchmarkOpticalDepthBuffer()
+{
+    // always computed, the disk cache is bypassed
+    int nMax = int(std::thread::hardware_concurrency());
+    if(nMax < 1)
+        nMax = 1;
+
+    // 1, 2, 4, ... and every hardware thread
+    std::vector<int> threadCounts;
+    for(int nThreads = 1; nThreads < nMax; nThreads *= 2)
+        threadCounts.push_back(nThreads);
+    threadCounts.push_back(nMax);
+
+    m_odbThreadTimings.clear();
+    std::vector<float> buffer;
+    for(int nThreads : threadCounts)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        OpticalDepth::Compute(m_odbWanted, buffer, nThreads);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        m_odbThreadTimings.push_back(std::make_pair(nThreads, ms));
+        std::cout << "Optical depth " << m_odbWanted.nSize << "x" << m_odbWanted.nSize
+                  << ", " << m_odbWanted.nSamples << " samples, "
+                  << nThreads << " threads: " << ms << " ms" << std::endl;
+    }
 }
 
 void Atmosphere::MakePhaseBuffer(float ESun, float Kr, float Km, float g)
@@ -332,6 +605,7 @@ void Atmosphere::MakePhaseBuffer(float ESun, float Kr, float Km, float g)
     glGenTextures(1, &m_tPhaseBuffer);
     glBindTexture(GL_TEXTURE_1D, m_tPhaseBuffer);
     glTexImage1D(GL_TEXTURE_1D, 0, GL_RG32F, m_nWidth, 0, GL_RG, GL_FLOAT, &m_pBuffer[0]);
+    UPLOAD_BYTES += 2*m_nWidth*sizeof(float);
     glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -340,24 +614,51 @@ void Atmosphere::MakePhaseBuffer(float ESun, float Kr, float Km, float g)
 
 void Atmosphere::update()
 {
-    m_fWavelength4[0] = powf(m_fWavelength[0], 4.0f);
-    m_fWavelength4[1] = powf(m_fWavelength[1], 4.0f);
-    m_fWavelength4[2] = powf(m_fWavelength[2], 4.0f);
+    if(!m_dirty)
+        return;
+    PROFILE_SCOPE("Atmosphere::update");
 
+    if(m_dirty & DIRTY_CONSTANTS)
+    {
+        m_fWavelength4[0] = powf(m_fWavelength[0], 4.0f);
+        m_fWavelength4[1] = powf(m_fWavelength[1], 4.0f);
+        m_fWavelength4[2] = powf(m_fWavelength[2], 4.0f);
 
-    m_Kr4PI = m_Kr*4.0f*PI;
-    m_Km4PI = m_Km*4.0f*PI;
-    m_vLightDirection = glm::normalize(m_vLight);
-    m_fScale = 1 / (m_fOuterRadius - m_fInnerRadius);
+        m_Kr4PI = m_Kr*4.0f*PI;
+        m_Km4PI = m_Km*4.0f*PI;
+        m_vLightDirection = glm::normalize(m_vLight);
+        m_fScale = 1 / (m_fOuterRadius - m_fInnerRadius);
+    }
 
-    MakeOpticalDepthBuffer(m_fInnerRadius,m_fOuterRadius,m_fRayleighScaleDepth,m_fMieScaleDepth);
-    MakePhaseBuffer(m_ESun, m_Kr, m_Km, m_g);
+    // the table itself is built off the GL thread, see MakeOpticalDepthBuffer
+    if(m_dirty & DIRTY_OPTICAL_DEPTH)
+        MakeOpticalDepthBuffer(m_fInnerRadius,m_fOuterRadius,m_fRayleighScaleDepth,m_fMieScaleDepth);
+    if(m_dirty & DIRTY_PHASE)
+        MakePhaseBuffer(m_ESun, m_Kr, m_Km, m_g);
 
+    if(m_dirty & DIRTY_SCALE)
+    {
+        m_tEarth.setScale(m_fInnerRadius);
+    }
 
-    m_tEarth.setScale(m_fInnerRadius);
-    m_tSky.setScale(m_fOuterRadius);
-    m_tOcean.setScale(m_fInnerRadius);
+    m_dirty = 0;
+}
 
+ScatteringParams Atmosphere::scatteringParams() const
+{
+    ScatteringParams params;
+    params.fInnerRadius = m_fInnerRadius;
+    params.fOuterRadius = m_fOuterRadius;
+    params.fRayleighScaleDepth = m_fRayleighScaleDepth;
+    params.fMieScaleDepth = m_fMieScaleDepth;
+    params.Kr = m_Kr;
+    params.Km = m_Km;
+    params.ESun = m_ESun;
+    params.g = m_g;
+    params.v3InvWavelength = glm::vec3(1.0f/powf(m_fWavelength[0], 4.0f),
+                                       1.0f/powf(m_fWavelength[1], 4.0f),
+                                       1.0f/powf(m_fWavelength[2], 4.0f));
+    return params;
 }
 
 void Atmosphere::reset()
@@ -382,6 +683,7 @@ void Atmosphere::reset()
     m_fMieScaleDepth = 0.1f;
     m_fHdr = true;
 
+    m_dirty = DIRTY_ALL;
     update();
 }
 
@@ -395,23 +697,35 @@ void Atmosphere::gui_interface()
 
         // Transform
         ImGui::DragFloat3("Camera Position",&(m_3DCamera.Position)[0], 0.0001,1.0f,99.0f,"%.6f");
-        ImGui::DragFloat3("Light Position",&(m_vLight)[0]);
-        m_vLightDirection = glm::normalize(m_vLight);
-        ImGui::DragFloat3("Wave length",&(m_fWavelength)[0],0.001);
+        // each parameter only dirties what is derived from it, update() picks it up next frame
+        if(ImGui::DragFloat3("Light Position",&(m_vLight)[0]))
+            m_dirty |= DIRTY_CONSTANTS;
+        if(ImGui::DragFloat3("Wave length",&(m_fWavelength)[0],0.001))
+            m_dirty |= DIRTY_CONSTANTS;
         ImGui::DragInt("m_nSamples",&m_nSamples,1,1,16);
-        ImGui::DragInt("ODBsize",&m_nODBSize,16,16,1024);
-        ImGui::DragInt("ODBsamples",&m_nODBSamples,1,16,256);
-
-        ImGui::DragFloat("Rayleigh", &m_Kr,0.0001);		// Rayleigh scattering constant
-        ImGui::DragFloat("Mie", &m_Km,0.0001);		// Mie scattering constant
-        ImGui::DragFloat("Brightness", &m_ESun,0.1);		// Sun brightness constant
-        ImGui::DragFloat("Mie phase asymmetry", &m_g,0.001,-0.999,-0.75);		// The Mie phase asymmetry factor
-
-        ImGui::DragFloat("Inner Radius", &m_fInnerRadius,0.1,0.1,m_fOuterRadius);
-        ImGui::DragFloat("Outer Radius", &m_fOuterRadius,0.1,m_fInnerRadius,9999);
-
-        ImGui::DragFloat("Rayleigh ScaleDepth", &m_fRayleighScaleDepth,0.01);
-        ImGui::DragFloat("Mie ScaleDepth", &m_fMieScaleDepth,0.01);
+        if(ImGui::DragInt("ODBsize",&m_nODBSize,16,16,1024))
+            m_dirty |= DIRTY_OPTICAL_DEPTH;
+        if(ImGui::DragInt("ODBsamples",&m_nODBSamples,1,16,256))
+            m_dirty |= DIRTY_OPTICAL_DEPTH;
+
+        if(ImGui::DragFloat("Rayleigh", &m_Kr,0.0001))		// Rayleigh scattering constant
+            m_dirty |= DIRTY_CONSTANTS | DIRTY_PHASE;
+        if(ImGui::DragFloat("Mie", &m_Km,0.0001))		// Mie scattering constant
+            m_dirty |= DIRTY_CONSTANTS | DIRTY_PHASE;
+        if(ImGui::DragFloat("Brightness", &m_ESun,0.1))		// Sun brightness constant
+            m_dirty |= DIRTY_PHASE;
+        if(ImGui::DragFloat("Mie phase asymmetry", &m_g,0.001,-0.999,-0.75))		// The Mie phase asymmetry factor
+            m_dirty |= DIRTY_PHASE;
+
+        if(ImGui::DragFloat("Inner Radius", &m_fInnerRadius,0.1,0.1,m_fOuterRadius))
+            m_dirty |= DIRTY_CONSTANTS | DIRTY_OPTICAL_DEPTH | DIRTY_SCALE;
+        if(ImGui::DragFloat("Outer Radius", &m_fOuterRadius,0.1,m_fInnerRadius,9999))
+            m_dirty |= DIRTY_CONSTANTS | DIRTY_OPTICAL_DEPTH | DIRTY_SCALE;
+
+        if(ImGui::DragFloat("Rayleigh ScaleDepth", &m_fRayleighScaleDepth,0.01))
+            m_dirty |= DIRTY_OPTICAL_DEPTH;
+        if(ImGui::DragFloat("Mie ScaleDepth", &m_fMieScaleDepth,0.01))
+            m_dirty |= DIRTY_OPTICAL_DEPTH;
 
         ImGui::Checkbox("HDR",&m_fHdr);
         if(m_fHdr)
@@ -423,7 +737,28 @@ void Atmosphere::gui_interface()
             reset();
 
         if(ImGui::Button("Update Buffers"))
-            update();
+            m_dirty = DIRTY_ALL;
+
+        ImGui::Text("Scattering constants uploads: %u", m_nParamsUploads);
+
+        ImGui::Checkbox("Ray marched sky", &m_bRaymarchSky);
+        if(m_bRaymarchSky)
+        {
+            ImGui::SliderInt("Sky resolution divisor", &m_nSkyDownsample, 1, 4);
+            ImGui::Text("Sky pass: %.3f ms GPU at %dx%d", m_fSkyTime, m_nSkyWidth, m_nSkyHeight);
+            ImGui::DragFloat("Sky error bound", &m_fSkyErrorBound, 0.0001f, 0.0f, 0.1f, "%.4f");
+            if(ImGui::Button("Measure sky error"))
+                m_bMeasureSkyError = true;
+            if(m_fSkyMeanError >= 0.0f)
+                ImGui::Text("Mean %.5f, max %.5f; full resolution %.3f ms", m_fSkyMeanError, m_fSkyMaxError, m_fSkyReferenceTime);
+        }
+        ImGui::Text("Optical depth table: %dx%d, %.2f ms (%s)%s", m_odbBound.nSize, m_odbBound.nSize,
+                    m_fODBTime, m_bODBCached ? "disk cache" : "computed",
+                    m_odbJob.valid() ? ", refining..." : "");
+        if(ImGui::Button("Benchmark optical depth threads"))
+            benchmarkOpticalDepthBuffer();
+        for(const auto& timing : m_odbThreadTimings)
+            ImGui::Text("  %2d threads: %.2f ms", timing.first, timing.second);
 
         // Global transformation
         //ImGui::DragFloat4("rotation", (float*)&rotation,0.01f);
@@ -3,6 +3,9 @@
 
 #include <iostream>
 #include <cmath>
+#include <vector>
+#include <future>
+#include <memory>
 
 #include "shader.h"
 #include "camera.h"
@@ -12,9 +15,35 @@
 #include "glm/gtc/type_ptr.hpp"
 
 #include "geocube.h"
+#include "icosphere.h"
+#include "opticaldepth.h"
+#include "scatteringlut.h"
 
 #define PI (3.141592654)
 
+// std140 mirror of the AtmosphereParams block in renderer/include/atmosphere.glsl
+// ------------------------------------------------------------------------
+struct AtmosphereParams
+{
+    glm::vec3 v3LightDir;
+    float fESun;
+    glm::vec3 v3InvWavelength;
+    float fOuterRadius;
+    float fOuterRadius2;
+    float fInnerRadius;
+    float fInnerRadius2;
+    float fKrESun;
+    float fKmESun;
+    float fKr4PI;
+    float fKm4PI;
+    float fScale;
+    float fScaleDepth;
+    float fScaleOverScaleDepth;
+    float g;
+    float g2;
+};
+static_assert(sizeof(AtmosphereParams) == 80, "AtmosphereParams must match the std140 layout");
+
 class Atmosphere
 {
 
@@ -24,18 +53,31 @@ public:
     {
         //glDeleteTextures(1,&m_tPhaseBuffer);
         //glDeleteTextures(1,&m_tOpticalDepthBuffer);
+        if(m_uboParams)
+            glDeleteBuffers(1,&m_uboParams);
+        if(m_fboSky)
+        {
+            glDeleteFramebuffers(1,&m_fboSky);
+            glDeleteTextures(1,&m_tSkyColor);
+        }
+        if(m_vaoFullscreen)
+            glDeleteVertexArrays(1,&m_vaoFullscreen);
+        if(m_qSkyTime)
+            glDeleteQueries(1,&m_qSkyTime);
     }
 
     void bindCamera(Camera& cam) { m_3DCamera = cam; }
     void init();
     Geocube& getGroundHandle() {return m_tEarth;}
-    Geocube& getSkyHandle() {return m_tSky;}
-    Geocube& getOceanHandle() {return m_tOcean;}
     void drawGround(Camera& camera);
     void drawSky(Camera& camera);
     void drawOcean(Camera& camera);
+    // sky ray marched at 1/m_nSkyDownsample resolution, composited into targetFBO where
+    // depthTexture (its depth attachment) still holds the cleared depth; falls back to drawSky
+    void drawSkyPass(Camera& camera, unsigned int depthTexture, unsigned int targetFBO, int width, int height);
     void MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight);
     void MakePhaseBuffer(float ESun, float Kr, float Km, float g);
+    // applies pending parameter changes, cheap when nothing is dirty; call once per frame
     void update();
     void reset();
     void gui_interface();
@@ -44,6 +86,8 @@ public:
         hdrShader.setInt("hdr", m_fHdr);
         hdrShader.setFloat("exposure", m_fExposure);
     }
+    // current constants as inputs of the precomputed scattering tables
+    ScatteringParams scatteringParams() const;
     inline float getInnerRadius() const { return this->m_fInnerRadius; }
     inline float getOuterRadius() const { return this->m_fOuterRadius; }
     inline bool inAtmosphere(const glm::vec3& pos) const
@@ -53,10 +97,32 @@ public:
         return true;
     }
 
+    static unsigned int UPLOAD_BYTES; // buffer and texture data sent to the gpu, reset by the caller
+
 protected:
     Shader& getGroundShader(const glm::vec3& pos);
     Shader& getSkyShader(const glm::vec3& pos);
     Shader& getOceanShader(const glm::vec3& pos);
+    void bindParams();
+    // optical depth table: rebuilt off the GL thread, the previous one stays bound until it lands
+    void pollOpticalDepthBuffer();
+    void uploadOpticalDepthBuffer(const OpticalDepthParams& params, const std::vector<float>& buffer);
+    void benchmarkOpticalDepthBuffer();
+    void launchOpticalDepthJob();
+    void resizeSkyTarget(int width, int height);
+    void raymarchSky(int downsample, unsigned int depthTexture);
+    void measureSkyError(unsigned int depthTexture, int width, int height);
+
+    // what has to be rebuilt after a parameter change
+    enum DirtyFlags
+    {
+        DIRTY_CONSTANTS     = 1 << 0, // wavelength^4, 4*PI*K, light direction, scale
+        DIRTY_OPTICAL_DEPTH = 1 << 1,
+        DIRTY_PHASE         = 1 << 2,
+        DIRTY_SCALE         = 1 << 3, // geocube radii
+        DIRTY_ALL           = 0xF
+    };
+    unsigned int m_dirty = DIRTY_ALL;
 
 private:
     Camera& m_3DCamera;
@@ -94,10 +160,31 @@ private:
     float m_fMieScaleDepth = 0.1f;
     bool m_fHdr = true;
 
-    unsigned int m_tOpticalDepthBuffer, m_tPhaseBuffer;
+    unsigned int m_tOpticalDepthBuffer = 0, m_tPhaseBuffer = 0;
+
+    // scattering constants shared by every program, re-uploaded only when they differ
+    unsigned int m_uboParams = 0;
+    AtmosphereParams m_uploadedParams;
+    unsigned int m_nParamsUploads = 0;
+    static const unsigned int PARAMS_BINDING = 0;
     int m_nODBSize = 256;
     int m_nODBSamples = 50;
 
+    struct OpticalDepthResult
+    {
+        OpticalDepthParams params;
+        std::vector<float> buffer;
+        double ms;
+        bool cached;
+    };
+    // persist: write the table to the disk cache, coarse tables are not kept
+    static OpticalDepthResult buildOpticalDepth(const OpticalDepthParams& params, bool persist);
+    std::future<OpticalDepthResult> m_odbJob;
+    OpticalDepthParams m_odbWanted, m_odbBound;
+    double m_fODBTime = 0.0;
+    bool m_bODBCached = false;
+    std::vector<std::pair<int, double> > m_odbThreadTimings;
+
     Shader m_shSkyFromSpace         ;
     Shader m_shSkyFromAtmosphere    ;
     Shader m_shGroundFromSpace      ;
@@ -107,7 +194,28 @@ private:
     Shader m_shOceanFromSpace       ;
     Shader m_shOceanFromAtmosphere  ;
 
-    Geocube m_tEarth, m_tSky, m_tOcean;
+    Geocube m_tEarth;
+
+    // sky and ocean shells share one static unit sphere, scaled to
+    // m_fOuterRadius / m_fInnerRadius through m4ModelMatrix at draw time
+    std::unique_ptr<Icosphere> m_pShell;
+    static const unsigned int SHELL_SUBDIVISION = 6;
+
+    // reduced resolution sky pass
+    Shader m_shSkyRaymarch;
+    Shader m_shSkyUpsample;
+    bool m_bRaymarchSky = true;
+    int m_nSkyDownsample = 2;
+    unsigned int m_fboSky = 0, m_tSkyColor = 0, m_vaoFullscreen = 0;
+    int m_nSkyWidth = 0, m_nSkyHeight = 0;
+    unsigned int m_qSkyTime = 0;
+    bool m_bSkyQueryPending = false;
+    double m_fSkyTime = 0.0;            // ms, GPU time of the last finished sky pass
+    // tonemapped error against a full resolution reference, see measureSkyError
+    bool m_bMeasureSkyError = false;
+    float m_fSkyErrorBound = 2.0f / 255.0f;
+    float m_fSkyMeanError = -1.0f, m_fSkyMaxError = -1.0f;
+    double m_fSkyReferenceTime = 0.0;
 };
 
 #endif
@@ -0,0 +1,298 @@
+#include "benchmark.h"
+
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include <glad/glad.h>
+
+#include "grid.h"
+#include "camera.h"
+
+static float percentile(std::vector<float> v, float p)
+{
+    if(v.empty()) return 0.0f;
+    std::sort(v.begin(), v.end());
+    size_t i = size_t(p*(v.size() - 1) + 0.5f);
+    return v[i];
+}
+
+template<typename T>
+static double mean(const std::vector<T>& v)
+{
+    if(v.empty()) return 0.0;
+    return std::accumulate(v.begin(), v.end(), 0.0)/v.size();
+}
+
+TileBenchmark::~TileBenchmark()
+{
+    if(m_query)
+        glDeleteQueries(1, &m_query);
+}
+
+glm::vec3 TileBenchmark::cameraPosition() const
+{
+    // quarter turn around the planet while descending to ~3 km (unit radius = 6371 km)
+    float t = m_nFrames > 1 ? m_nFrame/float(m_nFrames - 1) : 1.0f;
+    float angle = 0.5f*float(M_PI)*t;
+    float altitude = glm::mix(1.2f, 0.0005f, glm::smoothstep(0.0f, 1.0f, t));
+    glm::vec3 dir = glm::normalize(glm::vec3(-cosf(angle), 0.2f*sinf(angle), 2.0f*cosf(angle) + sinf(angle)));
+    return dir*(1.0f + altitude);
+}
+
+void TileBenchmark::beginFrame()
+{
+    if(!m_query)
+        glGenQueries(1, &m_query);
+
+    Node::DRAW_COUNT = 0;
+    Node::BAKE_COUNT = 0;
+    m_frameStart = std::chrono::steady_clock::now();
+    glBeginQuery(GL_TIME_ELAPSED, m_query);
+}
+
+void TileBenchmark::endUpdate()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void TileBenchmark::countGround()
+{
+    m_tiles.push_back(Node::DRAW_COUNT);
+}
+
+void TileBenchmark::endFrame()
+{
+    glFinish();
+    auto now = std::chrono::steady_clock::now();
+    m_frameMs.push_back(std::chrono::duration<float, std::milli>(now - m_frameStart).count());
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(m_query, GL_QUERY_RESULT, &elapsed);
+    m_bakeMs.push_back(elapsed*1e-6f);
+    m_nodes.push_back(Node::NODE_COUNT);
+    m_bakes.push_back(Node::BAKE_COUNT);
+
+    m_nFrame++;
+}
+
+void TileBenchmark::report() const
+{
+    unsigned int maxNodes = m_nodes.empty() ? 0 : *std::max_element(m_nodes.begin(), m_nodes.end());
+    unsigned int bakes = std::accumulate(m_bakes.begin(), m_bakes.end(), 0u);
+    float bakeTotal = std::accumulate(m_bakeMs.begin(), m_bakeMs.end(), 0.0f);
+
+    std::cout << "Tile benchmark: " << m_frameMs.size() << " frames, grid "
+              << Tile::GRIDX << "x" << Tile::GRIDY << ", appearance "
+              << Tile::ALBEDO_MAP_X << "x" << Tile::ALBEDO_MAP_Y << std::endl;
+    printf("tile,frames,nodes_avg,nodes_max,tiles_avg,triangles_avg,bakes,bake_ms_total,bake_ms_p95,frame_ms_avg,frame_ms_p50,frame_ms_p95,frame_ms_max\n");
+    printf("%d,%d,%.1f,%u,%.1f,%.0f,%u,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+           int(Tile::HEIGHT_MAP_X), int(m_frameMs.size()),
+           mean(m_nodes), maxNodes,
+           mean(m_tiles), mean(m_tiles)*Tile::TRIANGLE_COUNT,
+           bakes, bakeTotal, percentile(m_bakeMs, 0.95f),
+           mean(m_frameMs), percentile(m_frameMs, 0.5f), percentile(m_frameMs, 0.95f),
+           percentile(m_frameMs, 1.0f));
+}
+
+// --- scripted flight
+
+static const char* PHASE_NAMES[FlightBenchmark::PHASE_COUNT] = {"update", "bake", "crack", "draw"};
+
+bool FlightBenchmark::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if(!file.is_open())
+    {
+        std::cout << "FlightBenchmark: cannot open " << path << std::endl;
+        return false;
+    }
+
+    m_keys.clear();
+    std::string line;
+    while(std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        FlightKeyframe key;
+        glm::quat& q = key.rotation;
+        if(in >> key.time >> key.position.x >> key.position.y >> key.position.z >> q.w >> q.x >> q.y >> q.z)
+        {
+            q = glm::normalize(q);
+            if(!m_keys.empty() && key.time <= m_keys.back().time)
+            {
+                std::cout << "FlightBenchmark: keyframe times must increase, " << path << std::endl;
+                return false;
+            }
+            m_keys.push_back(key);
+        }
+    }
+    if(m_keys.empty())
+    {
+        std::cout << "FlightBenchmark: no keyframes in " << path << std::endl;
+        return false;
+    }
+
+    m_nFrames = int((m_keys.back().time - m_keys.front().time)/m_fStep) + 1;
+    m_nFrame = 0;
+    m_frames.clear();
+    m_frames.reserve(m_nFrames);
+    return true;
+}
+
+void FlightBenchmark::applyPose(Camera& camera) const
+{
+    float t = m_keys.front().time + m_nFrame*m_fStep;
+
+    // last keyframe at or before t
+    size_t i = 0;
+    while(i + 2 < m_keys.size() && m_keys[i + 1].time <= t)
+        i++;
+    const FlightKeyframe& a = m_keys[i];
+    const FlightKeyframe& b = m_keys[std::min(i + 1, m_keys.size() - 1)];
+    float s = b.time > a.time ? glm::clamp((t - a.time)/(b.time - a.time), 0.0f, 1.0f) : 0.0f;
+
+    camera.Position = glm::mix(a.position, b.position, s);
+    camera.rotation = glm::slerp(a.rotation, b.rotation, s);
+    camera.updateCameraVectors();
+}
+
+void FlightBenchmark::beginFrame()
+{
+    Node::DRAW_COUNT = 0;
+    Node::BAKE_COUNT = 0;
+    Node::BAKE_MS = 0.0f;
+    m_current = Frame();
+    m_frameStart = std::chrono::steady_clock::now();
+}
+
+void FlightBenchmark::beginPhase(Phase)
+{
+    m_phaseStart = std::chrono::steady_clock::now();
+}
+
+void FlightBenchmark::endPhase(Phase phase)
+{
+    auto now = std::chrono::steady_clock::now();
+    m_current.ms[phase] += std::chrono::duration<float, std::milli>(now - m_phaseStart).count();
+}
+
+void FlightBenchmark::endFrame()
+{
+    glFinish();
+    auto now = std::chrono::steady_clock::now();
+    m_current.frameMs = std::chrono::duration<float, std::milli>(now - m_frameStart).count();
+
+    // splits happen inside the update phase, report them on their own
+    m_current.ms[BAKE] = Node::BAKE_MS;
+    m_current.ms[UPDATE] = std::max(0.0f, m_current.ms[UPDATE] - Node::BAKE_MS);
+    m_current.nodes = Node::NODE_COUNT;
+    m_current.tiles = Node::DRAW_COUNT;
+    m_current.bakes = Node::BAKE_COUNT;
+    m_frames.push_back(m_current);
+
+    m_nFrame++;
+}
+
+void FlightBenchmark::report(const char* backend) const
+{
+    std::cout << "Flight benchmark (" << backend << "): " << m_frames.size() << " frames, step "
+              << m_fStep*1000.0f << " ms" << std::endl;
+    printf("%-8s %9s %9s %9s %9s %9s\n", "phase", "mean", "p50", "p95", "p99", "max");
+    for(int p = 0; p <= PHASE_COUNT; p++)
+    {
+        std::vector<float> ms;
+        for(const Frame& f : m_frames)
+            ms.push_back(p < PHASE_COUNT ? f.ms[p] : f.frameMs);
+        printf("%-8s %9.3f %9.3f %9.3f %9.3f %9.3f\n", p < PHASE_COUNT ? PHASE_NAMES[p] : "frame",
+               mean(ms), percentile(ms, 0.5f), percentile(ms, 0.95f), percentile(ms, 0.99f), percentile(ms, 1.0f));
+    }
+}
+
+bool FlightBenchmark::write(const std::string& prefix, const char* backend) const
+{
+    FILE* csv = fopen((prefix + ".csv").c_str(), "w");
+    FILE* json = fopen((prefix + ".json").c_str(), "w");
+    if(!csv || !json)
+    {
+        std::cout << "FlightBenchmark: cannot write " << prefix << ".csv/.json" << std::endl;
+        if(csv) fclose(csv);
+        if(json) fclose(json);
+        return false;
+    }
+
+    fprintf(csv, "frame,time,update_ms,bake_ms,crack_ms,draw_ms,frame_ms,nodes,tiles,bakes\n");
+    for(size_t i = 0; i < m_frames.size(); i++)
+    {
+        const Frame& f = m_frames[i];
+        fprintf(csv, "%zu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%u,%u,%u\n", i, i*m_fStep,
+                f.ms[UPDATE], f.ms[BAKE], f.ms[CRACK], f.ms[DRAW], f.frameMs, f.nodes, f.tiles, f.bakes);
+    }
+
+    fprintf(json, "{\n  \"backend\": \"%s\",\n  \"frames\": %zu,\n  \"step_ms\": %.4f,\n",
+            backend, m_frames.size(), m_fStep*1000.0f);
+    fprintf(json, "  \"tile\": {\"heightmap\": %d, \"appearance\": %d},\n",
+            int(Tile::HEIGHT_MAP_X), int(Tile::ALBEDO_MAP_X));
+    const char* series[] = {"update_ms", "bake_ms", "crack_ms", "draw_ms", "frame_ms", "nodes", "tiles", "bakes"};
+    for(int s = 0; s < 8; s++)
+    {
+        std::vector<float> v;
+        for(const Frame& f : m_frames)
+        {
+            if(s < PHASE_COUNT) v.push_back(f.ms[s]);
+            else if(s == 4) v.push_back(f.frameMs);
+            else if(s == 5) v.push_back(float(f.nodes));
+            else if(s == 6) v.push_back(float(f.tiles));
+            else v.push_back(float(f.bakes));
+        }
+        fprintf(json, "  \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+                series[s], mean(v), percentile(v, 0.5f), percentile(v, 0.95f), percentile(v, 0.99f),
+                percentile(v, 1.0f), s < 7 ? "," : "");
+    }
+    fprintf(json, "}\n");
+
+    fclose(csv);
+    fclose(json);
+    std::cout << "FlightBenchmark: wrote " << prefix << ".csv and " << prefix << ".json" << std::endl;
+    return true;
+}
+
+void FlightRecorder::sample(float time, const Camera& camera)
+{
+    if(m_fStart < 0.0f)
+        m_fStart = time;
+    time -= m_fStart;
+    if(!m_keys.empty() && time - m_keys.back().time < m_fInterval)
+        return;
+
+    FlightKeyframe key;
+    key.time = time;
+    key.position = camera.Position;
+    key.rotation = camera.rotation;
+    m_keys.push_back(key);
+}
+
+bool FlightRecorder::save() const
+{
+    if(m_keys.empty())
+        return false;
+
+    FILE* file = fopen(m_path.c_str(), "w");
+    if(!file)
+    {
+        std::cout << "FlightRecorder: cannot write " << m_path << std::endl;
+        return false;
+    }
+    fprintf(file, "# time px py pz qw qx qy qz\n");
+    for(const FlightKeyframe& key : m_keys)
+        fprintf(file, "%.4f %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", key.time,
+                key.position.x, key.position.y, key.position.z,
+                key.rotation.w, key.rotation.x, key.rotation.y, key.rotation.z);
+    fclose(file);
+    std::cout << "FlightRecorder: " << m_keys.size() << " keyframes written to " << m_path << std::endl;
+    return true;
+}
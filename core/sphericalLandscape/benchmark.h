@@ -0,0 +1,120 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+class Camera;
+
+// Scripted flight used to compare tile configurations (see TileConfig in grid.h):
+// the camera descends from orbit to low altitude along a fixed path, one step per frame,
+// nodes, drawn tiles, bakes, bake time and frame time are recorded and summarised.
+class TileBenchmark
+{
+public:
+    explicit TileBenchmark(int frames) : m_nFrames(frames) {}
+    ~TileBenchmark();
+
+    bool running() const { return m_nFrame < m_nFrames; }
+    float deltaTime() const { return 1.0f/60.0f; } // fixed step, independent of the frame rate
+    glm::vec3 cameraPosition() const;
+
+    void beginFrame();  // resets node counters, starts timers
+    void endUpdate();   // after the quadtree update, where all baking happens
+    void countGround(); // right after the ground draw
+    void endFrame();    // waits for the gpu and records the frame
+    void report() const;
+
+private:
+    int m_nFrames;
+    int m_nFrame = 0;
+    unsigned int m_query = 0;
+    std::chrono::steady_clock::time_point m_frameStart;
+
+    std::vector<float> m_bakeMs, m_frameMs;
+    std::vector<unsigned int> m_nodes, m_tiles, m_bakes;
+};
+
+// camera pose at a point of a recorded flight, time in seconds
+struct FlightKeyframe
+{
+    float time;
+    glm::vec3 position;
+    glm::quat rotation;
+};
+
+// Replays a recorded camera path (see FlightRecorder) at a fixed timestep.
+// Per frame it records the CPU time of each phase plus node, tile and bake counts,
+// then writes the frames as CSV and a percentile summary as JSON.
+// Works the same against a real context or NullGL, the gpu is only waited on in endFrame.
+class FlightBenchmark
+{
+public:
+    enum Phase
+    {
+        UPDATE, // quadtree traversal, split() time excluded
+        BAKE,   // filled from Node::BAKE_MS, not timed directly
+        CRACK,
+        DRAW,
+        PHASE_COUNT
+    };
+
+    explicit FlightBenchmark(float step = 1.0f/60.0f) : m_fStep(step) {}
+
+    // keyframe file: one "time px py pz qw qx qy qz" per line, '#' starts a comment
+    bool load(const std::string& path);
+
+    bool running() const { return m_nFrame < m_nFrames; }
+    float deltaTime() const { return m_fStep; }
+    void applyPose(Camera& camera) const; // interpolated pose of the current frame
+
+    void beginFrame(); // resets node counters
+    void beginPhase(Phase phase);
+    void endPhase(Phase phase);
+    void endFrame(); // waits for the gpu and records the frame
+
+    void report(const char* backend) const;
+    // <prefix>.csv per frame, <prefix>.json summary
+    bool write(const std::string& prefix, const char* backend) const;
+
+private:
+    struct Frame
+    {
+        float ms[PHASE_COUNT];
+        float frameMs;
+        unsigned int nodes, tiles, bakes;
+    };
+
+    float m_fStep;
+    int m_nFrames = 0;
+    int m_nFrame = 0;
+    std::vector<FlightKeyframe> m_keys;
+    std::vector<Frame> m_frames;
+
+    Frame m_current;
+    std::chrono::steady_clock::time_point m_frameStart, m_phaseStart;
+};
+
+// Samples the camera pose at a fixed wall clock interval and writes a keyframe file
+// FlightBenchmark::load reads back
+class FlightRecorder
+{
+public:
+    FlightRecorder(const std::string& path, float interval = 0.25f) : m_path(path), m_fInterval(interval) {}
+    ~FlightRecorder() { save(); }
+
+    void sample(float time, const Camera& camera);
+    bool save() const;
+
+private:
+    std::string m_path;
+    float m_fInterval;
+    float m_fStart = -1.0f;
+    std::vector<FlightKeyframe> m_keys;
+};
+
+#endif
@@ -2,9 +2,11 @@
 
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
+#include "profiler.h"
 
 void Geocube::update(Camera& camera)
 {
+    PROFILE_SCOPE("Geocube::update");
     self_spin();
 
     auto localPos = convertToLocal(camera.Position);
@@ -17,6 +19,7 @@ void Geocube::update(Camera& camera)
 }
 void Geocube::draw(Shader& shader, Camera& camera)
 {
+    PROFILE_SCOPE("Geocube::draw");
     auto localPos = convertToLocal(camera.Position);
     shader.setMat4("m4ModelMatrix",this->getModelMatrix());
     top.draw(shader,    localPos );
@@ -69,6 +72,17 @@ void Geocube::subdivision(int level)
     back.subdivision(   level);
 }
 
+void Geocube::fixcrack()
+{
+    PROFILE_GPU_SCOPE("Geocube::fixcrack");
+    top.fixcrack();
+    bottom.fixcrack();
+    left.fixcrack();
+    right.fixcrack();
+    front.fixcrack();
+    back.fixcrack();
+}
+
 void Geocube::releaseAllTextureHandles()
 {
     top     .releaseAllTextureHandles();
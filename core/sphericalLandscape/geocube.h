@@ -19,16 +19,17 @@ class Geocube
 
 public:
     Geocube():position(0),rotation(0),scale(1)
-        ,top(Geomesh(glm::translate(glm::mat4(1),glm::vec3(0,1,0))))
-        ,bottom(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(180.0f),glm::vec3(0,0,1)),glm::vec3(0,1,0))))
-        ,left(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(90.0f),glm::vec3(0,0,1)),glm::vec3(0,1,0))))
-        ,right(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(-90.0f),glm::vec3(0,0,1)),glm::vec3(0,1,0))))
-        ,front(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(90.0f),glm::vec3(1,0,0)),glm::vec3(0,1,0))))
-        ,back(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(-90.0f),glm::vec3(1,0,0)),glm::vec3(0,1,0))))
+        ,top(Geomesh(glm::translate(glm::mat4(1),glm::vec3(0,1,0)), 0))
+        ,bottom(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(180.0f),glm::vec3(0,0,1)),glm::vec3(0,1,0)), 1))
+        ,left(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(90.0f),glm::vec3(0,0,1)),glm::vec3(0,1,0)), 2))
+        ,right(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(-90.0f),glm::vec3(0,0,1)),glm::vec3(0,1,0)), 3))
+        ,front(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(90.0f),glm::vec3(1,0,0)),glm::vec3(0,1,0)), 4))
+        ,back(Geomesh(glm::translate(glm::rotate(glm::mat4(1),glm::radians(-90.0f),glm::vec3(1,0,0)),glm::vec3(0,1,0)), 5))
     {}
     void update(Camera& camera);
     void draw(Shader& shader, Camera& camera);
     void subdivision(int);
+    void fixcrack(); // sync leaf edges with coarser neighbours, see Geomesh::CRACK_FILLING
     void releaseAllTextureHandles();
     float currentElevation(const glm::vec3& pos) const;
     float currentLocalHeight(const glm::vec3& pos) const;
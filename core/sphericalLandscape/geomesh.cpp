@@ -1,5 +1,6 @@
 #include "geomesh.h"
 #include <glad/glad.h>
+#include "profiler.h"
 
 // Caution: only return subdivided grids.
 // write additional condition if you need root
@@ -136,6 +137,9 @@ void Geomesh::subdivision(const glm::vec3& viewPos, const float& viewY, Node* no
     // Subdivision
     if( node->level < MIN_DEPTH || (node->level < MAX_DEPTH && d < K)   )
     {
+        if(!node->subdivided && Profiler::Capturing())
+            Profiler::Instant("split", {{"face", face}, {"level", node->level}, {"morton", node->morton}});
+
         // split and bake heightmap
         node->split(model);
 
@@ -149,6 +153,9 @@ void Geomesh::subdivision(const glm::vec3& viewPos, const float& viewY, Node* no
     {
         if( node->subdivided && d >= CUTOUT_FACTOR * K )
         {
+            if(Profiler::Capturing())
+                Profiler::Instant("merge", {{"face", face}, {"level", node->level}, {"morton", node->morton}});
+
             delete node->child[0];
             delete node->child[1];
             delete node->child[2];
@@ -205,23 +212,23 @@ glm::vec2 computeExactTexPos(int code)
     return o;
 }
 
-void Geomesh::drawRecr(Node* node, Shader& shader) const
+void Geomesh::drawRecr(Node* node, Shader& shader, const NodeUniforms& handles) const
 {
     if(node->subdivided)
     {
-        drawRecr(node->child[0], shader);
-        drawRecr(node->child[1], shader);
-        drawRecr(node->child[2], shader);
-        drawRecr(node->child[3], shader);
+        drawRecr(node->child[0], shader, handles);
+        drawRecr(node->child[1], shader, handles);
+        drawRecr(node->child[2], shader, handles);
+        drawRecr(node->child[3], shader, handles);
     }
     else
     {
         // Transfer local grid model
-        shader.setMat4("m4CubeProjMatrix", node->model);
+        shader.setMat4(handles.cubeProjMatrix, node->model);
 
         // Transfer lo and hi
-        shader.setInt("level",node->level);
-        shader.setInt("hash",node->morton);
+        shader.setInt(handles.level,node->level);
+        shader.setInt(handles.hash,node->morton);
 
 
 
@@ -9,6 +9,7 @@
 #include "glm/gtx/intersect.hpp"
 
 #include "shader.h"
+#include "profiler.h"
 
 enum RenderMode
 {
@@ -19,6 +20,14 @@ enum RenderMode
     ELEMENT_COUNT
 };
 
+// uniform handles set for every drawn leaf
+struct NodeUniforms
+{
+    UniformHandle cubeProjMatrix;
+    UniformHandle level;
+    UniformHandle hash;
+};
+
 class Geomesh
 {
     // start from the deepest level (leaf node), compute the distance to reference point/camera
@@ -29,10 +38,11 @@ class Geomesh
 
     std::shared_ptr<Node> root;
     glm::mat4 model; // projection to cube faces
+    int face; // index in the Geocube, for trace events
 
 public:
 
-    Geomesh(glm::mat4 arg = glm::mat4(1)) : root(new Node), model(arg){
+    Geomesh(glm::mat4 arg = glm::mat4(1), int face = -1) : root(new Node), model(arg), face(face){
         root->parent = root.get(); // should not cause cyclic referencing
         root->set_model_matrix(model);
         root->bake_height_map(model);
@@ -89,6 +99,7 @@ public:
 
     void subdivision(const glm::vec3& viewPos)
     {
+        PROFILE_SCOPE("Geomesh::subdivision");
         subdivision(convertToUV(viewPos), queryElevation(viewPos), root.get());
     }
 
@@ -97,11 +108,22 @@ public:
         subdivision( level, root.get() );
     }
 
+    void fixcrack()
+    {
+        fixcrack( root.get() );
+    }
+
     void draw(Shader& shader, const glm::vec3& viewPos) const
     {
         shader.setVec3("v3CameraProjectedPos",convertToUV(viewPos));
         shader.setInt("renderType", Geomesh::RENDER_MODE);
-        drawRecr(root.get(), shader);
+
+        // per-leaf uniforms, resolved once per draw
+        NodeUniforms handles;
+        handles.cubeProjMatrix = shader.uniform("m4CubeProjMatrix");
+        handles.level = shader.uniform("level");
+        handles.hash = shader.uniform("hash");
+        drawRecr(root.get(), shader, handles);
     }
 
     void releaseAllTextureHandles()
@@ -129,7 +151,7 @@ public:
     void fixcrack( Node* );
     void subdivision( const glm::vec3&, const float&, Node* );
     void subdivision( int, Node* );
-    void drawRecr( Node*, Shader& ) const;
+    void drawRecr( Node*, Shader&, const NodeUniforms& ) const;
 
 
     // static functions
@@ -4,9 +4,11 @@
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <chrono>
 #include "shader.h"
 #include "cmake_source_dir.h"
 #include "texture_utility.h"
+#include "profiler.h"
 
 #include <stdint.h>
 
@@ -20,13 +22,18 @@ static unsigned int noiseTex, elevationTex, materialTex;
 
 uint Node::NODE_COUNT = 0;
 uint Node::INTERFACE_NODE_COUNT = 0;
+uint Node::DRAW_COUNT = 0;
+uint Node::BAKE_COUNT = 0;
+float Node::BAKE_MS = 0.0f;
+uint Node::CACHE_HITS = 0;
+uint Node::CACHE_MISSES = 0;
 bool Node::USE_CACHE = true;
 
 #define MAX_CACHE_CAPACITY (1524)
 std::vector<std::tuple<uint,uint,uint>> Node::CACHE;
 
 
-void renderGrid();
+template<class Config> void renderGrid();
 void planeSeedInit();
 
 void cubeSeedInitZero()
@@ -124,13 +131,24 @@ void Node::init()
     materialTex = loadLayeredTexture("Y42lf.png",FP("../../resources/textures"), false);
 
     // Geo mesh, careful: need a noise texture and shader before intialized
-    upsampling.reload_shader_program_from_files(FP("renderer/upsampling.glsl"));
-    appearance_baking.reload_shader_program_from_files(FP("renderer/appearance.glsl"));
-    crackfixing.reload_shader_program_from_files(FP("renderer/crackfixing.glsl"));
+    upsampling.reload_shader_program_from_files(FP("renderer/upsampling.glsl"), shader_defines());
+    appearance_baking.reload_shader_program_from_files(FP("renderer/appearance.glsl"), shader_defines());
+    crackfixing.reload_shader_program_from_files(FP("renderer/crackfixing.glsl"), shader_defines());
 
     std::cout << "Node class initialized!" << std::endl;
 }
 
+ShaderDefines Node::shader_defines()
+{
+    ShaderDefines defines;
+    defines["HEIGHT_MAP_X"] = std::to_string(Tile::HEIGHT_MAP_X);
+    defines["HEIGHT_MAP_Y"] = std::to_string(Tile::HEIGHT_MAP_Y);
+    defines["ALBEDO_MAP_X"] = std::to_string(Tile::ALBEDO_MAP_X);
+    defines["ALBEDO_MAP_Y"] = std::to_string(Tile::ALBEDO_MAP_Y);
+    defines["NOISE_OCTAVES"] = std::to_string(NOISE_OCTAVES);
+    return defines;
+}
+
 void Node::finalize()
 {
     //glDeleteTextures(1,&noiseTex);
@@ -153,6 +171,7 @@ void Node::queryTextureHandle()
     {
         if(Node::CACHE.empty() || !Node::USE_CACHE)
         {
+            Node::CACHE_MISSES++;
             glGenTextures(1, &heightmap);
 
             glActiveTexture(GL_TEXTURE0);
@@ -164,7 +183,7 @@ void Node::queryTextureHandle()
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
             //Generate a distance field to the center of the cube
-            glTexImage2D( GL_TEXTURE_2D, 0, HEIGHT_MAP_INTERNAL_FORMAT, HEIGHT_MAP_X, HEIGHT_MAP_Y, 0, HEIGHT_MAP_FORMAT, GL_FLOAT, NULL);
+            glTexImage2D( GL_TEXTURE_2D, 0, HEIGHT_MAP_INTERNAL_FORMAT, Tile::HEIGHT_MAP_X, Tile::HEIGHT_MAP_Y, 0, HEIGHT_MAP_FORMAT, GL_FLOAT, NULL);
 
             glGenTextures(1, &appearance);
 
@@ -177,7 +196,7 @@ void Node::queryTextureHandle()
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
             //Generate a distance field to the center of the cube
-            glTexImage2D( GL_TEXTURE_2D, 0, APPEARANCE_MAP_INTERNAL_FORMAT, ALBEDO_MAP_X, ALBEDO_MAP_Y, 0, GL_RGBA, GL_FLOAT, NULL);
+            glTexImage2D( GL_TEXTURE_2D, 0, APPEARANCE_MAP_INTERNAL_FORMAT, Tile::ALBEDO_MAP_X, Tile::ALBEDO_MAP_Y, 0, GL_RGBA, GL_FLOAT, NULL);
 
             glGenTextures(1, &normal);
 
@@ -190,11 +209,12 @@ void Node::queryTextureHandle()
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
             //Generate a distance field to the center of the cube
-            glTexImage2D( GL_TEXTURE_2D, 0, APPEARANCE_MAP_INTERNAL_FORMAT, ALBEDO_MAP_X, ALBEDO_MAP_Y, 0, GL_RGBA, GL_FLOAT, NULL);
+            glTexImage2D( GL_TEXTURE_2D, 0, APPEARANCE_MAP_INTERNAL_FORMAT, Tile::ALBEDO_MAP_X, Tile::ALBEDO_MAP_Y, 0, GL_RGBA, GL_FLOAT, NULL);
 
         }
         else
         {
+            Node::CACHE_HITS++;
             heightmap = std::get<0>(Node::CACHE.back());
             appearance = std::get<1>(Node::CACHE.back());
             normal = std::get<2>(Node::CACHE.back());
@@ -247,11 +267,13 @@ Node::~Node()
 void Node::draw()
 {
     // Render grid
-    renderGrid();
+    Node::DRAW_COUNT++;
+    renderGrid<Tile>();
 }
 
 void Node::bake_appearance_map(glm::mat4 arg)
 {
+    PROFILE_SCOPE("Node::bake_appearance_map");
 
     //Datafield//
     //Store the volume data to polygonise
@@ -276,12 +298,14 @@ void Node::bake_appearance_map(glm::mat4 arg)
     glBindImageTexture(1, normal, 0, GL_FALSE, 0, GL_WRITE_ONLY, APPEARANCE_MAP_INTERNAL_FORMAT);
 
     // Deploy kernel
-    glDispatchCompute((ALBEDO_MAP_X/16)+1,(ALBEDO_MAP_Y/16)+1,1);
+    glDispatchCompute((Tile::ALBEDO_MAP_X/16)+1,(Tile::ALBEDO_MAP_Y/16)+1,1);
+    Node::BAKE_COUNT++;
 
 }
 
 void Node::bake_height_map(glm::mat4 arg)
 {
+    PROFILE_SCOPE("Node::bake_height_map");
     // Initialize 2d heightmap texture
 
     //Datafield//
@@ -306,7 +330,8 @@ void Node::bake_height_map(glm::mat4 arg)
     glBindImageTexture(0, heightmap, 0, GL_FALSE, 0, GL_WRITE_ONLY, HEIGHT_MAP_INTERNAL_FORMAT);
 
     // Deploy kernel
-    glDispatchCompute((HEIGHT_MAP_X/16)+1,(HEIGHT_MAP_Y/16)+1,1);
+    glDispatchCompute((Tile::HEIGHT_MAP_X/16)+1,(Tile::HEIGHT_MAP_Y/16)+1,1);
+    Node::BAKE_COUNT++;
 
     // make sure writing to image has finished before read
     //glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
@@ -378,7 +403,7 @@ void Node::fix_heightmap(Node* neighbour, int edgedir)
         //printf(" trim to bottom neighbour, shared tex range(%f->%f)\n",texrange.x,texrange.y);
     }
 
-    // notice: assumed square height map (hx = hy = 17)
+    // notice: assumed square height map (hx = hy = Tile::HEIGHT_MAP_X), one workgroup per edge
     crackfixing.use();
     crackfixing.setVec2("mylo", my_begin);
     crackfixing.setVec2("myhi", my_end);
@@ -405,6 +430,10 @@ void Node::split(glm::mat4 arg = glm::mat4(1))
 {
     if(!this->subdivided)
     {
+        // one query pair for the four children, not one per bake
+        PROFILE_GPU_SCOPE("Node::split");
+        auto start = std::chrono::steady_clock::now();
+
         child[0] = new Node;
         child[0]->setconnectivity<0>(this);
         child[0]->set_model_matrix(arg);
@@ -438,6 +467,8 @@ void Node::split(glm::mat4 arg = glm::mat4(1))
 
 
         this->subdivided = true;
+
+        BAKE_MS += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
     }
 }
 int Node::search(glm::vec2 p) const
@@ -466,10 +497,10 @@ int Node::search(glm::vec2 p) const
 float Node::min_elevation() const
 {
 #if 1
-    std::vector<float> heightData(HEIGHT_MAP_X*HEIGHT_MAP_Y);
+    std::vector<float> heightData(Tile::HEIGHT_MAP_X*Tile::HEIGHT_MAP_Y);
 
     // read texture
-    glGetTextureImage(heightmap, 0, GL_RED, GL_FLOAT,HEIGHT_MAP_X*HEIGHT_MAP_Y*sizeof(float),&heightData[0]);
+    glGetTextureImage(heightmap, 0, GL_RED, GL_FLOAT,Tile::HEIGHT_MAP_X*Tile::HEIGHT_MAP_Y*sizeof(float),&heightData[0]);
 
     auto min = std::min_element(heightData.begin(),heightData.end());
     return *min;
@@ -487,12 +518,12 @@ float Node::get_elevation(const glm::vec2& pos) const
     // and avoid to call this function every frame
     glm::vec2 relPos = (pos-lo)/(hi-lo);
 
-    uint xoffset = uint(glm::clamp(relPos.x,0.0f,1.0f)*(HEIGHT_MAP_X-1));
-    uint yoffset = uint(glm::clamp(relPos.y,0.0f,1.0f)*(HEIGHT_MAP_Y-1));
+    uint xoffset = uint(glm::clamp(relPos.x,0.0f,1.0f)*(Tile::HEIGHT_MAP_X-1));
+    uint yoffset = uint(glm::clamp(relPos.y,0.0f,1.0f)*(Tile::HEIGHT_MAP_Y-1));
 
     float height = 0.0f;
     glGetTextureSubImage(heightmap,
-                         0,xoffset,yoffset,0,1,1,1,GL_RED,GL_FLOAT,HEIGHT_MAP_X*HEIGHT_MAP_Y*sizeof(float),&height);
+                         0,xoffset,yoffset,0,1,1,1,GL_RED,GL_FLOAT,Tile::HEIGHT_MAP_X*Tile::HEIGHT_MAP_Y*sizeof(float),&height);
 
     return height;
 #else
@@ -594,13 +625,16 @@ void planeSeedInit()
     return;
 }
 
-// renderGrid() renders a 16x16 2d grid in NDC.
+// renderGrid() renders a Config::GRIDX x Config::GRIDY 2d grid in NDC.
 // -------------------------------------------------
 static unsigned int gridVAO = 0;
 static unsigned int gridVBO = 0;
 
+template<class Config>
 void renderGrid()
 {
+    const int GRIDX = Config::GRIDX, GRIDY = Config::GRIDY;
+    const int HEIGHT_MAP_X = Config::HEIGHT_MAP_X, HEIGHT_MAP_Y = Config::HEIGHT_MAP_Y;
 
     // initialize (if necessary)
     if (gridVAO == 0)
@@ -651,7 +685,7 @@ void renderGrid()
     }
     // render Grid
     glBindVertexArray(gridVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6*GRIDX*GRIDY);
+    glDrawArrays(GL_TRIANGLES, 0, Config::VERTEX_COUNT);
     glBindVertexArray(0);
 }
 
@@ -672,6 +706,7 @@ void Node::gui_interface()
         }
         ImGui::Text("Number of nodes generated %d", Node::NODE_COUNT);
         ImGui::Text("Number of interface nodes generated %d", Node::INTERFACE_NODE_COUNT);
+        ImGui::Text("Tile %dx%d, appearance %dx%d", Tile::HEIGHT_MAP_X, Tile::HEIGHT_MAP_Y, Tile::ALBEDO_MAP_X, Tile::ALBEDO_MAP_Y);
 
         if (ImGui::TreeNode("Noise map"))
         {
@@ -9,15 +9,38 @@
 #include <vector>
 #include <memory>
 #include <tuple>
+
+#include "shader.h"
 typedef unsigned int uint;
 
 // sizes
-#define GRIDX (18)
-#define GRIDY (18)
-#define HEIGHT_MAP_X (GRIDX+1)
-#define HEIGHT_MAP_Y (GRIDY+1)
-#define ALBEDO_MAP_X (127)
-#define ALBEDO_MAP_Y (127)
+// tile geometry, heightmap and appearance resolution of every node
+// pick another configuration at build time with -DTILE_GRID=... -DTILE_ALBEDO=...
+template<int GRID, int ALBEDO>
+struct TileConfig
+{
+    enum
+    {
+        GRIDX = GRID,
+        GRIDY = GRID,
+        HEIGHT_MAP_X = GRID + 1,
+        HEIGHT_MAP_Y = GRID + 1,
+        ALBEDO_MAP_X = ALBEDO,
+        ALBEDO_MAP_Y = ALBEDO,
+        VERTEX_COUNT = 6*GRID*GRID,
+        TRIANGLE_COUNT = 2*GRID*GRID
+    };
+};
+
+#ifndef TILE_GRID
+#define TILE_GRID (18)
+#endif
+#ifndef TILE_ALBEDO
+#define TILE_ALBEDO (127)
+#endif
+typedef TileConfig<TILE_GRID, TILE_ALBEDO> Tile;
+
+#define NOISE_OCTAVES (8)
 
 // Node class
 class Node
@@ -106,10 +129,15 @@ public:
     static void finalize();
     static void draw();
     static void gui_interface();
+    static ShaderDefines shader_defines(); // tile sizes and noise octaves for GLSL
 
     // static member
     static uint NODE_COUNT;
     static uint INTERFACE_NODE_COUNT;
+    static uint DRAW_COUNT; // tiles drawn, reset by the caller
+    static uint BAKE_COUNT; // heightmap + appearance bakes, reset by the caller
+    static float BAKE_MS; // cpu time in split(): allocation, bakes and elevation readback, reset by the caller
+    static uint CACHE_HITS, CACHE_MISSES; // texture handle requests served by / missing CACHE, reset by the caller
     static bool USE_CACHE;
     static std::vector<std::tuple<uint,uint,uint>> CACHE;
 };
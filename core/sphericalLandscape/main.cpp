@@ -1,6 +1,8 @@
 #include <iostream>
 #include <cmath>
 #include <memory>
+#include <string>
+#include <cstdlib>
 
 #include <glad/glad.h>
 
@@ -17,7 +19,7 @@
 #include "filesystemmonitor.h"
 #include "gui_interface.h"
 #include "imgui.h"
-//#include "image_io.h"
+#include "image_io.h"
 #include "texture_utility.h"
 
 #include "grid.h"
@@ -27,6 +29,11 @@
 
 #include "geocube.h"
 #include "atmosphere.h"
+#include "benchmark.h"
+#include "scatteringlut.h"
+#include "nullgl.h"
+#include "glcontext.h"
+#include "profiler.h"
 
 // settings
 static int SCR_WIDTH  = 1600;
@@ -47,6 +54,10 @@ static float lastFrame = 0.0f;
 static float lastFpsCountFrame = 0;
 static int frameCount = 0;
 
+// gl call statistics of the last frame
+static unsigned int uniformCallsPerFrame = 0;
+static unsigned int locationQueriesPerFrame = 0;
+
 // Shortcut
 static bool bindCam = true;
 static bool drawWireframe = false;
@@ -59,6 +70,7 @@ void processInput(GLFWwindow *window);
 void renderBox();
 void renderPlane();
 void renderQuad();
+int runHeadlessFlight(FlightBenchmark& flight, const std::string& out, const std::string& tracePath, int traceFrames);
 
 void gui_interface(float h)
 {
@@ -69,20 +81,96 @@ void gui_interface(float h)
         ImGui::Checkbox("Bind camera", &bindCam);
         ImGui::Checkbox("Draw wireframe", &drawWireframe);
         ImGui::Checkbox("Draw normal arrows", &drawNormalArrows);
+        ImGui::Text("Uniform calls per frame: %u", uniformCallsPerFrame);
+        ImGui::Text("Uniform location queries per frame: %u", locationQueriesPerFrame);
         ImGui::TreePop();
     }
 }
 
 
-int main()
+int main(int argc, char** argv)
 {
 #if defined(__linux__)
     setenv ("DISPLAY", ":0", 0);
 #endif
 
-    // Initialize a window
-    GLFWwindow* window = initGL(SCR_WIDTH, SCR_HEIGHT);
-    printf("Initial glwindow...\n");
+    // --tile-bench [frames]: fly the scripted path, print statistics and exit
+    // --bake-luts [dir]: write the precomputed scattering tables and exit, no window
+    // --flight-bench <keyframes> [--null-gl] [--bench-out prefix]: replay a recorded flight,
+    //   write <prefix>.csv/.json and exit; --null-gl runs the LOD logic only, no window or gpu
+    // --record-flight <keyframes>: sample the camera while flying, written on exit
+    // --trace <file> [--trace-frames N]: Chrome trace of the first N frames (all if 0),
+    //   F9 starts and stops a capture interactively
+    // --headless [N] [--headless-backend egl|osmesa] [--headless-output file.png]: render
+    //   N frames (or the benchmark) offscreen without a display and exit
+    // --capture <file.y4m | pattern%06d.png>: record every frame without the gui,
+    //   F10 starts and stops a y4m capture interactively
+    std::unique_ptr<TileBenchmark> bench;
+    std::unique_ptr<FlightBenchmark> flight;
+    std::unique_ptr<FlightRecorder> recorder;
+    std::string flightOut = "flight";
+    bool nullGL = false;
+    std::string tracePath;
+    int traceFrames = 0;
+    std::string capturePath;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if(arg == "--flight-bench" && i + 1 < argc)
+        {
+            flight.reset(new FlightBenchmark);
+            if(!flight->load(argv[++i]))
+                return 1;
+        }
+        if(arg == "--bench-out" && i + 1 < argc)
+            flightOut = argv[++i];
+        if(arg == "--null-gl")
+            nullGL = true;
+        if(arg == "--record-flight" && i + 1 < argc)
+            recorder.reset(new FlightRecorder(argv[++i]));
+        if(arg == "--trace" && i + 1 < argc)
+            tracePath = argv[++i];
+        if(arg == "--trace-frames" && i + 1 < argc)
+            traceFrames = atoi(argv[++i]);
+        if(arg == "--capture" && i + 1 < argc)
+            capturePath = argv[++i];
+
+        if(std::string(argv[i]) == "--tile-bench")
+        {
+            int frames = (i + 1 < argc) ? atoi(argv[i + 1]) : 0;
+            bench.reset(new TileBenchmark(frames > 0 ? frames : 600));
+        }
+        if(std::string(argv[i]) == "--bake-luts")
+        {
+            std::string directory = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[i + 1] : "lut_cache";
+            // default constants, camera just above the ground, sun 60 degrees from the zenith
+            return ScatteringLUT::Bake(ScatteringParams(), 0.01f, 0.5f, directory) ? 0 : 1;
+        }
+    }
+
+    if(flight && nullGL)
+        return runHeadlessFlight(*flight, flightOut, tracePath, traceFrames);
+
+    // Initialize a window, or an offscreen context
+    GLContext::Options context = GLContext::ParseArgs(argc, argv);
+    GLFWwindow* window = nullptr;
+    if(context.backend == GLContext::WINDOWED)
+    {
+        window = initGL(SCR_WIDTH, SCR_HEIGHT);
+        GLContext::Attach(window);
+        printf("Initial glwindow...\n");
+    }
+    else
+    {
+        // without a benchmark nothing else ends the loop
+        if(context.frames == 0 && !bench && !flight)
+            context.frames = 1;
+        if(!GLContext::InitHeadless(SCR_WIDTH, SCR_HEIGHT, context))
+            return 1;
+    }
+
+    // reuse linked programs from previous runs
+    Shader::enableBinaryCache("shader_cache");
 
     // configure global opengl state
     // -----------------------------
@@ -154,32 +242,69 @@ int main()
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // create depth buffer (renderbuffer)
-    unsigned int rboDepth;
-    glGenRenderbuffers(1, &rboDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
+    // create depth buffer, a texture so the sky pass can find the pixels terrain left empty
+    unsigned int depthBuffer;
+    glGenTextures(1, &depthBuffer);
+    glBindTexture(GL_TEXTURE_2D, depthBuffer);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SCR_WIDTH, SCR_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     // attach buffers
     glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffer, 0);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthBuffer, 0);
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "Framebuffer not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, GLContext::DefaultFramebuffer());
 
 
     hdrShader.use();
     hdrShader.setInt("hdrBuffer", 0);
 
-    while( !glfwWindowShouldClose( window ) )
+    if(!tracePath.empty())
+        Profiler::BeginCapture(tracePath, traceFrames);
+    if(!capturePath.empty())
+    {
+        bool y4m = capturePath.size() > 4 && capturePath.compare(capturePath.size() - 4, 4, ".y4m") == 0;
+        ImageIO::BeginCapture(capturePath, SCR_WIDTH, SCR_HEIGHT, y4m ? ImageIO::CAPTURE_Y4M : ImageIO::CAPTURE_PNG);
+    }
+
+    bool firstFrame = true;
+    while( !GLContext::ShouldClose() )
     {
         // per-frame time logic
         // --------------------
         countAndDisplayFps(window);
+        Profiler::NewFrame();
+        Node::DRAW_COUNT = 0;
+        Node::BAKE_COUNT = 0;
+        Node::CACHE_HITS = 0;
+        Node::CACHE_MISSES = 0;
+        Atmosphere::UPLOAD_BYTES = 0;
+
+        // uniform traffic of the previous frame
+        uniformCallsPerFrame = Shader::UNIFORM_CALL_COUNT;
+        locationQueriesPerFrame = Shader::LOCATION_QUERY_COUNT;
+        Shader::resetCounters();
 
         // input
-        glfwGetFramebufferSize(window, &SCR_WIDTH, &SCR_HEIGHT);
-        processInput(window);
+        GLContext::GetFramebufferSize(&SCR_WIDTH, &SCR_HEIGHT);
+        if(bench)
+        {
+            bench->beginFrame();
+            deltaTime = bench->deltaTime();
+            camera.Position = bench->cameraPosition();
+        }
+        if(flight)
+        {
+            flight->beginFrame();
+            deltaTime = flight->deltaTime();
+            flight->applyPose(camera);
+        }
+        if(recorder)
+            recorder->sample(float(GLContext::GetTime()), camera);
+        if(window)
+            processInput(window);
 
         if(bindCam)
         {
@@ -200,8 +325,19 @@ int main()
         glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        // apply atmosphere parameter changes, LUTs are refined in the background
+        mesh.update();
+
         // update geomesh
+        if(flight) flight->beginPhase(FlightBenchmark::UPDATE);
         mesh.getGroundHandle().update(refcam);
+        if(flight) flight->endPhase(FlightBenchmark::UPDATE);
+        if(bench) bench->endUpdate();
+
+        if(flight) flight->beginPhase(FlightBenchmark::CRACK);
+        if(Geomesh::CRACK_FILLING)
+            mesh.getGroundHandle().fixcrack();
+        if(flight) flight->endPhase(FlightBenchmark::CRACK);
 
         // Draw scene
         if(drawWireframe)
@@ -214,78 +350,191 @@ int main()
         refcam.sync_frustrum();
 
         //mesh.drawOcean(refcam);
+        if(flight) flight->beginPhase(FlightBenchmark::DRAW);
         mesh.drawGround(refcam);
-        // Draw sky
-        mesh.drawSky(refcam);
+        if(bench) bench->countGround();
+        // Draw sky, reduced resolution and upsampled into the empty pixels
+        mesh.drawSkyPass(refcam, depthBuffer, hdrFBO, SCR_WIDTH, SCR_HEIGHT);
+        if(flight) flight->endPhase(FlightBenchmark::DRAW);
 
         // Restore options
         //glDisable(GL_DEPTH_CLAMP);
         glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, GLContext::DefaultFramebuffer());
 
         // Draw screen
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        hdrShader.use();
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, colorBuffer);
-        mesh.setHDR(hdrShader);
-        renderQuad();
-
-        // gui
-        GuiInterface::Begin();
-        mesh.gui_interface();
-        mesh.getGroundHandle().gui_interface();
-        Node::gui_interface();
-        Geomesh::gui_interface();
-        refcam.gui_interface();
-        //dirlight.gui_interface(camera);
-        gui_interface(mesh.getGroundHandle().currentGlobalHeight(refcam.Position)*6371.0);
-        ImGui::ShowDemoWindow();
-        GuiInterface::End();
+        {
+            PROFILE_GPU_SCOPE("HDR pass");
+            hdrShader.use();
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, colorBuffer);
+            mesh.setHDR(hdrShader);
+            renderQuad();
+        }
+        ImageIO::CaptureFrame();
+
+        if(Profiler::Capturing())
+        {
+            Profiler::Counter("nodes", Node::NODE_COUNT);
+            Profiler::Counter("texture cache", Node::CACHE.size());
+            Profiler::Counter("cache hits", Node::CACHE_HITS);
+            Profiler::Counter("cache misses", Node::CACHE_MISSES);
+            Profiler::Counter("ground draw calls", Node::DRAW_COUNT);
+            Profiler::Counter("bakes", Node::BAKE_COUNT);
+            Profiler::Counter("bytes uploaded", Atmosphere::UPLOAD_BYTES);
+            Profiler::Counter("uniform calls", Shader::UNIFORM_CALL_COUNT);
+        }
+
+        // gui, there is no imgui context without a window
+        if(window)
+        {
+            GuiInterface::Begin();
+            mesh.gui_interface();
+            mesh.getGroundHandle().gui_interface();
+            Node::gui_interface();
+            Geomesh::gui_interface();
+            Profiler::gui_interface();
+            ImageIO::gui_interface();
+            refcam.gui_interface();
+            //dirlight.gui_interface(camera);
+            gui_interface(mesh.getGroundHandle().currentGlobalHeight(refcam.Position)*6371.0);
+            ImGui::ShowDemoWindow();
+            GuiInterface::End();
+        }
 
 
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        GLContext::SwapBuffers();
+
+        if(bench)
+        {
+            bench->endFrame();
+            if(!bench->running())
+            {
+                bench->report();
+                GLContext::Close();
+            }
+        }
+        if(flight)
+        {
+            flight->endFrame();
+            if(!flight->running())
+            {
+                flight->report("gl");
+                flight->write(flightOut, "gl");
+                GLContext::Close();
+            }
+        }
+
+        if(firstFrame)
+        {
+            glFinish();
+            printf("Time to first frame: %.3f s (program binaries: %u cached, %u compiled)\n",
+                   GLContext::GetTime(), Shader::BINARY_CACHE_HITS, Shader::BINARY_CACHE_MISSES);
+            firstFrame = false;
+        }
     }
 
+    // write out what a running capture still holds while the context is alive
+    ImageIO::EndCapture();
+    Profiler::Finalize();
+
     // Initlize geogrid system
     Node::finalize();
-    glfwTerminate( );
+    GLContext::Terminate();
 
     return 0;
 }
 
+// the flight without a window: every GL call goes to NullGL, so only the
+// quadtree update, splits, crack fix and draw traversal are measured
+int runHeadlessFlight(FlightBenchmark& flight, const std::string& out, const std::string& tracePath, int traceFrames)
+{
+    if(!NullGL::Load())
+    {
+        std::cout << "Failed to load the null GL backend" << std::endl;
+        return 1;
+    }
+
+    Node::init();
+    if(!tracePath.empty())
+        Profiler::BeginCapture(tracePath, traceFrames);
+    {
+        Geocube ground;
+        Shader groundShader; // no program, uniforms are dropped
+        refCamera refcam(camera);
+
+        while(flight.running())
+        {
+            Profiler::NewFrame();
+            flight.beginFrame();
+            flight.applyPose(camera);
+            refcam.sync_frustrum();
+            refcam.sync_position();
+            refcam.sync_rotation();
+
+            flight.beginPhase(FlightBenchmark::UPDATE);
+            ground.update(refcam);
+            flight.endPhase(FlightBenchmark::UPDATE);
+
+            flight.beginPhase(FlightBenchmark::CRACK);
+            if(Geomesh::CRACK_FILLING)
+                ground.fixcrack();
+            flight.endPhase(FlightBenchmark::CRACK);
+
+            flight.beginPhase(FlightBenchmark::DRAW);
+            ground.draw(groundShader, refcam);
+            flight.endPhase(FlightBenchmark::DRAW);
+
+            if(Profiler::Capturing())
+            {
+                Profiler::Counter("nodes", Node::NODE_COUNT);
+                Profiler::Counter("texture cache", Node::CACHE.size());
+                Profiler::Counter("ground draw calls", Node::DRAW_COUNT);
+            }
+            flight.endFrame();
+        }
+    }
+    Profiler::Finalize();
+    Node::finalize();
+
+    flight.report("null");
+    return flight.write(out, "null") ? 0 : 1;
+}
+
 bool countAndDisplayFps(GLFWwindow* window)
 {
-    float currentFrame = float(glfwGetTime());
+    float currentFrame = float(GLContext::GetTime());
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
     frameCount++;
-    if(float(glfwGetTime()) - lastFpsCountFrame > 1.0f)
+    if(float(GLContext::GetTime()) - lastFpsCountFrame > 1.0f)
     {
         std::cout << "Current fps: "
-                  << frameCount/(glfwGetTime() - lastFpsCountFrame)
+                  << frameCount/(GLContext::GetTime() - lastFpsCountFrame)
                   << " runtime:"
-                  << glfwGetTime()
+                  << GLContext::GetTime()
                   << std::endl; // deprecated
 
         frameCount = 0;
-        lastFpsCountFrame = float(glfwGetTime());
+        lastFpsCountFrame = float(GLContext::GetTime());
         return true;
     }
     if(deltaTime > 60.0f) {
         std::cout << "No response for 60 sec... exit program." << std::endl;
-        glfwTerminate();
+        GLContext::Terminate();
         EXIT_FAILURE;
     }
     return false;
 }
 
 static int key_space_old_state = GLFW_RELEASE;
+static int key_f9_old_state = GLFW_RELEASE;
+static int key_f10_old_state = GLFW_RELEASE;
 void processInput(GLFWwindow *window)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -311,6 +560,28 @@ void processInput(GLFWwindow *window)
         camera.printInfo();
     }
     key_space_old_state = glfwGetKey(window, GLFW_KEY_SPACE);
+
+    // trace capture on/off
+    if ((glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS) && (key_f9_old_state == GLFW_RELEASE))
+    {
+        static int traceCount = 0;
+        if(Profiler::Capturing())
+            Profiler::EndCapture();
+        else
+            Profiler::BeginCapture("trace_" + std::to_string(traceCount++) + ".json");
+    }
+    key_f9_old_state = glfwGetKey(window, GLFW_KEY_F9);
+
+    // video capture on/off
+    if ((glfwGetKey(window, GLFW_KEY_F10) == GLFW_PRESS) && (key_f10_old_state == GLFW_RELEASE))
+    {
+        static int videoCount = 0;
+        if(ImageIO::Capturing())
+            ImageIO::EndCapture();
+        else
+            ImageIO::BeginCapture("capture_" + std::to_string(videoCount++) + ".y4m", SCR_WIDTH, SCR_HEIGHT, ImageIO::CAPTURE_Y4M);
+    }
+    key_f10_old_state = glfwGetKey(window, GLFW_KEY_F10);
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -0,0 +1,191 @@
+#include "opticaldepth.h"
+#include "filesystem.h"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+
+namespace OpticalDepth {
+
+// exp(x) for x <= 0, as 2^n * 2^f with n = round(x*log2(e)), f in [-0.5, 0.5]
+// no float compares and no libm calls so the sample loop below vectorises
+// without -ffast-math; relative error ~1e-7, flushes to ~1e-38 below x = -87
+static inline float fastExpNeg(float x)
+{
+    x *= 1.44269504f;
+    int n = -int(0.5f - x);
+    float f = x - float(n);
+    float p = 1.0f + f*(0.693147181f + f*(0.240226507f + f*(0.0555041087f
+              + f*(0.00961812911f + f*(0.00133335581f + f*0.000154035304f)))));
+    n = n < -126 ? -126 : n;
+    int bits = (n + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p*scale;
+}
+
+// columns [begin, end) of the table, every angle;
+// a shadowed texel reuses the texel one angle above, so a column is walked top-down.
+// samples are accumulated for the whole column block at once: the inner loop runs
+// over heights with one accumulator each, which is what the auto-vectoriser wants
+static void computeColumns(const OpticalDepthParams& params, float* buffer, int begin, int end)
+{
+    const float DELTA = 1e-6f;
+    const int nChannels = 4;
+    const int nSize = params.nSize;
+    const int nSamples = params.nSamples;
+    const int nColumns = end - begin;
+    const float fInnerRadius = params.fInnerRadius;
+    const float fOuterRadius = params.fOuterRadius;
+    const float fScale = 1.0f / (fOuterRadius - fInnerRadius);
+    const float fInvRayleigh = 1.0f / params.fRayleighScaleHeight;
+    const float fInvMie = 1.0f / params.fMieScaleHeight;
+
+    std::vector<float> scratch(4*nColumns);
+    float* B = &scratch[0];
+    float* C = B + nColumns;
+    float* fSampleLength = C + nColumns;
+    float* fDepth = fSampleLength + nColumns;
+
+    for(int nAngle=0; nAngle<nSize; nAngle++)
+    {
+        // As the y tex coord goes from 0 to 1, the angle goes from 0 to 180 degrees
+        float fCos = 1.0f - (nAngle+nAngle) / (float)nSize;
+
+        // Where the ray leaves the atmosphere, and the length of each sample
+        for(int j=0; j<nColumns; j++)
+        {
+            // As the x tex coord goes from 0 to 1, the height goes from the bottom of the atmosphere to the top
+            float fHeight = DELTA + fInnerRadius + ((fOuterRadius - fInnerRadius) * (begin + j)) / nSize;
+            B[j] = 2.0f * fHeight * fCos;
+            C[j] = fHeight * fHeight;
+            float fDet = B[j]*B[j] - 4.0f * (C[j] - fOuterRadius*fOuterRadius);
+            fSampleLength[j] = 0.5f * (-B[j] + sqrtf(fDet)) / nSamples;
+            fDepth[j] = 0.0f;
+        }
+
+        // The sample i sits at s = (i + 0.5)*fSampleLength along a unit ray,
+        // its distance to the centre is sqrt(h^2 + 2*h*cos*s + s^2)
+        for(int i=0; i<nSamples; i++)
+        {
+            for(int j=0; j<nColumns; j++)
+            {
+                float s = (i + 0.5f) * fSampleLength[j];
+                float fSampleHeight = sqrtf(C[j] + B[j]*s + s*s);
+                float fAltitude = (fSampleHeight - fInnerRadius) * fScale;
+                fDepth[j] += fastExpNeg(-fAltitude * fInvRayleigh);
+            }
+        }
+
+        for(int j=0; j<nColumns; j++)
+        {
+            float* texel = buffer + (nAngle*nSize + begin + j)*nChannels;
+            float fHeight = sqrtf(C[j]);
+
+            // If the ray from the camera heading along the view ray intersects the planet, this spot is not visible
+            float fDet = B[j]*B[j] - 4.0f * (C[j] - fInnerRadius*fInnerRadius);
+            bool bVisible = (fDet < 0 || ((0.5f * (-B[j] - sqrtf(fDet)) <= 0) && (0.5f * (-B[j] + sqrtf(fDet)) <= 0)));
+            float fRayleighDensityRatio;
+            float fMieDensityRatio;
+            if(bVisible)
+            {
+                fRayleighDensityRatio = expf(-(fHeight - fInnerRadius) * fScale * fInvRayleigh);
+                fMieDensityRatio = expf(-(fHeight - fInnerRadius) * fScale * fInvMie);
+            }
+            else
+            {
+                // Smooth the transition from light to shadow (it is a soft shadow after all)
+                fRayleighDensityRatio = texel[0 - nSize*nChannels] * 0.5f;
+                fMieDensityRatio = texel[2 - nSize*nChannels] * 0.5f;
+            }
+
+            // Rayleigh to the light source, Rayleigh to the camera, Mie to the light source, (unused) Mie to the camera
+            texel[0] = fRayleighDensityRatio;
+            texel[1] = fDepth[j] * fSampleLength[j] * fScale;
+            texel[2] = fMieDensityRatio;
+            texel[3] = 1.0f;
+        }
+    }
+}
+
+void Compute(const OpticalDepthParams& params, std::vector<float>& buffer, int nThreads)
+{
+    const int nSize = params.nSize;
+    buffer.assign(4*nSize*nSize, 0.0f);
+
+    if(nThreads <= 0)
+        nThreads = int(std::thread::hardware_concurrency());
+    if(nThreads <= 0)
+        nThreads = 1;
+    if(nThreads > nSize)
+        nThreads = nSize;
+
+    // contiguous blocks of columns, no two threads write the same texel
+    std::vector<std::thread> workers;
+    for(int t = 1; t < nThreads; t++)
+        workers.push_back(std::thread(computeColumns, std::cref(params), &buffer[0],
+                                      t*nSize/nThreads, (t+1)*nSize/nThreads));
+    computeColumns(params, &buffer[0], 0, nSize/nThreads);
+    for(auto& worker : workers)
+        worker.join();
+}
+
+static std::string cacheFile(const std::string& directory, const OpticalDepthParams& params)
+{
+    // 64-bit FNV-1a over the parameter values
+    unsigned long long hash = 14695981039346656037ULL;
+    auto feed = [&hash](const void* data, size_t n)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < n; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    feed(&params.fInnerRadius, sizeof(float));
+    feed(&params.fOuterRadius, sizeof(float));
+    feed(&params.fRayleighScaleHeight, sizeof(float));
+    feed(&params.fMieScaleHeight, sizeof(float));
+    feed(&params.nSize, sizeof(int));
+    feed(&params.nSamples, sizeof(int));
+
+    char name[32];
+    snprintf(name, sizeof(name), "odb_%016llx.bin", hash);
+    return directory + "/" + name;
+}
+
+bool Load(const std::string& directory, const OpticalDepthParams& params, std::vector<float>& buffer)
+{
+    std::ifstream file(cacheFile(directory, params), std::ios::binary);
+    if(!file.is_open())
+        return false;
+
+    // the header repeats the parameters, reject hash collisions and stale layouts
+    OpticalDepthParams stored;
+    file.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+    if(!file || stored != params)
+        return false;
+
+    buffer.resize(4*params.nSize*params.nSize);
+    file.read(reinterpret_cast<char*>(&buffer[0]), buffer.size()*sizeof(float));
+    return bool(file);
+}
+
+void Save(const std::string& directory, const OpticalDepthParams& params, const std::vector<float>& buffer)
+{
+    FileSystem::MakeDirectory(directory);
+    std::ofstream file(cacheFile(directory, params), std::ios::binary);
+    if(!file.is_open())
+    {
+        std::cout << "OpticalDepth: cannot write cache to " << directory << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(&params), sizeof(params));
+    file.write(reinterpret_cast<const char*>(&buffer[0]), buffer.size()*sizeof(float));
+}
+
+}
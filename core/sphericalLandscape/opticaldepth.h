@@ -0,0 +1,40 @@
+#ifndef OPTICALDEPTH_H
+#define OPTICALDEPTH_H
+
+#include <vector>
+#include <string>
+
+// parameters the optical depth lookup table depends on
+struct OpticalDepthParams
+{
+    float fInnerRadius;
+    float fOuterRadius;
+    float fRayleighScaleHeight;
+    float fMieScaleHeight;
+    int nSize;
+    int nSamples;
+
+    bool operator==(const OpticalDepthParams& o) const
+    {
+        return fInnerRadius == o.fInnerRadius && fOuterRadius == o.fOuterRadius
+                && fRayleighScaleHeight == o.fRayleighScaleHeight && fMieScaleHeight == o.fMieScaleHeight
+                && nSize == o.nSize && nSamples == o.nSamples;
+    }
+    bool operator!=(const OpticalDepthParams& o) const { return !(*this == o); }
+};
+
+// nSize x nSize RGBA table: rows are view angles, columns are heights
+// (Rayleigh density, Rayleigh optical depth, Mie density, 1)
+// CPU only, safe to run off the GL thread
+namespace OpticalDepth {
+
+// nThreads <= 0 uses every hardware thread
+void Compute(const OpticalDepthParams& params, std::vector<float>& buffer, int nThreads = 0);
+
+// disk cache, keyed by every field of params
+bool Load(const std::string& directory, const OpticalDepthParams& params, std::vector<float>& buffer);
+void Save(const std::string& directory, const OpticalDepthParams& params, const std::vector<float>& buffer);
+
+}
+
+#endif
@@ -0,0 +1,14 @@
+#version 330 core
+//
+// One triangle covering the viewport, drawn without a vertex buffer
+//
+
+out vec2 v2NDC;
+
+void main()
+{
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    v2NDC = p;
+    // on the far plane, so a LEQUAL depth test keeps only pixels nothing was drawn to
+    gl_Position = vec4(p, 1.0, 1.0);
+}
@@ -28,7 +28,7 @@ uniform sampler2D normalmapParent;               // normal
 uniform samplerCube s2TexTest;
 
 uniform vec3 v3CameraPos;		// The camera's current position
-uniform vec3 v3LightDir;		// The direction vector to the light source
+#include "../include/atmosphere.glsl"
 
 uniform int level;
 uniform int hash;
@@ -21,7 +21,7 @@ in float blendNearFar;
 uniform samplerCube s2TexTest;
 
 uniform vec3 v3CameraPos;		// The camera's current position
-uniform vec3 v3LightDir;		// The direction vector to the light source
+#include "../include/atmosphere.glsl"
 
 uniform int renderType;
 
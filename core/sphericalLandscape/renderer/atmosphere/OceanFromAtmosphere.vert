@@ -4,8 +4,12 @@
 //
 // Author: Sean O'Neil
 // Author: Yuxuan Liu
+#ifndef HEIGHT_MAP_X
 #define HEIGHT_MAP_X (19)
+#endif
+#ifndef HEIGHT_MAP_Y
 #define HEIGHT_MAP_Y (19)
+#endif
 #define K (2)
 
 layout (location = 0) in vec3 aPos;
@@ -22,22 +26,9 @@ out vec2 TexCoords;
 out float blendNearFar;
 
 uniform vec3 v3CameraPos;		// The camera's current position
-uniform vec3 v3LightDir;		// The direction vector to the light source
-uniform vec3 v3InvWavelength;	// 1 / pow(wavelength, 4) for the red, green, and blue channels
 uniform float fCameraHeight;	// The camera's current height
 uniform float fCameraHeight2;	// fCameraHeight^2
-uniform float fOuterRadius;		// The outer (atmosphere) radius
-uniform float fOuterRadius2;	// fOuterRadius^2
-uniform float fInnerRadius;		// The inner (planetary) radius
-uniform float fInnerRadius2;	// fInnerRadius^2
-uniform float fESun;			// ESun
-uniform float fKrESun;			// Kr * ESun
-uniform float fKmESun;			// Km * ESun
-uniform float fKr4PI;			// Kr * 4 * PI
-uniform float fKm4PI;			// Km * 4 * PI
-uniform float fScale;			// 1 / (fOuterRadius - fInnerRadius)
-uniform float fScaleDepth;		// The scale depth (i.e. the altitude at which the atmosphere's average density is found)
-uniform float fScaleOverScaleDepth;	// fScale / fScaleDepth
+#include "../include/atmosphere.glsl"
 uniform mat4 m4ModelViewProjectionMatrix;
 uniform mat4 m4ModelMatrix;
 
@@ -13,9 +13,7 @@ in vec3 v3FrontColor;
 in vec3 v3FrontSecondaryColor;
 in vec3 v3Direction;
 
-uniform vec3 v3LightDir;
-uniform float g;
-uniform float g2;
+#include "../include/atmosphere.glsl"
 //uniform sampler1D phaseTex;
 
 void main ()
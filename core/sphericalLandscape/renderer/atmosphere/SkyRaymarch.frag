@@ -0,0 +1,103 @@
+#version 330 core
+//
+// Sky ray marched per texel of a reduced resolution target, see Atmosphere::drawSkyPass
+// Same integral as SkyFrom*Raytracing.frag, the ray comes from the screen position
+//
+// rgb: sky radiance, a: 1 where at least one full resolution pixel of the block shows the sky
+//
+
+out vec4 color;
+
+in vec2 v2NDC;
+
+uniform vec3 v3CameraPos;		// The camera's current position
+uniform float fCameraHeight;	// The camera's current height
+uniform float fCameraHeight2;	// fCameraHeight^2
+#include "../include/atmosphere.glsl"
+
+uniform mat4 m4InvViewProjection;	// inverse of projection * origin based view
+uniform int nDownsample;			// full resolution pixels per texel, in each direction
+
+uniform sampler2D opticalTex;
+uniform sampler2D depthTex;			// full resolution scene depth
+
+const int nSamples = 4;
+const float fSamples = 4.0;
+
+vec2 getRayleigh(float fCos, float fHeight)
+{
+    float x = (1.0f-fCos)/2.0f;
+    float y = (fHeight - fInnerRadius) * fScale;
+
+    return texture(opticalTex, vec2(y,x)).xy;
+}
+
+void main ()
+{
+    // skip blocks the terrain covers completely, they are never composited
+    ivec2 base = ivec2(gl_FragCoord.xy) * nDownsample;
+    ivec2 last = textureSize(depthTex, 0) - 1;
+    bool bSky = false;
+    for(int y = 0; y < nDownsample; y++)
+        for(int x = 0; x < nDownsample; x++)
+            bSky = bSky || texelFetch(depthTex, min(base + ivec2(x, y), last), 0).r >= 1.0;
+    if(!bSky)
+    {
+        color = vec4(0.0);
+        return;
+    }
+
+    vec4 v4Far = m4InvViewProjection * vec4(v2NDC, 1.0, 1.0);
+    vec3 v3Ray = normalize(v4Far.xyz / v4Far.w);
+
+    // Where the ray enters and leaves the outer atmosphere, it may start inside
+    float B = 2.0 * dot(v3CameraPos, v3Ray);
+    float C = fCameraHeight2 - fOuterRadius2;
+    float fDet = B*B - 4.0 * C;
+    float fFar = 0.5 * (-B + sqrt(max(fDet, 0.0)));
+    // Rays missing the atmosphere, or heading into the planet (the ground shaders light those)
+    float fPlanetDet = B*B - 4.0 * (fCameraHeight2 - fInnerRadius2);
+    if(fDet <= 0.0 || fFar <= 0.0 || (B < 0.0 && fPlanetDet >= 0.0))
+    {
+        color = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+    float fNear = max(0.5 * (-B - sqrt(fDet)), 0.0);
+
+    // Calculate the ray's starting position, then calculate its scattering offset
+    vec3 v3Start = v3CameraPos + v3Ray * fNear;
+    fFar -= fNear;
+    float fStartHeight = length(v3Start);
+    float fStartAngle = dot(v3Ray, v3Start) / fStartHeight;
+    float fStartOffset = getRayleigh(fStartAngle, fStartHeight).y;
+
+    // Initialize the scattering loop variables
+    float fSampleLength = fFar / fSamples;
+    float fScaledLength = fSampleLength * fScale;
+    vec3 v3SampleRay = v3Ray * fSampleLength;
+    vec3 v3SamplePoint = v3Start + v3SampleRay * 0.5;
+
+    // Now loop through the sample rays
+    vec3 v3FrontColor = vec3(0.0, 0.0, 0.0);
+    for(int i=0; i<nSamples; i++)
+    {
+        float fHeight = length(v3SamplePoint);
+        float fLightAngle = dot(v3LightDir, v3SamplePoint) / fHeight;
+        float fCameraAngle = dot(v3Ray, v3SamplePoint) / fHeight;
+
+        vec2 v2Light = getRayleigh(fLightAngle, fHeight);
+        float fScatter = v2Light.y + fStartOffset - getRayleigh(fCameraAngle, fHeight).y;
+
+        vec3 v3Attenuate = exp(-fScatter * (v3InvWavelength * fKr4PI + fKm4PI));
+        v3FrontColor += v3Attenuate * (v2Light.x * fScaledLength);
+        v3SamplePoint += v3SampleRay;
+    }
+
+    // Finally, scale the Mie and Rayleigh colors
+    vec3 v3FrontSecondaryColor = v3FrontColor * fKmESun;
+    v3FrontColor = v3FrontColor * (v3InvWavelength * fKrESun);
+
+    float fCos = dot(v3LightDir, -v3Ray);
+    float fMiePhase = 1.5 * ((1.0 - g2) / (2.0 + g2)) * (1.0 + fCos*fCos) / pow(1.0 + g2 - 2.0*g*fCos, 1.5);
+    color = vec4(v3FrontColor + fMiePhase * v3FrontSecondaryColor, 1.0);
+}
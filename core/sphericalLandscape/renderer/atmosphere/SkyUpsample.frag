@@ -0,0 +1,34 @@
+#version 330 core
+//
+// Depth-aware upsampling of the reduced resolution sky, see Atmosphere::drawSkyPass
+// Bilinear weights are multiplied by the sky coverage of each texel, so terrain blocks
+// never bleed into the sky along silhouettes. Drawn with a LEQUAL depth test at the
+// far plane, only pixels still holding the cleared depth are written.
+//
+
+out vec4 color;
+
+uniform sampler2D skyTex;
+uniform int nDownsample;
+
+void main ()
+{
+    vec2 p = gl_FragCoord.xy / float(nDownsample) - 0.5;
+    ivec2 i0 = ivec2(floor(p));
+    vec2 f = p - vec2(i0);
+    ivec2 last = textureSize(skyTex, 0) - 1;
+
+    vec3 v3Sum = vec3(0.0);
+    float fWeight = 0.0;
+    for(int y = 0; y < 2; y++)
+        for(int x = 0; x < 2; x++)
+        {
+            vec4 v4Sky = texelFetch(skyTex, clamp(i0 + ivec2(x, y), ivec2(0), last), 0);
+            float w = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y) * v4Sky.a;
+            v3Sum += v4Sky.rgb * w;
+            fWeight += w;
+        }
+
+    // the block containing this pixel always has coverage and a weight >= 1/4
+    color = vec4(v3Sum / max(fWeight, 1e-4), 1.0);
+}
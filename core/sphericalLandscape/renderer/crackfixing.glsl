@@ -1,8 +1,12 @@
 #version 430
+#ifndef HEIGHT_MAP_X
 #define HEIGHT_MAP_X (17)
+#endif
+#ifndef HEIGHT_MAP_Y
 #define HEIGHT_MAP_Y (17)
+#endif
 // Kernel
-layout(local_size_x = 17, local_size_y = 1, local_size_z = 1) in;
+layout(local_size_x = HEIGHT_MAP_X, local_size_y = 1, local_size_z = 1) in;
 
 // Child heightmaP
 layout(rgba32f, binding = 0) uniform image2D heightmap;
@@ -0,0 +1,22 @@
+// Scattering constants, shared by all atmosphere programs through a std140 UBO.
+// Atmosphere::AtmosphereParams (atmosphere.h) mirrors this layout, and uploads it only
+// when the parameters change
+layout (std140) uniform AtmosphereParams
+{
+    vec3 v3LightDir;		// The direction vector to the light source
+    float fESun;			// ESun
+    vec3 v3InvWavelength;	// 1 / pow(wavelength, 4) for the red, green, and blue channels
+    float fOuterRadius;		// The outer (atmosphere) radius
+    float fOuterRadius2;	// fOuterRadius^2
+    float fInnerRadius;		// The inner (planetary) radius
+    float fInnerRadius2;	// fInnerRadius^2
+    float fKrESun;			// Kr * ESun
+    float fKmESun;			// Km * ESun
+    float fKr4PI;			// Kr * 4 * PI
+    float fKm4PI;			// Km * 4 * PI
+    float fScale;			// 1 / (fOuterRadius - fInnerRadius)
+    float fScaleDepth;		// The scale depth (i.e. the altitude at which the atmosphere's average density is found)
+    float fScaleOverScaleDepth;	// fScale / fScaleDepth
+    float g;				// The Mie phase asymmetry factor
+    float g2;				// g^2
+};
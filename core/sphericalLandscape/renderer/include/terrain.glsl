@@ -0,0 +1,89 @@
+// Procedural terrain shared by the heightmap and appearance baking kernels.
+// The including kernel declares globalMatrix and the elevationmap sampler.
+#include "noise.glsl"
+
+#ifndef NOISE_OCTAVES
+#define NOISE_OCTAVES (8)
+#endif
+
+vec2 computeUVfromMorton(int code)
+{
+    vec2 o = vec2(-1);
+    for(int i = 0; i < 15; i++)
+    {
+        o += vec2((code>>1)&1, (code)&1)/float(1<<i);
+        code >>= 2;
+    }
+    return o;
+}
+
+float ridgenoise(vec2 t, int freq) {
+    return  2.0*(0.5 - abs( 0.5 - snoise( t*(1<<freq)*16.0 ) ));
+}
+
+#define EFFECTIVE_HEIGHT_SYNTHETIC (0.001)
+#define EFFECTIVE_HEIGHT (0.002)
+
+vec3 convertToDeformed(vec2 t)
+{
+    return vec3(globalMatrix*vec4(t.x,0.0f,t.y,1.0f));
+}
+
+
+vec3 convertToSphere(vec2 t)
+{
+    return normalize(convertToDeformed(t));
+}
+
+vec2 convertToRadial(vec3 coord)
+{
+    return vec2(atan(coord.y,coord.x),acos(coord.z));
+}
+
+// S3 noise
+float ridgenoises3(vec2 t, int freq) {
+    vec3 v = convertToSphere(t);
+
+    return  2.0*(0.5 - abs( 0.5 -
+                            mix(
+                                mix(
+                                    snoise( vec2(snoise( v.xy*(1<<freq)*16.0f ), v.z ) )
+                                    ,snoise( vec2(snoise( v.xz*(1<<freq)*16.0f ), v.y ) )
+                                    ,abs(v.y))
+                                ,snoise( vec2(snoise( v.yz*(1<<freq)*16.0f ), v.x ) )
+                                ,abs(v.x)) ));
+
+}
+
+
+float calc_height(vec2 pixel)
+{
+
+    // Noise sampler1D
+    float density = ridgenoises3( pixel,0 );
+
+    for(int i = 1; i < NOISE_OCTAVES; i++)
+    {
+        density += ridgenoises3( pixel,i + 2 ) * density / float(1<<i);
+    }
+
+    density /= 2.0;
+    // Procedure
+    density = EFFECTIVE_HEIGHT_SYNTHETIC*clamp(density,0.0,1.0);
+
+
+    // Read elevation map
+    // Caution: low-res elevation map causes bumpy ground-> truncation issue
+    //density += -2.0*tanh(0.03f*abs(dot(pixel,pixel))-0.15);
+    //vec2 offset = 0.5/vec2(ELEVATION_MAP_RESOLUTION);
+    //vec2 cpixel = offset + pixel*(1.0f - 2.0f*offset);
+
+    float heightData = 2.0f*(texture( elevationmap,  vec3(convertToSphere(pixel)) ).r - 0.5f);
+    density = mix(0, density, heightData);
+    density += EFFECTIVE_HEIGHT*heightData;
+
+    // Bound height
+    density = clamp(density,0.0,EFFECTIVE_HEIGHT);
+
+    return density;
+}
@@ -0,0 +1,489 @@
+#include "scatteringlut.h"
+#include "opticaldepth.h"
+#include "filesystem.h"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#define PI_F (3.141592654f)
+
+glm::vec4 ScatteringTable::sample(float u, float v) const
+{
+    float fx = std::min(std::max(u, 0.0f), 1.0f) * (width - 1);
+    float fy = std::min(std::max(v, 0.0f), 1.0f) * (height - 1);
+    int x0 = int(fx), y0 = int(fy);
+    int x1 = std::min(x0 + 1, width - 1), y1 = std::min(y0 + 1, height - 1);
+    float tx = fx - x0, ty = fy - y0;
+    return glm::mix(glm::mix(at(x0, y0), at(x1, y0), tx),
+                    glm::mix(at(x0, y1), at(x1, y1), tx), ty);
+}
+
+namespace ScatteringLUT {
+
+// everything derived from the parameters once, distances are in planet units
+// and scattering coefficients per atmosphere thickness, as in the shaders
+struct Medium
+{
+    float Rg, Rt, H, fScale;
+    float fInvRayleigh, fInvMie;
+    glm::vec3 betaR;        // 4*PI*Kr / wavelength^4
+    float betaM;            // 4*PI*Km
+    glm::vec3 KrInvWave;    // Kr / wavelength^4
+    float Km, ESun, g, albedo;
+
+    explicit Medium(const ScatteringParams& p)
+    {
+        Rg = p.fInnerRadius;
+        Rt = p.fOuterRadius;
+        H = Rt - Rg;
+        fScale = 1.0f / H;
+        fInvRayleigh = 1.0f / p.fRayleighScaleDepth;
+        fInvMie = 1.0f / p.fMieScaleDepth;
+        betaR = 4.0f * PI_F * p.Kr * p.v3InvWavelength;
+        betaM = 4.0f * PI_F * p.Km;
+        KrInvWave = p.Kr * p.v3InvWavelength;
+        Km = p.Km;
+        ESun = p.ESun;
+        g = p.g;
+        albedo = p.fGroundAlbedo;
+    }
+    float altitude(float r) const
+    {
+        return std::min(std::max((r - Rg) * fScale, 0.0f), 1.0f);
+    }
+    void density(float r, float& rhoR, float& rhoM) const
+    {
+        float a = altitude(r);
+        rhoR = expf(-a * fInvRayleigh);
+        rhoM = expf(-a * fInvMie);
+    }
+};
+
+// ray from radius r with cos(zenith) mu: does it hit the planet, and how far does it go
+static bool hitsGround(const Medium& m, float r, float mu)
+{
+    return mu < 0.0f && r*r*(mu*mu - 1.0f) + m.Rg*m.Rg >= 0.0f;
+}
+
+static float rayLength(const Medium& m, float r, float mu, bool& ground)
+{
+    ground = hitsGround(m, r, mu);
+    if(ground)
+        return std::max(0.0f, -r*mu - sqrtf(std::max(r*r*(mu*mu - 1.0f) + m.Rg*m.Rg, 0.0f)));
+    return std::max(0.0f, -r*mu + sqrtf(std::max(r*r*(mu*mu - 1.0f) + m.Rt*m.Rt, 0.0f)));
+}
+
+static glm::vec3 sunTransmittance(const Medium& m, const ScatteringTable& transmittance, float r, float muS)
+{
+    return glm::vec3(transmittance.sample(m.altitude(r), muS*0.5f + 0.5f));
+}
+
+static glm::vec3 multipleScattering(const Medium& m, const ScatteringTable& ms, float r, float muS)
+{
+    return glm::vec3(ms.sample(muS*0.5f + 0.5f, m.altitude(r)));
+}
+
+// phase functions as in the atmosphere shaders: normalised to 4*PI, Mie uses
+// the cosine against the direction back to the camera
+static float rayleighPhase(float nu)
+{
+    return 0.75f * (1.0f + nu*nu);
+}
+
+static float miePhase(float fCos, float g)
+{
+    float g2 = g*g;
+    return 1.5f * ((1.0f - g2) / (2.0f + g2)) * (1.0f + fCos*fCos) / powf(1.0f + g2 - 2.0f*g*fCos, 1.5f);
+}
+
+// single and multiple scattering along a view ray between s0 and s1,
+// each step integrated analytically against its own extinction
+static void march(const Medium& m, const ScatteringTable& transmittance, const ScatteringTable& ms,
+                  float r, float mu, float muS, float nu, float s0, float s1, int nSteps,
+                  glm::vec3& L, glm::vec3& T)
+{
+    const float pR = rayleighPhase(nu);
+    const float pM = miePhase(-nu, m.g);
+    const float ds = (s1 - s0) / nSteps;
+    for(int i = 0; i < nSteps; i++)
+    {
+        float s = s0 + (i + 0.5f) * ds;
+        float rs = sqrtf(std::max(r*r + 2.0f*r*mu*s + s*s, 1e-12f));
+        float muSs = (r*muS + s*nu) / rs;
+
+        float rhoR, rhoM;
+        m.density(rs, rhoR, rhoM);
+        glm::vec3 scatter = m.betaR*rhoR + glm::vec3(m.betaM*rhoM);
+        glm::vec3 stepT = glm::exp(-scatter * (ds * m.fScale));
+
+        glm::vec3 single = m.ESun * (m.KrInvWave*(rhoR*pR) + glm::vec3(m.Km*rhoM*pM))
+                * sunTransmittance(m, transmittance, rs, muSs);
+        glm::vec3 multi = scatter * multipleScattering(m, ms, rs, muSs);
+
+        L += T * (single + multi) * (glm::vec3(1.0f) - stepT) / glm::max(scatter, glm::vec3(1e-6f));
+        T *= stepT;
+    }
+}
+
+// rows [0, rows) split into contiguous blocks, one thread each
+template<class Function>
+static void parallelRows(int rows, int nThreads, Function f)
+{
+    if(nThreads <= 0)
+        nThreads = int(std::thread::hardware_concurrency());
+    nThreads = std::max(1, std::min(nThreads, rows));
+
+    std::vector<std::thread> workers;
+    for(int t = 1; t < nThreads; t++)
+        workers.push_back(std::thread(f, t*rows/nThreads, (t+1)*rows/nThreads));
+    f(0, rows/nThreads);
+    for(auto& worker : workers)
+        worker.join();
+}
+
+static void allocate(ScatteringTable& table, int width, int height, int depth)
+{
+    table.width = width;
+    table.height = height;
+    table.depth = depth;
+    table.texels.assign(4*width*height*depth, 0.0f);
+}
+
+// sky view elevation, squeezed towards the horizon where the sky changes fastest
+static float elevationFromV(float v)
+{
+    float l = 2.0f*v - 1.0f;
+    return (l < 0 ? -l*l : l*l) * 0.5f * PI_F;
+}
+
+static float vFromElevation(float e)
+{
+    float l = sqrtf(fabsf(e) / (0.5f * PI_F));
+    return 0.5f + 0.5f * (e < 0 ? -l : l);
+}
+
+void Transmittance(const ScatteringParams& params, ScatteringTable& table, int width, int height, int nThreads)
+{
+    const Medium m(params);
+    const int nSteps = 40;
+    allocate(table, width, height, 1);
+
+    parallelRows(height, nThreads, [&](int begin, int end)
+    {
+        for(int y = begin; y < end; y++)
+            for(int x = 0; x < width; x++)
+            {
+                float r = m.Rg + m.H * x / float(width - 1);
+                float mu = 2.0f * y / float(height - 1) - 1.0f;
+
+                bool ground;
+                float len = rayLength(m, r, mu, ground);
+                glm::vec3 depth(0.0f);
+                if(!ground)
+                {
+                    float ds = len / nSteps;
+                    for(int i = 0; i < nSteps; i++)
+                    {
+                        float s = (i + 0.5f) * ds;
+                        float rhoR, rhoM;
+                        m.density(sqrtf(r*r + 2.0f*r*mu*s + s*s), rhoR, rhoM);
+                        depth += (m.betaR*rhoR + glm::vec3(m.betaM*rhoM)) * (ds * m.fScale);
+                    }
+                }
+                table.at(x, y) = ground ? glm::vec4(0.0f, 0.0f, 0.0f, 1.0f) : glm::vec4(glm::exp(-depth), 1.0f);
+            }
+    });
+}
+
+void MultipleScattering(const ScatteringParams& params, const ScatteringTable& transmittance,
+                        ScatteringTable& table, int size, int nThreads)
+{
+    const Medium m(params);
+    const int nDirections = 8;  // nDirections^2 rays over the sphere
+    const int nSteps = 20;
+    allocate(table, size, size, 1);
+
+    parallelRows(size, nThreads, [&](int begin, int end)
+    {
+        for(int y = begin; y < end; y++)
+            for(int x = 0; x < size; x++)
+            {
+                float r = m.Rg + m.H * y / float(size - 1);
+                float muS = 2.0f * x / float(size - 1) - 1.0f;
+                glm::vec3 sun(sqrtf(std::max(1.0f - muS*muS, 0.0f)), muS, 0.0f);
+
+                glm::vec3 L2(0.0f), fms(0.0f);
+                for(int i = 0; i < nDirections; i++)
+                    for(int j = 0; j < nDirections; j++)
+                    {
+                        float mu = 1.0f - 2.0f * (i + 0.5f) / nDirections;
+                        float sinTheta = sqrtf(std::max(1.0f - mu*mu, 0.0f));
+                        float phi = 2.0f * PI_F * (j + 0.5f) / nDirections;
+                        float nu = glm::dot(glm::vec3(sinTheta*cosf(phi), mu, sinTheta*sinf(phi)), sun);
+
+                        bool ground;
+                        float len = rayLength(m, r, mu, ground);
+                        float ds = len / nSteps;
+                        glm::vec3 T(1.0f), Lf(0.0f), f(0.0f);
+                        for(int k = 0; k < nSteps; k++)
+                        {
+                            float s = (k + 0.5f) * ds;
+                            float rs = sqrtf(std::max(r*r + 2.0f*r*mu*s + s*s, 1e-12f));
+                            float muSs = (r*muS + s*nu) / rs;
+
+                            float rhoR, rhoM;
+                            m.density(rs, rhoR, rhoM);
+                            glm::vec3 scatter = m.betaR*rhoR + glm::vec3(m.betaM*rhoM);
+                            glm::vec3 stepT = glm::exp(-scatter * (ds * m.fScale));
+                            glm::vec3 integral = (glm::vec3(1.0f) - stepT) / glm::max(scatter, glm::vec3(1e-6f));
+
+                            // isotropic phase, 1 with the Kr / wavelength^4 coefficients as in
+                            // march's single scattering (scatter is 4*PI times them)
+                            glm::vec3 inScatter = m.KrInvWave*rhoR + glm::vec3(m.Km*rhoM);
+                            Lf += T * inScatter * m.ESun * sunTransmittance(m, transmittance, rs, muSs) * integral;
+                            f += T * scatter * integral;
+                            T *= stepT;
+                        }
+                        if(ground)
+                        {
+                            // lambertian ground lit by the sun
+                            float muSg = (r*muS + len*nu) / m.Rg;
+                            Lf += T * sunTransmittance(m, transmittance, m.Rg, muSg)
+                                    * (m.ESun * std::max(muSg, 0.0f) * m.albedo / PI_F);
+                        }
+                        L2 += Lf;
+                        fms += f;
+                    }
+                L2 /= float(nDirections*nDirections);
+                fms /= float(nDirections*nDirections);
+
+                // infinite series of isotropic bounces: L2 * (1 + fms + fms^2 + ...)
+                table.at(x, y) = glm::vec4(L2 / (glm::vec3(1.0f) - glm::min(fms, glm::vec3(0.99f))), 1.0f);
+            }
+    });
+}
+
+void SkyView(const ScatteringParams& params, const ScatteringTable& transmittance,
+             const ScatteringTable& multipleScattering, float fCameraAltitude, float fSunCos,
+             ScatteringTable& table, int width, int height, int nThreads)
+{
+    const Medium m(params);
+    const int nSteps = 30;
+    const float r = m.Rg + m.H * std::min(std::max(fCameraAltitude, 0.0f), 1.0f);
+    const float sinS = sqrtf(std::max(1.0f - fSunCos*fSunCos, 0.0f));
+    allocate(table, width, height, 1);
+
+    parallelRows(height, nThreads, [&](int begin, int end)
+    {
+        for(int y = begin; y < end; y++)
+            for(int x = 0; x < width; x++)
+            {
+                float e = elevationFromV(y / float(height - 1));
+                float phi = PI_F * x / float(width - 1);
+                float mu = sinf(e);
+                float nu = cosf(e)*cosf(phi)*sinS + mu*fSunCos;
+
+                bool ground;
+                float len = rayLength(m, r, mu, ground);
+                glm::vec3 L(0.0f), T(1.0f);
+                march(m, transmittance, multipleScattering, r, mu, fSunCos, nu, 0.0f, len, nSteps, L, T);
+                table.at(x, y) = glm::vec4(L, (T.r + T.g + T.b) / 3.0f);
+            }
+    });
+}
+
+void AerialPerspective(const ScatteringParams& params, const ScatteringTable& transmittance,
+                       const ScatteringTable& multipleScattering, float fCameraAltitude, float fSunCos,
+                       float fMaxDistance, ScatteringTable& table, int size, int nThreads)
+{
+    const Medium m(params);
+    const int nStepsPerSlice = 4;
+    const float r = m.Rg + m.H * std::min(std::max(fCameraAltitude, 0.0f), 1.0f);
+    const float sinS = sqrtf(std::max(1.0f - fSunCos*fSunCos, 0.0f));
+    allocate(table, size, size, size);
+
+    // one ray per (u, v), the slices are written as the ray walks through them
+    parallelRows(size, nThreads, [&](int begin, int end)
+    {
+        for(int y = begin; y < end; y++)
+            for(int x = 0; x < size; x++)
+            {
+                float e = elevationFromV(y / float(size - 1));
+                float phi = PI_F * x / float(size - 1);
+                float mu = sinf(e);
+                float nu = cosf(e)*cosf(phi)*sinS + mu*fSunCos;
+
+                bool ground;
+                float len = rayLength(m, r, mu, ground);
+                glm::vec3 L(0.0f), T(1.0f);
+                float s0 = 0.0f;
+                for(int z = 0; z < size; z++)
+                {
+                    float s1 = std::min(fMaxDistance * m.H * (z + 1) / size, len);
+                    if(s1 > s0)
+                        march(m, transmittance, multipleScattering, r, mu, fSunCos, nu, s0, s1, nStepsPerSlice, L, T);
+                    s0 = std::max(s0, s1);
+                    table.at(x, y, z) = glm::vec4(L, (T.r + T.g + T.b) / 3.0f);
+                }
+            }
+    });
+}
+
+bool Save(const std::string& path, const ScatteringTable& table)
+{
+    std::ofstream file(path, std::ios::binary);
+    if(!file.is_open())
+    {
+        std::cout << "ScatteringLUT: cannot write " << path << std::endl;
+        return false;
+    }
+    const int header[4] = {table.width, table.height, table.depth, 4};
+    file.write("LDLT", 4);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(&table.texels[0]), table.texels.size()*sizeof(float));
+    return bool(file);
+}
+
+// CPU port of the per-vertex loop in SkyFromAtmosphere.vert, as the baseline
+// for the per-pixel cost; returns the front colour before the phase functions
+static glm::vec3 perVertexSky(const Medium& m, const std::vector<float>& opticalDepth, int nSize,
+                              float r, const glm::vec3& ray, const glm::vec3& sun)
+{
+    const int nSamples = 4;
+    const glm::vec3 attenuation = m.betaR + glm::vec3(m.betaM);
+    auto getRayleigh = [&](float fCos, float fHeight)
+    {
+        float u = std::min(std::max((fHeight - m.Rg) * m.fScale, 0.0f), 1.0f) * (nSize - 1);
+        float v = std::min(std::max((1.0f - fCos) * 0.5f, 0.0f), 1.0f) * (nSize - 1);
+        int x0 = int(u), y0 = int(v);
+        int x1 = std::min(x0 + 1, nSize - 1), y1 = std::min(y0 + 1, nSize - 1);
+        float tx = u - x0, ty = v - y0;
+        const float* t00 = &opticalDepth[4*(y0*nSize + x0)];
+        const float* t10 = &opticalDepth[4*(y0*nSize + x1)];
+        const float* t01 = &opticalDepth[4*(y1*nSize + x0)];
+        const float* t11 = &opticalDepth[4*(y1*nSize + x1)];
+        return glm::mix(glm::mix(glm::vec2(t00[0], t00[1]), glm::vec2(t10[0], t10[1]), tx),
+                        glm::mix(glm::vec2(t01[0], t01[1]), glm::vec2(t11[0], t11[1]), tx), ty);
+    };
+
+    glm::vec3 start(0.0f, r, 0.0f);
+    bool ground;
+    float fFar = rayLength(m, r, ray.y, ground);
+    float fStartOffset = getRayleigh(ray.y, r).y;
+    float fSampleLength = fFar / nSamples;
+    float fScaledLength = fSampleLength * m.fScale;
+    glm::vec3 samplePoint = start + ray * (fSampleLength * 0.5f);
+
+    glm::vec3 front(0.0f);
+    for(int i = 0; i < nSamples; i++)
+    {
+        float fHeight = glm::length(samplePoint);
+        float fLightAngle = glm::dot(sun, samplePoint) / fHeight;
+        float fCameraAngle = glm::dot(ray, samplePoint) / fHeight;
+        glm::vec2 light = getRayleigh(fLightAngle, fHeight);
+        float fScatter = light.y + fStartOffset - getRayleigh(fCameraAngle, fHeight).y;
+        front += glm::exp(-fScatter * attenuation) * (light.x * fScaledLength);
+        samplePoint += ray * fSampleLength;
+    }
+    return front;
+}
+
+static double millisecondsSince(const std::chrono::high_resolution_clock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool Bake(const ScatteringParams& params, float fCameraAltitude, float fSunCos,
+          const std::string& directory, int nThreads)
+{
+    FileSystem::MakeDirectory(directory);
+    const int nUsed = nThreads > 0 ? nThreads : std::max(1, int(std::thread::hardware_concurrency()));
+    printf("Baking scattering tables into %s with %d threads\n", directory.c_str(), nUsed);
+
+    ScatteringTable transmittance, ms, sky, aerial;
+    auto report = [](const char* name, const ScatteringTable& table, double ms)
+    {
+        int texels = table.width*table.height*table.depth;
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%dx%d", table.width, table.height, table.depth);
+        printf("  %-20s %-12s %9.2f ms  %9.1f ns/texel\n", name, size, ms, 1e6*ms/texels);
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    Transmittance(params, transmittance, 256, 64, nThreads);
+    report("transmittance", transmittance, millisecondsSince(start));
+
+    start = std::chrono::high_resolution_clock::now();
+    MultipleScattering(params, transmittance, ms, 32, nThreads);
+    report("multiple scattering", ms, millisecondsSince(start));
+
+    start = std::chrono::high_resolution_clock::now();
+    SkyView(params, transmittance, ms, fCameraAltitude, fSunCos, sky, 192, 108, nThreads);
+    report("sky view", sky, millisecondsSince(start));
+
+    start = std::chrono::high_resolution_clock::now();
+    AerialPerspective(params, transmittance, ms, fCameraAltitude, fSunCos, 1.0f, aerial, 32, nThreads);
+    report("aerial perspective", aerial, millisecondsSince(start));
+
+    bool ok = Save(directory + "/transmittance.bin", transmittance)
+            && Save(directory + "/multiscattering.bin", ms)
+            && Save(directory + "/skyview.bin", sky)
+            && Save(directory + "/aerialperspective.bin", aerial);
+
+    // per-pixel cost: the per-vertex single scattering (4 samples, 13 optical depth fetches,
+    // 4 vec3 exp) against one bilinear sky view fetch, both on one CPU thread
+    const Medium m(params);
+    OpticalDepthParams od;
+    od.fInnerRadius = params.fInnerRadius;
+    od.fOuterRadius = params.fOuterRadius;
+    od.fRayleighScaleHeight = params.fRayleighScaleDepth;
+    od.fMieScaleHeight = params.fMieScaleDepth;
+    od.nSize = 256;
+    od.nSamples = 50;
+    std::vector<float> opticalDepth;
+    OpticalDepth::Compute(od, opticalDepth, nThreads);
+
+    const int nPixels = 256*256;
+    const float r = m.Rg + m.H * std::min(std::max(fCameraAltitude, 0.0f), 1.0f);
+    const glm::vec3 sun(sqrtf(std::max(1.0f - fSunCos*fSunCos, 0.0f)), fSunCos, 0.0f);
+    std::vector<glm::vec3> rays(nPixels);
+    for(int i = 0; i < nPixels; i++)
+    {
+        // upper hemisphere, the sky dome
+        float mu = (i / 256 + 0.5f) / 256.0f;
+        float phi = 2.0f * PI_F * ((i % 256) + 0.5f) / 256.0f;
+        float sinTheta = sqrtf(1.0f - mu*mu);
+        rays[i] = glm::vec3(sinTheta*cosf(phi), mu, sinTheta*sinf(phi));
+    }
+
+    glm::vec3 sink(0.0f);
+    start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < nPixels; i++)
+        sink += perVertexSky(m, opticalDepth, od.nSize, r, rays[i], sun);
+    double perVertex = millisecondsSince(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < nPixels; i++)
+    {
+        const glm::vec3& ray = rays[i];
+        float cosPhi = glm::dot(glm::normalize(glm::vec2(ray.x, ray.z) + glm::vec2(1e-12f, 0.0f)), glm::vec2(1.0f, 0.0f));
+        float u = acosf(std::min(std::max(cosPhi, -1.0f), 1.0f)) / PI_F;
+        sink += glm::vec3(sky.sample(u, vFromElevation(asinf(ray.y))));
+    }
+    double lut = millisecondsSince(start);
+
+    printf("  per pixel: per-vertex single scattering %.1f ns, sky view lookup %.1f ns (%.1fx)%s\n",
+           1e6*perVertex/nPixels, 1e6*lut/nPixels, perVertex/std::max(lut, 1e-9),
+           sink.x == sink.x ? "" : " (nan)");
+
+    if(!ok)
+        std::cout << "ScatteringLUT: some tables were not written" << std::endl;
+    return ok;
+}
+
+}
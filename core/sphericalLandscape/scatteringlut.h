@@ -0,0 +1,84 @@
+#ifndef SCATTERINGLUT_H
+#define SCATTERINGLUT_H
+
+#include <vector>
+#include <string>
+
+#include "glm/glm.hpp"
+
+// inputs of the precomputed scattering tables, same units as the Atmosphere constants:
+// radii in planet units, scale depths as a fraction of the atmosphere thickness.
+// defaults match Atmosphere::reset()
+struct ScatteringParams
+{
+    float fInnerRadius = 1.0f;
+    float fOuterRadius = 1.0126f;
+    float fRayleighScaleDepth = 0.1f;
+    float fMieScaleDepth = 0.1f;
+    float Kr = 0.0025f;
+    float Km = 0.0010f;
+    float ESun = 20.0f;
+    float g = -0.990f;
+    glm::vec3 v3InvWavelength = 1.0f / glm::pow(glm::vec3(0.700f, 0.546f, 0.435f), glm::vec3(4.0f)); // 1 / wavelength^4
+    float fGroundAlbedo = 0.3f;
+};
+
+// RGBA float table, width x height x depth texels, row major
+struct ScatteringTable
+{
+    int width = 0;
+    int height = 0;
+    int depth = 1;
+    std::vector<float> texels;
+
+    glm::vec4& at(int x, int y, int z = 0)
+    {
+        return *reinterpret_cast<glm::vec4*>(&texels[4*((z*height + y)*width + x)]);
+    }
+    const glm::vec4& at(int x, int y, int z = 0) const
+    {
+        return *reinterpret_cast<const glm::vec4*>(&texels[4*((z*height + y)*width + x)]);
+    }
+    // bilinear lookup in the first slice, u and v in [0, 1] across texel centres
+    glm::vec4 sample(float u, float v) const;
+};
+
+// precomputed atmosphere in the style of Hillaire 2020:
+// transmittance, isotropic multiple scattering transfer, then per-view sky and aerial
+// perspective tables built from them. CPU only, every pass is split over rows.
+// nThreads <= 0 uses every hardware thread
+namespace ScatteringLUT {
+
+// transmittance to the top of the atmosphere, 0 where the ray hits the ground
+// u: altitude 0..1, v: cos(view zenith) -1..1
+void Transmittance(const ScatteringParams& params, ScatteringTable& table,
+                   int width = 256, int height = 64, int nThreads = 0);
+
+// multiple scattering contribution Psi_ms, multiplied by the scattering coefficient when used
+// u: cos(sun zenith) -1..1, v: altitude 0..1
+void MultipleScattering(const ScatteringParams& params, const ScatteringTable& transmittance,
+                        ScatteringTable& table, int size = 32, int nThreads = 0);
+
+// sky radiance seen from fCameraAltitude (0..1) with the sun at fSunCos from the zenith
+// u: azimuth from the sun 0..PI, v: elevation, squeezed towards the horizon
+void SkyView(const ScatteringParams& params, const ScatteringTable& transmittance,
+             const ScatteringTable& multipleScattering, float fCameraAltitude, float fSunCos,
+             ScatteringTable& table, int width = 192, int height = 108, int nThreads = 0);
+
+// in-scattered light (rgb) and mean transmittance (a) between the camera and each depth slice
+// u, v: as SkyView, w: distance up to fMaxDistance in atmosphere thicknesses
+void AerialPerspective(const ScatteringParams& params, const ScatteringTable& transmittance,
+                       const ScatteringTable& multipleScattering, float fCameraAltitude, float fSunCos,
+                       float fMaxDistance, ScatteringTable& table, int size = 32, int nThreads = 0);
+
+// raw dump: "LDLT", width, height, depth, channels, then the floats
+bool Save(const std::string& path, const ScatteringTable& table);
+
+// builds every table into directory and prints build times and
+// the per-pixel cost of the per-vertex single scattering against the table lookups
+bool Bake(const ScatteringParams& params, float fCameraAltitude, float fSunCos,
+          const std::string& directory, int nThreads = 0);
+
+}
+
+#endif
@@ -1,10 +1,14 @@
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
-//GLEW
-#define GLEW_STATIC
-#include <GL/glew.h>
+#include <glad/glad.h>
 
 //GLFW
 #include <GLFW/glfw3.h>
@@ -14,6 +18,8 @@
 
 #include "shader.h"
 #include "camera.h"
+#include "glcontext.h"
+#include "voxelterrain.h"
 
 #include "cmake_source_dir.h"
 
@@ -605,7 +611,7 @@ void renderQuad();
 void renderCube();
 
 // Shader
-Shader MCShader, wireShader;
+Shader MCShader, wireShader, chunkShader;
 
 // Marching cube configuration
 glm::ivec3 gridSize(128);
@@ -633,23 +639,248 @@ float surf_of_evolution(float x, float z, float y)
     return (x*x + y*y - (log(z+3.2)*log(z+3.2))-0.02 + 1.0);
 }
 
-float gen_terrain(glm::vec3 ws)
+// sampleVolume in shader.geom.glsl: 0.5 - y plus noise octaves of amplitude at most
+// 0.05*(0.0625 + 0.25 + 1.0), the noise texture holds values in [-1, 1]
+const float NOISE_AMPLITUDE = 0.05f*(0.125f/2 + 0.25f + 1.0f);
+const int BRICK_SIZE = 8;
+
+// layers of cells whose bricks straddle isoValue: a brick row spanning grid points
+// [y0, y1] has density in [0.5 - y1/n - A, 0.5 - y0/n + A]
+void activeLayers(int& first, int& count)
+{
+    first = gridSize.y;
+    int last = 0;
+    for(int y0 = 0; y0 < gridSize.y - 1; y0 += BRICK_SIZE)
+    {
+        int y1 = std::min(y0 + BRICK_SIZE, gridSize.y - 1);
+        float lo = 0.5f - y1/(float)gridSize.y - NOISE_AMPLITUDE;
+        float hi = 0.5f - y0/(float)gridSize.y + NOISE_AMPLITUDE;
+        if(lo < isoValue && hi >= isoValue)
+        {
+            first = std::min(first, y0);
+            last = std::max(last, y1);
+        }
+    }
+    count = std::max(last - first, 0);
+}
+
+// the noise volume, a copy of dataFieldTex for the cpu
+static std::vector<float> noiseField;
+static const int NOISE_SIZE = 16;
+
+// texture() of dataFieldTex: linear filtering, repeat wrapping
+static float sampleNoise(glm::vec3 uvw)
+{
+    const glm::vec3 p = uvw*float(NOISE_SIZE) - 0.5f;
+    const glm::vec3 i = glm::floor(p), f = p - i;
+    auto at = [](int x, int y, int z) {
+        x &= NOISE_SIZE - 1; y &= NOISE_SIZE - 1; z &= NOISE_SIZE - 1;
+        return noiseField[x + NOISE_SIZE*(y + NOISE_SIZE*z)];
+    };
+    const int x = int(i.x), y = int(i.y), z = int(i.z);
+    return glm::mix(glm::mix(glm::mix(at(x, y, z), at(x+1, y, z), f.x), glm::mix(at(x, y+1, z), at(x+1, y+1, z), f.x), f.y),
+                    glm::mix(glm::mix(at(x, y, z+1), at(x+1, y, z+1), f.x), glm::mix(at(x, y+1, z+1), at(x+1, y+1, z+1), f.x), f.y),
+                    f.z);
+}
+
+// sampleVolume in shader.geom.glsl in world space: the volume spans TERRAIN_SCALE world
+// units translated by -TERRAIN_SCALE/2 in y, so its ws is the world position over the scale
+const float TERRAIN_SCALE = 20.0f;
+float gen_terrain(glm::vec3 world)
 {
-    isoValue = 0.0f;
+    glm::vec3 ws = world/TERRAIN_SCALE;
     float density = -ws.y;
 
+    density += 0.05f*sampleNoise(ws*16.07f)*0.125f/2;
+    density += 0.05f*sampleNoise(ws*4.03f)*0.25f;
+    density += 0.05f*sampleNoise(ws*1.01f)*1.00f;
+
     return density;
 }
 
+// Chunked terrain, T switches back to the single volume drawn by the geometry shader
+static bool chunked = true;
+static VoxelTerrain* terrain = nullptr;
+static const float BRUSH_RADIUS = 1.0f;
+
+// streams worlds of growing size, then times edits with the world idle and while it
+// streams somewhere else; the edit latency should not follow the size
+static void terrainBench()
+{
+    const int radii[] = { 2, 4, 8 };
+    for(int r : radii)
+    {
+        VoxelTerrain world(gen_terrain, voxelSize.x, isoValue, 1.0f/TERRAIN_SCALE);
+        world.viewRadius = glm::ivec3(r, 2, r);
+        glm::vec3 viewer(0.0f);
+        // a frame every millisecond, the workers share the cores with the render thread
+        auto frame = [&]() {
+            world.Update(viewer);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        };
+
+        auto begin = std::chrono::steady_clock::now();
+        do frame(); while(!world.Idle());
+        double streamMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        printf("terrain radius %d: %zu chunks, %zu with surface, %u triangles, streamed in %.0f ms\n",
+               r, world.CHUNKS, world.MESHES, world.TRIANGLES, streamMs);
+
+        // brushes on the surface, alternately adding and carving
+        const int edits = 8;
+        double idleMs = 0;
+        unsigned int chunks = 0;
+        for(int e = 0; e < edits; e++)
+        {
+            glm::vec3 hit;
+            if(!world.Raycast(glm::vec3(e*1.7f - 6.0f, 5.0f, 2.0f), glm::vec3(0, -1, 0), 20.0f, hit)) continue;
+            world.Sculpt(hit, BRUSH_RADIUS, e % 2 == 0);
+            do frame(); while(!world.Idle());
+            idleMs += world.EDIT_MS;
+            chunks += world.EDIT_CHUNKS;
+        }
+
+        // the viewer jumps away and an edit lands there before the first chunk arrives
+        viewer = glm::vec3(1000.0f, 0.0f, 0.0f);
+        world.Update(viewer);
+        world.EDIT_MS = 0;
+        world.Sculpt(viewer, BRUSH_RADIUS, false);
+        do frame(); while(world.EDIT_MS == 0);
+        printf("terrain radius %d: edit %.2f ms over %.1f chunks, %.2f ms while streaming (%zu jobs queued)\n",
+               r, idleMs/edits, chunks/float(edits), world.EDIT_MS, world.JOBS);
+    }
+}
+
+// directed edges of the welded mesh without their reverse, leaving out those along the
+// box the world was streamed into: the cracks
+static size_t openEdges(const IsoSurface::Mesh& mesh, const glm::vec3& lo, const glm::vec3& hi)
+{
+    // the chunks on either side of a seam place its vertices within rounding
+    const float eps = 1e-3f*voxelSize.x;
+    auto cellKey = [](const glm::ivec3& c) {
+        const uint64_t mask = (1u << 21) - 1;
+        return (uint64_t(c.x) & mask) | (uint64_t(c.y) & mask) << 21 | (uint64_t(c.z) & mask) << 42;
+    };
+    std::unordered_map<uint64_t, std::vector<unsigned int>> cells;
+    std::vector<glm::vec3> welded;
+    std::vector<unsigned int> weld(mesh.vertices.size());
+    for(size_t i = 0; i < mesh.vertices.size(); i++)
+    {
+        const glm::vec3& p = mesh.vertices[i].position;
+        const glm::ivec3 c(glm::floor(p/eps));
+        weld[i] = (unsigned int)welded.size();
+        for(int z = -1; z <= 1; z++)
+            for(int y = -1; y <= 1; y++)
+                for(int x = -1; x <= 1; x++)
+                {
+                    auto it = cells.find(cellKey(c + glm::ivec3(x, y, z)));
+                    if(it == cells.end()) continue;
+                    for(unsigned int j : it->second)
+                        if(glm::length(welded[j] - p) < eps)
+                            weld[i] = j;
+                }
+        if(weld[i] == welded.size())
+        {
+            welded.push_back(p);
+            cells[cellKey(c)].push_back(weld[i]);
+        }
+    }
+
+    auto onBox = [&](const glm::vec3& p) {
+        return glm::any(glm::lessThan(p, lo + eps)) || glm::any(glm::greaterThan(p, hi - eps));
+    };
+    std::unordered_set<uint64_t> edges;
+    for(size_t t = 0; t < mesh.indices.size(); t += 3)
+        for(int k = 0; k < 3; k++)
+            edges.insert(uint64_t(weld[mesh.indices[t + k]]) << 32 | weld[mesh.indices[t + (k + 1) % 3]]);
+    size_t open = 0;
+    for(uint64_t edge : edges)
+    {
+        const unsigned int a = (unsigned int)(edge >> 32), b = (unsigned int)edge;
+        if(!edges.count(uint64_t(b) << 32 | a) && !(onBox(welded[a]) && onBox(welded[b])))
+            open++;
+    }
+    return open;
+}
+
+// coarser levels against every chunk at full resolution: triangles by distance in chunks
+// from the viewer, and the cracks where levels meet
+static void lodBench()
+{
+    const int r = 8;
+    const float chunk = VoxelTerrain::CHUNK*voxelSize.x;
+    std::vector<size_t> triangles[2];
+    int lodDistance[VoxelTerrain::LODS - 1];
+    for(int lod = 0; lod < 2; lod++)
+    {
+        VoxelTerrain world(gen_terrain, voxelSize.x, isoValue, 1.0f/TERRAIN_SCALE);
+        world.viewRadius = glm::ivec3(r, 2, r);
+        for(int l = 0; l < VoxelTerrain::LODS - 1; l++)
+        {
+            if(!lod)
+                world.lodDistance[l] = r + l;
+            lodDistance[l] = world.lodDistance[l];
+        }
+        const glm::vec3 viewer(0.0f);
+        auto begin = std::chrono::steady_clock::now();
+        do
+        {
+            world.Update(viewer);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } while(!world.Idle());
+        double streamMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        world.Update(viewer);
+
+        IsoSurface::Mesh mesh;
+        world.ReadMesh(mesh);
+        triangles[lod].assign(r + 1, 0);
+        for(size_t t = 0; t < mesh.indices.size(); t += 3)
+        {
+            const glm::vec3 centre = (mesh.vertices[mesh.indices[t]].position + mesh.vertices[mesh.indices[t + 1]].position +
+                                      mesh.vertices[mesh.indices[t + 2]].position)/3.0f;
+            const glm::ivec3 d = glm::abs(glm::ivec3(glm::floor(centre/chunk)));
+            triangles[lod][std::min(std::max(d.x, std::max(d.y, d.z)), r)]++;
+        }
+        const glm::vec3 lo = glm::vec3(-r, -2, -r)*chunk, hi = glm::vec3(r + 1, 3, r + 1)*chunk;
+        printf("terrain %s: %u triangles, streamed in %.0f ms, %zu open edges inside\n",
+               lod ? "lod" : "full resolution", world.TRIANGLES, streamMs, openEdges(mesh, lo, hi));
+    }
+    for(int d = 0; d <= r; d++)
+    {
+        int level = 0;
+        while(level < VoxelTerrain::LODS - 1 && d > lodDistance[level])
+            level++;
+        printf("terrain %d chunks out: %zu triangles at level %d, %zu at full resolution\n",
+               d, triangles[1][d], level, triangles[0][d]);
+    }
+}
+
 int main(int argc, char **argv)
 {
 #if defined(__linux__)
     setenv ("DISPLAY", ":0", 0);
 #endif
 
-    // Initialize a window
-    GLFWwindow* window = initGL(SCR_WIDTH, SCR_HEIGHT);
-    printf("Initial glwindow...\n");
+    bool bench = false;
+    for(int i = 1; i < argc; i++)
+        if(!strcmp(argv[i], "--terrain-bench"))
+            bench = true;
+
+    // Initialize a window, or an offscreen context (--headless N renders N frames and exits)
+    GLContext::Options context = GLContext::ParseArgs(argc, argv);
+    GLFWwindow* window = nullptr;
+    if(context.backend == GLContext::WINDOWED)
+    {
+        window = initGL(SCR_WIDTH, SCR_HEIGHT);
+        GLContext::Attach(window);
+        printf("Initial glwindow...\n");
+    }
+    else
+    {
+        if(context.frames == 0)
+            context.frames = 1;
+        if(!GLContext::InitHeadless(SCR_WIDTH, SCR_HEIGHT, context))
+            return 1;
+    }
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
@@ -657,6 +888,7 @@ int main(int argc, char **argv)
 
     MCShader.reload_shader_program_from_files(FP("shader.vert"),FP("shader.bp.frag"),FP("shader.geom.glsl"));
     wireShader.reload_shader_program_from_files(FP("shader.box.vert"),FP("shader.box.frag"));
+    chunkShader.reload_shader_program_from_files(FP("shader.chunk.vert"),FP("shader.bp.frag"));
     //Triangle Table texture//
     //This texture store the vertex index list forgridPos
     //generating the triangles of each configurations.
@@ -717,12 +949,30 @@ int main(int argc, char **argv)
             }
     glTexImage3D( GL_TEXTURE_3D, 0, GL_R32F, volTexSize.x, volTexSize.y, volTexSize.z, 0,
                   GL_RED, GL_FLOAT, &dataField[0]);
+    noiseField = dataField;
+
+    if(bench)
+    {
+        terrainBench();
+        lodBench();
+        GLContext::Terminate();
+        return 0;
+    }
+    terrain = new VoxelTerrain(gen_terrain, voxelSize.x, isoValue, 1.0f/TERRAIN_SCALE);
 
     // Dummy VAO
     unsigned int  VAO;
     glGenVertexArrays(1, &VAO);
 
-    while( !glfwWindowShouldClose( window ) )
+    // a headless frame shows the terrain once streamed
+    if(!window)
+        do
+        {
+            terrain->Update(camera.Position);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } while(!terrain->Idle());
+
+    while( !GLContext::ShouldClose() )
     {
         // per-frame time logic
         // --------------------
@@ -730,12 +980,24 @@ int main(int argc, char **argv)
 
         // input
         // -----
-        glfwGetFramebufferSize(window, &SCR_WIDTH, &SCR_HEIGHT);
-        processInput(window);
+        GLContext::GetFramebufferSize(&SCR_WIDTH, &SCR_HEIGHT);
+        if(window)
+            processInput(window);
 
         // render
         glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if(chunked)
+        {
+            terrain->Update(camera.Position);
+            chunkShader.use();
+            chunkShader.setVec3("viewPos",camera.Position );
+            chunkShader.setVec3("color",glm::vec3(0.2,0.2,0.7));
+            chunkShader.setMat4("projectionMatrix",camera.GetFrustumMatrix() );
+            terrain->Draw(chunkShader);
+        }
+        else
+        {
         MCShader.use();
 
         MCShader.setVec3("viewPos",camera.Position );
@@ -752,9 +1014,16 @@ int main(int argc, char **argv)
 
         MCShader.setMat4("model",glm::translate(glm::mat4(1),glm::vec3(0,-10,0)));
 
+        // skip the layers of bricks that are all ground or all air
+        int firstLayer, layers;
+        activeLayers(firstLayer, layers);
+        MCShader.setVec3i("drawOrigin",glm::ivec3(0,firstLayer,0));
+        MCShader.setVec3i("drawSize",glm::ivec3(gridSize.x,layers,gridSize.z));
+
         glBindVertexArray(VAO);
-        glDrawArraysInstanced(GL_POINTS,0,1,gridSize.x*gridSize.y*gridSize.z);
+        glDrawArraysInstanced(GL_POINTS,0,1,gridSize.x*layers*gridSize.z);
         glBindVertexArray(0);
+        }
 
         wireShader.use();
         wireShader.setMat4("projectionMatrix",camera.GetFrustumMatrix() );
@@ -762,37 +1031,44 @@ int main(int argc, char **argv)
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        GLContext::SwapBuffers();
     }
 
     glDeleteVertexArrays(1, &VAO);
+    delete terrain;
 
-    glfwTerminate( );
+    GLContext::Terminate();
 
     return 0;
 }
 
 void countAndDisplayFps(GLFWwindow* window)
 {
-    float currentFrame = glfwGetTime();
+    float currentFrame = GLContext::GetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
     frameCount++;
-    if(glfwGetTime() - lastFpsCountFrame > 1.0f)
+    if(GLContext::GetTime() - lastFpsCountFrame > 1.0f)
     {
 
         char title [256];
         title [255] = '\0';
 
-        snprintf ( title, 255,
-                   "MQB+ARB DEMO - FPS: %4.2f | runtime: %.0fs | isoLevel: %.2f ",
-                   frameCount/(glfwGetTime() - lastFpsCountFrame), glfwGetTime(), isoValue );
-        glfwSetWindowTitle(window, title);
+        if(chunked)
+            snprintf ( title, 255,
+                       "MQB+ARB DEMO - FPS: %4.2f | chunks: %zu, %zu meshed, %zu queued | last edit: %.1f ms, %u chunks",
+                       frameCount/(GLContext::GetTime() - lastFpsCountFrame), terrain->CHUNKS, terrain->MESHES,
+                       terrain->JOBS, terrain->EDIT_MS, terrain->EDIT_CHUNKS );
+        else
+            snprintf ( title, 255,
+                       "MQB+ARB DEMO - FPS: %4.2f | runtime: %.0fs | isoLevel: %.2f ",
+                       frameCount/(GLContext::GetTime() - lastFpsCountFrame), GLContext::GetTime(), isoValue );
+        if(window)
+            glfwSetWindowTitle(window, title);
 
         frameCount = 0;
-        lastFpsCountFrame = glfwGetTime();
+        lastFpsCountFrame = GLContext::GetTime();
     }
 }
 // renderCube() renders a 1x1 3D cube in NDC.
@@ -912,6 +1188,19 @@ void processInput(GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
         isoValue -= deltaTime;
 
+    static bool tPressed = false;
+    bool t = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    if (t && !tPressed)
+        chunked = !chunked;
+    tPressed = t;
+
+    // sculpt where the view meets the ground while held, E adds and Q carves
+    bool add = glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS;
+    bool carve = glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS;
+    glm::vec3 hit;
+    if (chunked && (add || carve) && terrain->Raycast(camera.Position, camera.Front, 50.0f, hit))
+        terrain->Sculpt(hit, BRUSH_RADIUS, add);
+
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -984,10 +1273,9 @@ GLFWwindow* initGL(int w, int h)
     }
     glfwMakeContextCurrent(window);
 
-    // Initialize GLEW
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
+    // glad: load all OpenGL function pointers
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        fprintf(stderr, "Failed to initialize GLAD\n");
         getchar();
         glfwTerminate();
         EXIT_FAILURE;
@@ -1005,7 +1293,7 @@ GLFWwindow* initGL(int w, int h)
     glGetIntegerv(GL_MAX_DRAW_BUFFERS, &nrAttributes);
     std::cout << "Maximum nr of color attachments supported: " << nrAttributes << std::endl;
     GLint temp;
-    glGetIntegerv(GL_MAX_GEOMETRY_OUTPUT_VERTICES_EXT,&temp);
+    glGetIntegerv(GL_MAX_GEOMETRY_OUTPUT_VERTICES,&temp);
     std::cout<<"Max GS output vertices:"<<temp<<"\n";
 
     // Mouse input mode
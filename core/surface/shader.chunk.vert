@@ -0,0 +1,21 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+// a terrain chunk meshed on the cpu, named like the geometry shader output for shader.bp.frag
+out GS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec3 Color;
+} vs_out;
+
+uniform mat4 projectionMatrix;
+uniform mat4 model; // unit cube to the chunk, uniform scale
+
+void main()
+{
+    vs_out.FragPos = vec3(model*vec4(aPos, 1.0));
+    vs_out.Normal = aNormal;
+    vs_out.Color = vec3(0.7);
+    gl_Position = projectionMatrix*vec4(vs_out.FragPos, 1.0);
+}
@@ -30,10 +30,13 @@ ivec3 fetch3D(int ind, ivec3 gridSize) {
 uniform ivec3 gridSize;
 uniform vec3 voxelSize;
 uniform mat4 model;
+// the block of cells drawn, the bricks that can hold the surface
+uniform ivec3 drawOrigin;
+uniform ivec3 drawSize;
 
 void main()
 {
-    vs_out.gridPos = fetch3D(gl_InstanceID, gridSize);
+    vs_out.gridPos = drawOrigin + fetch3D(gl_InstanceID, drawSize);
 
     gl_Position = model*vec4(vs_out.gridPos*voxelSize, 1.0);
 }
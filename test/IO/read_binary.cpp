@@ -1,6 +1,11 @@
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
 #include "cmake_source_dir.h"
+#include "vtkfile.h"
 
 template <typename T>
 void SwapEnd(T& var)
@@ -10,67 +15,108 @@ void SwapEnd(T& var)
     std::swap(varArray[sizeof(var) - 1 - i],varArray[i]);
 }
 
-int main()
+template<typename F>
+static double timeMs(F f)
 {
-    std::ifstream is (FP("test.bin.vtk"), std::ifstream::binary);
-    if (is) {
-      // get length of file:
-      is.seekg (0, is.end);
-      int length = is.tellg();
-      is.seekg (0, is.beg);
-
-      char * buffer = new char [length];
-
-      //std::cout << "Reading " << length << " characters... ";
-      // read data as a block:
-      //is.read (buffer,length);
-
-      //vtkstream<<"# vtk DataFile Version 2.0"<<"\n";
-      //vtkstream<<"Exemple"<<"\n";
-      //vtkstream<<"BINARY"<<"\n";
-      //vtkstream<<"DATASET STRUCTURED_GRID"<<std::endl;
-      //vtkstream<<"DIMENSIONS 6 4 1"<<std::endl;
-      //vtkstream<<"POINTS 24 double"<<std::endl;
-
-      char header[255];
-      is.getline(header,255);
-      std::cout << header << std::endl;
-
-      is.getline(header,255);
-      std::cout << header << std::endl;
-
-      is.getline(header,255);
-      std::cout << header << std::endl;
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
 
-      is.getline(header,255);
-      std::cout << header << std::endl;
+// the element by element reader this test used to be: getline for the header, then
+// is.read and SwapEnd per value
+static bool readStream(const char* path, std::vector<float>& out)
+{
+    std::ifstream is (path, std::ifstream::binary);
+    if(!is) return false;
+    char header[255];
+    size_t n = 0;
+    while(is.getline(header,255))
+    {
+        char key[80]; char name[80]; char ftype[80];
+        if(sscanf(header, "%79s %79s %79s", key, name, ftype) == 3 && !strcmp(key, "SCALARS"))
+        {
+            is.getline(header,255); // LOOKUP_TABLE
+            break;
+        }
+        if(sscanf(header, "%79s", key) == 1 && !strcmp(key, "POINT_DATA"))
+            sscanf(header, "%79s %zu", key, &n);
+    }
+    out.resize(n);
+    for(size_t i = 0; i < n; ++i)
+    {
+        is.read(reinterpret_cast<char*>(&out[i]), sizeof(float));
+        SwapEnd(out[i]);
+    }
+    return bool(is);
+}
 
-      is.getline(header,255);
-      char ss[80];int nx,ny,nz;
-      sscanf(header, "%s %d %d %d", ss, &nx, &ny, &nz);
-      std::cout << ss << " " << nx  << " " << ny << " " << nz << std::endl;
+// n^3 float scalars, written big endian in one block
+static void writeBenchFile(const char* path, int n)
+{
+    std::ofstream os(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    os << "# vtk DataFile Version 2.0\nbench\nBINARY\nDATASET STRUCTURED_POINTS\n";
+    os << "DIMENSIONS " << n << " " << n << " " << n << "\nORIGIN 0 0 0\nSPACING 1 1 1\n";
+    os << "POINT_DATA " << size_t(n)*n*n << "\nSCALARS density float 1\nLOOKUP_TABLE default\n";
+    std::vector<float> slice(size_t(n)*n);
+    for(int k = 0; k < n; k++)
+    {
+        for(size_t i = 0; i < slice.size(); i++)
+        {
+            slice[i] = float(k) + 0.001f*float(i);
+            SwapEnd(slice[i]);
+        }
+        os.write((const char*)slice.data(), slice.size()*sizeof(float));
+    }
+}
 
-      is.getline(header,255);
-      char ft[80];char ftype[80];int nelem;
-      sscanf(header, "%s %d %s", ft, &nelem, ftype);
-      std::cout << ft << " " << nelem << " " << ftype << std::endl;
+// the stream reader against the mapped one, the file in the page cache for both
+static int bench(int n, const char* path)
+{
+    writeBenchFile(path, n);
+    std::vector<float> a, b;
+    const double streamMs = timeMs([&]() { readStream(path, a); });
 
-      double myarray[72];
-      for (unsigned int i = 0; i < 72; ++i) {
-        is.read(reinterpret_cast<char*>(&myarray[i]), sizeof(double));
-        SwapEnd(myarray[i]);
-        std::cout << myarray[i] << std::endl;
-      }
+    VtkFile file;
+    double openMs = 0.0, readMs = 0.0, getMs = 0.0;
+    openMs = timeMs([&]() { file.Open(path); });
+    const VtkFile::Array* density = file.Find("density");
+    if(!density)
+        return 1;
+    b.resize(density->Size());
+    readMs = timeMs([&]() { density->Read(b.data()); });
+    double sum = 0.0;
+    getMs = timeMs([&]() {
+        for(size_t i = 0; i < density->Size(); i += 64)
+            sum += density->Get<float>(i);
+    });
 
-      if (is)
-        std::cout << "all characters read successfully.";
-      else
-        std::cout << "error: only " << is.gcount() << " could be read";
-      is.close();
+    const double gb = density->Bytes()/1e9;
+    printf("vtk read %d^3 floats (%.2f GB)\n", n, gb);
+    printf("  stream + SwapEnd per value  %8.1f ms %6.2f GB/s\n", streamMs, gb/(streamMs*1e-3));
+    printf("  mapped, Open               %8.3f ms\n", openMs);
+    printf("  mapped, Read<float>        %8.1f ms %6.2f GB/s\n", readMs, gb/(readMs*1e-3));
+    printf("  mapped, Get<float> 1 in 64 %8.1f ms (sum %g)\n", getMs, sum);
+    printf("  same values: %s\n", a == b ? "yes" : "NO");
+    return a == b ? 0 : 1;
+}
 
-      // ...buffer contains the entire file...
+int main(int argc, char **argv)
+{
+    if(argc >= 2 && !strcmp(argv[1], "--bench"))
+        return bench(argc >= 3 ? atoi(argv[2]) : 256, argc >= 4 ? argv[3] : "bench.vtk");
 
-      delete[] buffer;
+    VtkFile file;
+    if(!file.Open(FP("test.bin.vtk")))
+        return 1;
+    std::cout << file.title << std::endl;
+    std::cout << file.dataset << " " << file.dimensions.x << " " << file.dimensions.y << " " << file.dimensions.z << std::endl;
+    for(const VtkFile::Array& a : file.arrays)
+    {
+        std::cout << a.keyword << " " << a.name << " " << a.tuples << "x" << a.components << " "
+                  << VtkIO::TypeName(a.type) << std::endl;
+        for(size_t i = 0; i < a.Size(); ++i)
+            std::cout << a.Get<double>(i) << std::endl;
     }
     return 0;
 }
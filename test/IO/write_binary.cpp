@@ -1,6 +1,11 @@
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
 #include "cmake_source_dir.h"
+#include "vtkfile.h"
 
 // Thanks to https://stackoverflow.com/questions/105252
 template <typename T>
@@ -18,22 +23,96 @@ double myarray[72] = {
   3,2,0,4,2,0,5,2,0,0,3,0,1,3,0,
   2,3,0,3,3,0,4,3,0,5,3,0};
 
-int main()
+template<typename F>
+static double timeMs(F f)
 {
-  std::ofstream vtkstream;
-  vtkstream.open(FP("test.bin.vtk"), std::ios::out | std::ios::app | std::ios::binary);
-  if (vtkstream) {
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// the element by element writer this test used to be: SwapEnd and ostream::write per value
+static void writeStream(const char* path, int n, const std::vector<double>& field)
+{
+    std::ofstream vtkstream(path, std::ios::out | std::ios::trunc | std::ios::binary);
     vtkstream<<"# vtk DataFile Version 2.0"<<"\n";
-    vtkstream<<"Exemple"<<"\n";
+    vtkstream<<"bench"<<"\n";
     vtkstream<<"BINARY"<<"\n";
-    vtkstream<<"DATASET STRUCTURED_GRID"<<std::endl;
-    vtkstream<<"DIMENSIONS 6 4 1"<<std::endl;
-    vtkstream<<"POINTS 24 double"<<std::endl;
-    for (unsigned int i = 0; i < 72; ++i) {
-      SwapEnd(myarray[i]);
-      vtkstream.write((char*)&myarray[i], sizeof(double));
+    vtkstream<<"DATASET STRUCTURED_POINTS"<<std::endl;
+    vtkstream<<"DIMENSIONS "<<n<<" "<<n<<" "<<n<<std::endl;
+    vtkstream<<"ORIGIN 0 0 0"<<std::endl;
+    vtkstream<<"SPACING 1 1 1"<<std::endl;
+    vtkstream<<"POINT_DATA "<<field.size()<<std::endl;
+    vtkstream<<"SCALARS density double 1"<<std::endl;
+    vtkstream<<"LOOKUP_TABLE default"<<std::endl;
+    for (size_t i = 0; i < field.size(); ++i) {
+      double v = field[i];
+      SwapEnd(v);
+      vtkstream.write((char*)&v, sizeof(double));
+    }
+}
+
+static bool writeVtk(const char* path, int n, const std::vector<double>& field, int threads)
+{
+    VtkWriter writer(threads);
+    if(!writer.Open(path, "bench"))
+        return false;
+    writer.StructuredPoints(glm::ivec3(n));
+    const int density = writer.AddScalars("density", VtkIO::FLOAT64);
+    writer.Write(density, field.data());
+    return writer.Close();
+}
+
+static bool same(const char* path, const std::vector<double>& field)
+{
+    VtkFile file;
+    if(!file.Open(path)) return false;
+    const VtkFile::Array* density = file.Find("density");
+    if(!density || density->Size() != field.size()) return false;
+    std::vector<double> back(field.size());
+    density->Read(back.data());
+    return back == field;
+}
+
+// n^3 doubles written per value against the writer on 1 and all threads; the files land in
+// the page cache, the rates are the writers' rather than the disk's
+static int bench(int n, const char* path)
+{
+    std::vector<double> field(size_t(n)*n*n);
+    for(size_t i = 0; i < field.size(); i++)
+        field[i] = 0.001*double(i);
+    const double gb = field.size()*sizeof(double)/1e9;
+    printf("vtk write %d^3 doubles (%.2f GB)\n", n, gb);
+
+    const double streamMs = timeMs([&]() { writeStream(path, n, field); });
+    const bool streamOk = same(path, field);
+    printf("  ostream + SwapEnd per value %8.1f ms %6.2f GB/s %s\n", streamMs, gb/(streamMs*1e-3), streamOk ? "" : "(MISMATCH)");
+    bool ok = streamOk;
+    const int threads[] = { 1, 0 };
+    for(int t : threads)
+    {
+        bool written = false;
+        const double ms = timeMs([&]() { written = writeVtk(path, n, field, t); });
+        const bool readBack = written && same(path, field);
+        ok = ok && readBack;
+        printf("  VtkWriter, %-16s %8.1f ms %6.2f GB/s %s\n", t ? "1 thread" : "all threads",
+               ms, gb/(ms*1e-3), readBack ? "" : "(MISMATCH)");
     }
-    vtkstream.close();
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  if(argc >= 2 && !strcmp(argv[1], "--bench"))
+    return bench(argc >= 3 ? atoi(argv[2]) : 256, argc >= 4 ? argv[3] : "bench.vtk");
+
+  VtkWriter writer(1);
+  if (writer.Open(FP("test.bin.vtk"), "Exemple")) {
+    writer.StructuredGrid(glm::ivec3(6, 4, 1));
+    const int points = writer.AddPoints(VtkIO::FLOAT64);
+    writer.Write(points, myarray);
+    if (!writer.Close())
+      std::cout<<"ERROR"<<std::endl;
   } else {
     std::cout<<"ERROR"<<std::endl;
   }
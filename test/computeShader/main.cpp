@@ -1,9 +1,13 @@
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <cfloat>
+#include <cstdio>
 
-//GLEW
-#define GLEW_STATIC
-#include <GL/glew.h>
+#include <glad/glad.h>
 
 //GLFW
 #include <GLFW/glfw3.h>
@@ -17,6 +21,11 @@
 #include "colormap.h"
 #include "filesystemmonitor.h"
 #include "isosurface.h"
+#include "volumerender.h"
+#include "slice.h"
+#include "brickvolume.h"
+#include "vtkfile.h"
+#include "glcontext.h"
 
 // settings
 static int SCR_WIDTH  = 800;
@@ -51,7 +60,7 @@ void renderCube();
 
 // Display texture
 static int selectTexture = 0;
-static int renderType = 0;
+static int renderType = 0; // isosurface, volume, volume at half resolution, --bricks, its slices
 static float slidebar = 0.02f;
 
 // simulation related parameter
@@ -63,15 +72,217 @@ static Shader fluid3DInitShader;
 static Shader fluid3DComputeShader;
 static Shader postProcessShader;
 
-int main()
+// a volume larger than memory, streamed in
+static std::unique_ptr<BrickVolume> bricked;
+
+template<typename F>
+static double timeMs(int runs, F f)
+{
+    f();
+    auto begin = std::chrono::steady_clock::now();
+    for(int r = 0; r < runs; r++)
+        f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / runs;
+}
+
+// ray marching a shell of density on R8 volumes, each optimisation added to the ones
+// before it, timed with glFinish
+static void volumeBench()
+{
+    Camera view(glm::vec3(0.5f, 0.5f, 1.8f), (float)SCR_WIDTH/SCR_HEIGHT);
+    VolumeRender::Transfer transfer;
+    transfer.lo = 0.1f;
+    transfer.density = 60.0f;
+    transfer.channel = 0;
+    transfer.colormap = Colormap::ID();
+    Colormap::Bind(transfer.colormap);
+
+    const int sizes[] = { 128, 512 };
+    for(int n : sizes)
+    {
+        std::vector<unsigned char> field(size_t(n)*n*n);
+        for(int k=0; k<n; k++)
+            for(int j=0; j<n; j++)
+                for(int i=0; i<n; i++)
+                {
+                    const float r = glm::distance((glm::vec3(i, j, k) + 0.5f)/float(n), glm::vec3(0.5f));
+                    const float f = 1.0f - std::abs(r - 0.3f)/0.08f;
+                    field[i+j*size_t(n)+k*size_t(n)*n] = (unsigned char)(255.0f*glm::clamp(f, 0.0f, 1.0f));
+                }
+        unsigned int tex;
+        glGenTextures(1, &tex);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, tex);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, n, n, n, 0, GL_RED, GL_UNSIGNED_BYTE, field.data());
+        const glm::ivec3 size(n);
+        VolumeRender::BuildBricks(0, size, transfer.channel);
+
+        VolumeRender::Quality quality;
+        quality.opacityCutoff = 1.0f;
+        quality.skipEmpty = false;
+        quality.adaptiveStep = false;
+        const char* names[] = { "baseline", "+ early termination", "+ empty bricks", "+ adaptive step", "+ half resolution" };
+        double baseMs = 0.0;
+        for(int step = 0; step < 5; step++)
+        {
+            if(step == 1) quality.opacityCutoff = 0.98f;
+            if(step == 2) quality.skipEmpty = true;
+            if(step == 3) quality.adaptiveStep = true;
+            if(step == 4) quality.downsample = 2;
+            const int runs = 10;
+            double ms = timeMs(runs, [&]() {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                VolumeRender::Draw(0, size, transfer, quality, view);
+                glFinish();
+            });
+            if(step == 0) baseMs = ms;
+            printf("volume %d^3 %dx%d: %-20s %.2f ms (%.1fx)\n", n, SCR_WIDTH, SCR_HEIGHT, names[step], ms, baseMs/ms);
+        }
+        glDeleteTextures(1, &tex);
+    }
+}
+
+// nested shells around the centre, empty in the corners
+static unsigned char shells(int i, int j, int k, int n)
+{
+    const float r = glm::distance((glm::vec3(i, j, k) + 0.5f)/float(n), glm::vec3(0.5f));
+    if(r > 0.5f) return 0;
+    const float f = 1.0f - std::abs(r*5.0f - std::floor(r*5.0f) - 0.5f)/0.08f;
+    return (unsigned char)(255.0f*glm::clamp(f, 0.0f, 1.0f));
+}
+
+// n^3 shells built into a brick file, then streamed through a cache of a fraction of the
+// bricks and a smaller atlas while the camera flies into them, then a slice sweeps through
+static void brickBench(int n)
+{
+    const char* path = "bench.bricks";
+    auto begin = std::chrono::steady_clock::now();
+    BrickVolume::Build(path, glm::ivec3(n), VtkIO::UINT8, [n](int k, void* slice) {
+        unsigned char* v = (unsigned char*)slice;
+        for(int j = 0; j < n; j++)
+            for(int i = 0; i < n; i++)
+                v[i + j*size_t(n)] = shells(i, j, k, n);
+    });
+    const double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    printf("bricks %d^3: built in %.0f ms, %.0f MB/s of field\n", n, buildMs, double(n)*n*n/1e6/(buildMs*1e-3));
+
+    BrickVolume volume(size_t(64) << 20, glm::ivec3(8, 8, 4));
+    if(!volume.Open(path))
+        return;
+    Camera view(glm::vec3(0.5f, 0.5f, 2.5f), (float)SCR_WIDTH/SCR_HEIGHT);
+    VolumeRender::Transfer transfer;
+    transfer.lo = 0.1f;
+    transfer.density = 60.0f;
+    transfer.colormap = Colormap::ID();
+    Colormap::Bind(transfer.colormap);
+    VolumeRender::Quality quality;
+    quality.downsample = 2;
+    auto report = [&volume](int frame, float z, double ms) {
+        printf("  frame %3d z %.2f: wanted %zu, cached %zu, in the atlas %zu, reading %zu, uploaded %zu, read %.0f MB, %.1f ms\n",
+               frame, z, volume.WANTED, volume.CPU_BRICKS, volume.GPU_BRICKS, volume.PENDING,
+               volume.UPLOADED, volume.READ_MB, ms);
+    };
+    const int frames = 40;
+    for(int frame = 0; frame < frames; frame++)
+    {
+        view.Position.z = 2.5f - 2.2f*frame/(frames - 1);
+        begin = std::chrono::steady_clock::now();
+        volume.Update(view, glm::mat4(1), transfer.lo, FLT_MAX);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        VolumeRender::Draw(volume, transfer, quality, view);
+        glFinish();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        if(frame % 5 == 0 || frame == frames - 1)
+            report(frame, view.Position.z, ms);
+    }
+
+    // a z plane swept through from the front, no value range: its bricks alone are wanted
+    printf("  slice sweep, z is the plane's\n");
+    Slice::Colors colors;
+    colors.colormap = Colormap::ID();
+    view.Position.z = 2.5f;
+    const int sweep = 20;
+    for(int frame = 0; frame < sweep; frame++)
+    {
+        const float z = 1.0f - frame/(sweep - 1.0f);
+        const std::vector<Slice::Plane> planes(1, Slice::Plane{ glm::vec3(0, 0, 1), z - 0.5f });
+        begin = std::chrono::steady_clock::now();
+        volume.Update(view, glm::mat4(1), FLT_MAX, FLT_MAX, planes);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        Slice::Draw(volume, planes, view, colors);
+        glFinish();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        if(frame % 5 == 0 || frame == sweep - 1)
+            report(frame, z, ms);
+    }
+    volume.Close();
+    std::remove(path);
+}
+
+// a .bricks file, or a .vtk one built into path.bricks first from its first scalars
+static bool openBricks(std::string path)
+{
+    if(path.size() > 4 && path.compare(path.size() - 4, 4, ".vtk") == 0)
+    {
+        VtkFile file;
+        if(!file.Open(path))
+            return false;
+        const VtkFile::Array* scalars = nullptr;
+        for(const VtkFile::Array& a : file.arrays)
+            if(!scalars && a.keyword == "SCALARS")
+                scalars = &a;
+        if(!scalars || !BrickVolume::Build(path + ".bricks", file, *scalars))
+            return false;
+        path += ".bricks";
+    }
+    bricked.reset(new BrickVolume());
+    if(bricked->Open(path))
+        return true;
+    bricked.reset();
+    return false;
+}
+
+int main(int argc, char **argv)
 {
 #if defined(__linux__)
     setenv ("DISPLAY", ":0", 0);
 #endif
 
-    // Initialize a window
-    GLFWwindow* window = initGL(SCR_WIDTH, SCR_HEIGHT);
-    printf("Initial glwindow...\n");
+    bool bench = false;
+    int brickBenchSize = 0;
+    const char* bricksPath = nullptr;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--volume-bench"))
+            bench = true;
+        if(!strcmp(argv[i], "--brick-bench"))
+            brickBenchSize = i + 1 < argc && atoi(argv[i + 1]) > 0 ? atoi(argv[++i]) : 512;
+        if(!strcmp(argv[i], "--bricks") && i + 1 < argc)
+            bricksPath = argv[++i];
+    }
+
+    // Initialize a window, or an offscreen context (--headless N renders N frames and exits)
+    GLContext::Options context = GLContext::ParseArgs(argc, argv);
+    GLFWwindow* window = nullptr;
+    if(context.backend == GLContext::WINDOWED)
+    {
+        window = initGL(SCR_WIDTH, SCR_HEIGHT);
+        GLContext::Attach(window);
+        printf("Initial glwindow...\n");
+    }
+    else
+    {
+        if(context.frames == 0)
+            context.frames = 1;
+        if(!GLContext::InitHeadless(SCR_WIDTH, SCR_HEIGHT, context, 4, 3))
+            return 1;
+    }
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
@@ -79,8 +290,8 @@ int main()
     // Read shader
     fluid3DInitShader.reload_shader_program_from_files(FP("init3d.compute.glsl"));
    
-    // For auto-reloading
-    FileSystemMonitor::Init(SRC_PATH);
+    // For auto-reloading (the monitor is stubbed out in utility, key I reloads instead)
+    //FileSystemMonitor::Init(SRC_PATH);
 
     // Gen colormap
     Colormap::Viridis();
@@ -88,6 +299,19 @@ int main()
     // Isosurface
     IsoSurface::Init();
     //IsoSurface::Demo(nx,ny,nz);
+    VolumeRender::Init();
+    Slice::Init();
+    if(bench || brickBenchSize)
+    {
+        if(bench)
+            volumeBench();
+        if(brickBenchSize)
+            brickBench(brickBenchSize);
+        GLContext::Terminate();
+        return 0;
+    }
+    if(bricksPath && openBricks(bricksPath))
+        renderType = 3;
 
     // configure g-buffer framebuffer
     // ------------------------------
@@ -150,7 +374,7 @@ int main()
             }
     glUnmapBuffer( GL_SHADER_STORAGE_BUFFER );
 
-    while( !glfwWindowShouldClose( window ) )
+    while( !GLContext::ShouldClose() )
     {
         // per-frame time logic
         // --------------------
@@ -158,15 +382,16 @@ int main()
 
         // input
         // -----
-        glfwGetFramebufferSize(window, &SCR_WIDTH, &SCR_HEIGHT);
-        processInput(window);
+        GLContext::GetFramebufferSize(&SCR_WIDTH, &SCR_HEIGHT);
+        if(window)
+            processInput(window);
 
+        if(initFluid)
         { // launch compute shaders
-          if(FileSystemMonitor::Update()) IsoSurface::ReloadShader();
           fluid3DInitShader.use();
           fluid3DInitShader.setInt("img_output", 0);
           fluid3DInitShader.setVec3i("gridSize", glm::ivec3(nx, ny, nz));
-          fluid3DInitShader.setFloat("time", glfwGetTime());
+          fluid3DInitShader.setFloat("time", float(GLContext::GetTime()));
           glBindImageTexture(0, _demoVolumeTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
           glBindBufferBase(GL_SHADER_STORAGE_BUFFER,1,fBuf);
           glDispatchCompute(nx,ny,nz);
@@ -174,6 +399,13 @@ int main()
           // make sure writing to image has finished before read
           glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
           glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+          // brick ranges of the new volume, scrubbing the iso value only culls them again
+          glActiveTexture(GL_TEXTURE0);
+          glBindTexture(GL_TEXTURE_3D, _demoVolumeTex);
+          IsoSurface::BuildBricks(0, glm::ivec3(nx, ny, nz));
+          VolumeRender::BuildBricks(0, glm::ivec3(nx, ny, nz));
+          initFluid = false;
         }
 
         {
@@ -184,49 +416,89 @@ int main()
             //Colormap::Bind();
             //Lattice3DOpenGLInterface::BindTexRead();
             //renderQuad();
-            IsoSurface::Draw(0, slidebar+1.0f,
-                             camera,
-                             glm::ivec3(nx,ny,nz));
+            if(renderType == 0)
+                IsoSurface::Draw(0, slidebar+1.0f,
+                                 camera,
+                                 glm::ivec3(nx,ny,nz));
+            else
+            {
+                // what lies past the iso level, denser further out
+                VolumeRender::Transfer transfer;
+                transfer.lo = slidebar+1.0f;
+                transfer.hi = transfer.lo+2.0f;
+                transfer.density = 8.0f;
+                transfer.colormap = Colormap::ID();
+                VolumeRender::Quality quality;
+                quality.downsample = renderType;
+                Colormap::Bind(transfer.colormap);
+                if(renderType == 3)
+                {
+                    // streamed values above the slide bar
+                    transfer.lo = glm::clamp(slidebar, 0.0f, 1.0f);
+                    transfer.hi = transfer.lo+0.5f;
+                    quality.downsample = 1;
+                    bricked->Update(camera, glm::mat4(1), transfer.lo, FLT_MAX);
+                    VolumeRender::Draw(*bricked, transfer, quality, camera);
+                }
+                else if(renderType == 4)
+                {
+                    // x and y planes through the middle, the z plane at the slide bar; their
+                    // bricks are streamed ahead of the values above it
+                    const float lo = glm::clamp(slidebar, 0.0f, 1.0f);
+                    const std::vector<Slice::Plane> planes = { Slice::Plane{ glm::vec3(1, 0, 0), 0.0f },
+                                                               Slice::Plane{ glm::vec3(0, 1, 0), 0.0f },
+                                                               Slice::Plane{ glm::vec3(0, 0, 1), lo - 0.5f } };
+                    Slice::Colors colors;
+                    colors.colormap = transfer.colormap;
+                    bricked->Update(camera, glm::mat4(1), lo, FLT_MAX, planes);
+                    Slice::Draw(*bricked, planes, camera, colors);
+                }
+                else
+                    VolumeRender::Draw(0, glm::ivec3(nx,ny,nz), transfer, quality, camera);
+            }
         }
 
         //if(Lattice3DOpenGLInterface::GetTimestep() == 15000) Lattice3DOpenGLInterface::DumpAll();
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        GLContext::SwapBuffers();
     }
 
-    glfwTerminate( );
+    bricked.reset();
+    VolumeRender::Finalize();
+    GLContext::Terminate();
 
     return 0;
 }
 
 void countAndDisplayFps(GLFWwindow* window)
 {
-    float currentFrame = glfwGetTime();
+    float currentFrame = GLContext::GetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
     frameCount++;
-    if(glfwGetTime() - lastFpsCountFrame > 1.0f)
+    if(GLContext::GetTime() - lastFpsCountFrame > 1.0f)
     {
         /*std::cout << "Current fps: "
-                  << frameCount/(glfwGetTime() - lastFpsCountFrame)
+                  << frameCount/(GLContext::GetTime() - lastFpsCountFrame)
                   << " runtime:"
-                  << glfwGetTime()
+                  << GLContext::GetTime()
                   << std::endl;*/ // deprecated
 
         char title [256];
         title [255] = '\0';
 
         snprintf ( title, 255,
-                   "FAST+ARB DEMO - FPS: %4.2f | runtime: %.0fs ",
-                   frameCount/(glfwGetTime() - lastFpsCountFrame), glfwGetTime() );
-        glfwSetWindowTitle(window, title);
+                   "FAST+ARB DEMO - FPS: %4.2f | runtime: %.0fs | isoLevel: %.2f | active bricks: %.1f%%",
+                   frameCount/(GLContext::GetTime() - lastFpsCountFrame), GLContext::GetTime(),
+                   slidebar+1.0f, 100.0f*IsoSurface::ACTIVE_BRICKS );
+        if(window)
+            glfwSetWindowTitle(window, title);
 
         frameCount = 0;
-        lastFpsCountFrame = glfwGetTime();
+        lastFpsCountFrame = GLContext::GetTime();
     }
 }
 
@@ -365,7 +637,7 @@ void processInput(GLFWwindow *window)
     key_1_old_state = glfwGetKey(window, GLFW_KEY_1);
     if ((glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS) && (key_2_old_state == GLFW_RELEASE))
     {
-        renderType = (++renderType)%3;
+        renderType = (++renderType)%(bricked ? 5 : 3);
         std::cout << "Select render mode " << renderType << std::endl;
     }
     key_2_old_state = glfwGetKey(window, GLFW_KEY_2);
@@ -381,6 +653,9 @@ void processInput(GLFWwindow *window)
         slidebar -= deltaTime;
 
     if ( (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS) && (key_i_old_state == GLFW_RELEASE) ) {
+         IsoSurface::ReloadShader();
+         VolumeRender::ReloadShader();
+         Slice::ReloadShader();
          std::cout << "Shader reloaded." << std::endl;
     }
     key_i_old_state = glfwGetKey(window, GLFW_KEY_I);
@@ -457,10 +732,9 @@ GLFWwindow* initGL(int w, int h)
     }
     glfwMakeContextCurrent(window);
     
-    // Initialize GLEW
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
+    // glad: load all OpenGL function pointers
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        fprintf(stderr, "Failed to initialize GLAD\n");
         getchar();
         glfwTerminate();
         EXIT_FAILURE;
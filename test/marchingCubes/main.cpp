@@ -1,10 +1,10 @@
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <cstring>
+#include <chrono>
 
-//GLEW
-#define GLEW_STATIC
-#include <GL/glew.h>
+#include <glad/glad.h>
 
 //GLFW
 #include <GLFW/glfw3.h>
@@ -14,6 +14,10 @@
 
 #include "shader.h"
 #include "camera.h"
+#include "glcontext.h"
+#include "isosurface.h"
+#include "slice.h"
+#include "colormap.h"
 
 #include "cmake_source_dir.h"
 
@@ -611,6 +615,8 @@ Shader MCShader;
 glm::ivec3 gridSize(64);
 glm::vec3 voxelSize(glm::vec3(4.0f/gridSize.z));
 float isoValue = 1.0f;
+enum MeshMode { CPU_MESH, GPU_MESH, GS_MESH };
+int meshMode = CPU_MESH; // M cycles through the three paths
 
 // an interesting field function
 float torus(float x, float y, float z)
@@ -633,21 +639,177 @@ float surf_of_evolution(float x, float z, float y)
     return (x*x + y*y - (log(z+3.2)*log(z+3.2))-0.02 + 1.0);
 }
 
+// average ms of runs calls of f, after one to warm up
+template<typename F>
+static double timeMs(int runs, F f)
+{
+    f();
+    auto begin = std::chrono::steady_clock::now();
+    for(int r = 0; r < runs; r++)
+        f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / runs;
+}
+
+// mesher throughput on the tangle and torus fields, with and without skipping empty
+// bricks; 512^3 is CPU only. The GPU mesher is timed with glFinish and its vertices
+// compared with the CPU mesh expanded through its indices
+static void meshBench()
+{
+    struct Case { const char* name; float (*f)(float, float, float); int n; };
+    const Case cases[] = { {"tangle", tangle, 128}, {"tangle", tangle, 256}, {"tangle", tangle, 512},
+                           {"torus", torus, 128}, {"torus", torus, 256} };
+    for(const Case& test : cases)
+    {
+        const int n = test.n;
+        const glm::ivec3 size(n);
+        std::vector<float> field(size_t(n)*n*n);
+        for(int k=0; k<n; k++)
+            for(int j=0; j<n; j++)
+                for(int i=0; i<n; i++)
+                    field[i+j*size_t(n)+k*size_t(n)*n] = test.f(2*i/(float)n-1,2*j/(float)n-1,2*k/(float)n-1);
+
+        const int runs = n > 256 ? 1 : 5;
+        IsoSurface::Mesh mesh, culled;
+        IsoSurface::MinMaxTree bricks;
+        double buildMs = timeMs(runs, [&]() { bricks.Build(field.data(), size); });
+        double ms = timeMs(runs, [&]() { IsoSurface::Polygonise(field.data(), size, isoValue, mesh); });
+        double culledMs = timeMs(runs, [&]() { IsoSurface::Polygonise(field.data(), size, isoValue, culled, 0, &bricks); });
+        printf("%s %d^3: cpu mesh %.2f ms (%.1f Mvoxels/s), %zu vertices, %zu triangles\n",
+               test.name, n, ms, double(n)*n*n / ms * 1e-3, mesh.vertices.size(), mesh.indices.size()/3);
+        printf("%s %d^3: %.1f%% bricks active, built in %.2f ms, cpu mesh %.2f ms (%.2fx)%s\n",
+               test.name, n, 100.0f*IsoSurface::ACTIVE_BRICKS, buildMs, culledMs, ms / culledMs,
+               culled.indices.size() == mesh.indices.size() ? "" : ", triangle count differs");
+
+        if(!IsoSurface::ComputeSupported() || n > 256) continue;
+        unsigned int tex;
+        glGenTextures(1, &tex);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, tex);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, n, n, n, 0, GL_RED, GL_FLOAT, field.data());
+
+        IsoSurface::Mesh soup;
+        IsoSurface::PolygoniseGPU(0, size, isoValue);
+        IsoSurface::ReadGPUMesh(soup); // sizes the buffers
+        ms = timeMs(runs, [&]() { IsoSurface::PolygoniseGPU(0, size, isoValue); glFinish(); });
+        IsoSurface::ReadGPUMesh(soup);
+
+        float dp = 0, dn = 0;
+        bool same = soup.vertices.size() == mesh.indices.size();
+        for(size_t v = 0; same && v < soup.vertices.size(); v++)
+        {
+            const IsoSurface::Vertex& a = mesh.vertices[mesh.indices[v]];
+            dp = std::max(dp, glm::length(a.position - soup.vertices[v].position));
+            dn = std::max(dn, glm::length(a.normal - soup.vertices[v].normal));
+        }
+        printf("%s %d^3: gpu mesh %.2f ms (%.1f Mvoxels/s), %zu triangles, %s (max |dp| %g, |dn| %g)\n",
+               test.name, n, ms, double(n)*n*n / ms * 1e-3, soup.vertices.size()/3,
+               same ? "matches cpu" : "triangle count differs from cpu", dp, dn);
+        glDeleteTextures(1, &tex);
+    }
+}
+
+// slicing a volume of n^3 voxels: a quad per voxel through sl.geom.glsl against a quad per
+// plane sampled in the fragment shader, for one plane and for Slice::MAX_PLANES at once
+static void sliceBench()
+{
+    Slice::Init();
+    Colormap::Viridis();
+    Colormap::Bind(Colormap::ID());
+    Camera view(glm::vec3(0.5f, 0.5f, 1.8f), (float)SCR_WIDTH/SCR_HEIGHT);
+    const int sizes[] = { 128, 512 };
+    for(int n : sizes)
+    {
+        std::vector<unsigned char> field(size_t(n)*n*n);
+        for(int k=0; k<n; k++)
+            for(int j=0; j<n; j++)
+                for(int i=0; i<n; i++)
+                {
+                    const float f = tangle(2*i/(float)n-1,2*j/(float)n-1,2*k/(float)n-1);
+                    field[i+j*size_t(n)+k*size_t(n)*n] = (unsigned char)(255.0f*glm::clamp(f/4.0f, 0.0f, 1.0f));
+                }
+        unsigned int tex;
+        glGenTextures(1, &tex);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, tex);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, n, n, n, 0, GL_RED, GL_UNSIGNED_BYTE, field.data());
+
+        // z planes through the volume, then as many tilted about y
+        std::vector<Slice::Plane> planes;
+        for(int i = 0; i < Slice::MAX_PLANES; i++)
+        {
+            const float angle = i < Slice::MAX_PLANES/2 ? 0.0f : 0.6f;
+            planes.push_back(Slice::Plane{ glm::vec3(std::sin(angle), 0.0f, std::cos(angle)),
+                                           (i % (Slice::MAX_PLANES/2))*0.2f - 0.3f });
+        }
+        const glm::ivec3 size(n);
+        const int runs = 10;
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        double quadMs = timeMs(runs, [&]() { Slice::Draw(0, planes[0].offset + 0.5f, view, size); glFinish(); });
+        double pointMs = timeMs(runs, [&]() { Slice::DrawPoints(0, planes[0].offset + 0.5f, view, size); glFinish(); });
+        printf("slice %d^3: 1 plane %.2f ms, %.2f ms a quad per voxel (%.1fx)\n", n, quadMs, pointMs, pointMs/quadMs);
+        quadMs = timeMs(runs, [&]() { Slice::Draw(0, planes, view, size); glFinish(); });
+        pointMs = timeMs(runs, [&]() {
+            for(int i = 0; i < Slice::MAX_PLANES; i++)
+                Slice::DrawPoints(0, i*0.125f, view, size);
+            glFinish();
+        });
+        printf("slice %d^3: %d planes in one draw %.2f ms, %.2f ms a quad per voxel (z planes only, %.1fx)\n",
+               n, Slice::MAX_PLANES, quadMs, pointMs, pointMs/quadMs);
+        glDeleteTextures(1, &tex);
+    }
+}
+
 int main(int argc, char **argv)
 {
 #if defined(__linux__)
     setenv ("DISPLAY", ":0", 0);
 #endif
 
-    // Initialize a window
-    GLFWwindow* window = initGL(SCR_WIDTH, SCR_HEIGHT);
-    printf("Initial glwindow...\n");
+    bool bench = false, slices = false;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--mesh-bench"))
+            bench = true;
+        if(!strcmp(argv[i], "--slice-bench"))
+            slices = true;
+    }
+
+    // Initialize a window, or an offscreen context (--headless N renders N frames and exits)
+    GLContext::Options context = GLContext::ParseArgs(argc, argv);
+    GLFWwindow* window = nullptr;
+    if(context.backend == GLContext::WINDOWED)
+    {
+        window = initGL(SCR_WIDTH, SCR_HEIGHT);
+        GLContext::Attach(window);
+        printf("Initial glwindow...\n");
+    }
+    else
+    {
+        if(context.frames == 0)
+            context.frames = 1;
+        if(!GLContext::InitHeadless(SCR_WIDTH, SCR_HEIGHT, context))
+            return 1;
+    }
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
     //glEnable(GL_CULL_FACE); // Enable to decrease computing load
 
     MCShader.reload_shader_program_from_files(FP("shader.vert"),FP("shader.bp.frag"),FP("shader.geom.glsl"));
+    IsoSurface::Init();
+    if(bench || slices)
+    {
+        if(bench)
+            meshBench();
+        if(slices)
+            sliceBench();
+        GLContext::Terminate();
+        return 0;
+    }
 
     //Triangle Table texture//
     //This texture store the vertex index list forgridPos
@@ -711,14 +873,15 @@ int main(int argc, char **argv)
             }
     glTexImage3D( GL_TEXTURE_3D, 0, GL_R32F, gridSize.x, gridSize.y, gridSize.z, 0,
                   GL_RED, GL_FLOAT, dataField);
-    delete [] dataField;
-    dataField=NULL;
+    // the cpu mesher reads the field until exit, meshes again when isoValue changes
+    IsoSurface::SetField(dataField, gridSize);
+    float gpuIsoValue = -1;
 
     // Dummy VAO
     unsigned int  VAO;
     glGenVertexArrays(1, &VAO);
 
-    while( !glfwWindowShouldClose( window ) )
+    while( !GLContext::ShouldClose() )
     {
         // per-frame time logic
         // --------------------
@@ -726,12 +889,26 @@ int main(int argc, char **argv)
 
         // input
         // -----
-        glfwGetFramebufferSize(window, &SCR_WIDTH, &SCR_HEIGHT);
-        processInput(window);
+        GLContext::GetFramebufferSize(&SCR_WIDTH, &SCR_HEIGHT);
+        if(window)
+            processInput(window);
 
         // render
         glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, dataFieldTex);
+        if(meshMode == CPU_MESH)
+            IsoSurface::DrawMesh(0, isoValue, camera, glm::scale(glm::mat4(1.0f), glm::vec3(4.0f)));
+        else if(meshMode == GPU_MESH)
+        {
+            if(isoValue != gpuIsoValue)
+                IsoSurface::PolygoniseGPU(0, gridSize, isoValue);
+            gpuIsoValue = isoValue;
+            IsoSurface::DrawGPU(camera, glm::scale(glm::mat4(1.0f), glm::vec3(4.0f)));
+        }
+        else
+        {
         MCShader.use();
         MCShader.setMat4("projectionMatrix",camera.GetPerspectiveMatrix()*camera.GetViewMatrix() );
         MCShader.setVec3("viewPos",camera.Position );
@@ -746,40 +923,44 @@ int main(int argc, char **argv)
         glBindVertexArray(VAO);
         glDrawArraysInstanced(GL_POINTS,0,1,gridSize.x*gridSize.y*gridSize.z);
         glBindVertexArray(0);
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        GLContext::SwapBuffers();
     }
 
     glDeleteVertexArrays(1, &VAO);
+    delete [] dataField;
 
-    glfwTerminate( );
+    GLContext::Terminate();
 
     return 0;
 }
 
 void countAndDisplayFps(GLFWwindow* window)
 {
-    float currentFrame = glfwGetTime();
+    float currentFrame = GLContext::GetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
     frameCount++;
-    if(glfwGetTime() - lastFpsCountFrame > 1.0f)
+    if(GLContext::GetTime() - lastFpsCountFrame > 1.0f)
     {
 
         char title [256];
         title [255] = '\0';
 
         snprintf ( title, 255,
-                   "MQB+ARB DEMO - FPS: %4.2f | runtime: %.0fs | isoLevel: %.2f ",
-                   frameCount/(glfwGetTime() - lastFpsCountFrame), glfwGetTime(), isoValue );
-        glfwSetWindowTitle(window, title);
+                   "MQB+ARB DEMO - FPS: %4.2f | runtime: %.0fs | isoLevel: %.2f | %s: %u tris %.1f ms",
+                   frameCount/(GLContext::GetTime() - lastFpsCountFrame), GLContext::GetTime(), isoValue,
+                   meshMode == CPU_MESH ? "cpu mesh" : meshMode == GPU_MESH ? "gpu mesh" : "gs",
+                   meshMode == GPU_MESH ? IsoSurface::GPU_TRIANGLES : IsoSurface::MESH_TRIANGLES, IsoSurface::MESH_MS );
+        if(window)
+            glfwSetWindowTitle(window, title);
 
         frameCount = 0;
-        lastFpsCountFrame = glfwGetTime();
+        lastFpsCountFrame = GLContext::GetTime();
     }
 }
 
@@ -912,6 +1093,15 @@ void processInput(GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
         isoValue -= deltaTime;
 
+    static bool mPressed = false;
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && !mPressed)
+    {
+        meshMode = (meshMode + 1) % 3;
+        if(meshMode == GPU_MESH && !IsoSurface::ComputeSupported())
+            meshMode = GS_MESH;
+    }
+    mPressed = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -984,10 +1174,9 @@ GLFWwindow* initGL(int w, int h)
     }
     glfwMakeContextCurrent(window);
 
-    // Initialize GLEW
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
+    // glad: load all OpenGL function pointers
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        fprintf(stderr, "Failed to initialize GLAD\n");
         getchar();
         glfwTerminate();
         EXIT_FAILURE;
@@ -1005,7 +1194,7 @@ GLFWwindow* initGL(int w, int h)
     glGetIntegerv(GL_MAX_DRAW_BUFFERS, &nrAttributes);
     std::cout << "Maximum nr of color attachments supported: " << nrAttributes << std::endl;
     GLint temp;
-    glGetIntegerv(GL_MAX_GEOMETRY_OUTPUT_VERTICES_EXT,&temp);
+    glGetIntegerv(GL_MAX_GEOMETRY_OUTPUT_VERTICES,&temp);
     std::cout<<"Max GS output vertices:"<<temp<<"\n";
 
     // Mouse input mode
@@ -0,0 +1,645 @@
+#include "brickvolume.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include "camera.h"
+#include "shader.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// ------------------------------------------------------------------------
+// texture unit the atlas and tables are updated on, the last of VolumeRender's
+static const int UPLOAD_UNIT = 15;
+
+// header | (min, max) per brick | overview | bricks, x fastest, from a 4k boundary
+struct FileHeader
+{
+    char magic[8];
+    int32_t version;
+    int32_t type;
+    int32_t dimensions[3];
+    int32_t brick, apron;
+    int32_t overview[3];
+};
+static const char MAGIC[8] = { 'L', 'O', 'D', 'B', 'R', 'I', 'C', 'K' };
+static const int VERSION = 1;
+
+static size_t volume(const glm::ivec3& v) { return size_t(v.x) * v.y * v.z; }
+
+static glm::ivec3 overviewSize(const glm::ivec3& dimensions)
+{
+    const int largest = std::max(dimensions.x, std::max(dimensions.y, dimensions.z));
+    const int ratio = std::max(1, (largest + BrickVolume::OVERVIEW - 1) / BrickVolume::OVERVIEW);
+    return (dimensions + ratio - 1) / ratio;
+}
+
+static size_t brickOffset(const glm::ivec3& bricks, const glm::ivec3& overview, int size)
+{
+    const size_t end = sizeof(FileHeader) + volume(bricks) * sizeof(glm::vec2) + volume(overview) * size;
+    return (end + 4095) & ~size_t(4095);
+}
+
+static GLenum internalFormat(VtkIO::Type type)
+{
+    return type == VtkIO::UINT8 ? GL_R8 : type == VtkIO::UINT16 ? GL_R16 : GL_R32F;
+}
+static GLenum pixelType(VtkIO::Type type)
+{
+    return type == VtkIO::UINT8 ? GL_UNSIGNED_BYTE : type == VtkIO::UINT16 ? GL_UNSIGNED_SHORT : GL_FLOAT;
+}
+
+// range of n values, as the shaders sample them
+template<typename T>
+static glm::vec2 rangeOf(const unsigned char* voxels, size_t n, float scale)
+{
+    const T* v = (const T*)voxels;
+    T lo = v[0], hi = v[0];
+    for(size_t i = 1; i < n; i++)
+    {
+        lo = std::min(lo, v[i]);
+        hi = std::max(hi, v[i]);
+    }
+    return glm::vec2(float(lo), float(hi)) * scale;
+}
+static glm::vec2 rangeOf(VtkIO::Type type, const unsigned char* voxels, size_t n)
+{
+    if(type == VtkIO::UINT8) return rangeOf<uint8_t>(voxels, n, 1.0f / 255.0f);
+    if(type == VtkIO::UINT16) return rangeOf<uint16_t>(voxels, n, 1.0f / 65535.0f);
+    return rangeOf<float>(voxels, n, 1.0f);
+}
+
+static bool readAt(int fd, void* dst, size_t bytes, size_t offset)
+{
+    char* p = (char*)dst;
+#ifdef _WIN32
+    static std::mutex seek;
+    std::lock_guard<std::mutex> lock(seek);
+    if(_lseeki64(fd, offset, SEEK_SET) < 0) return false;
+    while(bytes > 0)
+    {
+        const int n = _read(fd, p, unsigned(std::min(bytes, size_t(1) << 30)));
+        if(n <= 0) return false;
+        p += n;
+        bytes -= n;
+    }
+#else
+    while(bytes > 0)
+    {
+        const ssize_t n = pread(fd, p, bytes, off_t(offset));
+        if(n <= 0) return false;
+        p += n;
+        offset += n;
+        bytes -= n;
+    }
+#endif
+    return true;
+}
+
+static size_t fileSize(int fd)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    return _fstat64(fd, &st) == 0 ? size_t(st.st_size) : 0;
+#else
+    struct stat st;
+    return fstat(fd, &st) == 0 ? size_t(st.st_size) : 0;
+#endif
+}
+
+// ------------------------------------------------------------------------
+// building
+// A row of bricks at a time: the BRICK slices it covers, aprons included, are asked of the
+// source and cut into bricks, voxels outside the volume repeating its edge.
+bool BrickVolume::Build(const std::string& path, const glm::ivec3& dimensions, VtkIO::Type type, const SliceSource& source)
+{
+    if(type != VtkIO::UINT8 && type != VtkIO::UINT16 && type != VtkIO::FLOAT32)
+    {
+        std::cout << "BrickVolume:: bricks hold unsigned_char, unsigned_short or float, not " << VtkIO::TypeName(type) << std::endl;
+        return false;
+    }
+    if(glm::any(glm::lessThan(dimensions, glm::ivec3(1))))
+        return false;
+    std::ofstream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if(!out)
+    {
+        std::cout << "BrickVolume:: cannot create " << path << std::endl;
+        return false;
+    }
+
+    const int size = VtkIO::SizeOf(type);
+    const glm::ivec3 count = (dimensions + INTERIOR - 1) / INTERIOR;
+    const glm::ivec3 overview = overviewSize(dimensions);
+    const glm::ivec3 ratio = (dimensions + overview - 1) / overview;
+    const size_t sliceBytes = size_t(dimensions.x) * dimensions.y * size;
+    const size_t bytes = size_t(BRICK) * BRICK * BRICK * size;
+    std::vector<glm::vec2> ranges(volume(count));
+    std::vector<unsigned char> overviewVoxels(volume(overview) * size);
+    std::vector<unsigned char> slab(BRICK * sliceBytes);
+    std::vector<unsigned char> row(size_t(count.x) * count.y * bytes);
+
+    out.seekp(brickOffset(count, overview, size));
+    for(int bz = 0; bz < count.z; bz++)
+    {
+        const int z0 = bz * INTERIOR - APRON;
+        for(int s = 0; s < BRICK; s++)
+            source(glm::clamp(z0 + s, 0, dimensions.z - 1), &slab[s * sliceBytes]);
+
+        // the overview samples the volume every ratio voxels, from the slices of this row
+        for(int k = 0; k < overview.z; k++)
+        {
+            const int z = std::min(k * ratio.z + ratio.z / 2, dimensions.z - 1);
+            if(z < bz * INTERIOR || z >= (bz + 1) * INTERIOR) continue;
+            const unsigned char* slice = &slab[(z - z0) * sliceBytes];
+            for(int j = 0; j < overview.y; j++)
+                for(int i = 0; i < overview.x; i++)
+                {
+                    const size_t x = std::min(i * ratio.x + ratio.x / 2, dimensions.x - 1);
+                    const size_t y = std::min(j * ratio.y + ratio.y / 2, dimensions.y - 1);
+                    memcpy(&overviewVoxels[(i + overview.x * (j + size_t(overview.y) * k)) * size],
+                           slice + (x + y * dimensions.x) * size, size);
+                }
+        }
+
+        for(int by = 0; by < count.y; by++)
+            for(int bx = 0; bx < count.x; bx++)
+            {
+                unsigned char* brick = &row[(bx + size_t(count.x) * by) * bytes];
+                const int x0 = bx * INTERIOR - APRON, y0 = by * INTERIOR - APRON;
+                // the run of x inside the volume is copied, the voxels either side repeat its ends
+                const int xBegin = std::max(x0, 0), xEnd = std::min(x0 + BRICK, dimensions.x);
+                for(int s = 0; s < BRICK; s++)
+                    for(int y = 0; y < BRICK; y++)
+                    {
+                        const unsigned char* src = &slab[s * sliceBytes] + size_t(glm::clamp(y0 + y, 0, dimensions.y - 1)) * dimensions.x * size;
+                        unsigned char* dst = brick + (size_t(s) * BRICK + y) * BRICK * size;
+                        memcpy(dst + (xBegin - x0) * size, src + xBegin * size, (xEnd - xBegin) * size);
+                        for(int x = 0; x < xBegin - x0; x++)
+                            memcpy(dst + x * size, src + xBegin * size, size);
+                        for(int x = xEnd - x0; x < BRICK; x++)
+                            memcpy(dst + x * size, src + (xEnd - 1) * size, size);
+                    }
+                ranges[bx + count.x * (by + size_t(count.y) * bz)] = rangeOf(type, brick, size_t(BRICK) * BRICK * BRICK);
+            }
+        out.write((const char*)row.data(), row.size());
+    }
+
+    FileHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.type = type;
+    header.brick = BRICK;
+    header.apron = APRON;
+    for(int i = 0; i < 3; i++)
+    {
+        header.dimensions[i] = dimensions[i];
+        header.overview[i] = overview[i];
+    }
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)ranges.data(), ranges.size() * sizeof(glm::vec2));
+    out.write((const char*)overviewVoxels.data(), overviewVoxels.size());
+    if(!out)
+    {
+        std::cout << "BrickVolume:: writing " << path << " failed" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool BrickVolume::Build(const std::string& path, const VtkFile& file, const VtkFile::Array& array)
+{
+    const glm::ivec3 d = file.dimensions;
+    if(array.cellData || array.components != 1 || array.tuples != volume(d))
+    {
+        std::cout << "BrickVolume:: " << array.name << " is not one component point data over "
+                  << d.x << "x" << d.y << "x" << d.z << std::endl;
+        return false;
+    }
+    const size_t slice = size_t(d.x) * d.y;
+    if(array.type == VtkIO::UINT8)
+        return Build(path, d, VtkIO::UINT8, [&](int z, void* dst) { array.Read((uint8_t*)dst, z * slice, slice); });
+    if(array.type == VtkIO::UINT16)
+        return Build(path, d, VtkIO::UINT16, [&](int z, void* dst) { array.Read((uint16_t*)dst, z * slice, slice); });
+    return Build(path, d, VtkIO::FLOAT32, [&](int z, void* dst) { array.Read((float*)dst, z * slice, slice); });
+}
+
+// ------------------------------------------------------------------------
+// streaming
+BrickVolume::BrickVolume(size_t cpuBytes, const glm::ivec3& atlasBricks, int threads)
+    : _cpuBytes(cpuBytes), _atlasBricks(atlasBricks)
+{
+    if(threads <= 0)
+        threads = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+    _threads = threads;
+}
+
+BrickVolume::~BrickVolume()
+{
+    Close();
+}
+
+bool BrickVolume::Open(const std::string& path)
+{
+    Close();
+#ifdef _WIN32
+    _fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    _fd = open(path.c_str(), O_RDONLY);
+#endif
+    FileHeader header;
+    if(_fd < 0 || !readAt(_fd, &header, sizeof(header), 0) || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+       header.version != VERSION || header.brick != BRICK || header.apron != APRON)
+    {
+        std::cout << "BrickVolume:: " << path << " is not a brick file of this version" << std::endl;
+        Close();
+        return false;
+    }
+    // what Build writes, the brick table within a 3d texture, and every brick in the file
+    GLint largest;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &largest);
+    const glm::ivec3 size3(header.dimensions[0], header.dimensions[1], header.dimensions[2]);
+    const glm::ivec3 overview(header.overview[0], header.overview[1], header.overview[2]);
+    const bool known = header.type == VtkIO::UINT8 || header.type == VtkIO::UINT16 || header.type == VtkIO::FLOAT32;
+    if(!known || glm::any(glm::lessThan(size3, glm::ivec3(1))) ||
+       glm::any(glm::greaterThan((size3 - 1) / INTERIOR + 1, glm::ivec3(largest))) ||
+       glm::any(glm::lessThan(overview, glm::ivec3(1))) || glm::any(glm::greaterThan(overview, glm::ivec3(OVERVIEW))))
+    {
+        std::cout << "BrickVolume:: " << path << " has a bad header" << std::endl;
+        Close();
+        return false;
+    }
+    type = VtkIO::Type(header.type);
+    dimensions = size3;
+    bricks = (dimensions - 1) / INTERIOR + 1;
+    const int size = VtkIO::SizeOf(type);
+    if(fileSize(_fd) < brickOffset(bricks, overview, size) + volume(bricks) * brickBytes())
+    {
+        std::cout << "BrickVolume:: " << path << " is cut short" << std::endl;
+        Close();
+        return false;
+    }
+    _ranges.resize(volume(bricks));
+    std::vector<unsigned char> overviewVoxels(volume(overview) * size);
+    if(!readAt(_fd, _ranges.data(), _ranges.size() * sizeof(glm::vec2), sizeof(header)) ||
+       !readAt(_fd, overviewVoxels.data(), overviewVoxels.size(), sizeof(header) + _ranges.size() * sizeof(glm::vec2)))
+    {
+        std::cout << "BrickVolume:: " << path << " is cut short" << std::endl;
+        Close();
+        return false;
+    }
+    _path = path;
+    _brickOffset = brickOffset(bricks, overview, size);
+
+    _atlasBricks = glm::clamp(_atlasBricks, glm::ivec3(1), glm::ivec3(std::min(largest / BRICK, 255)));
+
+    auto texture3D = [](unsigned int& tex, GLint filter) {
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_3D, tex);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    };
+    glActiveTexture(GL_TEXTURE0 + UPLOAD_UNIT);
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    texture3D(_overviewTex, GL_LINEAR);
+    glTexImage3D(GL_TEXTURE_3D, 0, internalFormat(type), overview.x, overview.y, overview.z, 0, GL_RED, pixelType(type),
+                 overviewVoxels.data());
+    const glm::ivec3 atlas = _atlasBricks * BRICK;
+    texture3D(_atlasTex, GL_LINEAR);
+    glTexImage3D(GL_TEXTURE_3D, 0, internalFormat(type), atlas.x, atlas.y, atlas.z, 0, GL_RED, pixelType(type), nullptr);
+    _table.assign(volume(bricks) * 4, 0);
+    texture3D(_tableTex, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8UI, bricks.x, bricks.y, bricks.z, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, _table.data());
+    std::vector<float> largestOf(_ranges.size());
+    for(size_t b = 0; b < _ranges.size(); b++)
+        largestOf[b] = _ranges[b].y;
+    texture3D(_rangeTex, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, bricks.x, bricks.y, bricks.z, 0, GL_RED, GL_FLOAT, largestOf.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+    _slotBrick.assign(volume(_atlasBricks), -1);
+    _slotUsed.assign(_slotBrick.size(), 0);
+    _brickSlot.assign(_ranges.size(), -1);
+    _frame = 0;
+    _wantedClip = glm::mat4(0);
+    _stop = false;
+    for(int t = 0; t < _threads; t++)
+        _readers.push_back(std::thread(&BrickVolume::reader, this));
+    return true;
+}
+
+void BrickVolume::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _requestReady.notify_all();
+    for(std::thread& t : _readers)
+        t.join();
+    _readers.clear();
+    if(_fd >= 0)
+    {
+#ifdef _WIN32
+        _close(_fd);
+#else
+        close(_fd);
+#endif
+    }
+    _fd = -1;
+    unsigned int textures[] = { _atlasTex, _tableTex, _overviewTex, _rangeTex };
+    for(unsigned int tex : textures)
+        if(tex)
+            glDeleteTextures(1, &tex);
+    _atlasTex = _tableTex = _overviewTex = _rangeTex = 0;
+    _requests.clear();
+    _pending.clear();
+    _failed.clear();
+    _loaded.clear();
+    _cache.clear();
+    _lru.clear();
+    _wanted.clear();
+    _wantedSlices.clear();
+    _ranges.clear();
+    _table.clear();
+    _slotBrick.clear();
+    _slotUsed.clear();
+    _brickSlot.clear();
+    _readBytes = 0;
+    dimensions = bricks = glm::ivec3(0);
+    type = VtkIO::UNKNOWN;
+    WANTED = CPU_BRICKS = GPU_BRICKS = PENDING = UPLOADED = 0;
+    READ_MB = 0;
+}
+
+void BrickVolume::reader()
+{
+    const size_t bytes = brickBytes();
+    for(;;)
+    {
+        int brick;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _requestReady.wait(lock, [this]() { return _stop || !_requests.empty(); });
+            if(_stop)
+                return;
+            brick = _requests.front();
+            _requests.pop_front();
+        }
+        std::vector<unsigned char> voxels(bytes);
+        const bool ok = readAt(_fd, voxels.data(), bytes, _brickOffset + brick * bytes);
+        if(!ok)
+            std::cout << "BrickVolume:: reading brick " << brick << " of " << _path << " failed" << std::endl;
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(ok)
+        {
+            _loaded.push_back(std::make_pair(brick, std::move(voxels)));
+            _readBytes += bytes;
+        }
+        else
+        {
+            // the overview stands in for it from now on
+            _pending.erase(brick);
+            _failed.insert(brick);
+        }
+    }
+}
+
+static bool samePlanes(const std::vector<Slice::Plane>& a, const std::vector<Slice::Plane>& b)
+{
+    if(a.size() != b.size()) return false;
+    for(size_t i = 0; i < a.size(); i++)
+        if(a[i].normal != b[i].normal || a[i].offset != b[i].offset) return false;
+    return true;
+}
+
+// Bricks in the frustum the slices cross, then those whose range meets [lo, hi], each by
+// distance from the eye. Only made again when the view, the slices or the range change
+void BrickVolume::want(const glm::mat4& clip, const glm::vec3& eye, float lo, float hi,
+                       const std::vector<Slice::Plane>& slices)
+{
+    if(clip == _wantedClip && _wantedRange == glm::vec2(lo, hi) && samePlanes(slices, _wantedSlices))
+        return;
+    _wantedClip = clip;
+    _wantedRange = glm::vec2(lo, hi);
+    _wantedSlices = slices;
+
+    // frustum planes in the unit cube's space, pointing in
+    glm::vec4 planes[6];
+    const glm::vec4 r0(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+    const glm::vec4 r1(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+    const glm::vec4 r2(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+    const glm::vec4 r3(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+    planes[0] = r3 + r0; planes[1] = r3 - r0;
+    planes[2] = r3 + r1; planes[3] = r3 - r1;
+    planes[4] = r3 + r2; planes[5] = r3 - r2;
+
+    const glm::vec3 voxel = 1.0f / glm::vec3(dimensions);
+    std::vector<std::pair<float, int>> onSlices, inRange;
+    for(int z = 0; z < bricks.z; z++)
+        for(int y = 0; y < bricks.y; y++)
+            for(int x = 0; x < bricks.x; x++)
+            {
+                const int b = x + bricks.x * (y + bricks.y * z);
+                const glm::ivec3 c(x, y, z);
+                const glm::vec3 bmin = glm::vec3(c * INTERIOR) * voxel;
+                const glm::vec3 bmax = glm::min(glm::vec3((c + 1) * INTERIOR) * voxel, glm::vec3(1.0f));
+                bool inside = true;
+                for(int p = 0; p < 6 && inside; p++)
+                {
+                    const glm::vec3 n(planes[p]);
+                    const glm::vec3 corner(n.x > 0 ? bmax.x : bmin.x, n.y > 0 ? bmax.y : bmin.y, n.z > 0 ? bmax.z : bmin.z);
+                    inside = glm::dot(n, corner) + planes[p].w >= 0.0f;
+                }
+                if(!inside) continue;
+                // slice p is dot(normal, x - 0.5) = offset, it crosses the brick when the
+                // brick's half extent along the normal reaches it from the centre
+                const glm::vec3 centre = 0.5f * (bmin + bmax) - 0.5f, half = 0.5f * (bmax - bmin);
+                bool crossed = false;
+                for(size_t p = 0; p < slices.size() && !crossed; p++)
+                    crossed = std::abs(glm::dot(slices[p].normal, centre) - slices[p].offset) <=
+                              glm::dot(glm::abs(slices[p].normal), half);
+                if(!crossed && (_ranges[b].y < lo || _ranges[b].x > hi)) continue;
+                const glm::vec3 d = glm::max(glm::max(bmin - eye, eye - bmax), glm::vec3(0.0f));
+                (crossed ? onSlices : inRange).push_back(std::make_pair(glm::dot(d, d), b));
+            }
+    std::sort(onSlices.begin(), onSlices.end());
+    std::sort(inRange.begin(), inRange.end());
+    _wanted.clear();
+    for(const auto& o : onSlices)
+        _wanted.push_back(o.second);
+    for(const auto& o : inRange)
+        _wanted.push_back(o.second);
+}
+
+void BrickVolume::touch(int brick)
+{
+    Cached& c = _cache[brick];
+    _lru.splice(_lru.begin(), _lru, c.lru);
+}
+
+// a free slot, or the least recently used one not drawn this frame; -1 when all are
+int BrickVolume::slotFor(int brick)
+{
+    int best = -1;
+    for(int s = 0; s < int(_slotBrick.size()); s++)
+    {
+        if(_slotBrick[s] < 0) { best = s; break; }
+        if(_slotUsed[s] < _frame && (best < 0 || _slotUsed[s] < _slotUsed[best]))
+            best = s;
+    }
+    if(best < 0)
+        return -1;
+    if(_slotBrick[best] >= 0)
+    {
+        _brickSlot[_slotBrick[best]] = -1;
+        _table[4 * _slotBrick[best] + 3] = 0;
+    }
+    _slotBrick[best] = brick;
+    _slotUsed[best] = _frame;
+    _brickSlot[brick] = best;
+    return best;
+}
+
+void BrickVolume::upload(int brick, int slot, const std::vector<unsigned char>& voxels)
+{
+    const glm::ivec3 s(slot % _atlasBricks.x, (slot / _atlasBricks.x) % _atlasBricks.y, slot / (_atlasBricks.x * _atlasBricks.y));
+    glTexSubImage3D(GL_TEXTURE_3D, 0, s.x * BRICK, s.y * BRICK, s.z * BRICK, BRICK, BRICK, BRICK, GL_RED, pixelType(type),
+                    voxels.data());
+    uint8_t* entry = &_table[4 * brick];
+    entry[0] = uint8_t(s.x);
+    entry[1] = uint8_t(s.y);
+    entry[2] = uint8_t(s.z);
+    entry[3] = 1;
+    _tableDirty = true;
+}
+
+template<typename T>
+void BrickVolume::Update(const T& camera, const glm::mat4& model, float lo, float hi, const std::vector<Slice::Plane>& slices)
+{
+    if(_fd < 0) return;
+    _frame++;
+    want(camera.GetFrustumMatrix() * model, glm::vec3(glm::inverse(model) * glm::vec4(camera.Position, 1.0f)), lo, hi, slices);
+    const size_t capacity = std::max<size_t>(1, _cpuBytes / brickBytes());
+    const size_t considered = std::min(_wanted.size(), capacity);
+
+    // 1. bricks just read go in first, so the wanted ones touched after them stay ahead
+    std::deque<std::pair<int, std::vector<unsigned char>>> loaded;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        loaded.swap(_loaded);
+        for(const auto& l : loaded)
+            _pending.erase(l.first);
+        READ_MB = _readBytes / 1e6;
+    }
+    for(auto& l : loaded)
+    {
+        if(_cache.count(l.first)) continue;
+        _lru.push_front(l.first);
+        Cached& c = _cache[l.first];
+        c.voxels.swap(l.second);
+        c.lru = _lru.begin();
+    }
+    for(size_t i = considered; i-- > 0;)
+        if(_cache.count(_wanted[i]))
+            touch(_wanted[i]);
+    while(_cache.size() > capacity)
+    {
+        _cache.erase(_lru.back());
+        _lru.pop_back();
+    }
+
+    // 2. nearest first: what is in the atlas stays, what is cached goes into it, the rest
+    // is read ahead, as far as the cache reaches
+    glActiveTexture(GL_TEXTURE0 + UPLOAD_UNIT);
+    glBindTexture(GL_TEXTURE_3D, _atlasTex);
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    std::vector<int> missing;
+    size_t gpu = 0, uploads = 0;
+    bool atlasFull = false;
+    for(size_t i = 0; i < considered; i++)
+    {
+        const int b = _wanted[i];
+        if(_brickSlot[b] >= 0)
+        {
+            _slotUsed[_brickSlot[b]] = _frame;
+            gpu++;
+            continue;
+        }
+        auto c = _cache.find(b);
+        if(c == _cache.end())
+            missing.push_back(b);
+        else if(!atlasFull && uploads < size_t(uploadsPerFrame))
+        {
+            const int slot = slotFor(b);
+            atlasFull = slot < 0;
+            if(slot >= 0)
+            {
+                upload(b, slot, c->second.voxels);
+                uploads++;
+                gpu++;
+            }
+        }
+    }
+    if(_tableDirty)
+    {
+        glBindTexture(GL_TEXTURE_3D, _tableTex);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, bricks.x, bricks.y, bricks.z, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, _table.data());
+        _tableDirty = false;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+    {
+        // what is still queued gives way to the new view's order
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(int b : _requests)
+            _pending.erase(b);
+        _requests.clear();
+        for(int b : missing)
+            if(!_failed.count(b) && _pending.insert(b).second)
+                _requests.push_back(b);
+        PENDING = _pending.size();
+    }
+    _requestReady.notify_all();
+
+    WANTED = _wanted.size();
+    CPU_BRICKS = _cache.size();
+    GPU_BRICKS = gpu;
+    UPLOADED = uploads;
+}
+
+void BrickVolume::Bind(const Shader& shader, int unit) const
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_3D, _atlasTex);
+    glActiveTexture(GL_TEXTURE0 + unit + 1);
+    glBindTexture(GL_TEXTURE_3D, _tableTex);
+    glActiveTexture(GL_TEXTURE0 + unit + 2);
+    glBindTexture(GL_TEXTURE_3D, _overviewTex);
+    shader.setInt("brickAtlas", unit);
+    shader.setInt("brickTable", unit + 1);
+    shader.setInt("brickOverview", unit + 2);
+    shader.setVec3i("brickVolumeSize", dimensions);
+}
+
+template void BrickVolume::Update<Camera>(const Camera&, const glm::mat4&, float, float, const std::vector<Slice::Plane>&);
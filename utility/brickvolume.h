@@ -0,0 +1,144 @@
+#ifndef BRICKVOLUME_H
+#define BRICKVOLUME_H
+
+// Volumes larger than memory, streamed from a file of fixed size bricks. Build writes the
+// file once, a z slab of the field at a time: the bricks with an apron of their
+// neighbours' voxels (so trilinear filtering never leaves the brick), the value range of
+// each and a coarse overview of the whole volume.
+// Open keeps the overview and the ranges in memory and the bricks on disk. Update picks
+// the bricks the view frustum sees that the active slice planes cross, then those whose
+// range meets the active value range, nearest first: worker threads read them into an
+// LRU cache of cpu memory, and the render thread copies them into slots of a 3d atlas
+// texture, itself an LRU. An indirection texture maps each brick to its slot;
+// glsl/bricks.glsl samples through it and falls back to the overview for bricks that are
+// not in the atlas (yet).
+// Open, Update, Bind and the destructor need the GL context.
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+#include "vtkfile.h"
+#include "slice.h"
+
+class Shader;
+
+class BrickVolume
+{
+public:
+    static const int BRICK = 32;                    // voxels a side as stored, apron included
+    static const int APRON = 1;
+    static const int INTERIOR = BRICK - 2 * APRON;  // voxels of the volume a brick covers
+    static const int OVERVIEW = 128;                // largest side of the overview
+
+    // --- building
+    // source(z, slice) writes slice z of the field, dimensions.x*dimensions.y values of type
+    // (UINT8, UINT16 or FLOAT32), x fastest
+    typedef std::function<void(int z, void* slice)> SliceSource;
+    static bool Build(const std::string& path, const glm::ivec3& dimensions, VtkIO::Type type, const SliceSource& source);
+    // one component point data; 8 and 16 bit unsigned arrays keep their type, others become float
+    static bool Build(const std::string& path, const VtkFile& file, const VtkFile::Array& array);
+
+    // --- streaming
+    // cpuBytes of bricks cached in memory, an atlas of atlasBricks on the gpu; threads
+    // reading bricks, <= 0 uses all cores but one
+    explicit BrickVolume(size_t cpuBytes = size_t(2) << 30, const glm::ivec3& atlasBricks = glm::ivec3(16, 16, 8),
+                         int threads = 0);
+    ~BrickVolume();
+    BrickVolume(const BrickVolume&) = delete;
+    BrickVolume& operator=(const BrickVolume&) = delete;
+
+    bool Open(const std::string& path);
+    void Close();
+
+    // bricks in the frustum of camera (the volume filling the unit cube placed by model)
+    // are wanted: first those the slices cross, whatever their values, then those whose
+    // range meets [lo, hi]. Reads them ahead into the cache and uploads up to
+    // uploadsPerFrame of them
+    template<typename T> void Update(const T& camera, const glm::mat4& model, float lo, float hi,
+                                     const std::vector<Slice::Plane>& slices = std::vector<Slice::Plane>());
+    int uploadsPerFrame = 64;
+
+    // atlas, indirection and overview textures on units unit..unit+2, and the uniforms of
+    // glsl/bricks.glsl, for the bound shader
+    void Bind(const Shader& shader, int unit) const;
+    // largest value of each brick, R32F, for skipping empty bricks as VolumeRender::BuildBricks
+    unsigned int RangeTexture() const { return _rangeTex; }
+
+    glm::ivec3 dimensions = glm::ivec3(0);
+    glm::ivec3 bricks = glm::ivec3(0);  // per axis
+    VtkIO::Type type = VtkIO::UNKNOWN;
+    // (min, max) of a brick, apron included, in the units shaders sample: 8 and 16 bit
+    // values normalised
+    const glm::vec2& Range(int brick) const { return _ranges[brick]; }
+
+    // last Update
+    size_t WANTED = 0;      // bricks in view, on a slice or in range
+    size_t CPU_BRICKS = 0;  // in the cache
+    size_t GPU_BRICKS = 0;  // wanted and in the atlas
+    size_t PENDING = 0;     // with the readers
+    size_t UPLOADED = 0;
+    double READ_MB = 0;     // read since Open
+
+private:
+    struct Cached
+    {
+        std::vector<unsigned char> voxels;
+        std::list<int>::iterator lru;
+    };
+
+    size_t brickBytes() const { return size_t(BRICK) * BRICK * BRICK * VtkIO::SizeOf(type); }
+    void want(const glm::mat4& clip, const glm::vec3& eye, float lo, float hi, const std::vector<Slice::Plane>& slices);
+    void touch(int brick);
+    int slotFor(int brick);
+    void upload(int brick, int slot, const std::vector<unsigned char>& voxels);
+    void reader();
+
+    size_t _cpuBytes;
+    glm::ivec3 _atlasBricks;
+    int _threads;
+    int _fd = -1;
+    std::string _path;
+    size_t _brickOffset = 0;
+    std::vector<glm::vec2> _ranges;
+
+    // view the wanted list was made for
+    glm::mat4 _wantedClip = glm::mat4(0);
+    glm::vec2 _wantedRange = glm::vec2(0);
+    std::vector<Slice::Plane> _wantedSlices;
+    std::vector<int> _wanted;            // on the slices, then in range, each nearest first
+
+    // cpu cache, the render thread's
+    std::unordered_map<int, Cached> _cache;
+    std::list<int> _lru;                 // most recent first
+
+    // atlas slots, least recently used evicted
+    std::vector<int> _slotBrick;         // -1 free
+    std::vector<unsigned int> _slotUsed; // frame
+    std::vector<int> _brickSlot;         // -1 not in the atlas
+    std::vector<uint8_t> _table;         // indirection, slot xyz and resident flag per brick
+    bool _tableDirty = false;
+    unsigned int _frame = 0;
+    unsigned int _atlasTex = 0, _tableTex = 0, _overviewTex = 0, _rangeTex = 0;
+
+    // readers
+    std::mutex _mutex;
+    std::condition_variable _requestReady;
+    std::deque<int> _requests;
+    std::unordered_set<int> _pending;    // being read, or read and not yet in the cache
+    std::unordered_set<int> _failed;     // could not be read, never asked for again
+    std::deque<std::pair<int, std::vector<unsigned char>>> _loaded;
+    size_t _readBytes = 0;
+    bool _stop = false;
+    std::vector<std::thread> _readers;
+};
+
+#endif
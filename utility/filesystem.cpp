@@ -0,0 +1,17 @@
+#include "filesystem.h"
+#include <cerrno>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+bool FileSystem::MakeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+    const int result = _mkdir(path.c_str());
+#else
+    const int result = mkdir(path.c_str(), 0755);
+#endif
+    return result == 0 || errno == EEXIST;
+}
@@ -0,0 +1,11 @@
+#ifndef FILESYSTEM_H
+#define FILESYSTEM_H
+
+#include <string>
+
+namespace FileSystem {
+// creates directory (not its parents); true if it exists afterwards
+bool MakeDirectory(const std::string& path);
+}
+
+#endif
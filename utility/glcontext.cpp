@@ -0,0 +1,329 @@
+#include "glcontext.h"
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef HAVE_EGL
+#define EGL_NO_X11 // keep Xlib (and its Window typedef) out, no display is used
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef HAVE_OSMESA
+#include <GL/osmesa.h> // after glad, which stands in for GL/gl.h
+#endif
+
+#include "stb_image_write.h"
+
+namespace GLContext {
+
+static GLFWwindow* WINDOW = nullptr;
+static Backend BACKEND = WINDOWED;
+static bool CLOSED = false;
+
+// --- headless state
+static int WIDTH = 0, HEIGHT = 0;
+static int FRAMES = 0, FRAME_LIMIT = 0;
+static std::string OUTPUT;
+static GLuint FBO = 0, COLOR_RB = 0, DEPTH_RB = 0;
+static std::chrono::steady_clock::time_point START;
+
+#ifdef HAVE_EGL
+static EGLDisplay EGL_DPY = EGL_NO_DISPLAY;
+static EGLContext EGL_CTX = EGL_NO_CONTEXT;
+
+static bool initEGL(int major, int minor)
+{
+    // the surfaceless platform needs neither an X server nor a DRM device
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if(getPlatformDisplay)
+        EGL_DPY = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if(EGL_DPY == EGL_NO_DISPLAY)
+        EGL_DPY = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint versionMajor = 0, versionMinor = 0;
+    if(EGL_DPY == EGL_NO_DISPLAY || !eglInitialize(EGL_DPY, &versionMajor, &versionMinor))
+    {
+        std::cout << "GLContext:: no EGL display" << std::endl;
+        EGL_DPY = EGL_NO_DISPLAY;
+        return false;
+    }
+    const char* extensions = eglQueryString(EGL_DPY, EGL_EXTENSIONS);
+    if(!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context"))
+    {
+        std::cout << "GLContext:: EGL " << versionMajor << "." << versionMinor
+                  << " without EGL_KHR_surfaceless_context" << std::endl;
+        eglTerminate(EGL_DPY);
+        EGL_DPY = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    // any surface type, nothing is ever drawn to an EGL surface
+    const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, 0, EGL_NONE };
+    EGLConfig config;
+    EGLint configCount = 0;
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, major,
+        EGL_CONTEXT_MINOR_VERSION_KHR, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE };
+    if(eglBindAPI(EGL_OPENGL_API)
+            && eglChooseConfig(EGL_DPY, configAttribs, &config, 1, &configCount) && configCount > 0)
+        EGL_CTX = eglCreateContext(EGL_DPY, config, EGL_NO_CONTEXT, contextAttribs);
+    if(EGL_CTX == EGL_NO_CONTEXT || !eglMakeCurrent(EGL_DPY, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_CTX))
+    {
+        std::cout << "GLContext:: failed to create an EGL OpenGL " << major << "." << minor
+                  << " core context (error 0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+        if(EGL_CTX != EGL_NO_CONTEXT) eglDestroyContext(EGL_DPY, EGL_CTX);
+        eglTerminate(EGL_DPY);
+        EGL_CTX = EGL_NO_CONTEXT;
+        EGL_DPY = EGL_NO_DISPLAY;
+        return false;
+    }
+    return gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress)) != 0;
+}
+
+static void finalizeEGL()
+{
+    if(EGL_DPY == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(EGL_DPY, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(EGL_DPY, EGL_CTX);
+    eglTerminate(EGL_DPY);
+    EGL_CTX = EGL_NO_CONTEXT;
+    EGL_DPY = EGL_NO_DISPLAY;
+}
+#else
+static bool initEGL(int, int)
+{
+    std::cout << "GLContext:: built without EGL (HAVE_EGL)" << std::endl;
+    return false;
+}
+static void finalizeEGL() {}
+#endif
+
+#ifdef HAVE_OSMESA
+static OSMesaContext OSMESA_CTX = nullptr;
+static std::vector<unsigned char> OSMESA_BUFFER; // osmesa wants a client buffer, rendering goes to the FBO
+
+static bool initOSMesa(int major, int minor)
+{
+    const int attribs[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_DEPTH_BITS, 0,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, major,
+        OSMESA_CONTEXT_MINOR_VERSION, minor,
+        0 };
+    OSMESA_CTX = OSMesaCreateContextAttribs(attribs, nullptr);
+    OSMESA_BUFFER.assign(4, 0);
+    if(!OSMESA_CTX || !OSMesaMakeCurrent(OSMESA_CTX, OSMESA_BUFFER.data(), GL_UNSIGNED_BYTE, 1, 1))
+    {
+        std::cout << "GLContext:: failed to create an OSMesa OpenGL " << major << "." << minor << " core context" << std::endl;
+        if(OSMESA_CTX) OSMesaDestroyContext(OSMESA_CTX);
+        OSMESA_CTX = nullptr;
+        return false;
+    }
+    return gladLoadGLLoader(reinterpret_cast<GLADloadproc>(OSMesaGetProcAddress)) != 0;
+}
+
+static void finalizeOSMesa()
+{
+    if(!OSMESA_CTX) return;
+    OSMesaDestroyContext(OSMESA_CTX);
+    OSMESA_CTX = nullptr;
+    OSMESA_BUFFER.clear();
+}
+#else
+static bool initOSMesa(int, int)
+{
+    std::cout << "GLContext:: built without OSMesa (HAVE_OSMESA)" << std::endl;
+    return false;
+}
+static void finalizeOSMesa() {}
+#endif
+
+Options ParseArgs(int argc, char** argv)
+{
+    Options options;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if(arg == "--headless")
+        {
+            if(options.backend == WINDOWED)
+                options.backend = EGL;
+            if(i + 1 < argc && argv[i + 1][0] != '-')
+                options.frames = std::max(0, atoi(argv[++i]));
+        }
+        if(arg == "--headless-backend" && i + 1 < argc)
+            options.backend = std::string(argv[++i]) == "osmesa" ? OSMESA : EGL;
+        if(arg == "--headless-output" && i + 1 < argc)
+            options.output = argv[++i];
+    }
+    return options;
+}
+
+void Attach(GLFWwindow* window)
+{
+    WINDOW = window;
+    BACKEND = WINDOWED;
+    CLOSED = false;
+}
+
+bool InitHeadless(int w, int h, const Options& options, int major, int minor)
+{
+    BACKEND = options.backend == WINDOWED ? EGL : options.backend;
+    bool loaded = false;
+    if(BACKEND == EGL)
+        loaded = initEGL(major, minor);
+    if(!loaded)
+    {
+        BACKEND = OSMESA;
+        loaded = initOSMesa(major, minor);
+    }
+    if(!loaded)
+    {
+        std::cout << "GLContext:: no headless backend available" << std::endl;
+        BACKEND = WINDOWED;
+        return false;
+    }
+
+    // offscreen target in place of the default framebuffer
+    WIDTH = w;
+    HEIGHT = h;
+    glGenRenderbuffers(1, &COLOR_RB);
+    glBindRenderbuffer(GL_RENDERBUFFER, COLOR_RB);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glGenRenderbuffers(1, &DEPTH_RB);
+    glBindRenderbuffer(GL_RENDERBUFFER, DEPTH_RB);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+    glGenFramebuffers(1, &FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, COLOR_RB);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, DEPTH_RB);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "GLContext:: offscreen framebuffer not complete!" << std::endl;
+    glViewport(0, 0, w, h);
+
+    WINDOW = nullptr;
+    CLOSED = false;
+    FRAMES = 0;
+    FRAME_LIMIT = options.frames;
+    OUTPUT = options.output;
+    START = std::chrono::steady_clock::now();
+
+    std::cout << "GLContext:: headless " << (BACKEND == EGL ? "EGL" : "OSMesa") << " " << w << "x" << h
+              << " on " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")" << std::endl;
+    return true;
+}
+
+void Terminate()
+{
+    if(!Headless())
+    {
+        glfwTerminate();
+        WINDOW = nullptr;
+        return;
+    }
+    if(!OUTPUT.empty())
+        SaveFramebuffer(OUTPUT);
+    glDeleteFramebuffers(1, &FBO);
+    glDeleteRenderbuffers(1, &COLOR_RB);
+    glDeleteRenderbuffers(1, &DEPTH_RB);
+    FBO = COLOR_RB = DEPTH_RB = 0;
+    if(BACKEND == EGL) finalizeEGL();
+    if(BACKEND == OSMESA) finalizeOSMesa();
+    BACKEND = WINDOWED;
+}
+
+bool Headless()
+{
+    return BACKEND != WINDOWED;
+}
+
+GLFWwindow* Handle()
+{
+    return WINDOW;
+}
+
+bool ShouldClose()
+{
+    if(!Headless())
+        return glfwWindowShouldClose(WINDOW);
+    return CLOSED || (FRAME_LIMIT > 0 && FRAMES >= FRAME_LIMIT);
+}
+
+void Close()
+{
+    if(!Headless())
+        glfwSetWindowShouldClose(WINDOW, true);
+    CLOSED = true;
+}
+
+void SwapBuffers()
+{
+    if(!Headless())
+    {
+        glfwSwapBuffers(WINDOW);
+        glfwPollEvents();
+        return;
+    }
+    // nothing is presented, the flush keeps the driver from queueing frames without bound
+    glFlush();
+    FRAMES++;
+}
+
+double GetTime()
+{
+    if(!Headless())
+        return glfwGetTime();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - START).count();
+}
+
+void GetFramebufferSize(int* w, int* h)
+{
+    if(!Headless())
+    {
+        glfwGetFramebufferSize(WINDOW, w, h);
+        return;
+    }
+    *w = WIDTH;
+    *h = HEIGHT;
+}
+
+unsigned int DefaultFramebuffer()
+{
+    return FBO;
+}
+
+bool SaveFramebuffer(const std::string& path)
+{
+    int w = 0, h = 0;
+    GetFramebufferSize(&w, &h);
+    std::vector<unsigned char> pixels(size_t(w) * size_t(h) * 4);
+
+    GLint readFBO = 0;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, DefaultFramebuffer());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(readFBO));
+
+    stbi_flip_vertically_on_write(true);
+    if(!stbi_write_png(path.c_str(), w, h, 4, pixels.data(), w * 4))
+    {
+        std::cout << "GLContext:: failed to write " << path << std::endl;
+        return false;
+    }
+    std::cout << "GLContext:: saved " << path << std::endl;
+    return true;
+}
+
+}
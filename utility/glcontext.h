@@ -0,0 +1,46 @@
+#ifndef GLCONTEXT_H
+#define GLCONTEXT_H
+
+// The context a demo renders with: a glfw window, or a headless context for machines
+// without a display or a gpu. Headless runs use surfaceless EGL or OSMesa (both run on
+// Mesa llvmpipe) and draw into an offscreen framebuffer that stands in for the window's,
+// so the demo binds DefaultFramebuffer() wherever it would bind 0.
+// Built with EGL when HAVE_EGL is defined and with OSMesa when HAVE_OSMESA is defined.
+#include <string>
+
+struct GLFWwindow;
+namespace GLContext {
+
+enum Backend { WINDOWED, EGL, OSMESA };
+
+struct Options
+{
+    Backend backend = WINDOWED;
+    int frames = 0;     // headless: frames rendered before ShouldClose, 0 until Close()
+    std::string output; // headless: png of the last frame, written by Terminate
+};
+
+// --headless [N] [--headless-backend egl|osmesa] [--headless-output file.png]
+Options ParseArgs(int argc, char** argv);
+
+// route everything through a window the demo created (hints and callbacks stay its own)
+void Attach(GLFWwindow* window);
+// GL major.minor core context without a display, loads glad; false if no backend works.
+// the EGL backend falls back to OSMesa when both are built
+bool InitHeadless(int w, int h, const Options& options, int major = 4, int minor = 1);
+void Terminate();
+
+bool Headless();
+GLFWwindow* Handle(); // nullptr when headless
+bool ShouldClose();
+void Close();
+// swap and poll events, or finish the frame when headless
+void SwapBuffers();
+double GetTime();
+void GetFramebufferSize(int* w, int* h);
+unsigned int DefaultFramebuffer(); // 0 when windowed
+bool SaveFramebuffer(const std::string& path);
+
+}
+
+#endif
@@ -0,0 +1,22 @@
+// Sampling a BrickVolume filling the unit cube. The table holds, per brick, its slot in the
+// atlas (xyz) and whether it is there (w); bricks that are not read the overview.
+uniform sampler3D brickAtlas;
+uniform usampler3D brickTable;
+uniform sampler3D brickOverview;
+uniform ivec3 brickVolumeSize; // voxels
+
+const float BRICK = 32.0;          // BrickVolume::BRICK
+const float BRICK_APRON = 1.0;     // BrickVolume::APRON
+const float BRICK_INTERIOR = 30.0; // BrickVolume::INTERIOR
+
+float brickSample(vec3 p)
+{
+    vec3 u = p*vec3(brickVolumeSize); // texels, centres at i + 0.5
+    ivec3 b = clamp(ivec3(u/BRICK_INTERIOR), ivec3(0), textureSize(brickTable, 0) - 1);
+    uvec4 entry = texelFetch(brickTable, b, 0);
+    if(entry.w == 0u)
+        return texture(brickOverview, p).r;
+    // the brick's first texel is the apron, the voxel before its interior
+    vec3 a = vec3(entry.xyz)*BRICK + BRICK_APRON + (u - vec3(b)*BRICK_INTERIOR);
+    return textureLod(brickAtlas, a/vec3(textureSize(brickAtlas, 0)), 0.0).r;
+}
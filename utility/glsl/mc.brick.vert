@@ -0,0 +1,24 @@
+#version 430 core
+out VS_OUT {
+    ivec3 gridPos;
+} vs_out;
+
+// one instance per cell of the active bricks, see mc.cull.compute.glsl
+layout(std430, binding = 1) readonly buffer Bricks { uint activeBricks[]; };
+
+uniform ivec3 brickCount;
+uniform int brickSize;
+uniform vec3 voxelSize;
+
+void main()
+{
+    int cells = brickSize*brickSize*brickSize;
+    int brick = int(activeBricks[gl_InstanceID / cells]);
+    int cell = gl_InstanceID % cells;
+
+    ivec3 b = ivec3(brick % brickCount.x, (brick / brickCount.x) % brickCount.y, brick / (brickCount.x*brickCount.y));
+    ivec3 c = ivec3(cell % brickSize, (cell / brickSize) % brickSize, cell / (brickSize*brickSize));
+    vs_out.gridPos = b*brickSize + c;
+
+    gl_Position = vec4(vs_out.gridPos*voxelSize, 1.0);
+}
@@ -0,0 +1,38 @@
+// shared by the marching cubes compute passes
+// cells are numbered x fastest over (gridSize - 1), the order the CPU mesher walks them
+uniform sampler3D volumeTex;
+uniform isampler1D numVertsTex;
+uniform ivec3 gridSize;
+uniform float isoValue;
+
+// dispatches wider than the 65535 group limit are split over y
+uint linearInvocation()
+{
+    return (gl_WorkGroupID.y*gl_NumWorkGroups.x + gl_WorkGroupID.x)*gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+}
+
+float fieldAt(ivec3 p)
+{
+    return texelFetch(volumeTex, p, 0).r;
+}
+
+ivec3 cellPos(uint cell)
+{
+    uvec3 cells = uvec3(gridSize - 1);
+    return ivec3(cell % cells.x, (cell / cells.x) % cells.y, cell / (cells.x*cells.y));
+}
+
+// bit i set when corner i is inside (below isoValue), corners ordered as in mc.geom.glsl
+int cubeIndex(ivec3 p)
+{
+    int cubeindex;
+    cubeindex =  int(fieldAt(p                 ) < isoValue);
+    cubeindex += int(fieldAt(p + ivec3(1, 0, 0)) < isoValue)*2;
+    cubeindex += int(fieldAt(p + ivec3(1, 1, 0)) < isoValue)*4;
+    cubeindex += int(fieldAt(p + ivec3(0, 1, 0)) < isoValue)*8;
+    cubeindex += int(fieldAt(p + ivec3(0, 0, 1)) < isoValue)*16;
+    cubeindex += int(fieldAt(p + ivec3(1, 0, 1)) < isoValue)*32;
+    cubeindex += int(fieldAt(p + ivec3(1, 1, 1)) < isoValue)*64;
+    cubeindex += int(fieldAt(p + ivec3(0, 1, 1)) < isoValue)*128;
+    return cubeindex;
+}
@@ -0,0 +1,18 @@
+#version 430
+layout(local_size_x = 64) in;
+
+#include "mc.cell.glsl"
+
+// x: vertices the cell emits, y: 1 if it emits any
+layout(std430, binding = 0) writeonly buffer Counts { uvec2 counts[]; };
+
+uniform int cellCount;
+
+void main()
+{
+    uint cell = linearInvocation();
+    if(cell >= uint(cellCount)) return;
+
+    int numVerts = texelFetch(numVertsTex, cubeIndex(cellPos(cell)), 0).r;
+    counts[cell] = uvec2(uint(numVerts), numVerts > 0 ? 1u : 0u);
+}
@@ -0,0 +1,38 @@
+#version 430
+layout(local_size_x = 64) in;
+
+#include "mc.cell.glsl"
+
+layout(std430, binding = 0) readonly buffer Counts { uvec2 counts[]; };
+layout(std430, binding = 1) readonly buffer Prefix { uvec2 prefix[]; };
+layout(std430, binding = 3) writeonly buffer Active { uint activeCells[]; };
+// 0-3: DrawArraysIndirectCommand, 4-6: DispatchIndirectCommand of the generate pass,
+// 7: vertices generated, 8: active cells
+layout(std430, binding = 4) writeonly buffer Args { uint args[]; };
+
+uniform int cellCount;
+uniform int maxVertices;
+
+void main()
+{
+    uint cell = linearInvocation();
+    if(cell >= uint(cellCount)) return;
+
+    if(counts[cell].y != 0u)
+        activeCells[prefix[cell].y] = cell;
+
+    if(cell == uint(cellCount) - 1u)
+    {
+        uvec2 total = prefix[cell] + counts[cell];
+        uint groups = (total.y + 63u) / 64u;
+        args[0] = min(total.x, uint(maxVertices));
+        args[1] = 1u;
+        args[2] = 0u;
+        args[3] = 0u;
+        args[4] = min(groups, 65535u);
+        args[5] = (groups + 65534u) / 65535u;
+        args[6] = 1u;
+        args[7] = total.x;
+        args[8] = total.y;
+    }
+}
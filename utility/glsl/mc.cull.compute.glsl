@@ -0,0 +1,22 @@
+#version 430
+layout(local_size_x = 64) in;
+
+// appends the bricks straddling isoValue and counts their cells as instances
+uniform float isoValue;
+uniform int brickTotal;
+uniform int brickCells;
+
+layout(std430, binding = 0) readonly buffer Ranges { vec2 ranges[]; };
+layout(std430, binding = 1) writeonly buffer Bricks { uint activeBricks[]; };
+// DrawArraysIndirectCommand, instanceCount starts at 0
+layout(std430, binding = 2) buffer Command { uint count; uint instanceCount; uint first; uint baseInstance; };
+
+void main()
+{
+    uint brick = (gl_WorkGroupID.y*gl_NumWorkGroups.x + gl_WorkGroupID.x)*gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+    if(brick >= uint(brickTotal)) return;
+
+    vec2 range = ranges[brick];
+    if(range.x < isoValue && range.y >= isoValue)
+        activeBricks[atomicAdd(instanceCount, uint(brickCells)) / uint(brickCells)] = brick;
+}
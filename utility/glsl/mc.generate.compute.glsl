@@ -0,0 +1,71 @@
+#version 430
+layout(local_size_x = 64) in;
+
+#include "mc.cell.glsl"
+
+struct Vertex
+{
+    vec4 position;
+    vec4 normal;
+};
+
+uniform isampler1D triTex;
+
+layout(std430, binding = 1) readonly buffer Prefix { uvec2 prefix[]; };
+layout(std430, binding = 3) readonly buffer Active { uint activeCells[]; };
+layout(std430, binding = 4) readonly buffer Args { uint args[]; };
+layout(std430, binding = 5) writeonly buffer Vertices { Vertex vertices[]; };
+
+uniform int maxVertices;
+
+// cube edges from their lower to their upper corner, so a crossing shared by several
+// cells is interpolated the same way in each (and as on the CPU)
+const ivec3 EDGE_A[12] = ivec3[12](
+    ivec3(0,0,0), ivec3(1,0,0), ivec3(0,1,0), ivec3(0,0,0),
+    ivec3(0,0,1), ivec3(1,0,1), ivec3(0,1,1), ivec3(0,0,1),
+    ivec3(0,0,0), ivec3(1,0,0), ivec3(1,1,0), ivec3(0,1,0));
+const ivec3 EDGE_B[12] = ivec3[12](
+    ivec3(1,0,0), ivec3(1,1,0), ivec3(1,1,0), ivec3(0,1,0),
+    ivec3(1,0,1), ivec3(1,1,1), ivec3(1,1,1), ivec3(0,1,1),
+    ivec3(0,0,1), ivec3(1,0,1), ivec3(1,1,1), ivec3(0,1,1));
+
+// central differences, one-sided at the border
+vec3 gradient(ivec3 p)
+{
+    ivec3 p0 = max(p - 1, ivec3(0));
+    ivec3 p1 = min(p + 1, gridSize - 1);
+    return vec3((fieldAt(ivec3(p1.x, p.y, p.z)) - fieldAt(ivec3(p0.x, p.y, p.z))) / float(p1.x - p0.x),
+                (fieldAt(ivec3(p.x, p1.y, p.z)) - fieldAt(ivec3(p.x, p0.y, p.z))) / float(p1.y - p0.y),
+                (fieldAt(ivec3(p.x, p.y, p1.z)) - fieldAt(ivec3(p.x, p.y, p0.z))) / float(p1.z - p0.z));
+}
+
+Vertex edgeVertex(ivec3 a, ivec3 b)
+{
+    float fa = fieldAt(a), fb = fieldAt(b);
+    float t = (isoValue - fa) / (fb - fa);
+    vec3 n = mix(gradient(a), gradient(b), t) * vec3(gridSize);
+    float len = length(n);
+
+    Vertex v;
+    v.position = vec4(mix(vec3(a), vec3(b), t) / vec3(gridSize), 1.0);
+    v.normal = vec4(len > 0.0 ? -n / len : vec3(0, 0, 1), 0.0);
+    return v;
+}
+
+void main()
+{
+    uint id = linearInvocation();
+    if(id >= args[8]) return;
+
+    uint cell = activeCells[id];
+    ivec3 p = cellPos(cell);
+    int cubeindex = cubeIndex(p);
+    int numVerts = texelFetch(numVertsTex, cubeindex, 0).r;
+    uint first = prefix[cell].x;
+
+    for(int i = 0; i < numVerts && first + uint(i) < uint(maxVertices); i++)
+    {
+        int edge = texelFetch(triTex, cubeindex*16 + i, 0).r;
+        vertices[first + uint(i)] = edgeVertex(p + EDGE_A[edge], p + EDGE_B[edge]);
+    }
+}
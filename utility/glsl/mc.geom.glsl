@@ -203,6 +203,8 @@ void main() {
     //render_point(vec3(1.0)*texelFetch(numVertsTex, 1, 0).r, gl_in[0].gl_Position); // Debug numverts texture
     //gs_out.Color = gs_in[0].gridPos*voxelSize/4.0;
     //gs_out.Color = vec3(0.7);
+    // bricks on the far border overhang the grid
+    if(any(greaterThanEqual(gs_in[0].gridPos, gridSize - 1))) return;
     generateTriangles(gs_in[0].gridPos, gl_in[0].gl_Position.xyz);
 }
 
@@ -0,0 +1,22 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+// named like the geometry shader output, mc.frag serves both paths
+out GS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec3 TexCoords;
+} vs_out;
+
+uniform mat4 projectionMatrix;
+uniform mat4 modelMatrix;
+uniform vec3 voxelSize;
+
+void main()
+{
+    vs_out.FragPos = vec3(modelMatrix*vec4(aPos, 1.0));
+    vs_out.Normal = mat3(transpose(inverse(modelMatrix)))*aNormal;
+    vs_out.TexCoords = aPos + 0.5f*voxelSize;
+    gl_Position = projectionMatrix*vec4(vs_out.FragPos, 1.0);
+}
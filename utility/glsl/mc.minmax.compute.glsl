@@ -0,0 +1,32 @@
+#version 430
+layout(local_size_x = 64) in;
+
+// range of the field over the corners of each brick, one thread per brick
+uniform sampler3D volumeTex;
+uniform ivec3 gridSize;
+uniform ivec3 brickCount;
+uniform int brickSize;
+
+layout(std430, binding = 0) writeonly buffer Ranges { vec2 ranges[]; };
+
+void main()
+{
+    uint brick = (gl_WorkGroupID.y*gl_NumWorkGroups.x + gl_WorkGroupID.x)*gl_WorkGroupSize.x + gl_LocalInvocationID.x;
+    uvec3 count = uvec3(brickCount);
+    if(brick >= count.x*count.y*count.z) return;
+
+    ivec3 b = ivec3(brick % count.x, (brick / count.x) % count.y, brick / (count.x*count.y));
+    ivec3 p0 = b*brickSize;
+    ivec3 p1 = min(p0 + brickSize, gridSize - 1);
+
+    // the channel mc.geom.glsl reads
+    vec2 range = vec2(texelFetch(volumeTex, p0, 0).a);
+    for(int z = p0.z; z <= p1.z; z++)
+        for(int y = p0.y; y <= p1.y; y++)
+            for(int x = p0.x; x <= p1.x; x++)
+            {
+                float f = texelFetch(volumeTex, ivec3(x, y, z), 0).a;
+                range = vec2(min(range.x, f), max(range.y, f));
+            }
+    ranges[brick] = range;
+}
@@ -0,0 +1,36 @@
+#version 430
+layout(local_size_x = 256) in;
+
+// exclusive prefix sum of each block of 256 values, block totals go to sums.
+// values and prefix may be the same buffer, a thread only reads its own element
+layout(std430, binding = 0) buffer Values { uvec2 values[]; };
+layout(std430, binding = 1) buffer Prefix { uvec2 prefix[]; };
+layout(std430, binding = 2) buffer Sums { uvec2 sums[]; };
+
+uniform int count;
+
+shared uvec2 partial[256];
+
+void main()
+{
+    uint block = gl_WorkGroupID.y*gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    uint i = block*256u + gl_LocalInvocationID.x;
+    uint t = gl_LocalInvocationID.x;
+
+    uvec2 value = i < uint(count) ? values[i] : uvec2(0);
+    partial[t] = value;
+    barrier();
+
+    // inclusive scan in shared memory
+    for(uint offset = 1u; offset < 256u; offset <<= 1)
+    {
+        uvec2 add = t >= offset ? partial[t - offset] : uvec2(0);
+        barrier();
+        partial[t] += add;
+        barrier();
+    }
+
+    if(i < uint(count)) prefix[i] = partial[t] - value;
+    // dispatch1D rounds the groups up, padding blocks have no total
+    if(t == 255u && block*256u < uint(count)) sums[block] = partial[255];
+}
@@ -0,0 +1,15 @@
+#version 430
+layout(local_size_x = 256) in;
+
+// adds the scanned block totals back to each block
+layout(std430, binding = 1) buffer Prefix { uvec2 prefix[]; };
+layout(std430, binding = 2) readonly buffer Sums { uvec2 sums[]; };
+
+uniform int count;
+
+void main()
+{
+    uint block = gl_WorkGroupID.y*gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    uint i = block*256u + gl_LocalInvocationID.x;
+    if(i < uint(count)) prefix[i] += sums[block];
+}
@@ -0,0 +1,47 @@
+#version 330 core
+// A slice plane: the volume's value through the colormap, lit as mc.frag lights the
+// isosurface
+out vec4 FragColor;
+
+in GS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec3 TexCoords;
+} fs_in;
+
+uniform sampler1D colormap;
+uniform float lo;          // values from lo to hi run across the colormap, see Slice::Colors
+uniform float hi;
+uniform vec3 viewPos;
+
+#ifdef BRICKED
+#include "bricks.glsl"
+#else
+uniform sampler3D volumeTex;
+uniform int channel;
+#endif
+
+float volume(vec3 p)
+{
+#ifdef BRICKED
+    return brickSample(p);
+#else
+    return texture(volumeTex, p)[channel];
+#endif
+}
+
+void main()
+{
+    vec3 color = texture(colormap, clamp((volume(fs_in.TexCoords) - lo)/(hi - lo), 0.0, 1.0)).rgb;
+
+    // blinn-phong, the light above the cube
+    vec3 lightPos = vec3(0.5, 0.5, 3.0);
+    vec3 ambient = 0.55*color;
+    vec3 lightDir = normalize(lightPos - fs_in.FragPos);
+    vec3 normal = normalize(fs_in.Normal);
+    vec3 diffuse = 0.3*max(dot(lightDir, normal), 0.0)*color;
+    vec3 viewDir = normalize(viewPos - fs_in.FragPos);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    vec3 specular = vec3(0.3)*pow(max(dot(normal, halfwayDir), 0.0), 32.0);
+    FragColor = vec4(ambient + diffuse + specular, 1.0);
+}
@@ -0,0 +1,43 @@
+#version 330 core
+// A quad per slice plane, instance i drawing planes[i] as a strip of 4 vertices. The quad
+// covers the unit cube the volume fills, the clip distances cut it down to the cube.
+out GS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec3 TexCoords;
+} vs_out;
+
+out float gl_ClipDistance[6];
+
+const int MAX_PLANES = 8;
+uniform vec4 planes[MAX_PLANES]; // unit normal, offset from the cube centre along it
+uniform mat4 projectionMatrix;
+uniform vec3 viewPos;
+uniform vec3 voxelSize;
+
+void main()
+{
+    vec3 n = planes[gl_InstanceID].xyz;
+    vec3 centre = vec3(0.5) + planes[gl_InstanceID].w*n;
+    // two axes in the plane, half the cube diagonal out of the centre reaches every corner
+    vec3 u = normalize(cross(n, abs(n.x) < 0.9 ? vec3(1, 0, 0) : vec3(0, 1, 0)));
+    vec3 v = cross(n, u);
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1)*2.0 - 1.0;
+    vec3 p = centre + 0.8660254*(corner.x*u + corner.y*v);
+
+    // the unit cube stretched to the grid's aspect, as sl.geom.glsl
+    vec3 aspect = voxelSize.y/voxelSize;
+    vs_out.FragPos = p*aspect;
+    vs_out.TexCoords = p;
+    // lit from the side facing the viewer
+    vs_out.Normal = normalize(n/aspect);
+    if(dot(vs_out.Normal, viewPos - vs_out.FragPos) < 0.0)
+        vs_out.Normal = -vs_out.Normal;
+    gl_Position = projectionMatrix*vec4(p, 1.0);
+
+    for(int i = 0; i < 3; i++)
+    {
+        gl_ClipDistance[2*i] = p[i];
+        gl_ClipDistance[2*i + 1] = 1.0 - p[i];
+    }
+}
@@ -0,0 +1,26 @@
+#version 430
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+
+// largest value trilinear sampling reads inside each brick, its voxels and the layer
+// around them, one thread per brick
+uniform sampler3D volumeTex;
+uniform ivec3 gridSize;
+uniform int brickSize;
+uniform int channel;
+
+layout(r32f, binding = 0) writeonly uniform image3D bricks;
+
+void main()
+{
+    ivec3 b = ivec3(gl_GlobalInvocationID);
+    if(any(greaterThanEqual(b, imageSize(bricks)))) return;
+
+    ivec3 p0 = max(b*brickSize - 1, ivec3(0));
+    ivec3 p1 = min(b*brickSize + brickSize, gridSize - 1);
+    float m = texelFetch(volumeTex, p0, 0)[channel];
+    for(int z = p0.z; z <= p1.z; z++)
+        for(int y = p0.y; y <= p1.y; y++)
+            for(int x = p0.x; x <= p1.x; x++)
+                m = max(m, texelFetch(volumeTex, ivec3(x, y, z), 0)[channel]);
+    imageStore(bricks, b, vec4(m));
+}
@@ -0,0 +1,80 @@
+#version 330 core
+// Front to back ray marching through the unit cube, see VolumeRender::Draw. The colour
+// comes out premultiplied by its opacity, for ONE, ONE_MINUS_SRC_ALPHA blending.
+in vec2 ndc;
+out vec4 color;
+
+uniform sampler3D volumeTex;  // or a BrickVolume, BRICKED
+uniform sampler1D colormap;
+uniform sampler3D brickTex;   // largest value of each brick
+uniform mat4 toModel;         // clip space to the cube's
+uniform vec3 eye;             // camera, in the cube's space
+uniform ivec3 gridSize;
+uniform int brickSize;
+uniform bool skipEmpty;
+uniform int channel;
+uniform float lo;             // transfer function, see VolumeRender::Transfer
+uniform float hi;
+uniform float density;
+uniform float voxelStep;      // shortest step
+uniform float footprint;      // step per unit distance from the eye
+uniform float opacityCutoff;
+
+const int MAX_STEPS = 4096;
+
+#ifdef BRICKED
+#include "bricks.glsl"
+#endif
+
+float volume(vec3 p)
+{
+#ifdef BRICKED
+    return brickSample(p);
+#else
+    return texture(volumeTex, p)[channel];
+#endif
+}
+
+void main()
+{
+    vec4 far = toModel*vec4(ndc, 1.0, 1.0);
+    vec3 dir = normalize(far.xyz/far.w - eye);
+
+    // the stretch of the ray inside the cube
+    vec3 inv = 1.0/dir;
+    vec3 t0 = -eye*inv, t1 = (1.0 - eye)*inv;
+    vec3 tmin = min(t0, t1), tmax = max(t0, t1);
+    float t = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+    float tEnd = min(min(tmax.x, tmax.y), tmax.z);
+    if(t >= tEnd) discard;
+
+    vec3 brickScale = vec3(gridSize)/float(brickSize); // the cube in bricks
+    ivec3 lastBrick = textureSize(brickTex, 0) - 1;
+    // start a fraction of a step in, differently per pixel, instead of banding
+    t += voxelStep*fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233)))*43758.5453);
+
+    color = vec4(0.0);
+    for(int i = 0; i < MAX_STEPS && t < tEnd && color.a < opacityCutoff; i++)
+    {
+        vec3 p = eye + t*dir;
+        if(skipEmpty)
+        {
+            vec3 b = floor(p*brickScale);
+            if(texelFetch(brickTex, clamp(ivec3(b), ivec3(0), lastBrick), 0).r <= lo)
+            {
+                // on to where the ray leaves the brick
+                vec3 exit = ((b + step(0.0, dir))/brickScale - eye)*inv;
+                t = max(t, min(min(exit.x, exit.y), exit.z)) + 0.01*voxelStep;
+                continue;
+            }
+        }
+        float dt = max(voxelStep, t*footprint);
+        float s = clamp((volume(p) - lo)/(hi - lo), 0.0, 1.0);
+        if(s > 0.0)
+        {
+            float alpha = 1.0 - exp(-density*s*dt);
+            color += (1.0 - color.a)*alpha*vec4(texture(colormap, s).rgb, 1.0);
+        }
+        t += dt;
+    }
+}
@@ -0,0 +1,11 @@
+#version 330 core
+// the reduced resolution volume, bilinear, blended over the framebuffer
+in vec2 ndc;
+out vec4 color;
+
+uniform sampler2D volumeColor;
+
+void main()
+{
+    color = texture(volumeColor, ndc*0.5 + 0.5);
+}
@@ -1,9 +1,23 @@
 #include "image_io.h"
 #include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <glad/glad.h>
 
 //GLFW
 #include <GLFW/glfw3.h>
 
+#include "imgui.h"
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
@@ -49,3 +63,339 @@ void ImageIO::Save(int w, int h, int imgIndex, bool verbose)
     delete [] image;
     //free(image);
 }
+
+// --- asynchronous capture
+namespace ImageIO {
+
+unsigned int CAPTURED_FRAMES = 0;
+double READBACK_WAIT_MS = 0;
+double ENCODER_WAIT_MS = 0;
+
+typedef std::vector<unsigned char> PixelBuffer;
+
+struct CaptureSlot
+{
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+    unsigned int frame = 0;
+};
+
+struct CaptureJob
+{
+    unsigned int frame;
+    std::unique_ptr<PixelBuffer> pixels; // rgba, bottom row first
+};
+
+static const int CAPTURE_RING = 3;
+static CaptureSlot SLOTS[CAPTURE_RING];
+static int HEAD = 0;
+static bool CAPTURING = false;
+static std::string CAPTURE_PATH;
+static CaptureFormat FORMAT = CAPTURE_PNG;
+static int WIDTH = 0, HEIGHT = 0;
+static unsigned int NEXT_FRAME = 0;
+static double TOTAL_READBACK_WAIT_MS = 0, TOTAL_ENCODER_WAIT_MS = 0;
+static int SAVED_COMPRESSION = 8, SAVED_FILTER = -1;
+
+// buffer pool and job queue, shared with the workers
+static std::mutex MUTEX;
+static std::condition_variable JOB_READY, BUFFER_FREE;
+static std::vector<std::unique_ptr<PixelBuffer>> POOL;
+static size_t POOL_CAPACITY = 0, POOL_ALLOCATED = 0;
+static std::deque<CaptureJob> JOBS;
+static bool STOP = false;
+static std::vector<std::thread> WORKERS;
+
+// y4m frames are converted in parallel and written in order
+static FILE* Y4M = nullptr;
+static std::mutex WRITE_MUTEX;
+static std::condition_variable WRITE_TURN;
+static unsigned int NEXT_WRITE = 0;
+
+static double elapsedMs(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void releaseBuffer(std::unique_ptr<PixelBuffer> pixels)
+{
+    std::lock_guard<std::mutex> lock(MUTEX);
+    POOL.push_back(std::move(pixels));
+    BUFFER_FREE.notify_one();
+}
+
+// blocks while every buffer is with an encoder, the capture is never lossy
+static std::unique_ptr<PixelBuffer> acquireBuffer()
+{
+    std::unique_lock<std::mutex> lock(MUTEX);
+    if(POOL.empty() && POOL_ALLOCATED < POOL_CAPACITY)
+    {
+        POOL_ALLOCATED++;
+        return std::unique_ptr<PixelBuffer>(new PixelBuffer(size_t(WIDTH) * size_t(HEIGHT) * 4));
+    }
+    BUFFER_FREE.wait(lock, [] { return !POOL.empty(); });
+    std::unique_ptr<PixelBuffer> pixels = std::move(POOL.back());
+    POOL.pop_back();
+    return pixels;
+}
+
+static void encodePNG(const CaptureJob& job)
+{
+    // drop alpha in place, reading rgba is the fast path on every driver
+    unsigned char* data = job.pixels->data();
+    const size_t count = size_t(WIDTH) * size_t(HEIGHT);
+    for(size_t i = 0; i < count; i++)
+    {
+        data[3*i + 0] = data[4*i + 0];
+        data[3*i + 1] = data[4*i + 1];
+        data[3*i + 2] = data[4*i + 2];
+    }
+    char name[1024];
+    snprintf(name, sizeof(name), CAPTURE_PATH.c_str(), job.frame);
+    if(!stbi_write_png(name, WIDTH, HEIGHT, 3, data, WIDTH * 3))
+        std::cout << "ImageIO:: failed to write " << name << std::endl;
+}
+
+// full range BT.601, 2x2 chroma average, flipped to top row first
+static void encodeY4M(const CaptureJob& job, PixelBuffer& yuv)
+{
+    const int w = WIDTH, h = HEIGHT, cw = (w + 1) / 2, ch = (h + 1) / 2;
+    yuv.resize(size_t(w) * h + 2 * size_t(cw) * ch);
+    unsigned char* Y = yuv.data();
+    unsigned char* U = Y + size_t(w) * h;
+    unsigned char* V = U + size_t(cw) * ch;
+    const unsigned char* rgba = job.pixels->data();
+    for(int y = 0; y < h; y++)
+    {
+        const unsigned char* row = rgba + size_t(h - 1 - y) * w * 4;
+        for(int x = 0; x < w; x++)
+        {
+            const int r = row[4*x], g = row[4*x + 1], b = row[4*x + 2];
+            Y[size_t(y) * w + x] = (unsigned char)((77*r + 150*g + 29*b + 128) >> 8);
+        }
+    }
+    for(int y = 0; y < ch; y++)
+    {
+        const unsigned char* row0 = rgba + size_t(h - 1 - std::min(2*y, h - 1)) * w * 4;
+        const unsigned char* row1 = rgba + size_t(h - 1 - std::min(2*y + 1, h - 1)) * w * 4;
+        for(int x = 0; x < cw; x++)
+        {
+            const int x0 = 4 * std::min(2*x, w - 1), x1 = 4 * std::min(2*x + 1, w - 1);
+            const int r = row0[x0] + row0[x1] + row1[x0] + row1[x1];
+            const int g = row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1];
+            const int b = row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2];
+            U[size_t(y) * cw + x] = (unsigned char)std::min(255, std::max(0, ((-43*r - 85*g + 128*b + 512) >> 10) + 128));
+            V[size_t(y) * cw + x] = (unsigned char)std::min(255, std::max(0, ((128*r - 107*g - 21*b + 512) >> 10) + 128));
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(WRITE_MUTEX);
+    WRITE_TURN.wait(lock, [&job] { return NEXT_WRITE == job.frame; });
+    fputs("FRAME\n", Y4M);
+    fwrite(yuv.data(), 1, yuv.size(), Y4M);
+    NEXT_WRITE++;
+    WRITE_TURN.notify_all();
+}
+
+static void worker()
+{
+    PixelBuffer yuv;
+    for(;;)
+    {
+        CaptureJob job;
+        {
+            std::unique_lock<std::mutex> lock(MUTEX);
+            JOB_READY.wait(lock, [] { return STOP || !JOBS.empty(); });
+            if(JOBS.empty())
+                return;
+            job = std::move(JOBS.front());
+            JOBS.pop_front();
+        }
+        if(FORMAT == CAPTURE_PNG)
+            encodePNG(job);
+        else
+            encodeY4M(job, yuv);
+        releaseBuffer(std::move(job.pixels));
+    }
+}
+
+// copies a finished readback out of its pixel buffer and queues it for encoding
+static void retire(CaptureSlot& slot)
+{
+    if(!slot.fence) return;
+
+    auto begin = std::chrono::steady_clock::now();
+    GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while(status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    READBACK_WAIT_MS += elapsedMs(begin);
+
+    begin = std::chrono::steady_clock::now();
+    CaptureJob job;
+    job.frame = slot.frame;
+    job.pixels = acquireBuffer();
+    ENCODER_WAIT_MS += elapsedMs(begin);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(job.pixels->size()), GL_MAP_READ_BIT);
+    if(mapped)
+    {
+        memcpy(job.pixels->data(), mapped, job.pixels->size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else
+        std::cout << "ImageIO:: failed to map the readback of frame " << slot.frame << std::endl;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    {
+        std::lock_guard<std::mutex> lock(MUTEX);
+        JOBS.push_back(std::move(job));
+    }
+    JOB_READY.notify_one();
+    CAPTURED_FRAMES++;
+}
+
+bool BeginCapture(const std::string& path, int w, int h, CaptureFormat format, int fps, int threads)
+{
+    if(CAPTURING)
+        EndCapture();
+    if(w <= 0 || h <= 0)
+        return false;
+
+    if(format == CAPTURE_Y4M)
+    {
+        Y4M = fopen(path.c_str(), "wb");
+        if(!Y4M)
+        {
+            std::cout << "ImageIO:: failed to open " << path << std::endl;
+            return false;
+        }
+        fprintf(Y4M, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", w, h, std::max(1, fps));
+    }
+
+    CAPTURE_PATH = path;
+    FORMAT = format;
+    WIDTH = w;
+    HEIGHT = h;
+    HEAD = 0;
+    NEXT_FRAME = 0;
+    NEXT_WRITE = 0;
+    CAPTURED_FRAMES = 0;
+    TOTAL_READBACK_WAIT_MS = TOTAL_ENCODER_WAIT_MS = 0;
+
+    for(CaptureSlot& slot : SLOTS)
+    {
+        glGenBuffers(1, &slot.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(w) * h * 4, nullptr, GL_STREAM_READ);
+        slot.fence = nullptr;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // fastest settings stb offers, the default filter search is most of the encoding time
+    SAVED_COMPRESSION = stbi_write_png_compression_level;
+    SAVED_FILTER = stbi_write_force_png_filter;
+    stbi_write_png_compression_level = 5;
+    stbi_write_force_png_filter = 1;
+    stbi_flip_vertically_on_write(true);
+
+    if(threads <= 0)
+        threads = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+    STOP = false;
+    POOL_CAPACITY = size_t(threads) * 2;
+    POOL_ALLOCATED = 0;
+    for(int i = 0; i < threads; i++)
+        WORKERS.push_back(std::thread(worker));
+
+    CAPTURING = true;
+    std::cout << "ImageIO:: capturing " << w << "x" << h << " to " << path << " with " << threads << " encoder threads" << std::endl;
+    return true;
+}
+
+void CaptureFrame()
+{
+    if(!CAPTURING) return;
+    READBACK_WAIT_MS = 0;
+    ENCODER_WAIT_MS = 0;
+
+    // the slot comes round again CAPTURE_RING frames later, its readback is long done
+    CaptureSlot& slot = SLOTS[HEAD];
+    retire(slot);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = NEXT_FRAME++;
+    HEAD = (HEAD + 1) % CAPTURE_RING;
+
+    TOTAL_READBACK_WAIT_MS += READBACK_WAIT_MS;
+    TOTAL_ENCODER_WAIT_MS += ENCODER_WAIT_MS;
+}
+
+void EndCapture()
+{
+    if(!CAPTURING) return;
+
+    // oldest first, the y4m writer expects frames in order
+    for(int i = 0; i < CAPTURE_RING; i++)
+        retire(SLOTS[(HEAD + i) % CAPTURE_RING]);
+    {
+        std::lock_guard<std::mutex> lock(MUTEX);
+        STOP = true;
+    }
+    JOB_READY.notify_all();
+    for(std::thread& thread : WORKERS)
+        thread.join();
+    WORKERS.clear();
+    POOL.clear();
+
+    for(CaptureSlot& slot : SLOTS)
+    {
+        glDeleteBuffers(1, &slot.pbo);
+        slot.pbo = 0;
+    }
+    if(Y4M)
+    {
+        fclose(Y4M);
+        Y4M = nullptr;
+    }
+    stbi_write_png_compression_level = SAVED_COMPRESSION;
+    stbi_write_force_png_filter = SAVED_FILTER;
+
+    CAPTURING = false;
+    std::cout << "ImageIO:: captured " << CAPTURED_FRAMES << " frames to " << CAPTURE_PATH
+              << ", render thread waited " << TOTAL_READBACK_WAIT_MS << " ms on readbacks and "
+              << TOTAL_ENCODER_WAIT_MS << " ms on encoders" << std::endl;
+}
+
+bool Capturing()
+{
+    return CAPTURING;
+}
+
+void gui_interface()
+{
+    if (ImGui::TreeNode("ImageIO::Capture"))
+    {
+        if(CAPTURING)
+        {
+            size_t queued = 0;
+            {
+                std::lock_guard<std::mutex> lock(MUTEX);
+                queued = JOBS.size();
+            }
+            ImGui::Text("Capturing %dx%d to %s", WIDTH, HEIGHT, CAPTURE_PATH.c_str());
+            ImGui::Text("Frames: %u encoded or queued, %u in queue", CAPTURED_FRAMES, unsigned(queued));
+            ImGui::Text("Readback wait: %.3f ms, encoder wait: %.3f ms", READBACK_WAIT_MS, ENCODER_WAIT_MS);
+        }
+        else
+            ImGui::Text("Idle");
+        ImGui::TreePop();
+    }
+}
+
+}
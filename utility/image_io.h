@@ -5,8 +5,31 @@
 // which are built from the interpolated edge vertices
 // Isosurface require: GLwindow, Camera initialized
 // can produce texture with 1-4 channels
+#include <string>
+
 namespace ImageIO {
 void Save(int w, int h, int imgIndex,bool verbose=false);
+
+// --- asynchronous capture
+// CaptureFrame reads the bound read framebuffer into a ring of pixel buffers and copies
+// a frame out once its fence has signalled, CAPTURE_RING-1 frames later, so the render
+// thread never waits on the gpu. Encoding runs on a pool of worker threads.
+// PNG: path is a printf pattern for the frame index ("shot.%06d.png");
+// Y4M: path is one raw yuv420 stream, frames in order (ffmpeg -i capture.y4m ...)
+enum CaptureFormat { CAPTURE_PNG, CAPTURE_Y4M };
+
+// threads <= 0 uses all cores but one
+bool BeginCapture(const std::string& path, int w, int h, CaptureFormat format = CAPTURE_PNG, int fps = 60, int threads = 0);
+// call once per frame after the image is complete
+void CaptureFrame();
+// flushes the pending readbacks and waits for the encoders
+void EndCapture();
+bool Capturing();
+void gui_interface();
+
+extern unsigned int CAPTURED_FRAMES; // frames handed to the encoders since BeginCapture
+extern double READBACK_WAIT_MS;      // render thread waiting on a fence, last frame
+extern double ENCODER_WAIT_MS;       // render thread waiting for a free buffer, last frame
 }
 
 #endif
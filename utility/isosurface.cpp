@@ -2,6 +2,13 @@
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
 
 #include <glad/glad.h>
 
@@ -580,13 +587,45 @@ static int numVertsTable[256] =
 static unsigned int triTableTex;
 static unsigned int numVertsTableTex;
 static unsigned int dummyVAO;
+static unsigned int meshVAO, meshVBO, meshEBO;
 static Shader _shaderHandle;
+static Shader _meshShaderHandle;
+static Shader _classifyShader, _scanShader, _scanAddShader, _compactShader, _generateShader;
+static Shader _brickShaderHandle, _minMaxShader, _cullShader;
+
+// bricks of the GPU field, see BuildBricks
+static unsigned int brickRanges, brickList, brickCommand;
+static glm::ivec3 brickGridSize(0), brickCount(0);
+static GLsync brickFence = 0; // the last cull, its instanceCount is readable once signalled
 #define FACE_CULLING
 
+// groups of a 1d pass, split over y past the 65535 limit (see linearInvocation)
+static void dispatch1D(size_t count, unsigned int localSize)
+{
+    size_t groups = (count + localSize - 1) / localSize;
+    if(groups == 0) return;
+    GLuint x = GLuint(std::min<size_t>(groups, 65535));
+    glDispatchCompute(x, GLuint((groups + x - 1) / x), 1);
+}
+
 void IsoSurface::ReloadShader()
 {
     _shaderHandle.reload_shader_program_from_files(
                 FP("glsl/mc.vert"),FP("glsl/mc.frag"),FP("glsl/mc.geom.glsl"));
+    _meshShaderHandle.reload_shader_program_from_files(
+                FP("glsl/mc.mesh.vert"),FP("glsl/mc.frag"));
+    if(ComputeSupported())
+    {
+        _classifyShader.reload_shader_program_from_files(FP("glsl/mc.classify.compute.glsl"));
+        _scanShader.reload_shader_program_from_files(FP("glsl/mc.scan.compute.glsl"));
+        _scanAddShader.reload_shader_program_from_files(FP("glsl/mc.scanadd.compute.glsl"));
+        _compactShader.reload_shader_program_from_files(FP("glsl/mc.compact.compute.glsl"));
+        _generateShader.reload_shader_program_from_files(FP("glsl/mc.generate.compute.glsl"));
+        _brickShaderHandle.reload_shader_program_from_files(
+                    FP("glsl/mc.brick.vert"),FP("glsl/mc.frag"),FP("glsl/mc.geom.glsl"));
+        _minMaxShader.reload_shader_program_from_files(FP("glsl/mc.minmax.compute.glsl"));
+        _cullShader.reload_shader_program_from_files(FP("glsl/mc.cull.compute.glsl"));
+    }
 }
 
 void IsoSurface::Init()
@@ -625,6 +664,88 @@ void IsoSurface::Init()
 
     // Dummy VAO
     glGenVertexArrays(1, &dummyVAO);
+
+    // CPU mesh buffers
+    glGenVertexArrays(1, &meshVAO);
+    glGenBuffers(1, &meshVBO);
+    glGenBuffers(1, &meshEBO);
+    glBindVertexArray(meshVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshEBO);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(IsoSurface::Vertex), (void*)offsetof(IsoSurface::Vertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(IsoSurface::Vertex), (void*)offsetof(IsoSurface::Vertex, normal));
+    glBindVertexArray(0);
+}
+
+void IsoSurface::BuildBricks(int target, const glm::ivec3& gridSize)
+{
+    if(!ComputeSupported() || glm::any(glm::lessThan(gridSize, glm::ivec3(2)))) return;
+    glm::ivec3 count = (gridSize - 1 + BRICK_SIZE - 1) / BRICK_SIZE;
+    const size_t total = size_t(count.x)*count.y*count.z;
+    if(brickRanges == 0)
+    {
+        glGenBuffers(1, &brickRanges);
+        glGenBuffers(1, &brickList);
+        glGenBuffers(1, &brickCommand);
+    }
+    if(count != brickCount)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickRanges);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, total*sizeof(glm::vec2), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickList);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, total*sizeof(unsigned int), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickCommand);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 4*sizeof(unsigned int), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    brickGridSize = gridSize;
+    brickCount = count;
+
+    _minMaxShader.use();
+    _minMaxShader.setInt("volumeTex", target);
+    _minMaxShader.setVec3i("gridSize", gridSize);
+    _minMaxShader.setVec3i("brickCount", count);
+    _minMaxShader.setInt("brickSize", BRICK_SIZE);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, brickRanges);
+    dispatch1D(total, 64);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// appends the bricks straddling isoValue to brickList, the draw command counts their cells
+static void cullBricks(float isoValue)
+{
+    const int total = brickCount.x*brickCount.y*brickCount.z;
+    const int cells = IsoSurface::BRICK_SIZE*IsoSurface::BRICK_SIZE*IsoSurface::BRICK_SIZE;
+
+    // fraction of the previous cull, without waiting for it
+    if(brickFence && glClientWaitSync(brickFence, 0, 0) != GL_TIMEOUT_EXPIRED)
+    {
+        unsigned int instances;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickCommand);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int), sizeof(instances), &instances);
+        IsoSurface::ACTIVE_BRICKS = float(instances / cells) / float(total);
+        glDeleteSync(brickFence);
+        brickFence = 0;
+    }
+
+    const unsigned int command[4] = { 1, 0, 0, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickCommand);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), command);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    _cullShader.use();
+    _cullShader.setFloat("isoValue", isoValue);
+    _cullShader.setInt("brickTotal", total);
+    _cullShader.setInt("brickCells", cells);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, brickRanges);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, brickList);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, brickCommand);
+    dispatch1D(size_t(total), 64);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    if(!brickFence)
+        brickFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
 template<typename T, typename S>
@@ -632,18 +753,27 @@ void IsoSurface::Draw(int target, float isoValue,
                       const T& camera,
                       const S& gridSize)
 {
+    const bool bricks = ComputeSupported() && glm::ivec3(gridSize) == brickGridSize;
+    if(bricks)
+        cullBricks(isoValue);
+    const Shader& shader = bricks ? _brickShaderHandle : _shaderHandle;
 
     // Set uniform attributes
-    _shaderHandle.use();
-    _shaderHandle.setMat4("projectionMatrix", camera.GetFrustumMatrix()*glm::scale(glm::mat4(1.0),
+    shader.use();
+    shader.setMat4("projectionMatrix", camera.GetFrustumMatrix()*glm::scale(glm::mat4(1.0),
                                               glm::vec3(gridSize.x/(float)gridSize.y,1.0f,gridSize.z/(float)gridSize.y)));
-    _shaderHandle.setVec3("viewPos",camera.Position);
-    _shaderHandle.setInt("volumeTex",target);
-    _shaderHandle.setInt("triTex",10);
-    _shaderHandle.setInt("numVertsTex",11);
-    _shaderHandle.setFloat("isoValue",isoValue);
-    _shaderHandle.setVec3i("gridSize",gridSize);
-    _shaderHandle.setVec3("voxelSize",1.0f/glm::vec3(gridSize));
+    shader.setVec3("viewPos",camera.Position);
+    shader.setInt("volumeTex",target);
+    shader.setInt("triTex",10);
+    shader.setInt("numVertsTex",11);
+    shader.setFloat("isoValue",isoValue);
+    shader.setVec3i("gridSize",gridSize);
+    shader.setVec3("voxelSize",1.0f/glm::vec3(gridSize));
+    if(bricks)
+    {
+        shader.setVec3i("brickCount",brickCount);
+        shader.setInt("brickSize",BRICK_SIZE);
+    }
 
     // Bind texture
     glActiveTexture(GL_TEXTURE10);
@@ -657,7 +787,14 @@ void IsoSurface::Draw(int target, float isoValue,
     glCullFace(GL_FRONT);
 #endif
     glBindVertexArray(dummyVAO);
-    glDrawArraysInstanced(GL_POINTS,0,1,gridSize.x*gridSize.y*gridSize.z);
+    if(bricks)
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, brickCommand);
+        glDrawArraysIndirect(GL_POINTS, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    else
+        glDrawArraysInstanced(GL_POINTS,0,1,gridSize.x*gridSize.y*gridSize.z);
     glBindVertexArray(0);
 #ifdef FACE_CULLING
     glDisable(GL_CULL_FACE); // Enable to decrease computing load
@@ -668,6 +805,665 @@ template void IsoSurface::Draw<Camera, glm::ivec3>(int, float, const Camera&, co
 //template void IsoSurface::Draw<double>(int, double, const glm::mat4&, const glm::ivec3&);
 //template void IsoSurface::Draw<int>(int, int, const glm::mat4&, const glm::ivec3&);
 
+// ------------------------------------------------------------------------
+// CPU mesher
+// A slab owns the vertices on the x/y edges of its bottom grid layer (the seam, built
+// first for every slab) and on all edges of the layers above it, up to but not including
+// the next slab's seam. Cells in the slab's last layer refer to the next seam with
+// SEAM_BIT set; the flag is resolved once every slab knows its vertex offset.
+static const unsigned int SEAM_BIT = 0x80000000u;
+
+struct FieldView
+{
+    const float* data;
+    glm::ivec3 size;
+    float isoValue;
+    const unsigned char* active; // bricks that can hold surface, nullptr visits every cell
+    glm::ivec3 bricks;
+    glm::ivec3 pitch;            // points per axis of the array data points into
+    int apron;                   // points readable outside size on every side
+
+    float at(int x, int y, int z) const { return data[x + pitch.x*(y + std::ptrdiff_t(pitch.y)*z)]; }
+    bool inside(int x, int y, int z) const { return at(x, y, z) < isoValue; }
+    // central differences, one-sided at the border of the apron
+    glm::vec3 gradient(int x, int y, int z) const
+    {
+        const int x0 = std::max(x - 1, -apron), x1 = std::min(x + 1, size.x - 1 + apron);
+        const int y0 = std::max(y - 1, -apron), y1 = std::min(y + 1, size.y - 1 + apron);
+        const int z0 = std::max(z - 1, -apron), z1 = std::min(z + 1, size.z - 1 + apron);
+        return glm::vec3((at(x1, y, z) - at(x0, y, z)) / float(x1 - x0),
+                         (at(x, y1, z) - at(x, y0, z)) / float(y1 - y0),
+                         (at(x, y, z1) - at(x, y, z0)) / float(z1 - z0));
+    }
+};
+
+// grid points [x0, x1] x [y0, y1] of a layer, the cells [x0, x1) x [y0, y1)
+struct Rect { int x0, x1, y0, y1; };
+
+// the rectangles of the active bricks in brick layers [bz0, bz1], the whole layer
+// without a brick mask
+static void activeRects(const FieldView& field, int bz0, int bz1, std::vector<Rect>& rects)
+{
+    rects.clear();
+    if(!field.active)
+    {
+        rects.push_back({0, field.size.x - 1, 0, field.size.y - 1});
+        return;
+    }
+    const int B = IsoSurface::BRICK_SIZE;
+    for(int by = 0; by < field.bricks.y; by++)
+        for(int bx = 0; bx < field.bricks.x; bx++)
+            for(int bz = bz0; bz <= bz1; bz++)
+                if(field.active[bx + field.bricks.x*(by + size_t(field.bricks.y)*bz)])
+                {
+                    rects.push_back({bx*B, std::min(bx*B + B, field.size.x - 1),
+                                     by*B, std::min(by*B + B, field.size.y - 1)});
+                    break;
+                }
+}
+
+struct Slab
+{
+    int z0, z1; // cell layers [z0, z1)
+    std::vector<IsoSurface::Vertex> vertices; // seam vertices first
+    std::vector<unsigned int> indices;
+    std::vector<unsigned int> seamX, seamY;   // vertex on the x/y edge at each point of grid layer z0
+    std::vector<Rect> rects;
+    std::vector<unsigned int> visited;        // rectangles of neighbouring bricks share their border
+    unsigned int visit = 0;
+    size_t vertexOffset, indexOffset;
+};
+
+static unsigned int edgeVertex(const FieldView& field, glm::ivec3 a, glm::ivec3 b, std::vector<IsoSurface::Vertex>& vertices)
+{
+    const float fa = field.at(a.x, a.y, a.z), fb = field.at(b.x, b.y, b.z);
+    const float t = (field.isoValue - fa) / (fb - fa); // fa != fb, the edge crosses
+    IsoSurface::Vertex v;
+    v.position = glm::mix(glm::vec3(a), glm::vec3(b), t) / glm::vec3(field.size);
+    // gradient in grid units to the unit cube, pointing out of the surface like the flat normals
+    glm::vec3 n = glm::mix(field.gradient(a.x, a.y, a.z), field.gradient(b.x, b.y, b.z), t) * glm::vec3(field.size);
+    float len = glm::length(n);
+    v.normal = len > 0.0f ? -n / len : glm::vec3(0, 0, 1);
+    vertices.push_back(v);
+    return (unsigned int)(vertices.size() - 1);
+}
+
+// calls f(x, y) once for every point in slab.rects
+template<typename F>
+static void forRects(Slab& slab, int nx, F f)
+{
+    const bool shared = slab.rects.size() > 1;
+    slab.visit++;
+    for(const Rect& r : slab.rects)
+        for(int y = r.y0; y <= r.y1; y++)
+            for(int x = r.x0; x <= r.x1; x++)
+            {
+                if(shared)
+                {
+                    unsigned int& v = slab.visited[x + size_t(y)*nx];
+                    if(v == slab.visit) continue;
+                    v = slab.visit;
+                }
+                f(x, y);
+            }
+}
+
+// vertices on the crossing x and y edges of grid layer z, for the cells above and below
+static void layerEdges(const FieldView& field, Slab& slab, int z, unsigned int* ex, unsigned int* ey)
+{
+    const int nx = field.size.x, ny = field.size.y;
+    const int B = IsoSurface::BRICK_SIZE;
+    activeRects(field, std::max(z - 1, 0) / B, std::min(z, field.size.z - 2) / B, slab.rects);
+    forRects(slab, nx, [&](int x, int y) {
+        const bool in = field.inside(x, y, z);
+        if(x + 1 < nx && in != field.inside(x + 1, y, z))
+            ex[x + y*nx] = edgeVertex(field, glm::ivec3(x, y, z), glm::ivec3(x + 1, y, z), slab.vertices);
+        if(y + 1 < ny && in != field.inside(x, y + 1, z))
+            ey[x + y*nx] = edgeVertex(field, glm::ivec3(x, y, z), glm::ivec3(x, y + 1, z), slab.vertices);
+    });
+}
+
+// vertices on the crossing z edges between grid layers z and z + 1
+static void verticalEdges(const FieldView& field, Slab& slab, int z, unsigned int* ez)
+{
+    const int nx = field.size.x;
+    activeRects(field, z / IsoSurface::BRICK_SIZE, z / IsoSurface::BRICK_SIZE, slab.rects);
+    forRects(slab, nx, [&](int x, int y) {
+        if(field.inside(x, y, z) != field.inside(x, y, z + 1))
+            ez[x + y*nx] = edgeVertex(field, glm::ivec3(x, y, z), glm::ivec3(x, y, z + 1), slab.vertices);
+    });
+}
+
+static void meshSlab(const FieldView& field, std::vector<Slab>& slabs, size_t s)
+{
+    Slab& slab = slabs[s];
+    const bool last = s + 1 == slabs.size();
+    const int nx = field.size.x, ny = field.size.y;
+    const size_t layer = size_t(nx) * ny;
+
+    // two layers of x/y edge caches and one of z edges, the seam starts as the bottom
+    std::vector<unsigned int> cache(5 * layer);
+    const unsigned int* bx = slab.seamX.data();
+    const unsigned int* by = slab.seamY.data();
+    unsigned int* ownX[2] = { &cache[0], &cache[2 * layer] };
+    unsigned int* ownY[2] = { &cache[layer], &cache[3 * layer] };
+    unsigned int* ez = &cache[4 * layer];
+
+    for(int z = slab.z0; z < slab.z1; z++)
+    {
+        const int flip = (z - slab.z0) & 1;
+        const unsigned int* tx = ownX[flip];
+        const unsigned int* ty = ownY[flip];
+        unsigned int topFlag = 0;
+        if(z + 1 == slab.z1 && !last)
+        {
+            tx = slabs[s + 1].seamX.data();
+            ty = slabs[s + 1].seamY.data();
+            topFlag = SEAM_BIT;
+        }
+        else
+            layerEdges(field, slab, z + 1, ownX[flip], ownY[flip]);
+        verticalEdges(field, slab, z, ez);
+
+        // verticalEdges left the rectangles of this cell layer
+        for(const Rect& r : slab.rects)
+            for(int y = r.y0; y < r.y1; y++)
+                for(int x = r.x0; x < r.x1; x++)
+                {
+                    int cubeindex = 0;
+                    cubeindex |= int(field.inside(x    , y    , z    ));
+                    cubeindex |= int(field.inside(x + 1, y    , z    )) << 1;
+                    cubeindex |= int(field.inside(x + 1, y + 1, z    )) << 2;
+                    cubeindex |= int(field.inside(x    , y + 1, z    )) << 3;
+                    cubeindex |= int(field.inside(x    , y    , z + 1)) << 4;
+                    cubeindex |= int(field.inside(x + 1, y    , z + 1)) << 5;
+                    cubeindex |= int(field.inside(x + 1, y + 1, z + 1)) << 6;
+                    cubeindex |= int(field.inside(x    , y + 1, z + 1)) << 7;
+                    if(cubeindex == 0 || cubeindex == 255) continue;
+
+                    const size_t i = x + size_t(y) * nx;
+                    // vertex of each cube edge, numbered as in edgeTable
+                    const unsigned int edges[12] = {
+                        bx[i], by[i + 1], bx[i + nx], by[i],
+                        tx[i] | topFlag, ty[i + 1] | topFlag, tx[i + nx] | topFlag, ty[i] | topFlag,
+                        ez[i], ez[i + 1], ez[i + 1 + nx], ez[i + nx] };
+                    for(int v = 0; v < numVertsTable[cubeindex]; v++)
+                        slab.indices.push_back(edges[triTable[cubeindex][v]]);
+                }
+
+        bx = ownX[flip];
+        by = ownY[flip];
+    }
+}
+
+// runs job(0..count-1) on up to threads threads, the caller included
+template<typename F>
+static void parallelFor(size_t count, int threads, F job)
+{
+    std::atomic<size_t> next(0);
+    auto run = [&]() { for(size_t i = next++; i < count; i = next++) job(i); };
+    std::vector<std::thread> pool;
+    for(int t = 1; t < threads && size_t(t) < count; t++)
+        pool.push_back(std::thread(run));
+    run();
+    for(std::thread& thread : pool)
+        thread.join();
+}
+
+// ------------------------------------------------------------------------
+float IsoSurface::ACTIVE_BRICKS = 1;
+
+void IsoSurface::MinMaxTree::Build(const float* field, const glm::ivec3& size, int threads)
+{
+    gridSize = size;
+    levelSize.clear();
+    levels.clear();
+    if(size.x < 2 || size.y < 2 || size.z < 2) return;
+    if(threads <= 0)
+        threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+    // bricks: cells [b*B, b*B + B), their corners up to b*B + B
+    const int B = BRICK_SIZE;
+    glm::ivec3 n = (size - 1 + B - 1) / B;
+    levelSize.push_back(n);
+    levels.push_back(std::vector<glm::vec2>(size_t(n.x)*n.y*n.z));
+    std::vector<glm::vec2>& bricks = levels.back();
+    parallelFor(size_t(n.z), threads, [&](size_t bz) {
+        for(int by = 0; by < n.y; by++)
+            for(int bx = 0; bx < n.x; bx++)
+            {
+                glm::vec2 range(field[bx*B + size.x*(by*B + size_t(size.y)*bz*B)]);
+                for(int z = int(bz)*B; z <= std::min(int(bz)*B + B, size.z - 1); z++)
+                    for(int y = by*B; y <= std::min(by*B + B, size.y - 1); y++)
+                    {
+                        const float* row = field + size.x*(y + size_t(size.y)*z);
+                        for(int x = bx*B; x <= std::min(bx*B + B, size.x - 1); x++)
+                        {
+                            range.x = std::min(range.x, row[x]);
+                            range.y = std::max(range.y, row[x]);
+                        }
+                    }
+                bricks[bx + n.x*(by + size_t(n.y)*bz)] = range;
+            }
+    });
+
+    // 2x2x2 blocks of the level below, up to one node
+    while(n.x > 1 || n.y > 1 || n.z > 1)
+    {
+        glm::ivec3 m = (n + 1) / 2;
+        std::vector<glm::vec2> parent(size_t(m.x)*m.y*m.z);
+        const std::vector<glm::vec2>& child = levels.back();
+        for(int z = 0; z < m.z; z++)
+            for(int y = 0; y < m.y; y++)
+                for(int x = 0; x < m.x; x++)
+                {
+                    glm::vec2 range(child[2*x + n.x*(2*y + size_t(n.y)*2*z)]);
+                    for(int k = 2*z; k < std::min(2*z + 2, n.z); k++)
+                        for(int j = 2*y; j < std::min(2*y + 2, n.y); j++)
+                            for(int i = 2*x; i < std::min(2*x + 2, n.x); i++)
+                            {
+                                const glm::vec2& c = child[i + n.x*(j + size_t(n.y)*k)];
+                                range = glm::vec2(std::min(range.x, c.x), std::max(range.y, c.y));
+                            }
+                    parent[x + m.x*(y + size_t(m.y)*z)] = range;
+                }
+        levelSize.push_back(m);
+        levels.push_back(std::move(parent));
+        n = m;
+    }
+}
+
+static void markActive(const IsoSurface::MinMaxTree& tree, float isoValue, int level, glm::ivec3 p,
+                       std::vector<unsigned char>& active, size_t& count)
+{
+    const glm::ivec3& n = tree.levelSize[level];
+    if(p.x >= n.x || p.y >= n.y || p.z >= n.z) return;
+    const size_t i = p.x + n.x*(p.y + size_t(n.y)*p.z);
+    const glm::vec2& range = tree.levels[level][i];
+    // some corner inside (below isoValue) and some not
+    if(!(range.x < isoValue && range.y >= isoValue)) return;
+    if(level == 0)
+    {
+        active[i] = 1;
+        count++;
+        return;
+    }
+    for(int c = 0; c < 8; c++)
+        markActive(tree, isoValue, level - 1, 2*p + glm::ivec3(c & 1, (c >> 1) & 1, c >> 2), active, count);
+}
+
+size_t IsoSurface::MinMaxTree::Active(float isoValue, std::vector<unsigned char>& active) const
+{
+    active.assign(levels.empty() ? 0 : levels[0].size(), 0);
+    size_t count = 0;
+    if(!levels.empty())
+        markActive(*this, isoValue, int(levels.size()) - 1, glm::ivec3(0), active, count);
+    return count;
+}
+
+// returns the fraction of bricks visited, the windowed meshes of worker threads leave
+// ACTIVE_BRICKS alone
+static float polygonise(FieldView field, IsoSurface::Mesh& mesh, int threads, const IsoSurface::MinMaxTree* bricks)
+{
+    using namespace IsoSurface;
+    const glm::ivec3 gridSize = field.size;
+    const float isoValue = field.isoValue;
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    if(gridSize.x < 2 || gridSize.y < 2 || gridSize.z < 2) return 1;
+
+    if(threads <= 0)
+        threads = std::max(1, int(std::thread::hardware_concurrency()));
+    float activeBricks = 1;
+    std::vector<unsigned char> active;
+    if(bricks && bricks->gridSize == gridSize && !bricks->levels.empty())
+    {
+        size_t count = bricks->Active(isoValue, active);
+        activeBricks = float(count) / float(active.size());
+        if(count == 0) return 0;
+        field.active = active.data();
+        field.bricks = bricks->levelSize[0];
+    }
+    const size_t layer = size_t(gridSize.x) * gridSize.y;
+
+    // a few slabs per thread keeps them busy when the surface is uneven
+    const int cellsZ = gridSize.z - 1;
+    std::vector<Slab> slabs(size_t(std::min(cellsZ, threads * 4)));
+    for(size_t s = 0; s < slabs.size(); s++)
+    {
+        slabs[s].z0 = int(cellsZ * s / slabs.size());
+        slabs[s].z1 = int(cellsZ * (s + 1) / slabs.size());
+    }
+
+    parallelFor(slabs.size(), threads, [&](size_t s) {
+        slabs[s].seamX.resize(layer);
+        slabs[s].seamY.resize(layer);
+        if(field.active)
+            slabs[s].visited.resize(layer);
+        layerEdges(field, slabs[s], slabs[s].z0, slabs[s].seamX.data(), slabs[s].seamY.data());
+    });
+    parallelFor(slabs.size(), threads, [&](size_t s) { meshSlab(field, slabs, s); });
+
+    size_t vertexCount = 0, indexCount = 0;
+    for(Slab& slab : slabs)
+    {
+        slab.vertexOffset = vertexCount;
+        slab.indexOffset = indexCount;
+        vertexCount += slab.vertices.size();
+        indexCount += slab.indices.size();
+    }
+    mesh.vertices.resize(vertexCount);
+    mesh.indices.resize(indexCount);
+    parallelFor(slabs.size(), threads, [&](size_t s) {
+        const Slab& slab = slabs[s];
+        std::copy(slab.vertices.begin(), slab.vertices.end(), mesh.vertices.begin() + slab.vertexOffset);
+        const unsigned int own = (unsigned int)slab.vertexOffset;
+        const unsigned int next = s + 1 < slabs.size() ? (unsigned int)slabs[s + 1].vertexOffset : 0;
+        unsigned int* out = mesh.indices.data() + slab.indexOffset;
+        for(unsigned int index : slab.indices)
+            *out++ = (index & SEAM_BIT) ? next + (index & ~SEAM_BIT) : own + index;
+    });
+    return activeBricks;
+}
+
+void IsoSurface::Polygonise(const float* data, const glm::ivec3& gridSize, float isoValue, Mesh& mesh, int threads,
+                            const MinMaxTree* bricks)
+{
+    FieldView field = { data, gridSize, isoValue, nullptr, glm::ivec3(0), gridSize, 0 };
+    ACTIVE_BRICKS = polygonise(field, mesh, threads, bricks);
+}
+
+void IsoSurface::Polygonise(const float* data, const glm::ivec3& gridSize, const glm::ivec3& pitch, int apron,
+                            float isoValue, Mesh& mesh, int threads)
+{
+    FieldView field = { data, gridSize, isoValue, nullptr, glm::ivec3(0), pitch, apron };
+    polygonise(field, mesh, threads, nullptr);
+}
+
+// ------------------------------------------------------------------------
+// Level of detail
+// Cells of stride points a side. An edge on the border of the window that a finer window
+// shares is split at its midpoint, and a face shared with a finer window into quarters,
+// the way the finer cells see them. Cells with a split edge are cut face by face rather
+// than through triTable, with the rule the table follows on every face: each run of
+// inside points around the face polygon is cut off between its crossing in and its
+// crossing out. The cuts close into loops around the cell, fanned from their centre. The
+// faces of such a cell are cut as its regular neighbours cut them, and the split ones as
+// the finer cells across, so the surface stays closed where the stride changes.
+static const glm::ivec3 CUBE_CORNER[8] = {
+    glm::ivec3(0, 0, 0), glm::ivec3(1, 0, 0), glm::ivec3(1, 1, 0), glm::ivec3(0, 1, 0),
+    glm::ivec3(0, 0, 1), glm::ivec3(1, 0, 1), glm::ivec3(1, 1, 1), glm::ivec3(0, 1, 1)
+};
+static const int CUBE_EDGE[12][2] = {
+    {0, 1}, {1, 2}, {2, 3}, {3, 0}, {4, 5}, {5, 6}, {6, 7}, {7, 4}, {0, 4}, {1, 5}, {2, 6}, {3, 7}
+};
+
+struct LODCells
+{
+    FieldView field;      // at full resolution, for the crossings and the normals
+    int stride;
+    unsigned int finer;
+    IsoSurface::Mesh& mesh;
+    std::unordered_map<uint64_t, unsigned int> crossings; // vertex of an edge by its low point, axis and length
+    std::vector<glm::uvec2> segments;
+    std::vector<unsigned int> loop;
+
+    bool finerAt(int dx, int dy, int dz) const { return (finer >> ((dx + 1) + 3*(dy + 1) + 9*(dz + 1))) & 1u; }
+
+    // a and b on one axis, the vertex shared by every cell using the edge
+    unsigned int vertex(glm::ivec3 a, glm::ivec3 b)
+    {
+        if(b.x < a.x || b.y < a.y || b.z < a.z) std::swap(a, b);
+        const glm::ivec3 d = b - a;
+        const int axis = d.x ? 0 : d.y ? 1 : 2;
+        const uint64_t key = uint64_t(a.x) | uint64_t(a.y) << 12 | uint64_t(a.z) << 24 | uint64_t(axis) << 36 |
+                             uint64_t(d[axis]) << 38;
+        auto it = crossings.find(key);
+        if(it != crossings.end()) return it->second;
+        const unsigned int index = edgeVertex(field, a, b, mesh.vertices);
+        crossings[key] = index;
+        return index;
+    }
+
+    // the edge of stride points from p along axis: on the border of the window and
+    // shared with a finer one
+    bool split(const glm::ivec3& p, int axis) const
+    {
+        if(!finer) return false;
+        glm::ivec3 lo(0), hi(0);
+        for(int k = 0; k < 3; k++)
+            if(k != axis)
+            {
+                lo[k] = p[k] == 0 ? -1 : 0;
+                hi[k] = p[k] == field.size[k] - 1 ? 1 : 0;
+            }
+        for(int dz = lo.z; dz <= hi.z; dz++)
+            for(int dy = lo.y; dy <= hi.y; dy++)
+                for(int dx = lo.x; dx <= hi.x; dx++)
+                    if((dx || dy || dz) && finerAt(dx, dy, dz)) return true;
+        return false;
+    }
+
+    static int axisOf(const glm::ivec3& a, const glm::ivec3& b) { return a.x != b.x ? 0 : a.y != b.y ? 1 : 2; }
+
+    // each run of inside points around the polygon, from the crossing before it to the one after
+    void cut(const glm::ivec3* points, int n)
+    {
+        bool in[8];
+        for(int i = 0; i < n; i++)
+            in[i] = field.inside(points[i].x, points[i].y, points[i].z);
+        for(int i = 0; i < n; i++)
+        {
+            const int first = (i + 1) % n;
+            if(in[i] || !in[first]) continue;
+            int last = first;
+            while(in[(last + 1) % n])
+                last = (last + 1) % n;
+            segments.push_back(glm::uvec2(vertex(points[i], points[first]), vertex(points[last], points[(last + 1) % n])));
+        }
+    }
+
+    void cell(const glm::ivec3& p)
+    {
+        glm::ivec3 corner[8];
+        int cubeindex = 0;
+        for(int i = 0; i < 8; i++)
+        {
+            corner[i] = p + stride*CUBE_CORNER[i];
+            if(field.inside(corner[i].x, corner[i].y, corner[i].z)) cubeindex |= 1 << i;
+        }
+        bool transition = false;
+        for(int e = 0; e < 12 && finer && !transition; e++)
+        {
+            const glm::ivec3& a = corner[CUBE_EDGE[e][0]];
+            const glm::ivec3& b = corner[CUBE_EDGE[e][1]];
+            transition = split(glm::min(a, b), axisOf(a, b));
+        }
+        if(!transition)
+        {
+            for(int v = 0; v < numVertsTable[cubeindex]; v++)
+            {
+                const int e = triTable[cubeindex][v];
+                mesh.indices.push_back(vertex(corner[CUBE_EDGE[e][0]], corner[CUBE_EDGE[e][1]]));
+            }
+            return;
+        }
+
+        // faces counter-clockwise seen from outside the cell, so every segment runs from
+        // the crossing into its run to the crossing out of it, and a crossing one face
+        // enters the face across the side leaves
+        segments.clear();
+        for(int axis = 0; axis < 3; axis++)
+            for(int side = 0; side < 2; side++)
+            {
+                glm::ivec3 o = p, eu(0), ev(0), across(0);
+                o[axis] += side*stride;
+                eu[(axis + 1) % 3] = 1;
+                ev[(axis + 2) % 3] = 1;
+                if(!side)
+                    std::swap(eu, ev);
+                across[axis] = o[axis] == 0 ? -1 : 1;
+                if((o[axis] == 0 || o[axis] == field.size[axis] - 1) && finer && finerAt(across.x, across.y, across.z))
+                {
+                    // the finer cells' faces
+                    const int h = stride/2;
+                    for(int j = 0; j < 2; j++)
+                        for(int i = 0; i < 2; i++)
+                        {
+                            const glm::ivec3 q = o + h*(i*eu + j*ev);
+                            const glm::ivec3 quarter[4] = { q, q + h*eu, q + h*(eu + ev), q + h*ev };
+                            cut(quarter, 4);
+                        }
+                    continue;
+                }
+                const glm::ivec3 square[4] = { o, o + stride*eu, o + stride*(eu + ev), o + stride*ev };
+                glm::ivec3 polygon[8];
+                int n = 0;
+                for(int i = 0; i < 4; i++)
+                {
+                    const glm::ivec3& a = square[i];
+                    const glm::ivec3& b = square[(i + 1) % 4];
+                    polygon[n++] = a;
+                    if(split(glm::min(a, b), axisOf(a, b)))
+                        polygon[n++] = (a + b)/2;
+                }
+                cut(polygon, n);
+            }
+
+        // the segments chain into loops around the inside points
+        std::vector<bool> used(segments.size(), false);
+        for(size_t s = 0; s < segments.size(); s++)
+        {
+            if(used[s]) continue;
+            used[s] = true;
+            loop.assign(1, segments[s].x);
+            unsigned int at = segments[s].y;
+            while(at != loop[0])
+            {
+                loop.push_back(at);
+                size_t next = 0;
+                while(next < segments.size() && (used[next] || segments[next].x != at))
+                    next++;
+                if(next == segments.size()) break;
+                used[next] = true;
+                at = segments[next].y;
+            }
+            fan();
+        }
+    }
+
+    // the loop from its centre, wound like the table's triangles
+    void fan()
+    {
+        const size_t n = loop.size();
+        if(n < 3) return;
+        if(n == 3)
+        {
+            mesh.indices.insert(mesh.indices.end(), loop.rbegin(), loop.rend());
+            return;
+        }
+        IsoSurface::Vertex centre = { glm::vec3(0), glm::vec3(0) };
+        for(unsigned int i : loop)
+        {
+            centre.position += mesh.vertices[i].position;
+            centre.normal += mesh.vertices[i].normal;
+        }
+        centre.position /= float(n);
+        const float len = glm::length(centre.normal);
+        centre.normal = len > 0.0f ? centre.normal/len : glm::vec3(0, 0, 1);
+        mesh.vertices.push_back(centre);
+        const unsigned int c = (unsigned int)(mesh.vertices.size() - 1);
+        for(size_t i = 0; i < n; i++)
+        {
+            mesh.indices.push_back(c);
+            mesh.indices.push_back(loop[(i + 1) % n]);
+            mesh.indices.push_back(loop[i]);
+        }
+    }
+};
+
+void IsoSurface::PolygoniseLOD(const float* data, const glm::ivec3& gridSize, const glm::ivec3& pitch, int apron,
+                               int stride, unsigned int finer, float isoValue, Mesh& mesh)
+{
+    if(stride <= 1)
+    {
+        Polygonise(data, gridSize, pitch, apron, isoValue, mesh, 1);
+        return;
+    }
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    FieldView field = { data, gridSize, isoValue, nullptr, glm::ivec3(0), pitch, apron };
+    LODCells cells = { field, stride, finer, mesh, {}, {}, {} };
+    for(int z = 0; z + stride < gridSize.z; z += stride)
+        for(int y = 0; y + stride < gridSize.y; y += stride)
+            for(int x = 0; x + stride < gridSize.x; x += stride)
+                cells.cell(glm::ivec3(x, y, z));
+}
+
+// ------------------------------------------------------------------------
+double IsoSurface::MESH_MS = 0;
+unsigned int IsoSurface::MESH_TRIANGLES = 0;
+
+static const float* _field = nullptr;
+static glm::ivec3 _fieldSize(0);
+static bool _fieldDirty = false;
+static float _meshIsoValue = 0;
+static IsoSurface::Mesh _mesh;
+static IsoSurface::MinMaxTree _fieldBricks;
+
+void IsoSurface::SetField(const float* field, const glm::ivec3& gridSize)
+{
+    _field = field;
+    _fieldSize = gridSize;
+    _fieldDirty = true;
+    _fieldBricks.Build(field, gridSize);
+}
+
+template<typename T>
+void IsoSurface::DrawMesh(int target, float isoValue, const T& camera, const glm::mat4& model)
+{
+    if(!_field) return;
+
+    if(_fieldDirty || isoValue != _meshIsoValue)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        Polygonise(_field, _fieldSize, isoValue, _mesh, 0, &_fieldBricks);
+        glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+        glBufferData(GL_ARRAY_BUFFER, _mesh.vertices.size() * sizeof(Vertex), _mesh.vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(meshVAO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, _mesh.indices.size() * sizeof(unsigned int), _mesh.indices.data(), GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        MESH_MS = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        MESH_TRIANGLES = (unsigned int)(_mesh.indices.size() / 3);
+        _fieldDirty = false;
+        _meshIsoValue = isoValue;
+    }
+
+    // Set uniform attributes
+    _meshShaderHandle.use();
+    _meshShaderHandle.setMat4("projectionMatrix", camera.GetFrustumMatrix());
+    _meshShaderHandle.setMat4("modelMatrix", model*glm::scale(glm::mat4(1.0),
+                                             glm::vec3(_fieldSize.x/(float)_fieldSize.y,1.0f,_fieldSize.z/(float)_fieldSize.y)));
+    _meshShaderHandle.setVec3("viewPos",camera.Position);
+    _meshShaderHandle.setInt("volumeTex",target);
+    _meshShaderHandle.setVec3("voxelSize",1.0f/glm::vec3(_fieldSize));
+
+    // Draw, the table winding is front facing
+#ifdef FACE_CULLING
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+#endif
+    glBindVertexArray(meshVAO);
+    glDrawElements(GL_TRIANGLES, GLsizei(_mesh.indices.size()), GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+#ifdef FACE_CULLING
+    glDisable(GL_CULL_FACE);
+#endif
+}
+
+template void IsoSurface::DrawMesh<Camera>(int, float, const Camera&, const glm::mat4&);
+
 // Initialize 3d datafield
 //Datafield//
 static unsigned int _demoVolumeTex;
@@ -730,3 +1526,250 @@ void IsoSurface::Demo(int nx, int ny, int nz)
     delete [] dataField;
     dataField=NULL;
 }
+
+// ------------------------------------------------------------------------
+// GPU mesher
+// buffers grow with the grid and are kept between meshes
+unsigned int IsoSurface::GPU_TRIANGLES = 0;
+
+static const unsigned int GPU_ARGS = 9; // see mc.compact.compute.glsl
+static unsigned int gpuVAO, gpuVertices, gpuCounts, gpuPrefix, gpuActive, gpuArgs;
+static std::vector<unsigned int> gpuSums;  // block totals, one buffer per scan level
+static size_t gpuCells = 0;                // capacity of the per-cell buffers
+static unsigned int gpuMaxVertices = 0;    // capacity of the vertex buffer
+static GLsync gpuFence = 0;                // counts of the last mesh are readable once signalled
+static int gpuTarget = 0;
+static glm::ivec3 gpuGridSize(0);
+static float gpuIsoValue = 0;
+
+struct GPUVertex
+{
+    glm::vec4 position;
+    glm::vec4 normal;
+};
+
+bool IsoSurface::ComputeSupported()
+{
+    return GLAD_GL_VERSION_4_3 != 0;
+}
+
+static void resizeBuffer(unsigned int buffer, size_t bytes)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+static void growCellBuffers(size_t cells)
+{
+    if(gpuVAO == 0)
+    {
+        glGenBuffers(1, &gpuVertices);
+        glGenBuffers(1, &gpuCounts);
+        glGenBuffers(1, &gpuPrefix);
+        glGenBuffers(1, &gpuActive);
+        glGenBuffers(1, &gpuArgs);
+        resizeBuffer(gpuArgs, GPU_ARGS*sizeof(unsigned int));
+
+        glGenVertexArrays(1, &gpuVAO);
+        glBindVertexArray(gpuVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, gpuVertices);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GPUVertex), (void*)offsetof(GPUVertex, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GPUVertex), (void*)offsetof(GPUVertex, normal));
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    if(cells <= gpuCells) return;
+
+    resizeBuffer(gpuCounts, cells*sizeof(glm::uvec2));
+    resizeBuffer(gpuPrefix, cells*sizeof(glm::uvec2));
+    resizeBuffer(gpuActive, cells*sizeof(unsigned int));
+    glDeleteBuffers(GLsizei(gpuSums.size()), gpuSums.data());
+    gpuSums.clear();
+    for(size_t n = (cells + 255) / 256; ; n = (n + 255) / 256)
+    {
+        unsigned int sums;
+        glGenBuffers(1, &sums);
+        resizeBuffer(sums, n*sizeof(glm::uvec2));
+        gpuSums.push_back(sums);
+        if(n == 1) break;
+    }
+    gpuCells = cells;
+}
+
+// exclusive prefix sum of count uvec2 from values into prefix, level picks the sums buffer
+static void scan(unsigned int values, unsigned int prefix, size_t count, size_t level)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, values);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, prefix);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gpuSums[level]);
+    _scanShader.use();
+    _scanShader.setInt("count", int(count));
+    dispatch1D(count, 256);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    size_t blocks = (count + 255) / 256;
+    if(blocks == 1) return;
+    scan(gpuSums[level], gpuSums[level], blocks, level + 1);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, prefix);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gpuSums[level]);
+    _scanAddShader.use();
+    _scanAddShader.setInt("count", int(count));
+    dispatch1D(count, 256);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+static void setCellUniforms(const Shader& shader, size_t cells)
+{
+    shader.use();
+    shader.setInt("volumeTex", gpuTarget);
+    shader.setInt("numVertsTex", 11);
+    shader.setVec3i("gridSize", gpuGridSize);
+    shader.setFloat("isoValue", gpuIsoValue);
+    shader.setInt("cellCount", int(cells));
+    shader.setInt("maxVertices", int(gpuMaxVertices));
+}
+
+void IsoSurface::PolygoniseGPU(int target, const glm::ivec3& gridSize, float isoValue)
+{
+    if(!ComputeSupported()) return;
+    gpuTarget = target;
+    gpuGridSize = gridSize;
+    gpuIsoValue = isoValue;
+    const glm::ivec3 cellSize = gridSize - 1;
+    const size_t cells = size_t(std::max(cellSize.x, 0)) * std::max(cellSize.y, 0) * std::max(cellSize.z, 0);
+    if(cells == 0) return;
+    growCellBuffers(cells);
+
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_1D, triTableTex);
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_1D, numVertsTableTex);
+
+    // classify
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuCounts);
+    setCellUniforms(_classifyShader, cells);
+    dispatch1D(cells, 64);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // vertex offsets and active cell slots
+    scan(gpuCounts, gpuPrefix, cells, 0);
+
+    // compact, the last cell writes the indirect commands
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuCounts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpuPrefix);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, gpuActive);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, gpuArgs);
+    setCellUniforms(_compactShader, cells);
+    dispatch1D(cells, 64);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // the first mesh sizes the vertex buffer before it is generated
+    if(gpuMaxVertices == 0)
+    {
+        unsigned int args[GPU_ARGS];
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuArgs);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(args), args);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        gpuMaxVertices = std::max(args[7] + args[7]/2, 3u*1024u);
+        resizeBuffer(gpuVertices, size_t(gpuMaxVertices)*sizeof(GPUVertex));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuArgs);
+        args[0] = std::min(args[7], gpuMaxVertices);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(unsigned int), &args[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // generate, one thread per active cell
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, gpuVertices);
+    setCellUniforms(_generateShader, cells);
+    _generateShader.setInt("triTex", 10);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, gpuArgs);
+    glDispatchComputeIndirect(4*sizeof(unsigned int));
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    if(gpuFence) glDeleteSync(gpuFence);
+    gpuFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// reads the counts of the last mesh once the gpu is done with it, and meshes again
+// into a bigger buffer if it did not fit
+static void resolveGPU(bool wait)
+{
+    if(!gpuFence) return;
+    GLenum state = glClientWaitSync(gpuFence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GLuint64(-1) : 0);
+    if(state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED) return;
+    glDeleteSync(gpuFence);
+    gpuFence = 0;
+
+    unsigned int args[GPU_ARGS];
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuArgs);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(args), args);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    IsoSurface::GPU_TRIANGLES = args[7] / 3;
+    if(args[7] > gpuMaxVertices)
+    {
+        gpuMaxVertices = args[7] + args[7]/2;
+        resizeBuffer(gpuVertices, size_t(gpuMaxVertices)*sizeof(GPUVertex));
+        IsoSurface::PolygoniseGPU(gpuTarget, gpuGridSize, gpuIsoValue);
+        if(wait) resolveGPU(true);
+    }
+}
+
+void IsoSurface::ReadGPUMesh(Mesh& mesh)
+{
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    resolveGPU(true);
+    if(gpuMaxVertices == 0) return;
+
+    unsigned int count;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuArgs);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(count), &count);
+    std::vector<GPUVertex> vertices(count);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuVertices);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count*sizeof(GPUVertex), vertices.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    mesh.vertices.resize(count);
+    mesh.indices.resize(count);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        mesh.vertices[i].position = glm::vec3(vertices[i].position);
+        mesh.vertices[i].normal = glm::vec3(vertices[i].normal);
+        mesh.indices[i] = i;
+    }
+}
+
+template<typename T>
+void IsoSurface::DrawGPU(const T& camera, const glm::mat4& model)
+{
+    if(!ComputeSupported() || gpuMaxVertices == 0) return;
+    resolveGPU(false);
+
+    _meshShaderHandle.use();
+    _meshShaderHandle.setMat4("projectionMatrix", camera.GetFrustumMatrix());
+    _meshShaderHandle.setMat4("modelMatrix", model*glm::scale(glm::mat4(1.0),
+                                             glm::vec3(gpuGridSize.x/(float)gpuGridSize.y,1.0f,gpuGridSize.z/(float)gpuGridSize.y)));
+    _meshShaderHandle.setVec3("viewPos",camera.Position);
+    _meshShaderHandle.setInt("volumeTex",gpuTarget);
+    _meshShaderHandle.setVec3("voxelSize",1.0f/glm::vec3(gpuGridSize));
+
+#ifdef FACE_CULLING
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+#endif
+    glBindVertexArray(gpuVAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuArgs);
+    glDrawArraysIndirect(GL_TRIANGLES, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+#ifdef FACE_CULLING
+    glDisable(GL_CULL_FACE);
+#endif
+}
+
+template void IsoSurface::DrawGPU<Camera>(const Camera&, const glm::mat4&);
@@ -5,6 +5,9 @@
 // which are built from the interpolated edge vertices
 // Isosurface require: GLwindow, Camera initialized
 // can produce texture with 1-4 channels
+#include <vector>
+#include "glm/glm.hpp"
+
 namespace IsoSurface {
 void Init();
 void Demo(int nx, int ny, int nz);
@@ -12,8 +15,89 @@ void ReloadShader();
 void Finalize();
 
 // Passing 3d texture
+// after BuildBricks for the same gridSize only the cells of bricks straddling isoValue
+// are drawn (GL 4.3), every cell otherwise
 template<typename T, typename S> void Draw(int, float, const T&, const S&);
 
+// --- empty space skipping
+// A brick of BRICK_SIZE^3 cells can only hold surface when the field over its corners
+// has min < isoValue <= max. The ranges are built once per field, after which changing
+// isoValue only costs a pass over the bricks.
+const int BRICK_SIZE = 8;
+
+// CPU: ranges of the bricks and of 2x2x2 blocks of them up to a single root, a query
+// descends only into nodes that straddle isoValue
+struct MinMaxTree
+{
+    glm::ivec3 gridSize = glm::ivec3(0);
+    std::vector<glm::ivec3> levelSize;          // nodes per axis, bricks first
+    std::vector<std::vector<glm::vec2>> levels; // (min, max), x fastest
+
+    void Build(const float* field, const glm::ivec3& gridSize, int threads = 0);
+    // one flag per brick, returns how many are set
+    size_t Active(float isoValue, std::vector<unsigned char>& active) const;
+};
+
+// GPU: ranges of the bricks of the field in the 3d texture on unit target, read from the
+// channel Draw reads; call again whenever the texture is written
+void BuildBricks(int target, const glm::ivec3& gridSize);
+
+extern float ACTIVE_BRICKS; // fraction of bricks visited by the last Polygonise or Draw
+
+// --- CPU mesher
+struct Vertex
+{
+    glm::vec3 position; // grid vertex i maps to i/gridSize, like the geometry shader path
+    glm::vec3 normal;   // field gradient, smooth across shared edges
+};
+struct Mesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+};
+
+// field holds one value per grid vertex, x fastest. z-slabs are meshed in parallel and
+// every edge crossing is emitted once, neighbouring cells and slabs share the vertex.
+// threads <= 0 uses every core; bricks built for the same field skip the empty ones
+void Polygonise(const float* field, const glm::ivec3& gridSize, float isoValue, Mesh& mesh, int threads = 0,
+                const MinMaxTree* bricks = nullptr);
+// a gridSize window of a larger array of pitch points per axis, field pointing at its first
+// point: the gradients read up to apron points outside the window, so the chunks of a
+// bigger field mesh with the normals the whole field would have
+void Polygonise(const float* field, const glm::ivec3& gridSize, const glm::ivec3& pitch, int apron,
+                float isoValue, Mesh& mesh, int threads = 0);
+// the window at a coarser level: cells of stride points a side, stride a power of two
+// dividing gridSize - 1. finer flags the neighbouring windows meshed at half the stride,
+// bit (dx+1) + 3*(dy+1) + 9*(dz+1) for the window at offset (dx, dy, dz); the cells along
+// them take in their points so the two meet without cracks. Neighbours may differ by one
+// level at most. Normals stay the full resolution field's; one thread, a window a job
+void PolygoniseLOD(const float* field, const glm::ivec3& gridSize, const glm::ivec3& pitch, int apron,
+                   int stride, unsigned int finer, float isoValue, Mesh& mesh);
+
+// Drawing a field meshed on the CPU: the mesh is built and uploaded once, and again only
+// after SetField or a change of isoValue. SetField builds the brick ranges, the field is
+// read again when meshing, keep it alive.
+// target is the 3d texture unit the colour is sampled from, as for Draw
+void SetField(const float* field, const glm::ivec3& gridSize);
+template<typename T> void DrawMesh(int target, float isoValue, const T& camera, const glm::mat4& model = glm::mat4(1));
+
+extern double MESH_MS;            // last rebuild, polygonise and upload
+extern unsigned int MESH_TRIANGLES;
+
+// --- GPU mesher (compute shaders, GL 4.3)
+// Cells are classified, their vertex counts prefix-summed and the active ones compacted
+// on the gpu, which then writes the vertices into a buffer drawn with glDrawArraysIndirect.
+// The result is the CPU mesher's, unwelded: the same triangles in the same order.
+// The count never comes back to the cpu before drawing; the buffer is resized a few frames
+// later when a mesh outgrows it (DrawGPU meshes again), or right away the first time.
+bool ComputeSupported();
+// field read from the R32F 3d texture bound to unit target
+void PolygoniseGPU(int target, const glm::ivec3& gridSize, float isoValue);
+template<typename T> void DrawGPU(const T& camera, const glm::mat4& model = glm::mat4(1));
+// waits for the gpu, indices are 0..n-1
+void ReadGPUMesh(Mesh& mesh);
+
+extern unsigned int GPU_TRIANGLES; // last PolygoniseGPU, once its counts are back
 }
 
 #endif
@@ -0,0 +1,126 @@
+#include "nullgl.h"
+
+#include <glad/glad.h>
+#include <cstring>
+#include <cstdint>
+
+namespace NullGL {
+
+static GLuint NEXT_NAME = 1;
+
+// every entry point without outputs shares this stub, arguments are ignored.
+// calling it through a mismatched pointer type relies on caller-cleans-up
+// conventions (x86-64 SysV and Win64, AArch64), not on 32-bit __stdcall
+static intptr_t APIENTRY noop() { return 0; }
+
+// --- object names
+static void APIENTRY genNames(GLsizei n, GLuint* names)
+{
+    for(GLsizei i = 0; i < n; i++)
+        names[i] = NEXT_NAME++;
+}
+static void APIENTRY createNames(GLenum, GLsizei n, GLuint* names) { genNames(n, names); }
+static GLuint APIENTRY createObject() { return NEXT_NAME++; }
+
+// --- state queries
+static const GLubyte* APIENTRY getString(GLenum name)
+{
+    const char* str = "";
+    if(name == GL_VERSION) str = "4.6.0 NullGL";
+    if(name == GL_VENDOR || name == GL_RENDERER) str = "NullGL";
+    if(name == GL_SHADING_LANGUAGE_VERSION) str = "4.60";
+    return reinterpret_cast<const GLubyte*>(str);
+}
+static const GLubyte* APIENTRY getStringi(GLenum, GLuint) { return reinterpret_cast<const GLubyte*>("GL_NullGL"); }
+static void APIENTRY getIntegerv(GLenum pname, GLint* data)
+{
+    *data = 0;
+    if(pname == GL_NUM_EXTENSIONS) *data = 1; // glad gives up on an empty extension list
+    if(pname == GL_MAJOR_VERSION) *data = 4;
+    if(pname == GL_MINOR_VERSION) *data = 6;
+}
+static void APIENTRY getFloatv(GLenum, GLfloat* data) { *data = 0.0f; }
+static void APIENTRY getObjectiv(GLuint, GLenum pname, GLint* params)
+{
+    *params = (pname == GL_COMPILE_STATUS || pname == GL_LINK_STATUS || pname == GL_VALIDATE_STATUS) ? GL_TRUE : 0;
+}
+static GLint APIENTRY getLocation(GLuint, const GLchar*) { return -1; }
+static GLenum APIENTRY framebufferComplete() { return GL_FRAMEBUFFER_COMPLETE; }
+
+// --- queries and fences finish immediately, every timer reads 0
+static void APIENTRY getQueryiv(GLuint, GLenum pname, GLint* params) { *params = pname == GL_QUERY_RESULT_AVAILABLE; }
+static void APIENTRY getQueryuiv(GLuint, GLenum pname, GLuint* params) { *params = pname == GL_QUERY_RESULT_AVAILABLE; }
+static void APIENTRY getQuery64v(GLuint, GLenum pname, GLint64* params) { *params = pname == GL_QUERY_RESULT_AVAILABLE; }
+static void APIENTRY getQueryu64v(GLuint, GLenum pname, GLuint64* params) { *params = pname == GL_QUERY_RESULT_AVAILABLE; }
+static GLsync APIENTRY fenceSync(GLenum, GLbitfield) { return reinterpret_cast<GLsync>(intptr_t(NEXT_NAME++)); }
+static GLenum APIENTRY clientWaitSync(GLsync, GLbitfield, GLuint64) { return GL_ALREADY_SIGNALED; }
+static void APIENTRY getSynciv(GLsync, GLenum pname, GLsizei bufSize, GLsizei* length, GLint* values)
+{
+    if(length) *length = 1;
+    if(bufSize > 0) *values = pname == GL_SYNC_STATUS ? GL_SIGNALED : 0;
+}
+
+struct Entry
+{
+    const char* name;
+    void* proc;
+};
+
+#define NULLGL_ENTRY(name, stub) { #name, reinterpret_cast<void*>(&stub) }
+static const Entry ENTRIES[] =
+{
+    NULLGL_ENTRY(glGenTextures, genNames),
+    NULLGL_ENTRY(glGenBuffers, genNames),
+    NULLGL_ENTRY(glGenVertexArrays, genNames),
+    NULLGL_ENTRY(glGenFramebuffers, genNames),
+    NULLGL_ENTRY(glGenRenderbuffers, genNames),
+    NULLGL_ENTRY(glGenQueries, genNames),
+    NULLGL_ENTRY(glGenSamplers, genNames),
+    NULLGL_ENTRY(glGenProgramPipelines, genNames),
+    NULLGL_ENTRY(glGenTransformFeedbacks, genNames),
+    NULLGL_ENTRY(glCreateBuffers, genNames),
+    NULLGL_ENTRY(glCreateVertexArrays, genNames),
+    NULLGL_ENTRY(glCreateFramebuffers, genNames),
+    NULLGL_ENTRY(glCreateRenderbuffers, genNames),
+    NULLGL_ENTRY(glCreateSamplers, genNames),
+    NULLGL_ENTRY(glCreateTextures, createNames),
+    NULLGL_ENTRY(glCreateQueries, createNames),
+    NULLGL_ENTRY(glCreateShader, createObject),
+    NULLGL_ENTRY(glCreateProgram, createObject),
+
+    NULLGL_ENTRY(glGetString, getString),
+    NULLGL_ENTRY(glGetStringi, getStringi),
+    NULLGL_ENTRY(glGetIntegerv, getIntegerv),
+    NULLGL_ENTRY(glGetFloatv, getFloatv),
+    NULLGL_ENTRY(glGetShaderiv, getObjectiv),
+    NULLGL_ENTRY(glGetProgramiv, getObjectiv),
+    NULLGL_ENTRY(glGetUniformLocation, getLocation),
+    NULLGL_ENTRY(glGetAttribLocation, getLocation),
+    NULLGL_ENTRY(glCheckFramebufferStatus, framebufferComplete),
+    NULLGL_ENTRY(glCheckNamedFramebufferStatus, framebufferComplete),
+
+    NULLGL_ENTRY(glGetQueryObjectiv, getQueryiv),
+    NULLGL_ENTRY(glGetQueryObjectuiv, getQueryuiv),
+    NULLGL_ENTRY(glGetQueryObjecti64v, getQuery64v),
+    NULLGL_ENTRY(glGetQueryObjectui64v, getQueryu64v),
+    NULLGL_ENTRY(glFenceSync, fenceSync),
+    NULLGL_ENTRY(glClientWaitSync, clientWaitSync),
+    NULLGL_ENTRY(glGetSynciv, getSynciv),
+};
+#undef NULLGL_ENTRY
+
+static void* getProc(const char* name)
+{
+    for(const Entry& entry : ENTRIES)
+        if(strcmp(entry.name, name) == 0)
+            return entry.proc;
+    return reinterpret_cast<void*>(&noop);
+}
+
+bool Load()
+{
+    NEXT_NAME = 1;
+    return gladLoadGLLoader(getProc) != 0;
+}
+
+}
@@ -0,0 +1,15 @@
+#ifndef NULLGL_H
+#define NULLGL_H
+
+// GL backend that accepts every call and draws nothing, used to run the CPU side
+// of a demo (quadtree updates, benchmarks) in CI without a GPU or a window.
+// object names are unique, shaders always compile and link, queries and reads
+// return zeros, framebuffers are complete and fences are signalled.
+namespace NullGL {
+
+// points every glad entry point at a stub; false if glad rejects the loader
+bool Load();
+
+}
+
+#endif
@@ -0,0 +1,548 @@
+#include "profiler.h"
+
+#if PROFILER_ENABLED
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <thread>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <cstdarg>
+#include <iostream>
+
+#include "imgui.h"
+
+namespace Profiler {
+
+bool ENABLED = true;
+
+// a frame's timestamp queries are read back when its slot comes round again,
+// two frames later, so the gpu has normally finished them
+static const int FRAME_SLOTS = 2;
+static const size_t HISTORY_SIZE = 120;
+static const GLsizei QUERY_BATCH = 64;
+
+struct Slot
+{
+    Frame frame;
+    std::vector<GLuint> queries;
+    int queriesUsed = 0;
+    bool open = false;
+    bool pending = false; // closed, waiting for its queries
+};
+
+static Slot SLOTS[FRAME_SLOTS];
+static int CURRENT = 0;
+static uint64_t FRAME_INDEX = 0;
+static std::vector<int> STACK; // open events of the current frame, -1 for ignored scopes
+static std::vector<Frame> HISTORY;
+
+static std::thread::id OWNER;
+static bool OWNED = false;
+static unsigned int LATE_FRAMES = 0; // queries not ready after two frames, gpu times dropped
+static float SCOPE_COST_NS = 0.0f;   // measured cost of one cpu scope
+
+static bool PAUSED = false;
+static Frame FROZEN;
+
+// trace capture: frames [CAPTURE_FROM, CAPTURE_TO) are written as they resolve
+static FILE* TRACE = nullptr;
+static std::vector<char> TRACE_BUFFER;
+static uint64_t CAPTURE_FROM = 0, CAPTURE_TO = 0;
+static bool TRACE_GPU_ALIGNED = false;
+static int64_t TRACE_GPU_OFFSET = 0; // gpu clock to cpu clock, fixed for the whole capture
+static unsigned int TRACE_EVENTS = 0;
+static int CAPTURE_FRAMES = 120;       // gui setting
+
+static const std::chrono::steady_clock::time_point START = std::chrono::steady_clock::now();
+
+static inline uint64_t now()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - START).count());
+}
+
+static void writeFrame(const Frame& frame);
+static void closeTrace();
+
+static void resolve(Slot& slot, bool wait = false)
+{
+    slot.pending = false;
+    if(slot.queriesUsed > 0)
+    {
+        // queries complete in order, the last one answers for all of them
+        GLint available = wait ? 1 : 0;
+        if(!wait)
+            glGetQueryObjectiv(slot.queries[slot.queriesUsed - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available)
+        {
+            for(Event& e : slot.frame.events)
+            {
+                if(e.gpuQuery < 0) continue;
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(slot.queries[e.gpuQuery], GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(slot.queries[e.gpuQuery + 1], GL_QUERY_RESULT, &end);
+                e.gpuBegin = begin;
+                e.gpuEnd = end;
+            }
+        }
+        else
+        {
+            LATE_FRAMES++;
+        }
+    }
+
+    if(TRACE && slot.frame.index >= CAPTURE_FROM && slot.frame.index < CAPTURE_TO)
+    {
+        writeFrame(slot.frame);
+        if(slot.frame.index + 1 >= CAPTURE_TO)
+            closeTrace();
+    }
+
+    HISTORY.push_back(std::move(slot.frame));
+    if(HISTORY.size() > HISTORY_SIZE)
+        HISTORY.erase(HISTORY.begin());
+    slot.frame = Frame();
+}
+
+// cost of an empty cpu scope, measured once on the owner thread
+static void calibrate(Slot& slot)
+{
+    const int N = 1000;
+    slot.open = true;
+    uint64_t begin = now();
+    for(int i = 0; i < N; i++)
+    {
+        Push("calibration", false);
+        Pop();
+    }
+    SCOPE_COST_NS = float(now() - begin)/N;
+    slot.open = false;
+    slot.frame.events.clear();
+}
+
+void NewFrame()
+{
+    if(!OWNED)
+    {
+        OWNER = std::this_thread::get_id();
+        OWNED = true;
+        calibrate(SLOTS[CURRENT]);
+    }
+
+    Slot& current = SLOTS[CURRENT];
+    if(current.open)
+    {
+        current.frame.cpuEnd = now();
+        current.open = false;
+        current.pending = true;
+    }
+    STACK.clear();
+
+    CURRENT = (CURRENT + 1) % FRAME_SLOTS;
+    Slot& next = SLOTS[CURRENT];
+    if(next.pending)
+        resolve(next);
+    next.frame.events.clear();
+    next.queriesUsed = 0;
+
+    if(!ENABLED)
+        return;
+    next.frame.index = FRAME_INDEX++;
+    next.frame.cpuBegin = now();
+    next.frame.cpuEnd = 0;
+    next.open = true;
+}
+
+void Push(const char* name, bool gpu)
+{
+    if(!OWNED || std::this_thread::get_id() != OWNER)
+        return;
+    Slot& slot = SLOTS[CURRENT];
+    if(!slot.open)
+    {
+        STACK.push_back(-1);
+        return;
+    }
+
+    Event e;
+    e.name = name;
+    e.depth = int(STACK.size());
+    e.gpuQuery = -1;
+    e.gpuBegin = e.gpuEnd = 0;
+    e.cpuEnd = 0;
+    if(gpu)
+    {
+        if(slot.queriesUsed + 2 > int(slot.queries.size()))
+        {
+            size_t size = slot.queries.size();
+            slot.queries.resize(size + QUERY_BATCH);
+            glGenQueries(QUERY_BATCH, &slot.queries[size]);
+        }
+        e.gpuQuery = slot.queriesUsed;
+        slot.queriesUsed += 2;
+        glQueryCounter(slot.queries[e.gpuQuery], GL_TIMESTAMP);
+    }
+
+    STACK.push_back(int(slot.frame.events.size()));
+    e.cpuBegin = now();
+    slot.frame.events.push_back(e);
+}
+
+void Pop()
+{
+    if(!OWNED || std::this_thread::get_id() != OWNER || STACK.empty())
+        return;
+    int index = STACK.back();
+    STACK.pop_back();
+    if(index < 0)
+        return;
+
+    Slot& slot = SLOTS[CURRENT];
+    Event& e = slot.frame.events[index];
+    e.cpuEnd = now();
+    if(e.gpuQuery >= 0)
+        glQueryCounter(slot.queries[e.gpuQuery + 1], GL_TIMESTAMP);
+}
+
+const std::vector<Frame>& History()
+{
+    return HISTORY;
+}
+
+void Finalize()
+{
+    Slot& current = SLOTS[CURRENT];
+    if(current.open)
+    {
+        current.frame.cpuEnd = now();
+        current.open = false;
+        current.pending = true;
+    }
+    STACK.clear();
+
+    // oldest first
+    for(int i = 1; i <= FRAME_SLOTS; i++)
+    {
+        Slot& slot = SLOTS[(CURRENT + i) % FRAME_SLOTS];
+        if(slot.pending)
+            resolve(slot, true);
+    }
+    closeTrace();
+}
+
+// --- chrome trace
+
+static void traceEvent(const char* fmt, ...)
+{
+    fputs(TRACE_EVENTS++ ? ",\n" : "\n", TRACE);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(TRACE, fmt, args);
+    va_end(args);
+}
+
+static void writeFrame(const Frame& frame)
+{
+    traceEvent("{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"index\":%llu}}",
+               frame.cpuBegin*1e-3, (frame.cpuEnd - frame.cpuBegin)*1e-3, (unsigned long long)frame.index);
+    for(const Event& e : frame.events)
+    {
+        traceEvent("{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                   e.name, e.cpuBegin*1e-3, (e.cpuEnd - e.cpuBegin)*1e-3);
+        if(e.gpuQuery < 0 || e.gpuEnd == 0)
+            continue;
+
+        // the gpu clock is unrelated to steady_clock: the first gpu scope of the
+        // capture is placed at its cpu begin, later ones keep their gpu spacing
+        if(!TRACE_GPU_ALIGNED)
+        {
+            TRACE_GPU_OFFSET = int64_t(e.cpuBegin) - int64_t(e.gpuBegin);
+            TRACE_GPU_ALIGNED = true;
+        }
+        traceEvent("{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f}",
+                   e.name, (int64_t(e.gpuBegin) + TRACE_GPU_OFFSET)*1e-3, (e.gpuEnd - e.gpuBegin)*1e-3);
+    }
+    // one frame at a time reaches the disk, nothing accumulates
+    fflush(TRACE);
+}
+
+static void closeTrace()
+{
+    if(!TRACE)
+        return;
+    fputs("\n]}\n", TRACE);
+    fclose(TRACE);
+    TRACE = nullptr;
+    std::cout << "Profiler: trace closed, " << TRACE_EVENTS << " events" << std::endl;
+}
+
+bool BeginCapture(const std::string& path, int frames)
+{
+    if(TRACE)
+    {
+        std::cout << "Profiler: a capture is already running" << std::endl;
+        return false;
+    }
+    TRACE = fopen(path.c_str(), "w");
+    if(!TRACE)
+    {
+        std::cout << "Profiler: cannot write " << path << std::endl;
+        return false;
+    }
+    TRACE_BUFFER.resize(1 << 20);
+    setvbuf(TRACE, &TRACE_BUFFER[0], _IOFBF, TRACE_BUFFER.size());
+
+    TRACE_EVENTS = 0;
+    TRACE_GPU_ALIGNED = false;
+    CAPTURE_FROM = FRAME_INDEX;
+    CAPTURE_TO = frames > 0 ? CAPTURE_FROM + frames : UINT64_MAX;
+    ENABLED = true;
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", TRACE);
+    traceEvent("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"LodDemo\"}}");
+    traceEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"cpu\"}}");
+    traceEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"gpu\"}}");
+    std::cout << "Profiler: capturing " << (frames > 0 ? std::to_string(frames) : std::string("all"))
+              << " frames to " << path << std::endl;
+    return true;
+}
+
+void EndCapture()
+{
+    if(!TRACE)
+        return;
+
+    // keep the frames already recorded, they are written when they resolve
+    const Slot& current = SLOTS[CURRENT];
+    CAPTURE_TO = std::min(CAPTURE_TO, current.open ? current.frame.index + 1 : FRAME_INDEX);
+    bool waiting = false;
+    for(const Slot& slot : SLOTS)
+        waiting |= (slot.open || slot.pending) && slot.frame.index >= CAPTURE_FROM && slot.frame.index < CAPTURE_TO;
+    if(!waiting)
+        closeTrace();
+}
+
+bool Capturing()
+{
+    const Slot& current = SLOTS[CURRENT];
+    return TRACE && current.open && current.frame.index >= CAPTURE_FROM && current.frame.index < CAPTURE_TO
+            && std::this_thread::get_id() == OWNER;
+}
+
+void Instant(const char* name, TraceArgs args)
+{
+    if(!Capturing())
+        return;
+    traceEvent("{\"name\":\"%s\",\"cat\":\"event\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"args\":{",
+               name, now()*1e-3);
+    bool first = true;
+    for(const auto& arg : args)
+    {
+        fprintf(TRACE, "%s\"%s\":%lld", first ? "" : ",", arg.first, arg.second);
+        first = false;
+    }
+    fputs("}}", TRACE);
+}
+
+void Counter(const char* name, double value)
+{
+    if(!Capturing())
+        return;
+    traceEvent("{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%.6g}}",
+               name, now()*1e-3, value);
+}
+
+// --- gui
+
+static ImU32 colorOf(const char* name)
+{
+    // FNV-1a of the name, mapped to a muted hue
+    unsigned int hash = 2166136261u;
+    for(const char* c = name; *c; c++)
+        hash = (hash ^ (unsigned char)(*c))*16777619u;
+    float r, g, b;
+    ImGui::ColorConvertHSVtoRGB((hash % 360)/360.0f, 0.5f, 0.8f, r, g, b);
+    return ImGui::GetColorU32(ImVec4(r, g, b, 1.0f));
+}
+
+static void drawTimeline(const Frame& frame)
+{
+    const float ROW = ImGui::GetTextLineHeight() + 4.0f;
+
+    // gpu timestamps are on their own clock: the first gpu scope is placed at its cpu begin
+    uint64_t gpuOrigin = 0, gpuAnchor = 0;
+    int cpuRows = 0, gpuRows = 0;
+    uint64_t span = frame.cpuEnd - frame.cpuBegin;
+    for(const Event& e : frame.events)
+    {
+        cpuRows = std::max(cpuRows, e.depth + 1);
+        if(e.gpuQuery < 0 || e.gpuEnd == 0) continue;
+        if(gpuOrigin == 0)
+        {
+            gpuOrigin = e.gpuBegin;
+            gpuAnchor = e.cpuBegin - frame.cpuBegin;
+        }
+        gpuRows = std::max(gpuRows, e.depth + 1);
+        span = std::max(span, gpuAnchor + (e.gpuEnd - gpuOrigin));
+    }
+    if(span == 0)
+        return;
+
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+    float height = ROW*(cpuRows + gpuRows) + (gpuRows ? ROW*0.5f : 0.0f);
+    ImGui::InvisibleButton("timeline", ImVec2(width, std::max(height, ROW)));
+    bool hovered = ImGui::IsItemHovered();
+    ImVec2 mouse = ImGui::GetIO().MousePos;
+
+    ImDrawList* draw = ImGui::GetWindowDrawList();
+    draw->PushClipRect(origin, ImVec2(origin.x + width, origin.y + height), true);
+    float scale = width/float(span);
+
+    const Event* tip = nullptr;
+    bool tipGpu = false;
+    for(int pass = 0; pass < 2; pass++)
+    {
+        for(const Event& e : frame.events)
+        {
+            uint64_t begin, end;
+            float y;
+            if(pass == 0)
+            {
+                begin = e.cpuBegin - frame.cpuBegin;
+                end = e.cpuEnd - frame.cpuBegin;
+                y = origin.y + ROW*e.depth;
+            }
+            else
+            {
+                if(e.gpuQuery < 0 || e.gpuEnd == 0) continue;
+                begin = gpuAnchor + (e.gpuBegin - gpuOrigin);
+                end = gpuAnchor + (e.gpuEnd - gpuOrigin);
+                y = origin.y + ROW*(cpuRows + e.depth) + ROW*0.5f;
+            }
+            ImVec2 a(origin.x + begin*scale, y);
+            ImVec2 b(std::max(origin.x + end*scale, a.x + 1.0f), y + ROW - 1.0f);
+            draw->AddRectFilled(a, b, colorOf(e.name), 2.0f);
+            if(b.x - a.x > ImGui::CalcTextSize(e.name).x + 4.0f)
+                draw->AddText(ImVec2(a.x + 2.0f, a.y + 2.0f), IM_COL32(0, 0, 0, 255), e.name);
+            if(hovered && mouse.x >= a.x && mouse.x < b.x && mouse.y >= a.y && mouse.y < b.y)
+            {
+                tip = &e;
+                tipGpu = pass == 1;
+            }
+        }
+    }
+    draw->PopClipRect();
+
+    if(tip)
+    {
+        ImGui::BeginTooltip();
+        ImGui::Text("%s (%s)", tip->name, tipGpu ? "gpu" : "cpu");
+        ImGui::Text("cpu %.3f ms", (tip->cpuEnd - tip->cpuBegin)*1e-6);
+        if(tip->gpuEnd)
+            ImGui::Text("gpu %.3f ms", (tip->gpuEnd - tip->gpuBegin)*1e-6);
+        ImGui::EndTooltip();
+    }
+}
+
+void gui_interface()
+{
+    if(!ImGui::TreeNode("Profiler"))
+        return;
+
+    ImGui::Checkbox("Enabled", &ENABLED);
+    ImGui::SameLine();
+    if(ImGui::Checkbox("Pause", &PAUSED) && PAUSED && !HISTORY.empty())
+        FROZEN = HISTORY.back();
+
+    if(TRACE)
+    {
+        ImGui::Text("Capturing trace: %u events", TRACE_EVENTS);
+        ImGui::SameLine();
+        if(ImGui::Button("Stop"))
+            EndCapture();
+    }
+    else
+    {
+        ImGui::SliderInt("frames", &CAPTURE_FRAMES, 1, 1000);
+        ImGui::SameLine();
+        if(ImGui::Button("Capture trace"))
+            BeginCapture("trace.json", CAPTURE_FRAMES);
+    }
+
+    if(HISTORY.empty())
+    {
+        ImGui::Text("No frames recorded yet");
+        ImGui::TreePop();
+        return;
+    }
+    const Frame& frame = PAUSED ? FROZEN : HISTORY.back();
+
+    // rolling cpu frame time
+    std::vector<float> frameMs;
+    for(const Frame& f : HISTORY)
+        frameMs.push_back((f.cpuEnd - f.cpuBegin)*1e-6f);
+    ImGui::PlotLines("cpu ms", &frameMs[0], int(frameMs.size()), 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 40));
+
+    float frameTime = (frame.cpuEnd - frame.cpuBegin)*1e-6f;
+    float overhead = frame.events.size()*SCOPE_COST_NS*1e-6f;
+    ImGui::Text("Frame %llu: %.3f ms, %d scopes, overhead ~%.3f ms (%.2f%%)",
+                (unsigned long long)frame.index, frameTime, int(frame.events.size()),
+                overhead, frameTime > 0.0f ? 100.0f*overhead/frameTime : 0.0f);
+    if(LATE_FRAMES)
+        ImGui::Text("Gpu timings dropped for %u frames (queries not ready)", LATE_FRAMES);
+
+    drawTimeline(frame);
+
+    // per scope averages over the history, in the order of the displayed frame
+    struct Average { double cpu = 0.0, gpu = 0.0; int count = 0, gpuCount = 0; };
+    std::map<std::string, Average> averages;
+    for(const Frame& f : HISTORY)
+    {
+        for(const Event& e : f.events)
+        {
+            Average& avg = averages[e.name];
+            avg.cpu += (e.cpuEnd - e.cpuBegin)*1e-6;
+            avg.count++;
+            if(e.gpuEnd)
+            {
+                avg.gpu += (e.gpuEnd - e.gpuBegin)*1e-6;
+                avg.gpuCount++;
+            }
+        }
+    }
+    float frames = float(HISTORY.size());
+
+    ImGui::Columns(4, "profiler_scopes");
+    ImGui::Text("scope"); ImGui::NextColumn();
+    ImGui::Text("calls"); ImGui::NextColumn();
+    ImGui::Text("cpu ms/frame"); ImGui::NextColumn();
+    ImGui::Text("gpu ms/frame"); ImGui::NextColumn();
+    ImGui::Separator();
+    std::map<std::string, bool> listed;
+    for(const Event& e : frame.events)
+    {
+        if(listed[e.name]) continue;
+        listed[e.name] = true;
+        const Average& avg = averages[e.name];
+        ImGui::Text("%*s%s", 2*e.depth, "", e.name); ImGui::NextColumn();
+        ImGui::Text("%.1f", avg.count/frames); ImGui::NextColumn();
+        ImGui::Text("%.3f", avg.cpu/frames); ImGui::NextColumn();
+        if(avg.gpuCount)
+            ImGui::Text("%.3f", avg.gpu/frames);
+        else
+            ImGui::Text("-");
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+
+    ImGui::TreePop();
+}
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Hierarchical frame profiler
+// PROFILE_SCOPE("name") times the enclosing block on the CPU, nested scopes form a tree;
+// PROFILE_GPU_SCOPE("name") also brackets the GL commands issued inside it with a pair of
+// timestamp queries. Queries are read two frames later, never waited on.
+// Names must be string literals (the pointer is kept). Only the thread that called
+// Profiler::NewFrame first is recorded, scopes on worker threads are ignored.
+// BeginCapture streams the recorded frames to a Chrome Trace Event file (chrome://tracing,
+// Perfetto): scopes on a cpu and a gpu track, plus Instant events and Counter values.
+// Compiled out when PROFILER_ENABLED is 0, which is the default for release (NDEBUG) builds.
+
+#include <string>
+#include <utility>
+#include <initializer_list>
+
+typedef std::initializer_list<std::pair<const char*, long long>> TraceArgs;
+
+#ifndef PROFILER_ENABLED
+#ifdef NDEBUG
+#define PROFILER_ENABLED 0
+#else
+#define PROFILER_ENABLED 1
+#endif
+#endif
+
+#if PROFILER_ENABLED
+
+#include <vector>
+#include <cstdint>
+
+namespace Profiler {
+
+struct Event
+{
+    const char* name;
+    int depth;
+    uint64_t cpuBegin, cpuEnd; // ns since the profiler started
+    int gpuQuery;              // first of the query pair in the frame's pool, -1 for cpu only
+    uint64_t gpuBegin, gpuEnd; // ns on the gpu clock, 0 until resolved
+};
+
+struct Frame
+{
+    uint64_t index = 0;
+    uint64_t cpuBegin = 0, cpuEnd = 0;
+    std::vector<Event> events; // in begin order, parents before children
+};
+
+// closes the current frame and opens the next one; call once per frame outside any scope
+void NewFrame();
+void Push(const char* name, bool gpu);
+void Pop();
+
+// frames whose gpu times are resolved, oldest first
+const std::vector<Frame>& History();
+void gui_interface();
+// closes the open frame and resolves the pending ones, waiting on their queries;
+// call before the context goes away to complete a capture
+void Finalize();
+
+// trace capture, starts with the next frame; frames <= 0 records until EndCapture.
+// events are written as their frames resolve, memory use does not grow with the capture
+bool BeginCapture(const std::string& path, int frames = 0);
+void EndCapture();
+bool Capturing();
+// point event on the cpu track, args are written as integers
+void Instant(const char* name, TraceArgs args = TraceArgs());
+// counter track sample at the current time
+void Counter(const char* name, double value);
+
+extern bool ENABLED; // runtime switch, scopes stop recording when off
+
+}
+
+struct ProfileScope
+{
+    ProfileScope(const char* name, bool gpu = false) { Profiler::Push(name, gpu); }
+    ~ProfileScope() { Profiler::Pop(); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name, true)
+
+#else
+
+namespace Profiler {
+inline void NewFrame() {}
+inline void gui_interface() {}
+inline void Finalize() {}
+inline bool BeginCapture(const std::string&, int = 0) { return false; }
+inline void EndCapture() {}
+inline bool Capturing() { return false; }
+inline void Instant(const char*, TraceArgs = TraceArgs()) {}
+inline void Counter(const char*, double) {}
+}
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+
+#endif
+
+#endif
@@ -1,10 +1,96 @@
 #include "shader.h"
+#include "filesystem.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <set>
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath):ID(0),isComputeShader(false)
+unsigned int Shader::UNIFORM_CALL_COUNT = 0;
+unsigned int Shader::LOCATION_QUERY_COUNT = 0;
+unsigned int Shader::BINARY_CACHE_HITS = 0;
+unsigned int Shader::BINARY_CACHE_MISSES = 0;
+std::string Shader::BINARY_CACHE_DIR;
+
+// linked programs built with injected defines, keyed by the final sources
+static std::unordered_map<std::string, GLuint> PERMUTATIONS;
+
+static std::string directoryOf(const std::string& path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+// splice #include "file" (relative to the including file) into the source,
+// every file is included at most once
+static std::string expandIncludes(const std::string& code, const std::string& path, std::set<std::string>& included)
+{
+    std::istringstream in(code);
+    std::ostringstream out;
+    std::string line;
+    int lineNumber = 0;
+    while(std::getline(in, line))
+    {
+        lineNumber++;
+        size_t first = line.find_first_not_of(" \t");
+        if(first == std::string::npos || line.compare(first, 8, "#include") != 0)
+        {
+            out << line << '\n';
+            continue;
+        }
+
+        size_t open = line.find('"', first), close = line.find('"', open + 1);
+        if(open == std::string::npos || close == std::string::npos)
+        {
+            std::cout << "ERROR::SHADER::MALFORMED_INCLUDE in " << path << ":" << lineNumber << std::endl;
+            continue;
+        }
+        std::string includePath = directoryOf(path) + line.substr(open + 1, close - open - 1);
+        if(!included.insert(includePath).second)
+            continue;
+
+        std::ifstream file(includePath);
+        if(!file.is_open())
+        {
+            std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND " << includePath << " (from " << path << ")" << std::endl;
+            continue;
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        out << "#line 1\n"
+            << expandIncludes(stream.str(), includePath, included)
+            << "#line " << lineNumber + 1 << '\n';
+    }
+    return out.str();
+}
+
+std::string Shader::preprocess(const std::string& code, const char* path, const ShaderDefines& defines)
+{
+    std::set<std::string> included;
+    included.insert(path);
+    std::string source = expandIncludes(code, path, included);
+    if(defines.empty())
+        return source;
+
+    // defines must follow the #version directive
+    std::string injected;
+    for(const auto& define : defines)
+        injected += "#define " + define.first + " " + define.second + "\n";
+    size_t version = source.find("#version");
+    size_t insertAt = version == std::string::npos ? 0 : source.find('\n', version);
+    if(insertAt == std::string::npos)
+        return source + "\n" + injected;
+    if(version != std::string::npos)
+    {
+        insertAt++;
+        injected += "#line 2\n"; // keep compiler messages on the file's own line numbers
+    }
+    return source.insert(insertAt, injected);
+}
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath, const ShaderDefines& defines):ID(0),isComputeShader(false)
 {
     // 1. retrieve the vertex/fragment source code from filePath
     std::string vertexCode;
@@ -46,6 +132,39 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geo
     {
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
     }
+    vertexCode = preprocess(vertexCode, vertexPath, defines);
+    fragmentCode = preprocess(fragmentCode, fragmentPath, defines);
+    if(geometryPath)
+        geometryCode = preprocess(geometryCode, geometryPath, defines);
+
+    // Save path
+    _vertexPath = vertexPath;
+    _fragmentPath = fragmentPath;
+    if(geometryPath) _geometryPath = geometryPath;
+
+    // reuse a permutation linked before, then try the binary cache
+    std::string permutation;
+    if(!defines.empty())
+    {
+        permutation = vertexCode + '\0' + fragmentCode + '\0' + geometryCode;
+        auto it = PERMUTATIONS.find(permutation);
+        if(it != PERMUTATIONS.end())
+        {
+            ID = it->second;
+            _shared = true;
+            reflectUniforms();
+            return;
+        }
+    }
+    const std::string sources[] = {vertexCode, fragmentCode, geometryCode};
+    std::string cacheKey = programCacheKey(sources, 3);
+    if(loadProgramBinary(cacheKey))
+    {
+        reflectUniforms();
+        sharePermutation(permutation);
+        return;
+    }
+
     const char* vShaderCode = vertexCode.c_str();
     const char * fShaderCode = fragmentCode.c_str();
     // 2. compile shaders
@@ -76,22 +195,21 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geo
     glAttachShader(ID, fragment);
     if(geometryPath)
         glAttachShader(ID, geometry);
+    if(!cacheKey.empty())
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
+    reflectUniforms();
+    saveProgramBinary(cacheKey);
+    sharePermutation(permutation);
     // delete the shaders as they're linked into our program now and no longer necessery
     glDeleteShader(vertex);
     glDeleteShader(fragment);
     if(geometryPath)
         glDeleteShader(geometry);
-
-    // Save path
-    _vertexPath = vertexPath;
-    _fragmentPath = fragmentPath;
-    if(geometryPath) _geometryPath = geometryPath;
-
 }
 
-Shader::Shader(const char* computePath):ID(0),isComputeShader(true)
+Shader::Shader(const char* computePath, const ShaderDefines& defines):ID(0),isComputeShader(true)
 {
     // 1. retrieve the compute shader source code from filePath
     std::string computeCode;
@@ -114,6 +232,33 @@ Shader::Shader(const char* computePath):ID(0),isComputeShader(true)
     {
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
     }
+    computeCode = preprocess(computeCode, computePath, defines);
+
+    // Save path
+    _vertexPath = computePath;
+
+    // reuse a permutation linked before, then try the binary cache
+    std::string permutation;
+    if(!defines.empty())
+    {
+        permutation = computeCode;
+        auto it = PERMUTATIONS.find(permutation);
+        if(it != PERMUTATIONS.end())
+        {
+            ID = it->second;
+            _shared = true;
+            reflectUniforms();
+            return;
+        }
+    }
+    std::string cacheKey = programCacheKey(&computeCode, 1);
+    if(loadProgramBinary(cacheKey))
+    {
+        reflectUniforms();
+        sharePermutation(permutation);
+        return;
+    }
+
     const char* cShaderCode = computeCode.c_str();
     // 2. compile shaders
     unsigned int compute;
@@ -125,13 +270,183 @@ Shader::Shader(const char* computePath):ID(0),isComputeShader(true)
     // shader Program
     ID = glCreateProgram();
     glAttachShader(ID, compute);
+    if(!cacheKey.empty())
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
+    reflectUniforms();
+    saveProgramBinary(cacheKey);
+    sharePermutation(permutation);
     // delete the shaders as they're linked into our program now and no longer necessery
     glDeleteShader(compute);
+}
 
-    // Save path
-    _vertexPath = computePath;
+void Shader::sharePermutation(const std::string& permutation)
+{
+    if(permutation.empty() || !ID)
+        return;
+    PERMUTATIONS[permutation] = ID;
+    _shared = true;
+}
+
+void Shader::reflectUniforms()
+{
+    _uniforms.clear();
+    if(!ID) return;
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+
+    for(GLint i = 0; i < count; i++)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type;
+        glGetActiveUniform(ID, GLuint(i), maxLength, &length, &size, &type, &name[0]);
+        std::string key(&name[0], length);
+
+        // members of uniform blocks have no location
+        LOCATION_QUERY_COUNT++;
+        UniformHandle location = glGetUniformLocation(ID, key.c_str());
+        if(location < 0) continue;
+        _uniforms[key] = location;
+
+        // arrays are reported as "name[0]", also accept the bare name
+        if(key.size() > 3 && key.compare(key.size() - 3, 3, "[0]") == 0)
+            _uniforms[key.substr(0, key.size() - 3)] = location;
+    }
+}
+
+UniformHandle Shader::uniform(const std::string &name) const
+{
+    auto it = _uniforms.find(name);
+    if(it != _uniforms.end())
+        return it->second;
+
+    // not reflected (inactive, or an element not listed by the driver):
+    // ask once and remember the answer, -1 included
+    LOCATION_QUERY_COUNT++;
+    UniformHandle location = glGetUniformLocation(ID, name.c_str());
+    _uniforms[name] = location;
+    return location;
+}
+
+void Shader::enableBinaryCache(const std::string& directory)
+{
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if(formats < 1)
+    {
+        std::cout << "Program binary cache: driver reports no binary formats, cache disabled." << std::endl;
+        BINARY_CACHE_DIR.clear();
+        return;
+    }
+    FileSystem::MakeDirectory(directory);
+    BINARY_CACHE_DIR = directory;
+}
+
+std::string Shader::programCacheKey(const std::string* sources, int count)
+{
+    if(BINARY_CACHE_DIR.empty())
+        return std::string();
+
+    // 64-bit FNV-1a over the driver identity and every stage source
+    unsigned long long hash = 14695981039346656037ULL;
+    auto feed = [&hash](const char* data, size_t n)
+    {
+        for(size_t i = 0; i < n; i++)
+        {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        hash ^= 0xff; hash *= 1099511628211ULL; // separator
+    };
+    const GLenum identity[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for(GLenum name : identity)
+    {
+        const char* str = reinterpret_cast<const char*>(glGetString(name));
+        if(str) feed(str, strlen(str));
+    }
+    for(int i = 0; i < count; i++)
+        feed(sources[i].data(), sources[i].size());
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", hash);
+    return std::string(key);
+}
+
+// cache file layout: magic, binary format, binary length, binary
+static const unsigned int PROGRAM_BINARY_MAGIC = 0x4250444c; // "LDPB"
+
+bool Shader::loadProgramBinary(const std::string& key)
+{
+    if(key.empty())
+        return false;
+
+    std::ifstream file(BINARY_CACHE_DIR + "/" + key + ".bin", std::ios::binary);
+    unsigned int magic = 0;
+    GLenum format = 0;
+    GLint length = 0;
+    if(file.is_open())
+    {
+        file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        file.read(reinterpret_cast<char*>(&format), sizeof(format));
+        file.read(reinterpret_cast<char*>(&length), sizeof(length));
+    }
+    if(!file || magic != PROGRAM_BINARY_MAGIC || length <= 0)
+    {
+        BINARY_CACHE_MISSES++;
+        return false;
+    }
+    std::vector<char> binary(length);
+    file.read(&binary[0], length);
+    if(!file)
+    {
+        BINARY_CACHE_MISSES++;
+        return false;
+    }
+
+    // the driver may reject binaries after an update, fall back to compiling
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, &binary[0], length);
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(!success)
+    {
+        glDeleteProgram(program);
+        BINARY_CACHE_MISSES++;
+        return false;
+    }
+    ID = program;
+    BINARY_CACHE_HITS++;
+    return true;
+}
+
+void Shader::saveProgramBinary(const std::string& key) const
+{
+    if(key.empty() || !ID)
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(ID, length, nullptr, &format, &binary[0]);
+
+    std::ofstream file(BINARY_CACHE_DIR + "/" + key + ".bin", std::ios::binary);
+    if(!file.is_open())
+    {
+        std::cout << "Program binary cache: cannot write " << BINARY_CACHE_DIR << "/" << key << ".bin" << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(&PROGRAM_BINARY_MAGIC), sizeof(PROGRAM_BINARY_MAGIC));
+    file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+    file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    file.write(&binary[0], length);
 }
 
 void Shader::checkCompileErrors(GLuint shader, std::string type)
@@ -164,28 +479,34 @@ void Shader::checkCompileErrors(GLuint shader, std::string type)
 void Shader::reload_shader_program_from_files(
   const char* vertex_shader_filename,
   const char* fragment_shader_filename,
-        const char* geometry_shader_filename) {
+        const char* geometry_shader_filename,
+        const ShaderDefines& defines) {
 
   //assert( ID && vertex_shader_filename && fragment_shader_filename );
 
   Shader reloaded_program(
-    vertex_shader_filename, fragment_shader_filename, geometry_shader_filename );
+    vertex_shader_filename, fragment_shader_filename, geometry_shader_filename, defines );
 
   if ( reloaded_program.ID ) {
-    if(ID) glDeleteProgram( ID );
+    if(ID && !_shared) glDeleteProgram( ID );
     ID = reloaded_program.ID;
+    _shared = reloaded_program._shared;
+    _uniforms.swap(reloaded_program._uniforms);
   }
 }
 
 void Shader::reload_shader_program_from_files(
-  const char* kernel_shader_filename) {
+  const char* kernel_shader_filename,
+        const ShaderDefines& defines) {
 
   //assert( ID && vertex_shader_filename && fragment_shader_filename );
 
-  Shader reloaded_program(kernel_shader_filename );
+  Shader reloaded_program(kernel_shader_filename, defines );
 
   if ( reloaded_program.ID ) {
-    if(ID) glDeleteProgram( ID );
+    if(ID && !_shared) glDeleteProgram( ID );
     ID = reloaded_program.ID;
+    _shared = reloaded_program._shared;
+    _uniforms.swap(reloaded_program._uniforms);
   }
 }
@@ -6,7 +6,14 @@
 #include "glm/glm.hpp"
 
 #include <string>
+#include <map>
+#include <unordered_map>
 
+// location of a uniform, resolve once with Shader::uniform() and reuse every frame
+typedef GLint UniformHandle;
+
+// #define name -> value injected after #version, ordered so equal sets give equal sources
+typedef std::map<std::string, std::string> ShaderDefines;
 
 class Shader
 {
@@ -14,11 +21,14 @@ public:
     unsigned int ID;
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
+    // sources may #include "file" relative to themselves; programs built with
+    // defines are shared between all Shaders asking for the same permutation
+    // ------------------------------------------------------------------------
     Shader():ID(0),isComputeShader(false) {}
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr);
-    Shader(const char* computePath); // Compute shader, require OpenGL version >= 4.0
-    void reload_shader_program_from_files(const char*,const char*,const char* = nullptr );
-    void reload_shader_program_from_files(const char*);
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const ShaderDefines& defines = ShaderDefines());
+    Shader(const char* computePath, const ShaderDefines& defines = ShaderDefines()); // Compute shader, require OpenGL version >= 4.0
+    void reload_shader_program_from_files(const char*,const char*,const char* = nullptr, const ShaderDefines& = ShaderDefines() );
+    void reload_shader_program_from_files(const char*, const ShaderDefines& = ShaderDefines());
 
     // activate the shader
     // ------------------------------------------------------------------------
@@ -26,71 +36,117 @@ public:
     {
         glUseProgram(ID);
     }
+    // uniform lookup: active uniforms are reflected at link time,
+    // anything else is asked once from the driver and cached (-1 included)
+    // ------------------------------------------------------------------------
+    UniformHandle uniform(const std::string &name) const;
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), static_cast<int>(value));
+        setBool(uniform(name), value);
+    }
+    void setBool(UniformHandle loc, bool value) const
+    {
+        UNIFORM_CALL_COUNT++;
+        glUniform1i(loc, static_cast<int>(value));
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        setInt(uniform(name), value);
+    }
+    void setInt(UniformHandle loc, int value) const
+    {
+        UNIFORM_CALL_COUNT++;
+        glUniform1i(loc, value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        setFloat(uniform(name), value);
+    }
+    void setFloat(UniformHandle loc, float value) const
+    {
+        UNIFORM_CALL_COUNT++;
+        glUniform1f(loc, value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec2(uniform(name), value);
+    }
+    void setVec2(UniformHandle loc, const glm::vec2 &value) const
+    {
+        UNIFORM_CALL_COUNT++;
+        glUniform2fv(loc, 1, &value[0]);
     }
     void setVec2(const std::string &name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        UNIFORM_CALL_COUNT++;
+        glUniform2f(uniform(name), x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec3(uniform(name), value);
+    }
+    void setVec3(UniformHandle loc, const glm::vec3 &value) const
+    {
+        UNIFORM_CALL_COUNT++;
+        glUniform3fv(loc, 1, &value[0]);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        UNIFORM_CALL_COUNT++;
+        glUniform3f(uniform(name), x, y, z);
     }
     void setVec3i(const std::string &name, const glm::ivec3 &value) const
     {
-        glUniform3iv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        UNIFORM_CALL_COUNT++;
+        glUniform3iv(uniform(name), 1, &value[0]);
     }
     void setVec3i(const std::string &name, int x, int y, int z) const
     {
-        glUniform3i(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        UNIFORM_CALL_COUNT++;
+        glUniform3i(uniform(name), x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec4(uniform(name), value);
+    }
+    void setVec4(UniformHandle loc, const glm::vec4 &value) const
+    {
+        UNIFORM_CALL_COUNT++;
+        glUniform4fv(loc, 1, &value[0]);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        UNIFORM_CALL_COUNT++;
+        glUniform4f(uniform(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        UNIFORM_CALL_COUNT++;
+        glUniformMatrix2fv(uniform(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        UNIFORM_CALL_COUNT++;
+        glUniformMatrix3fv(uniform(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(uniform(name), mat);
+    }
+    void setMat4(UniformHandle loc, const glm::mat4 &mat) const
+    {
+        UNIFORM_CALL_COUNT++;
+        glUniformMatrix4fv(loc, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setUniformBlockBinding(const char *name, const int &binding) const
@@ -108,14 +164,42 @@ public:
     //void setGeometryPath(const char *name);
     //void setKernelPath  (const char *name);
 
+    // GL call counters, reset once per frame by the caller
+    static unsigned int UNIFORM_CALL_COUNT;
+    static unsigned int LOCATION_QUERY_COUNT;
+    static void resetCounters()
+    {
+        UNIFORM_CALL_COUNT = 0;
+        LOCATION_QUERY_COUNT = 0;
+    }
+
+    // program binary cache, keyed by the sources and the driver identity
+    // disabled until a directory is given; needs a current GL context
+    // ------------------------------------------------------------------------
+    static void enableBinaryCache(const std::string& directory);
+    static unsigned int BINARY_CACHE_HITS;
+    static unsigned int BINARY_CACHE_MISSES;
+
 private:
     std::string _vertexPath;
     std::string _fragmentPath;
     std::string _geometryPath;
     const bool isComputeShader;
+    bool _shared = false; // ID belongs to the permutation cache
+    mutable std::unordered_map<std::string, UniformHandle> _uniforms;
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type);
+    // fill the uniform table from the linked program
+    void reflectUniforms();
+    // program binary cache helpers, return false on a miss or a rejected binary
+    static std::string BINARY_CACHE_DIR;
+    static std::string programCacheKey(const std::string* sources, int count);
+    bool loadProgramBinary(const std::string& key);
+    void saveProgramBinary(const std::string& key) const;
+    // include expansion and define injection
+    static std::string preprocess(const std::string& code, const char* path, const ShaderDefines& defines);
+    void sharePermutation(const std::string& permutation);
 };
 
 /*class ShaderManagement
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <algorithm>
 
 #include <glad/glad.h>
 
@@ -13,16 +14,23 @@
 
 #include "camera.h"
 #include "shader.h"
+#include "brickvolume.h"
 #include "cmake_source_dir.h"
 
 // ------------------------------------------------------------------------
 static unsigned int dummyVAO;
 static Shader _shaderHandle;
+static Shader _quadShaderHandle;
+static Shader _bricksQuadShaderHandle; // sampling a BrickVolume
+static const int BRICKED_UNIT = 13;   // and the two after it, see BrickVolume::Bind
 
 void Slice::ReloadShader()
 {
     _shaderHandle.reload_shader_program_from_files(
                 FP("glsl/sl.vert"),FP("glsl/mc.frag"),FP("glsl/sl.geom.glsl"));
+    _quadShaderHandle.reload_shader_program_from_files(FP("glsl/sl.quad.vert"),FP("glsl/sl.quad.frag"));
+    _bricksQuadShaderHandle.reload_shader_program_from_files(FP("glsl/sl.quad.vert"),FP("glsl/sl.quad.frag"),nullptr,
+                                                             ShaderDefines{ {"BRICKED", "1"} });
 }
 
 void Slice::Init()
@@ -35,6 +43,74 @@ void Slice::Init()
 
 template<typename T, typename S>
 void Slice::Draw(int target, float depth,
+                      const T& camera,
+                      const S& gridSize,
+                      const Colors& colors)
+{
+    Draw(target, std::vector<Plane>(1, Plane{ glm::vec3(0, 0, 1), depth - 0.5f }), camera, gridSize, colors);
+}
+
+// the quads of planes with shader's other uniforms set
+static void drawPlanes(const Shader& shader, const std::vector<Slice::Plane>& planes, const Slice::Colors& colors)
+{
+    using Slice::MAX_PLANES;
+    shader.setInt("colormap", colors.colormap);
+    shader.setFloat("lo", colors.lo);
+    shader.setFloat("hi", colors.hi);
+    const UniformHandle planesHandle = shader.uniform("planes");
+
+    // Draw, a strip per plane; the quads are clipped to the cube
+    for(int i = 0; i < 6; i++)
+        glEnable(GL_CLIP_DISTANCE0 + i);
+    glBindVertexArray(dummyVAO);
+    for(size_t first = 0; first < planes.size(); first += MAX_PLANES)
+    {
+        const int count = int(std::min(planes.size() - first, size_t(MAX_PLANES)));
+        glm::vec4 packed[MAX_PLANES];
+        for(int i = 0; i < count; i++)
+            packed[i] = glm::vec4(planes[first + i].normal, planes[first + i].offset);
+        glUniform4fv(planesHandle, count, &packed[0][0]);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP,0,4,count);
+    }
+    glBindVertexArray(0);
+    for(int i = 0; i < 6; i++)
+        glDisable(GL_CLIP_DISTANCE0 + i);
+}
+
+template<typename T, typename S>
+void Slice::Draw(int target, const std::vector<Plane>& planes,
+                      const T& camera,
+                      const S& gridSize,
+                      const Colors& colors)
+{
+    // Set uniform attributes
+    _quadShaderHandle.use();
+    _quadShaderHandle.setMat4("projectionMatrix", camera.GetFrustumMatrix()*glm::scale(glm::mat4(1.0),
+                                                  glm::vec3(gridSize.x/(float)gridSize.y,1.0f,gridSize.z/(float)gridSize.y)));
+    _quadShaderHandle.setVec3("viewPos",camera.Position);
+    _quadShaderHandle.setInt("volumeTex",target);
+    _quadShaderHandle.setInt("channel",colors.channel);
+    _quadShaderHandle.setVec3("voxelSize",glm::vec3(1.0f/gridSize.x,1.0f/gridSize.y, 1.0f/gridSize.z));
+    drawPlanes(_quadShaderHandle, planes, colors);
+}
+
+template<typename T>
+void Slice::Draw(const BrickVolume& volume, const std::vector<Plane>& planes,
+                      const T& camera,
+                      const Colors& colors,
+                      const glm::mat4& model)
+{
+    // model places the cube, lit in its own space
+    _bricksQuadShaderHandle.use();
+    _bricksQuadShaderHandle.setMat4("projectionMatrix", camera.GetFrustumMatrix()*model);
+    _bricksQuadShaderHandle.setVec3("viewPos",glm::vec3(glm::inverse(model)*glm::vec4(camera.Position, 1.0f)));
+    _bricksQuadShaderHandle.setVec3("voxelSize",glm::vec3(1.0f));
+    volume.Bind(_bricksQuadShaderHandle, BRICKED_UNIT);
+    drawPlanes(_bricksQuadShaderHandle, planes, colors);
+}
+
+template<typename T, typename S>
+void Slice::DrawPoints(int target, float depth,
                       const T& camera,
                       const S& gridSize)
 {
@@ -62,7 +138,11 @@ void Slice::Draw(int target, float depth,
 #endif
 }
 
-template void Slice::Draw<Camera, glm::ivec3>(int, float, const Camera&, const glm::ivec3&);
+template void Slice::Draw<Camera, glm::ivec3>(int, float, const Camera&, const glm::ivec3&, const Slice::Colors&);
+template void Slice::Draw<Camera, glm::ivec3>(int, const std::vector<Slice::Plane>&, const Camera&, const glm::ivec3&, const Slice::Colors&);
+template void Slice::Draw<Camera>(const BrickVolume&, const std::vector<Slice::Plane>&, const Camera&, const Slice::Colors&,
+                                  const glm::mat4&);
+template void Slice::DrawPoints<Camera, glm::ivec3>(int, float, const Camera&, const glm::ivec3&);
 //template void Slice::Draw<double>(int, double, const glm::mat4&, const glm::ivec3&);
 //template void Slice::Draw<int>(int, int, const glm::mat4&, const glm::ivec3&);
 
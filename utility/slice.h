@@ -1,18 +1,49 @@
 #ifndef SLICE_H
 #define SLICE_H
 
-//#include "glm/glm.hpp"
+#include <vector>
+#include "glm/glm.hpp"
 
-// 3dtexture slice: x, y or z dir, depth specified
+class BrickVolume;
+
+// 3dtexture slices: planes through the unit cube the volume fills, any orientation.
+// Each plane is one quad clipped to the cube, the fragment shader samples the volume, so
+// the cost follows the pixels covered rather than the grid resolution
 namespace Slice {
 void Init();
 void Demo(int nx, int ny, int nz);
 void ReloadShader();
 void Finalize();
 
+struct Plane
+{
+    glm::vec3 normal; // unit length
+    float offset;     // of the plane from the centre of the cube, along normal
+};
+const int MAX_PLANES = 8; // drawn in one call, more take several
+
+// values from lo to hi of a channel run across a 1d colormap (see Colormap)
+struct Colors
+{
+    float lo = 0.0f, hi = 1.0f;
+    int colormap = 10; // texture unit of the colormap, Colormap::ID()
+    int channel = 0;   // of the volume texture
+};
+
 // Passing 3d texture
+// xy plane at depth, normalized [0, 1)
+template<typename T, typename S>
+void Draw(int, float, const T&, const S&, const Colors& = Colors());
+template<typename T, typename S>
+void Draw(int, const std::vector<Plane>&, const T&, const S&, const Colors& = Colors());
+// planes through a BrickVolume filling the unit cube placed by model, sampled as its
+// Update with the same planes has streamed it in
+template<typename T>
+void Draw(const BrickVolume&, const std::vector<Plane>&, const T&, const Colors& = Colors(),
+          const glm::mat4& model = glm::mat4(1));
+// the xy plane drawn as a quad per voxel, raw rgb, for comparison
 template<typename T, typename S>
-void Draw(int, float,const T&, const S&);
+void DrawPoints(int, float, const T&, const S&);
 
 }
 
@@ -0,0 +1,242 @@
+#include "volumerender.h"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "camera.h"
+#include "shader.h"
+#include "brickvolume.h"
+#include "cmake_source_dir.h"
+
+// ------------------------------------------------------------------------
+// texture units of our own, after the colormap's
+static const int BRICK_UNIT = 11;
+static const int TARGET_UNIT = 12;
+static const int BRICKED_UNIT = 13; // and the two after it, see BrickVolume::Bind
+
+static unsigned int dummyVAO;
+static Shader _marchShader, _upsampleShader, _brickShader;
+static Shader _bricksMarchShader; // sampling a BrickVolume
+// rays marched at reduced resolution, RGBA16F premultiplied
+static unsigned int _fbo, _colorTex;
+static glm::ivec2 _targetSize(0);
+// largest value of each brick, see BuildBricks
+static unsigned int _brickTex;
+static glm::ivec3 _brickCount(0), _brickGridSize(0);
+static unsigned int _timeQuery;
+static bool _queryPending = false;
+
+double VolumeRender::GPU_MS = 0;
+
+void VolumeRender::ReloadShader()
+{
+    _marchShader.reload_shader_program_from_files(FP("glsl/vr.vert"),FP("glsl/vr.frag"));
+    _upsampleShader.reload_shader_program_from_files(FP("glsl/vr.vert"),FP("glsl/vr.upsample.frag"));
+    _bricksMarchShader.reload_shader_program_from_files(FP("glsl/vr.vert"),FP("glsl/vr.frag"),nullptr,ShaderDefines{ {"BRICKED", "1"} });
+    if(GLAD_GL_VERSION_4_3)
+        _brickShader.reload_shader_program_from_files(FP("glsl/vr.bricks.compute.glsl"));
+}
+
+void VolumeRender::Init()
+{
+    ReloadShader();
+
+    // Dummy VAO
+    glGenVertexArrays(1, &dummyVAO);
+    glGenQueries(1, &_timeQuery);
+}
+
+void VolumeRender::Finalize()
+{
+    glDeleteVertexArrays(1, &dummyVAO);
+    glDeleteQueries(1, &_timeQuery);
+    if(_fbo)
+    {
+        glDeleteFramebuffers(1, &_fbo);
+        glDeleteTextures(1, &_colorTex);
+    }
+    if(_brickTex)
+        glDeleteTextures(1, &_brickTex);
+    _fbo = _colorTex = _brickTex = 0;
+    _targetSize = glm::ivec2(0);
+    _brickCount = _brickGridSize = glm::ivec3(0);
+    _queryPending = false;
+}
+
+void VolumeRender::BuildBricks(int target, const glm::ivec3& gridSize, int channel)
+{
+    if(!GLAD_GL_VERSION_4_3 || glm::any(glm::lessThan(gridSize, glm::ivec3(1)))) return;
+    const glm::ivec3 count = (gridSize + BRICK_SIZE - 1) / BRICK_SIZE;
+    if(!_brickTex)
+        glGenTextures(1, &_brickTex);
+    glActiveTexture(GL_TEXTURE0 + BRICK_UNIT);
+    glBindTexture(GL_TEXTURE_3D, _brickTex);
+    if(count != _brickCount)
+    {
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, count.x, count.y, count.z, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        _brickCount = count;
+    }
+
+    _brickShader.use();
+    _brickShader.setInt("volumeTex", target);
+    _brickShader.setVec3i("gridSize", gridSize);
+    _brickShader.setInt("brickSize", BRICK_SIZE);
+    _brickShader.setInt("channel", channel);
+    glBindImageTexture(0, _brickTex, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((count.x + 3) / 4, (count.y + 3) / 4, (count.z + 3) / 4);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    _brickGridSize = gridSize;
+}
+
+static void resizeTarget(const glm::ivec2& size)
+{
+    if(size == _targetSize) return;
+    if(!_fbo)
+    {
+        glGenFramebuffers(1, &_fbo);
+        glGenTextures(1, &_colorTex);
+    }
+    glActiveTexture(GL_TEXTURE0 + TARGET_UNIT);
+    glBindTexture(GL_TEXTURE_2D, _colorTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x, size.y, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _colorTex, 0);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "VolumeRender:: reduced resolution target incomplete" << std::endl;
+    _targetSize = size;
+}
+
+// The rays of either Draw: shader is bound with its volume, bricks holds the largest
+// value of each brick of brickSize voxels, skipping is off without it
+template<typename T>
+static void march(Shader& shader, const glm::ivec3& gridSize, unsigned int bricks, int brickSize,
+                  const VolumeRender::Transfer& transfer, const VolumeRender::Quality& quality,
+                  const T& camera, const glm::mat4& model)
+{
+    GLint viewport[4], framebuffer;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    const int downsample = std::max(quality.downsample, 1);
+
+    // GPU time of an earlier Draw, read once available so the pipeline never stalls
+    if(_queryPending)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(_timeQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available)
+        {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(_timeQuery, GL_QUERY_RESULT, &ns);
+            VolumeRender::GPU_MS = ns * 1e-6;
+            _queryPending = false;
+        }
+    }
+    const bool timed = !_queryPending;
+    if(timed)
+        glBeginQuery(GL_TIME_ELAPSED, _timeQuery);
+
+    const GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean blend = glIsEnabled(GL_BLEND);
+    GLint blendFunc[4];
+    glGetIntegerv(GL_BLEND_SRC_RGB, &blendFunc[0]);
+    glGetIntegerv(GL_BLEND_DST_RGB, &blendFunc[1]);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &blendFunc[2]);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &blendFunc[3]);
+    GLfloat clearColor[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glBindVertexArray(dummyVAO);
+
+    // 1. rays, straight into the framebuffer or into the reduced resolution target
+    if(downsample > 1)
+    {
+        resizeTarget((glm::ivec2(viewport[2], viewport[3]) + downsample - 1) / downsample);
+        glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+        glViewport(0, 0, _targetSize.x, _targetSize.y);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    const glm::mat4 projection = camera.GetPerspectiveMatrix();
+    const bool skip = quality.skipEmpty && bricks;
+    shader.use();
+    shader.setMat4("toModel", glm::inverse(projection*camera.GetViewMatrix()*model));
+    shader.setVec3("eye", glm::vec3(glm::inverse(model)*glm::vec4(camera.Position, 1.0f)));
+    shader.setInt("colormap", transfer.colormap);
+    shader.setInt("brickTex", BRICK_UNIT);
+    shader.setVec3i("gridSize", gridSize);
+    shader.setInt("brickSize", brickSize);
+    shader.setBool("skipEmpty", skip);
+    shader.setInt("channel", transfer.channel);
+    shader.setFloat("lo", transfer.lo);
+    shader.setFloat("hi", std::max(transfer.hi, transfer.lo + 1e-6f));
+    shader.setFloat("density", transfer.density);
+    shader.setFloat("voxelStep", 1.0f / (std::max(gridSize.x, std::max(gridSize.y, gridSize.z)) * quality.stepsPerVoxel));
+    // the width of a marched pixel at unit distance, in the cube's units when model scales uniformly
+    shader.setFloat("footprint", quality.adaptiveStep ? 2.0f * downsample / (projection[1][1] * viewport[3]) : 0.0f);
+    shader.setFloat("opacityCutoff", quality.opacityCutoff);
+    if(skip)
+    {
+        glActiveTexture(GL_TEXTURE0 + BRICK_UNIT);
+        glBindTexture(GL_TEXTURE_3D, bricks);
+    }
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // 2. upsampled over the framebuffer
+    if(downsample > 1)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        _upsampleShader.use();
+        _upsampleShader.setInt("volumeColor", TARGET_UNIT);
+        glActiveTexture(GL_TEXTURE0 + TARGET_UNIT);
+        glBindTexture(GL_TEXTURE_2D, _colorTex);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glBindVertexArray(0);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    glBlendFuncSeparate(blendFunc[0], blendFunc[1], blendFunc[2], blendFunc[3]);
+    if(!blend)
+        glDisable(GL_BLEND);
+    if(depthTest)
+        glEnable(GL_DEPTH_TEST);
+    if(timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        _queryPending = true;
+    }
+}
+
+template<typename T>
+void VolumeRender::Draw(int target, const glm::ivec3& gridSize, const Transfer& transfer, const Quality& quality,
+                        const T& camera, const glm::mat4& model)
+{
+    _marchShader.use();
+    _marchShader.setInt("volumeTex", target);
+    march(_marchShader, gridSize, _brickGridSize == gridSize ? _brickTex : 0, BRICK_SIZE, transfer, quality, camera, model);
+}
+
+template<typename T>
+void VolumeRender::Draw(const BrickVolume& volume, const Transfer& transfer, const Quality& quality,
+                        const T& camera, const glm::mat4& model)
+{
+    _bricksMarchShader.use();
+    volume.Bind(_bricksMarchShader, BRICKED_UNIT);
+    march(_bricksMarchShader, volume.dimensions, volume.RangeTexture(), BrickVolume::INTERIOR, transfer, quality, camera, model);
+}
+
+template void VolumeRender::Draw<Camera>(int, const glm::ivec3&, const Transfer&, const Quality&, const Camera&, const glm::mat4&);
+template void VolumeRender::Draw<Camera>(const BrickVolume&, const Transfer&, const Quality&, const Camera&, const glm::mat4&);
@@ -0,0 +1,60 @@
+#ifndef VOLUMERENDER_H
+#define VOLUMERENDER_H
+
+// Direct volume rendering of a 3d texture filling the unit cube. Rays are marched front to
+// back through the cube: samples take their colour from a 1d colormap (see Colormap) and
+// their opacity from the transfer function, until the ray leaves the cube or is nearly
+// opaque. Bricks the transfer function leaves transparent are crossed in one step, and
+// steps grow with the distance from the camera to about a pixel's footprint.
+// Rays may be marched for a fraction of the pixels and upsampled, which keeps 512^3
+// volumes interactive. Require GLwindow, brick skipping GL 4.3
+#include "glm/glm.hpp"
+
+class BrickVolume;
+
+namespace VolumeRender {
+void Init();
+void ReloadShader();
+void Finalize();
+
+// values from lo to hi run across the colormap; opacity rises with them, from none at lo
+// (and below) to density at hi
+struct Transfer
+{
+    float lo = 0.0f, hi = 1.0f;
+    float density = 20.0f; // extinction per unit length of the cube
+    int colormap = 10;     // texture unit of the colormap, Colormap::ID()
+    int channel = 3;       // of the volume texture, the one IsoSurface::Draw reads
+};
+
+struct Quality
+{
+    int downsample = 1;          // a ray for every downsample^2 pixels
+    float stepsPerVoxel = 1.0f;  // close to the camera
+    bool adaptiveStep = true;    // further out a step spans a pixel
+    float opacityCutoff = 0.98f; // rays end once this opaque, 1 never ends them early
+    bool skipEmpty = true;       // bricks of BuildBricks
+};
+
+// --- empty space skipping
+// A brick of BRICK_SIZE^3 voxels is transparent when the largest value trilinear sampling
+// reads in it is at or below Transfer::lo. Built on the gpu from the texture on unit
+// target, call again whenever the texture is written
+const int BRICK_SIZE = 8;
+void BuildBricks(int target, const glm::ivec3& gridSize, int channel = 3);
+
+// volume in the 3d texture on unit target, blended over what is drawn already; model
+// places the unit cube
+template<typename T>
+void Draw(int target, const glm::ivec3& gridSize, const Transfer& transfer, const Quality& quality,
+          const T& camera, const glm::mat4& model = glm::mat4(1));
+// a BrickVolume as streamed in by its Update, its ranges standing in for BuildBricks;
+// Transfer::channel is not used
+template<typename T>
+void Draw(const BrickVolume& volume, const Transfer& transfer, const Quality& quality,
+          const T& camera, const glm::mat4& model = glm::mat4(1));
+
+extern double GPU_MS; // a recent Draw, read back without waiting
+}
+
+#endif
@@ -0,0 +1,521 @@
+#include "voxelterrain.h"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <cstddef>
+
+#include <glad/glad.h>
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "shader.h"
+
+struct VoxelTerrain::Chunk
+{
+    glm::ivec3 coord;
+    std::vector<float> density; // SAMPLES^3, x fastest; empty until generated, or while it can be again
+    std::vector<Brush> pending; // edits waiting for the density
+    unsigned int version = 0;   // bumped by every edit
+    unsigned int meshed = 0;    // version of the uploaded mesh
+    bool busy = false;          // a job is out, never more than one
+    bool dirty = false;         // to be meshed again
+    bool streaming = false;     // generated for the viewer, not for an edit
+    bool edited = false;        // kept out of range, the density can't be generated again
+    int level = -1;             // of the newest mesh job, and its finer neighbours
+    unsigned int finer = 0;
+    unsigned int vao = 0, vbo = 0, ebo = 0;
+    GLsizei count = 0;
+};
+
+static int floorDiv(int a, int b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+static glm::ivec3 floorDiv(const glm::ivec3& a, int b) { return glm::ivec3(floorDiv(a.x, b), floorDiv(a.y, b), floorDiv(a.z, b)); }
+static size_t sampleIndex(const glm::ivec3& p)
+{
+    const size_t n = VoxelTerrain::SAMPLES;
+    return p.x + n*(p.y + n*p.z);
+}
+
+VoxelTerrain::VoxelTerrain(Density density, float voxelSize, float isoValue, float densityPerUnit, int threads)
+    : _density(density), _voxelSize(voxelSize), _isoValue(isoValue), _densityPerUnit(densityPerUnit)
+{
+    if(threads <= 0)
+        threads = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+    for(int i = 0; i < threads; i++)
+        _workers.push_back(std::thread(&VoxelTerrain::worker, this));
+    std::cout << "VoxelTerrain:: " << CHUNK << "^3 chunks, " << threads << " worker threads" << std::endl;
+}
+
+VoxelTerrain::~VoxelTerrain()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _jobReady.notify_all();
+    for(std::thread& thread : _workers)
+        thread.join();
+    for(auto& entry : _chunks)
+        release(*entry.second);
+}
+
+// 21 bits a coordinate
+uint64_t VoxelTerrain::keyOf(const glm::ivec3& coord)
+{
+    const uint64_t mask = (1u << 21) - 1, bias = 1u << 20;
+    return ((uint64_t(coord.x) + bias) & mask) | (((uint64_t(coord.y) + bias) & mask) << 21) |
+           (((uint64_t(coord.z) + bias) & mask) << 42);
+}
+
+// rings around the viewer's chunk, a chunk wide at least: chunks touching each other,
+// corners included, are at most a level apart
+int VoxelTerrain::levelOf(const glm::ivec3& coord) const
+{
+    const glm::ivec3 d = glm::abs(coord - _viewerChunk);
+    const int distance = std::max(d.x, std::max(d.y, d.z));
+    int level = 0;
+    while(level < LODS - 1 && distance > _lodDistance[level])
+        level++;
+    return level;
+}
+
+unsigned int VoxelTerrain::finerOf(const glm::ivec3& coord) const
+{
+    const int level = levelOf(coord);
+    unsigned int finer = 0;
+    for(int z = -1; z <= 1; z++)
+        for(int y = -1; y <= 1; y++)
+            for(int x = -1; x <= 1; x++)
+                if(levelOf(coord + glm::ivec3(x, y, z)) < level)
+                    finer |= 1u << ((x + 1) + 3*(y + 1) + 9*(z + 1));
+    return finer;
+}
+
+VoxelTerrain::Chunk& VoxelTerrain::chunkAt(const glm::ivec3& coord)
+{
+    std::unique_ptr<Chunk>& chunk = _chunks[keyOf(coord)];
+    if(!chunk)
+    {
+        chunk.reset(new Chunk);
+        chunk->coord = coord;
+    }
+    return *chunk;
+}
+
+// --- workers
+void VoxelTerrain::worker()
+{
+    for(;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _jobReady.wait(lock, [this]() { return _stop || !_edits.empty() || !_stream.empty(); });
+            if(_stop) return;
+            std::deque<Job>& queue = _edits.empty() ? _stream : _edits;
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        Result result;
+        result.key = job.key;
+        result.version = job.version;
+        result.generated = job.generate;
+        result.empty = false;
+        if(job.generate)
+        {
+            job.density.resize(size_t(SAMPLES)*SAMPLES*SAMPLES);
+            const glm::ivec3 origin = job.coord*CHUNK - APRON;
+            float* d = job.density.data();
+            for(int z = 0; z < SAMPLES; z++)
+                for(int y = 0; y < SAMPLES; y++)
+                    for(int x = 0; x < SAMPLES; x++)
+                        *d++ = _density(glm::vec3(origin + glm::ivec3(x, y, z))*_voxelSize);
+        }
+        // the chunk's CHUNK+1 points, the apron around them only feeds the gradients
+        const float* points = job.density.data() + sampleIndex(glm::ivec3(APRON));
+        IsoSurface::PolygoniseLOD(points, glm::ivec3(CHUNK + 1), glm::ivec3(SAMPLES), APRON, job.stride, job.finer,
+                                  _isoValue, result.mesh);
+        if(job.generate)
+        {
+            // a coarse mesh can miss a small crossing, the points can't
+            bool inside = false, outside = false;
+            for(int z = 0; z <= CHUNK && !(inside && outside); z++)
+                for(int y = 0; y <= CHUNK; y++)
+                {
+                    const float* row = points + sampleIndex(glm::ivec3(0, y, z));
+                    for(int x = 0; x <= CHUNK; x++)
+                        if(row[x] < _isoValue) inside = true;
+                        else outside = true;
+                }
+            result.empty = !(inside && outside);
+            result.density = std::move(job.density);
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _results.push_back(std::move(result));
+    }
+}
+
+void VoxelTerrain::dispatch(Chunk& chunk, bool generate, bool edit)
+{
+    Job job;
+    job.key = keyOf(chunk.coord);
+    job.coord = chunk.coord;
+    job.version = chunk.version;
+    job.generate = generate;
+    chunk.level = levelOf(chunk.coord);
+    chunk.finer = finerOf(chunk.coord);
+    job.stride = 1 << chunk.level;
+    job.finer = chunk.finer;
+    if(!generate)
+        job.density = chunk.density; // a copy, edits keep going meanwhile
+    chunk.busy = true;
+    chunk.dirty = false;
+    chunk.streaming = !edit;
+    if(!edit)
+        _streaming++;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        (edit ? _edits : _stream).push_back(std::move(job));
+    }
+    _jobReady.notify_one();
+}
+
+// an edit waits on a chunk still queued for streaming, move it ahead
+void VoxelTerrain::promote(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(auto it = _stream.begin(); it != _stream.end(); ++it)
+        if(it->key == key)
+        {
+            _edits.push_back(std::move(*it));
+            _stream.erase(it);
+            return;
+        }
+}
+
+// --- edits
+void VoxelTerrain::applyBrush(Chunk& chunk, const Brush& brush) const
+{
+    // a couple of voxels past the sphere shape the gradient, further out nothing changes sign
+    const float reach = brush.radius + 2.0f*_voxelSize;
+    const glm::ivec3 origin = chunk.coord*CHUNK - APRON;
+    const glm::ivec3 lo = glm::max(glm::ivec3(glm::floor((brush.center - reach)/_voxelSize)) - origin, glm::ivec3(0));
+    const glm::ivec3 hi = glm::min(glm::ivec3(glm::ceil((brush.center + reach)/_voxelSize)) - origin, glm::ivec3(SAMPLES - 1));
+    for(int z = lo.z; z <= hi.z; z++)
+        for(int y = lo.y; y <= hi.y; y++)
+            for(int x = lo.x; x <= hi.x; x++)
+            {
+                const glm::ivec3 p(x, y, z);
+                const float distance = glm::length(glm::vec3(origin + p)*_voxelSize - brush.center);
+                if(distance > reach) continue;
+                const float sphere = (distance - brush.radius)*_densityPerUnit;
+                float& d = chunk.density[sampleIndex(p)];
+                d = brush.add ? std::max(d, _isoValue - sphere) : std::min(d, _isoValue + sphere);
+            }
+}
+
+void VoxelTerrain::Sculpt(const glm::vec3& center, float radius, bool add)
+{
+    if(_editing.empty())
+    {
+        _editBegin = std::chrono::steady_clock::now();
+        _editChunks = 0;
+    }
+    const Brush brush = { center, radius, add };
+
+    // chunk c holds points [c*CHUNK - APRON, c*CHUNK + CHUNK + APRON], every chunk that
+    // holds a point the brush changes is meshed again
+    const float reach = radius + 2.0f*_voxelSize;
+    const glm::ivec3 lo = glm::ivec3(glm::floor((center - reach)/_voxelSize));
+    const glm::ivec3 hi = glm::ivec3(glm::ceil((center + reach)/_voxelSize));
+    const glm::ivec3 c0 = floorDiv(lo - APRON - 1, CHUNK);
+    const glm::ivec3 c1 = floorDiv(hi + APRON, CHUNK);
+    for(int z = c0.z; z <= c1.z; z++)
+        for(int y = c0.y; y <= c1.y; y++)
+            for(int x = c0.x; x <= c1.x; x++)
+            {
+                Chunk& chunk = chunkAt(glm::ivec3(x, y, z));
+                chunk.version++;
+                chunk.edited = true;
+                if(_editing.insert(keyOf(chunk.coord)).second)
+                    _editChunks++;
+                if(!chunk.density.empty())
+                {
+                    applyBrush(chunk, brush);
+                    chunk.dirty = true;
+                    continue;
+                }
+                // generated first, the brush follows
+                chunk.pending.push_back(brush);
+                if(!chunk.busy)
+                    dispatch(chunk, true, true);
+                else if(chunk.streaming)
+                    promote(keyOf(chunk.coord));
+            }
+}
+
+// --- queries
+float VoxelTerrain::sample(const glm::ivec3& point) const
+{
+    const glm::ivec3 coord = floorDiv(point, CHUNK);
+    auto it = _chunks.find(keyOf(coord));
+    if(it != _chunks.end() && !it->second->density.empty())
+        return it->second->density[sampleIndex(point - coord*CHUNK + APRON)];
+    // not generated, or dropped unedited
+    return _density(glm::vec3(point)*_voxelSize);
+}
+
+bool VoxelTerrain::Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, glm::vec3& hit) const
+{
+    const glm::vec3 dir = glm::normalize(direction);
+    auto density = [this](const glm::vec3& ws) {
+        const glm::vec3 g = ws/_voxelSize;
+        const glm::ivec3 i(glm::floor(g));
+        const glm::vec3 f = g - glm::floor(g);
+        float c[2][2];
+        for(int z = 0; z < 2; z++)
+            for(int y = 0; y < 2; y++)
+                c[z][y] = glm::mix(sample(i + glm::ivec3(0, y, z)), sample(i + glm::ivec3(1, y, z)), f.x);
+        return glm::mix(glm::mix(c[0][0], c[0][1], f.y), glm::mix(c[1][0], c[1][1], f.y), f.z);
+    };
+
+    // half a voxel a step, then linear between the two samples around the surface
+    const float step = 0.5f*_voxelSize;
+    float previous = density(origin);
+    if(previous > _isoValue)
+    {
+        hit = origin;
+        return true;
+    }
+    for(float t = step; t <= maxDistance; t += step)
+    {
+        const float d = density(origin + t*dir);
+        if(d > _isoValue)
+        {
+            hit = origin + (t - step + step*(_isoValue - previous)/(d - previous))*dir;
+            return true;
+        }
+        previous = d;
+    }
+    return false;
+}
+
+bool VoxelTerrain::Idle() const
+{
+    return _streamed && _streaming == 0 && _editing.empty();
+}
+
+// --- render thread
+void VoxelTerrain::upload(Chunk& chunk, const IsoSurface::Mesh& mesh)
+{
+    chunk.count = GLsizei(mesh.indices.size());
+    if(mesh.indices.empty())
+    {
+        release(chunk);
+        return;
+    }
+    if(!chunk.vao)
+    {
+        glGenVertexArrays(1, &chunk.vao);
+        glGenBuffers(1, &chunk.vbo);
+        glGenBuffers(1, &chunk.ebo);
+        glBindVertexArray(chunk.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(IsoSurface::Vertex), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(IsoSurface::Vertex), (void*)offsetof(IsoSurface::Vertex, normal));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunk.ebo);
+        glBindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(IsoSurface::Vertex), mesh.vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(chunk.vao);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), mesh.indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
+
+void VoxelTerrain::release(Chunk& chunk)
+{
+    if(!chunk.vao) return;
+    glDeleteVertexArrays(1, &chunk.vao);
+    glDeleteBuffers(1, &chunk.vbo);
+    glDeleteBuffers(1, &chunk.ebo);
+    chunk.vao = chunk.vbo = chunk.ebo = 0;
+    chunk.count = 0;
+}
+
+void VoxelTerrain::Update(const glm::vec3& viewer)
+{
+    // finished jobs
+    std::deque<Result> results;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        results.swap(_results);
+    }
+    for(Result& result : results)
+    {
+        auto it = _chunks.find(result.key);
+        if(it == _chunks.end()) continue;
+        Chunk& chunk = *it->second;
+        chunk.busy = false;
+        if(chunk.streaming)
+        {
+            chunk.streaming = false;
+            _streaming--;
+        }
+        if(result.generated)
+        {
+            chunk.density = std::move(result.density);
+            if(!chunk.pending.empty())
+            {
+                // the mesh predates the edits
+                for(const Brush& brush : chunk.pending)
+                    applyBrush(chunk, brush);
+                chunk.pending.clear();
+                chunk.dirty = true;
+                continue;
+            }
+            // nothing to draw, generated again should an edit reach it
+            if(!chunk.edited && result.empty)
+                std::vector<float>().swap(chunk.density);
+        }
+        upload(chunk, result.mesh);
+        chunk.meshed = result.version;
+        // the viewer moved on while it was out
+        if(chunk.level != levelOf(chunk.coord) || chunk.finer != finerOf(chunk.coord))
+            _streamed = false;
+        if(chunk.meshed == chunk.version && _editing.erase(result.key) && _editing.empty())
+        {
+            EDIT_MS = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _editBegin).count();
+            EDIT_CHUNKS = _editChunks;
+        }
+    }
+
+    // edits, one job a chunk at a time, the newest density when it comes back
+    for(uint64_t key : _editing)
+    {
+        Chunk& chunk = *_chunks[key];
+        if(chunk.dirty && !chunk.busy)
+            dispatch(chunk, false, true);
+    }
+
+    // chunks around the viewer, nearest first
+    const glm::ivec3 viewerChunk = floorDiv(glm::ivec3(glm::floor(viewer/_voxelSize)), CHUNK);
+    if(viewRadius != _viewRadius)
+    {
+        _viewRadius = viewRadius;
+        _offsets.clear();
+        for(int z = -viewRadius.z; z <= viewRadius.z; z++)
+            for(int y = -viewRadius.y; y <= viewRadius.y; y++)
+                for(int x = -viewRadius.x; x <= viewRadius.x; x++)
+                    _offsets.push_back(glm::ivec3(x, y, z));
+        std::stable_sort(_offsets.begin(), _offsets.end(), [](const glm::ivec3& a, const glm::ivec3& b) {
+            return a.x*a.x + a.y*a.y + a.z*a.z < b.x*b.x + b.y*b.y + b.z*b.z;
+        });
+        _streamed = false;
+    }
+    if(viewerChunk != _viewerChunk)
+    {
+        // out of range by more than a chunk, edited chunks stay
+        for(auto it = _chunks.begin(); it != _chunks.end();)
+        {
+            const Chunk& chunk = *it->second;
+            if(glm::any(glm::greaterThan(glm::abs(chunk.coord - viewerChunk), viewRadius + 1)) && !chunk.edited && !chunk.busy)
+            {
+                release(*it->second);
+                it = _chunks.erase(it);
+            }
+            else
+                ++it;
+        }
+        _viewerChunk = viewerChunk;
+        _streamed = false;
+    }
+    if(!std::equal(lodDistance, lodDistance + LODS - 1, _lodDistance))
+    {
+        std::copy(lodDistance, lodDistance + LODS - 1, _lodDistance);
+        _streamed = false;
+    }
+    if(!_streamed)
+    {
+        // missing chunks, and chunks whose level or whose neighbours' changed
+        _streamed = true;
+        for(const glm::ivec3& offset : _offsets)
+        {
+            auto it = _chunks.find(keyOf(viewerChunk + offset));
+            Chunk* chunk = it != _chunks.end() ? it->second.get() : nullptr;
+            if(chunk && (chunk->density.empty() ||
+                         (chunk->level == levelOf(chunk->coord) && chunk->finer == finerOf(chunk->coord))))
+                continue;
+            if(_streaming >= size_t(streamingJobs))
+            {
+                _streamed = false;
+                break;
+            }
+            if(!chunk)
+                dispatch(chunkAt(viewerChunk + offset), true, false);
+            else if(!chunk->busy)
+                dispatch(*chunk, false, false);
+            else
+                _streamed = false; // once its job is back
+        }
+    }
+
+    CHUNKS = _chunks.size();
+    MESHES = 0;
+    TRIANGLES = 0;
+    for(const auto& entry : _chunks)
+        if(entry.second->count)
+        {
+            MESHES++;
+            TRIANGLES += entry.second->count / 3;
+        }
+    std::lock_guard<std::mutex> lock(_mutex);
+    JOBS = _edits.size() + _stream.size();
+}
+
+void VoxelTerrain::ReadMesh(IsoSurface::Mesh& mesh) const
+{
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    const glm::vec3 scale((CHUNK + 1)*_voxelSize);
+    for(const auto& entry : _chunks)
+    {
+        const Chunk& chunk = *entry.second;
+        if(!chunk.count) continue;
+        const size_t first = mesh.vertices.size(), indices = mesh.indices.size();
+        GLint size = 0;
+        glBindBuffer(GL_COPY_READ_BUFFER, chunk.vbo);
+        glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+        mesh.vertices.resize(first + size/sizeof(IsoSurface::Vertex));
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, &mesh.vertices[first]);
+        glBindBuffer(GL_COPY_READ_BUFFER, chunk.ebo);
+        mesh.indices.resize(indices + chunk.count);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, chunk.count*sizeof(unsigned int), &mesh.indices[indices]);
+
+        const glm::vec3 origin = glm::vec3(chunk.coord*CHUNK)*_voxelSize;
+        for(size_t i = first; i < mesh.vertices.size(); i++)
+            mesh.vertices[i].position = origin + mesh.vertices[i].position*scale;
+        for(size_t i = indices; i < mesh.indices.size(); i++)
+            mesh.indices[i] += (unsigned int)first;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void VoxelTerrain::Draw(const Shader& shader) const
+{
+    const UniformHandle model = shader.uniform("model");
+    // mesh positions run over the unit cube, point i at i/(CHUNK+1)
+    const glm::vec3 scale((CHUNK + 1)*_voxelSize);
+    for(const auto& entry : _chunks)
+    {
+        const Chunk& chunk = *entry.second;
+        if(!chunk.count) continue;
+        shader.setMat4(model, glm::scale(glm::translate(glm::mat4(1), glm::vec3(chunk.coord*CHUNK)*_voxelSize), scale));
+        glBindVertexArray(chunk.vao);
+        glDrawElements(GL_TRIANGLES, chunk.count, GL_UNSIGNED_INT, 0);
+    }
+    glBindVertexArray(0);
+}
@@ -0,0 +1,134 @@
+#ifndef VOXELTERRAIN_H
+#define VOXELTERRAIN_H
+
+// Chunked volume terrain: a sparse hash of fixed size chunks around the viewer, each
+// holding its density and its cached mesh. Density is generated, and chunks meshed, on
+// a pool of worker threads; the render thread only uploads finished meshes.
+// Sculpting re-meshes the chunks the brush touches, aprons included, so the neighbours
+// whose normals read the edited points follow. Those jobs go ahead of any streaming
+// work, an edit shows up after a few chunk meshes however large the world has grown.
+// Chunks further out are meshed with coarser cells, 2x then 4x the voxel; the cells next
+// to a finer chunk take in its points, so the levels meet without cracks. A chunk is
+// meshed again as the viewer moves its level or a neighbour's.
+// Solid is density above isoValue. Update, Draw and the destructor need the GL context.
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+#include "isosurface.h"
+
+class Shader;
+
+class VoxelTerrain
+{
+public:
+    static const int CHUNK = 32;                      // cells per chunk edge
+    static const int APRON = 1;                       // points kept outside the chunk for the gradients
+    static const int SAMPLES = CHUNK + 1 + 2 * APRON; // points per chunk edge
+    static const int LODS = 3;                        // cells of 1, 2 and 4 voxels
+
+    // density at a point in world space
+    typedef float (*Density)(glm::vec3 ws);
+
+    // brushes carve a density slope of densityPerUnit per world unit: match the generated
+    // field's gradient so edited and generated surfaces shade alike. threads <= 0 uses all
+    // cores but one
+    VoxelTerrain(Density density, float voxelSize, float isoValue = 0.0f, float densityPerUnit = 1.0f, int threads = 0);
+    ~VoxelTerrain();
+
+    glm::ivec3 viewRadius = glm::ivec3(4, 2, 4); // chunks kept around the viewer
+    int streamingJobs = 4;                       // chunks generated at once, edits never wait for more
+    // chunks (in the largest of the three axes) from the viewer's up to which level l is
+    // used, increasing; beyond the last the coarsest level
+    int lodDistance[LODS - 1] = { 1, 2 };
+
+    // sphere brush, add fills it with solid, otherwise carves it out
+    void Sculpt(const glm::vec3& center, float radius, bool add);
+    // first solid point along the ray, false if none within maxDistance
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, glm::vec3& hit) const;
+    // uploads finished meshes, hands dirty chunks to the workers and streams chunks in and
+    // out around the viewer
+    void Update(const glm::vec3& viewer);
+    // every chunk with surface, setting mat4 "model" of the bound shader (unit cube to chunk)
+    void Draw(const Shader& shader) const;
+    // nothing streaming, queued or dirty
+    bool Idle() const;
+    // the drawn triangles in world space, read back from the gpu
+    void ReadMesh(IsoSurface::Mesh& mesh) const;
+
+    // last Update
+    size_t CHUNKS = 0;            // in the hash
+    size_t MESHES = 0;            // holding surface
+    size_t JOBS = 0;              // with the workers
+    unsigned int TRIANGLES = 0;
+    // the last edit, from Sculpt to the last touched chunk uploaded; accumulates over
+    // overlapping edits
+    double EDIT_MS = 0;
+    unsigned int EDIT_CHUNKS = 0; // chunks it re-meshed
+
+private:
+    struct Brush { glm::vec3 center; float radius; bool add; };
+    struct Chunk;
+    struct Job
+    {
+        uint64_t key;
+        glm::ivec3 coord;
+        unsigned int version;
+        bool generate;              // density to be generated, otherwise meshed as handed over
+        int stride;
+        unsigned int finer;         // neighbours of the next level down, see IsoSurface::PolygoniseLOD
+        std::vector<float> density;
+    };
+    struct Result
+    {
+        uint64_t key;
+        unsigned int version;
+        bool generated;
+        bool empty;                 // generated without surface at any level
+        std::vector<float> density; // the generated density
+        IsoSurface::Mesh mesh;
+    };
+
+    static uint64_t keyOf(const glm::ivec3& coord);
+    int levelOf(const glm::ivec3& coord) const;
+    unsigned int finerOf(const glm::ivec3& coord) const;
+    Chunk& chunkAt(const glm::ivec3& coord);
+    void applyBrush(Chunk& chunk, const Brush& brush) const;
+    float sample(const glm::ivec3& point) const;
+    void dispatch(Chunk& chunk, bool generate, bool edit);
+    void promote(uint64_t key);
+    void upload(Chunk& chunk, const IsoSurface::Mesh& mesh);
+    void release(Chunk& chunk);
+    void worker();
+
+    Density _density;
+    float _voxelSize, _isoValue, _densityPerUnit;
+    std::unordered_map<uint64_t, std::unique_ptr<Chunk>> _chunks;
+    std::unordered_set<uint64_t> _editing;  // edited chunks whose mesh is not up to date
+    std::chrono::steady_clock::time_point _editBegin;
+    unsigned int _editChunks = 0;
+    std::vector<glm::ivec3> _offsets;       // chunks within viewRadius, nearest first
+    glm::ivec3 _viewRadius = glm::ivec3(-1);
+    glm::ivec3 _viewerChunk = glm::ivec3(0);
+    bool _streamed = false;                 // every chunk around the viewer requested
+    size_t _streaming = 0;                  // generate and level jobs out for streaming
+    int _lodDistance[LODS - 1] = { 0 };
+
+    // worker pool, edits first
+    std::mutex _mutex;
+    std::condition_variable _jobReady;
+    std::deque<Job> _edits, _stream;
+    std::deque<Result> _results;
+    bool _stop = false;
+    std::vector<std::thread> _workers;
+};
+
+#endif
@@ -0,0 +1,870 @@
+#include "vtkfile.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#ifdef _WIN32
+#include <cstdio>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define VTKIO_SSSE3 1
+#endif
+
+// ------------------------------------------------------------------------
+// byte order
+static bool bigEndianHost()
+{
+    const uint16_t one = 1;
+    unsigned char first;
+    memcpy(&first, &one, 1);
+    return first == 0;
+}
+
+#ifdef VTKIO_SSSE3
+// 16 bytes a shuffle, 64 a pass; returns the bytes done, whole vectors only
+__attribute__((target("ssse3")))
+static size_t swapSSSE3(const unsigned char* src, unsigned char* dst, size_t bytes, int size)
+{
+    const __m128i mask = size == 2 ? _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)
+                       : size == 4 ? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+                                   : _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+    for(; i + 64 <= bytes; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(a, mask));
+        _mm_storeu_si128((__m128i*)(dst + i + 16), _mm_shuffle_epi8(b, mask));
+        _mm_storeu_si128((__m128i*)(dst + i + 32), _mm_shuffle_epi8(c, mask));
+        _mm_storeu_si128((__m128i*)(dst + i + 48), _mm_shuffle_epi8(d, mask));
+    }
+    for(; i + 16 <= bytes; i += 16)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i)), mask));
+    return i;
+}
+static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+#endif
+
+void VtkIO::SwapToHost(const void* source, void* destination, size_t n, int size)
+{
+    const unsigned char* src = (const unsigned char*)source;
+    unsigned char* dst = (unsigned char*)destination;
+    const size_t bytes = n * size;
+    if(size == 1 || bigEndianHost())
+    {
+        if(dst != src)
+            memmove(dst, src, bytes);
+        return;
+    }
+    size_t i = 0;
+#ifdef VTKIO_SSSE3
+    if(hasSSSE3)
+        i = swapSSSE3(src, dst, bytes, size);
+#endif
+    for(; i < bytes; i += size)
+    {
+        unsigned char v[8];
+        memcpy(v, src + i, size);
+        for(int b = 0; b < size; b++)
+            dst[i + b] = v[size - 1 - b];
+    }
+}
+
+// ------------------------------------------------------------------------
+// types
+static const char* typeNames[] = { "unsigned_char", "char", "unsigned_short", "short", "unsigned_int", "int",
+                                   "vtktypeuint64", "vtktypeint64", "float", "double" };
+
+int VtkIO::SizeOf(Type type)
+{
+    static const int sizes[] = { 1, 1, 2, 2, 4, 4, 8, 8, 4, 8, 0 };
+    return sizes[type];
+}
+
+VtkIO::Type VtkIO::ParseType(const char* name, size_t length)
+{
+    for(int t = 0; t < UNKNOWN; t++)
+        if(strlen(typeNames[t]) == length && !strncmp(typeNames[t], name, length))
+            return Type(t);
+    // long is the writer's own, 8 bytes on the 64 bit hosts writing large dumps
+    if(length == 13 && !strncmp(name, "unsigned_long", length)) return UINT64;
+    if(length == 4 && !strncmp(name, "long", length)) return INT64;
+    return UNKNOWN;
+}
+
+const char* VtkIO::TypeName(Type type)
+{
+    return type < UNKNOWN ? typeNames[type] : "unknown";
+}
+
+template<typename T> struct TypeOf;
+template<> struct TypeOf<uint8_t>  { static const VtkIO::Type value = VtkIO::UINT8; };
+template<> struct TypeOf<int8_t>   { static const VtkIO::Type value = VtkIO::INT8; };
+template<> struct TypeOf<uint16_t> { static const VtkIO::Type value = VtkIO::UINT16; };
+template<> struct TypeOf<int16_t>  { static const VtkIO::Type value = VtkIO::INT16; };
+template<> struct TypeOf<uint32_t> { static const VtkIO::Type value = VtkIO::UINT32; };
+template<> struct TypeOf<int32_t>  { static const VtkIO::Type value = VtkIO::INT32; };
+template<> struct TypeOf<uint64_t> { static const VtkIO::Type value = VtkIO::UINT64; };
+template<> struct TypeOf<int64_t>  { static const VtkIO::Type value = VtkIO::INT64; };
+template<> struct TypeOf<float>    { static const VtkIO::Type value = VtkIO::FLOAT32; };
+template<> struct TypeOf<double>   { static const VtkIO::Type value = VtkIO::FLOAT64; };
+
+// n values of type, already in host order, to T
+template<typename S, typename T>
+static void convertAs(const unsigned char* src, T* dst, size_t n)
+{
+    const S* s = (const S*)src;
+    for(size_t i = 0; i < n; i++)
+        dst[i] = T(s[i]);
+}
+template<typename T>
+static void convert(VtkIO::Type type, const unsigned char* src, T* dst, size_t n)
+{
+    switch(type)
+    {
+    case VtkIO::UINT8:   convertAs<uint8_t>(src, dst, n); break;
+    case VtkIO::INT8:    convertAs<int8_t>(src, dst, n); break;
+    case VtkIO::UINT16:  convertAs<uint16_t>(src, dst, n); break;
+    case VtkIO::INT16:   convertAs<int16_t>(src, dst, n); break;
+    case VtkIO::UINT32:  convertAs<uint32_t>(src, dst, n); break;
+    case VtkIO::INT32:   convertAs<int32_t>(src, dst, n); break;
+    case VtkIO::UINT64:  convertAs<uint64_t>(src, dst, n); break;
+    case VtkIO::INT64:   convertAs<int64_t>(src, dst, n); break;
+    case VtkIO::FLOAT32: convertAs<float>(src, dst, n); break;
+    case VtkIO::FLOAT64: convertAs<double>(src, dst, n); break;
+    default: std::fill(dst, dst + n, T(0)); break;
+    }
+}
+
+// ------------------------------------------------------------------------
+// arrays
+template<typename T>
+T VtkFile::Array::Get(size_t i) const
+{
+    alignas(8) unsigned char v[8];
+    const int size = VtkIO::SizeOf(type);
+    VtkIO::SwapToHost(data + i * size, v, 1, size);
+    T value;
+    convert(type, v, &value, 1);
+    return value;
+}
+
+template<typename T>
+void VtkFile::Array::Read(T* dst, size_t first, size_t count) const
+{
+    if(first >= Size()) return;
+    count = std::min(count, Size() - first);
+    const int size = VtkIO::SizeOf(type);
+    const unsigned char* src = data + first * size;
+#ifndef _WIN32
+    // read ahead of the copy; the advice covers whole pages
+    if(count * size >= (size_t(1) << 20))
+    {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const uintptr_t begin = uintptr_t(src) & ~(page - 1);
+        madvise((void*)begin, uintptr_t(src) + count * size - begin, MADV_SEQUENTIAL);
+    }
+#endif
+    if(TypeOf<T>::value == type)
+    {
+        VtkIO::SwapToHost(src, dst, count, size);
+        return;
+    }
+    // swapped a block at a time into a buffer that stays in cache, then converted
+    const size_t BLOCK = 4096;
+    alignas(16) unsigned char block[BLOCK * 8];
+    for(size_t i = 0; i < count; i += BLOCK)
+    {
+        const size_t n = std::min(BLOCK, count - i);
+        VtkIO::SwapToHost(src + i * size, block, n, size);
+        convert(type, block, dst + i, n);
+    }
+}
+
+#define VTKFILE_INSTANTIATE(T) \
+    template T VtkFile::Array::Get<T>(size_t) const; \
+    template void VtkFile::Array::Read<T>(T*, size_t, size_t) const;
+VTKFILE_INSTANTIATE(uint8_t)
+VTKFILE_INSTANTIATE(int8_t)
+VTKFILE_INSTANTIATE(uint16_t)
+VTKFILE_INSTANTIATE(int16_t)
+VTKFILE_INSTANTIATE(uint32_t)
+VTKFILE_INSTANTIATE(int32_t)
+VTKFILE_INSTANTIATE(uint64_t)
+VTKFILE_INSTANTIATE(int64_t)
+VTKFILE_INSTANTIATE(float)
+VTKFILE_INSTANTIATE(double)
+#undef VTKFILE_INSTANTIATE
+
+// ------------------------------------------------------------------------
+// file
+bool VtkFile::Open(const std::string& path)
+{
+    Close();
+#ifdef _WIN32
+    // no mapping here, the file is read whole
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f)
+    {
+        std::cout << "VtkFile:: cannot open " << path << std::endl;
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    _size = size_t(_ftelli64(f));
+    fseek(f, 0, SEEK_SET);
+    unsigned char* buffer = new unsigned char[_size];
+    _size = fread(buffer, 1, _size, f);
+    fclose(f);
+    _data = buffer;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        std::cout << "VtkFile:: cannot open " << path << std::endl;
+        if(fd >= 0) close(fd);
+        return false;
+    }
+    _size = size_t(st.st_size);
+    void* mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        std::cout << "VtkFile:: cannot map " << path << std::endl;
+        _size = 0;
+        return false;
+    }
+    _data = (const unsigned char*)mapping;
+    _mapped = true;
+#endif
+    if(!parse())
+    {
+        std::cout << "VtkFile:: in " << path << std::endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void VtkFile::Close()
+{
+    if(_data)
+    {
+#ifdef _WIN32
+        delete[] _data;
+#else
+        if(_mapped)
+            munmap((void*)_data, _size);
+#endif
+    }
+    _data = nullptr;
+    _size = 0;
+    _mapped = false;
+    title.clear();
+    dataset.clear();
+    dimensions = glm::ivec3(1);
+    origin = glm::vec3(0);
+    spacing = glm::vec3(1);
+    arrays.clear();
+}
+
+const VtkFile::Array* VtkFile::Find(const std::string& name) const
+{
+    for(const Array& a : arrays)
+        if(a.name == name)
+            return &a;
+    return nullptr;
+}
+
+// --- header
+// The header is read a line at a time where it lies; a binary block starts right after
+// the line announcing it.
+namespace {
+struct Cursor
+{
+    const char* p;
+    const char* end;
+
+    // the next line, p moves past it
+    std::string line()
+    {
+        const char* begin = p;
+        while(p < end && *p != '\n') p++;
+        const char* last = p;
+        if(p < end) p++;
+        if(last > begin && last[-1] == '\r') last--;
+        return std::string(begin, last);
+    }
+    // the next line with something on it, split at blanks
+    std::vector<std::string> tokens()
+    {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        std::vector<std::string> t;
+        const std::string l = line();
+        size_t i = 0;
+        while(i < l.size())
+        {
+            while(i < l.size() && (l[i] == ' ' || l[i] == '\t')) i++;
+            size_t j = i;
+            while(j < l.size() && l[j] != ' ' && l[j] != '\t') j++;
+            if(j > i) t.push_back(l.substr(i, j - i));
+            i = j;
+        }
+        return t;
+    }
+};
+}
+
+static size_t toSize(const std::string& s) { return size_t(strtoull(s.c_str(), nullptr, 10)); }
+static VtkIO::Type toType(const std::string& s) { return VtkIO::ParseType(s.c_str(), s.size()); }
+static std::string upper(std::string s)
+{
+    for(char& c : s) c = char(toupper(c));
+    return s;
+}
+
+bool VtkFile::parse()
+{
+    Cursor in = { (const char*)_data, (const char*)_data + _size };
+    if(in.line().compare(0, 14, "# vtk DataFile") != 0)
+    {
+        std::cout << "VtkFile:: not a legacy vtk file" << std::endl;
+        return false;
+    }
+    title = in.line();
+    std::vector<std::string> t = in.tokens();
+    if(t.empty() || upper(t[0]) != "BINARY")
+    {
+        std::cout << "VtkFile:: only binary files are read" << std::endl;
+        return false;
+    }
+
+    bool cellData = false;
+    size_t count = 0; // values of the current POINT_DATA or CELL_DATA
+    // an array of the given layout starting where the cursor is
+    auto payload = [&](const std::string& keyword, const std::string& name, VtkIO::Type type,
+                       int components, size_t tuples) -> bool
+    {
+        Array a;
+        a.keyword = keyword;
+        a.name = name;
+        a.cellData = cellData;
+        a.type = type;
+        a.components = components;
+        a.tuples = tuples;
+        a.data = (const unsigned char*)in.p;
+        if(type == VtkIO::UNKNOWN)
+        {
+            std::cout << "VtkFile:: " << name << " has a type not read" << std::endl;
+            return false;
+        }
+        if(a.Bytes() > size_t(in.end - in.p))
+        {
+            std::cout << "VtkFile:: " << name << " is cut short" << std::endl;
+            return false;
+        }
+        in.p += a.Bytes();
+        arrays.push_back(a);
+        return true;
+    };
+
+    while(in.p < in.end)
+    {
+        t = in.tokens();
+        if(t.empty()) break;
+        const std::string key = upper(t[0]);
+        const size_t n = t.size();
+        if(key == "DATASET" && n >= 2)
+        {
+            dataset = upper(t[1]);
+            if(dataset != "STRUCTURED_POINTS" && dataset != "STRUCTURED_GRID" && dataset != "RECTILINEAR_GRID")
+            {
+                std::cout << "VtkFile:: " << t[1] << " datasets are not read" << std::endl;
+                return false;
+            }
+        }
+        else if(key == "DIMENSIONS" && n >= 4)
+            dimensions = glm::ivec3(atoi(t[1].c_str()), atoi(t[2].c_str()), atoi(t[3].c_str()));
+        else if(key == "ORIGIN" && n >= 4)
+            origin = glm::vec3(atof(t[1].c_str()), atof(t[2].c_str()), atof(t[3].c_str()));
+        else if((key == "SPACING" || key == "ASPECT_RATIO") && n >= 4)
+            spacing = glm::vec3(atof(t[1].c_str()), atof(t[2].c_str()), atof(t[3].c_str()));
+        else if(key == "POINTS" && n >= 3)
+        {
+            if(!payload(key, key, toType(t[2]), 3, toSize(t[1]))) return false;
+        }
+        else if((key == "X_COORDINATES" || key == "Y_COORDINATES" || key == "Z_COORDINATES") && n >= 3)
+        {
+            if(!payload(key, key, toType(t[2]), 1, toSize(t[1]))) return false;
+        }
+        else if((key == "POINT_DATA" || key == "CELL_DATA") && n >= 2)
+        {
+            cellData = key == "CELL_DATA";
+            count = toSize(t[1]);
+        }
+        else if(key == "SCALARS" && n >= 3)
+        {
+            // followed by the line naming its lookup table
+            const int components = n >= 4 ? atoi(t[3].c_str()) : 1;
+            const std::vector<std::string> table = in.tokens();
+            if(table.empty() || upper(table[0]) != "LOOKUP_TABLE")
+            {
+                std::cout << "VtkFile:: SCALARS " << t[1] << " without LOOKUP_TABLE" << std::endl;
+                return false;
+            }
+            if(!payload(key, t[1], toType(t[2]), components, count)) return false;
+        }
+        else if((key == "VECTORS" || key == "NORMALS") && n >= 3)
+        {
+            if(!payload(key, t[1], toType(t[2]), 3, count)) return false;
+        }
+        else if(key == "TENSORS" && n >= 3)
+        {
+            if(!payload(key, t[1], toType(t[2]), 9, count)) return false;
+        }
+        else if(key == "TEXTURE_COORDINATES" && n >= 4)
+        {
+            if(!payload(key, t[1], toType(t[3]), atoi(t[2].c_str()), count)) return false;
+        }
+        else if(key == "COLOR_SCALARS" && n >= 3)
+        {
+            if(!payload(key, t[1], VtkIO::UINT8, atoi(t[2].c_str()), count)) return false;
+        }
+        else if(key == "LOOKUP_TABLE" && n >= 3)
+        {
+            // a table of its own, rgba bytes
+            if(!payload(key, t[1], VtkIO::UINT8, 4, toSize(t[2]))) return false;
+        }
+        else if(key == "FIELD" && n >= 3)
+        {
+            const int fields = atoi(t[2].c_str());
+            for(int f = 0; f < fields; f++)
+            {
+                const std::vector<std::string> a = in.tokens();
+                if(a.size() < 4)
+                {
+                    std::cout << "VtkFile:: FIELD " << t[1] << " is cut short" << std::endl;
+                    return false;
+                }
+                if(!payload(key, a[0], toType(a[3]), atoi(a[1].c_str()), toSize(a[2]))) return false;
+            }
+        }
+        else if(key == "METADATA")
+        {
+            // written by newer VTK after an array, up to an empty line
+            while(in.p < in.end && !in.line().empty()) {}
+        }
+        else
+        {
+            std::cout << "VtkFile:: stopped at " << t[0] << std::endl;
+            break;
+        }
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------
+// upload
+bool VtkFile::Upload(const Array& array) const
+{
+    const glm::ivec3 d = dimensions;
+    const int c = array.components;
+    if(array.cellData || c < 1 || c > 4 || array.tuples != size_t(d.x) * d.y * d.z)
+    {
+        std::cout << "VtkFile:: " << array.name << " is not point data of 1-4 components over "
+                  << d.x << "x" << d.y << "x" << d.z << std::endl;
+        return false;
+    }
+    static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    static const GLenum unorm8[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    static const GLenum unorm16[] = { GL_R16, GL_RG16, GL_RGB16, GL_RGBA16 };
+    static const GLenum float32[] = { GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F };
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if(array.type == VtkIO::UINT8)
+    {
+        // nothing to convert, straight from the mapping
+        glTexImage3D(GL_TEXTURE_3D, 0, unorm8[c - 1], d.x, d.y, d.z, 0, formats[c - 1], GL_UNSIGNED_BYTE, array.data);
+    }
+    else
+    {
+        const bool shorts = array.type == VtkIO::UINT16;
+        const GLenum type = shorts ? GL_UNSIGNED_SHORT : GL_FLOAT;
+        const size_t size = shorts ? 2 : 4;
+        glTexImage3D(GL_TEXTURE_3D, 0, shorts ? unorm16[c - 1] : float32[c - 1], d.x, d.y, d.z, 0,
+                     formats[c - 1], type, nullptr);
+
+        // converted into a pixel buffer, about 64MB of z slices at a time
+        const size_t slice = size_t(d.x) * d.y * c;
+        const int slab = std::max(1, int((size_t(64) << 20) / (slice * size)));
+        unsigned int pbo;
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        for(int z = 0; z < d.z; z += slab)
+        {
+            const int n = std::min(slab, d.z - z);
+            const size_t bytes = n * slice * size;
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+            void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if(shorts)
+                array.Read((uint16_t*)dst, z * slice, n * slice);
+            else
+                array.Read((float*)dst, z * slice, n * slice);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z, d.x, d.y, n, formats[c - 1], type, nullptr);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    return true;
+}
+
+// ------------------------------------------------------------------------
+// writer
+VtkWriter::VtkWriter(int threads)
+{
+    if(threads <= 0)
+        threads = std::max(1, int(std::thread::hardware_concurrency()));
+    _threads = threads;
+}
+
+bool VtkWriter::Open(const std::string& path, const std::string& title)
+{
+    Close();
+#ifdef _WIN32
+    _fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if(_fd < 0)
+    {
+        std::cout << "VtkWriter:: cannot create " << path << std::endl;
+        return false;
+    }
+    _path = path;
+    _title = title;
+    return true;
+}
+
+// true, saying so, when the first Write has laid the file out and call can no longer change it
+bool VtkWriter::laidOut(const char* call)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_laidOut)
+        std::cout << "VtkWriter:: " << call << " after the first Write, " << _path << " is laid out" << std::endl;
+    return _laidOut;
+}
+
+bool VtkWriter::StructuredPoints(const glm::ivec3& dimensions, const glm::vec3& origin, const glm::vec3& spacing)
+{
+    if(laidOut("StructuredPoints"))
+        return false;
+    char text[256];
+    snprintf(text, sizeof(text), "DATASET STRUCTURED_POINTS\nDIMENSIONS %d %d %d\nORIGIN %g %g %g\nSPACING %g %g %g\n",
+             dimensions.x, dimensions.y, dimensions.z, origin.x, origin.y, origin.z, spacing.x, spacing.y, spacing.z);
+    _geometry = text;
+    _dimensions = dimensions;
+    return true;
+}
+
+bool VtkWriter::StructuredGrid(const glm::ivec3& dimensions)
+{
+    if(laidOut("StructuredGrid"))
+        return false;
+    char text[128];
+    snprintf(text, sizeof(text), "DATASET STRUCTURED_GRID\nDIMENSIONS %d %d %d\n", dimensions.x, dimensions.y, dimensions.z);
+    _geometry = text;
+    _dimensions = dimensions;
+    return true;
+}
+
+static size_t points(const glm::ivec3& d) { return size_t(d.x) * d.y * d.z; }
+
+int VtkWriter::AddPoints(VtkIO::Type type)
+{
+    if(laidOut("AddPoints"))
+        return -1;
+    _arrays.push_back(Array{ "POINTS " + std::to_string(points(_dimensions)) + " " + VtkIO::TypeName(type) + "\n",
+                             type, 3, false, 0 });
+    return int(_arrays.size()) - 1;
+}
+
+int VtkWriter::AddScalars(const std::string& name, VtkIO::Type type, int components)
+{
+    if(laidOut("AddScalars"))
+        return -1;
+    _arrays.push_back(Array{ "SCALARS " + name + " " + VtkIO::TypeName(type) + " " + std::to_string(components) +
+                             "\nLOOKUP_TABLE default\n", type, components, true, 0 });
+    return int(_arrays.size()) - 1;
+}
+
+int VtkWriter::AddVectors(const std::string& name, VtkIO::Type type)
+{
+    if(laidOut("AddVectors"))
+        return -1;
+    _arrays.push_back(Array{ "VECTORS " + name + " " + VtkIO::TypeName(type) + "\n", type, 3, true, 0 });
+    return int(_arrays.size()) - 1;
+}
+
+// The header and the text between arrays is written here, the file sized to its end and
+// every array given its offset; points go ahead of the point data
+void VtkWriter::layout()
+{
+    _laidOut = true;
+    std::string text = "# vtk DataFile Version 2.0\n" + _title + "\nBINARY\n" + _geometry;
+    size_t offset = 0;
+    bool pointData = false;
+    for(int pass = 0; pass < 2; pass++)
+        for(Array& a : _arrays)
+        {
+            if(a.pointData != (pass == 1)) continue;
+            if(a.pointData && !pointData)
+            {
+                text += "POINT_DATA " + std::to_string(points(_dimensions)) + "\n";
+                pointData = true;
+            }
+            text += a.header;
+            pwrite(text.data(), text.size(), offset);
+            a.offset = offset + text.size();
+            offset = a.offset + points(_dimensions) * a.components * VtkIO::SizeOf(a.type);
+            text = "\n";
+        }
+    if(offset == 0)
+        pwrite(text.data(), text.size(), 0);
+#ifndef _WIN32
+    else if(ftruncate(_fd, off_t(offset)) != 0)
+        std::cout << "VtkWriter:: cannot size " << _path << " to " << offset << " bytes" << std::endl;
+#endif
+
+    // two staging buffers a thread, one filling while the other is written
+    const size_t PAGE = 4096;
+    const int buffers = 2 * _threads;
+    _staging.resize(buffers * STAGING + PAGE);
+    unsigned char* aligned = (unsigned char*)((uintptr_t(_staging.data()) + PAGE - 1) & ~uintptr_t(PAGE - 1));
+    for(int b = 0; b < buffers; b++)
+        _free.push_back(aligned + b * STAGING);
+    _quit = false;
+    for(int t = 0; t < std::min(_threads, 4); t++)
+        _io.push_back(std::thread(&VtkWriter::ioLoop, this));
+}
+
+void VtkWriter::pwrite(const void* data, size_t bytes, size_t offset)
+{
+    const char* p = (const char*)data;
+#ifdef _WIN32
+    static std::mutex seek;
+    std::lock_guard<std::mutex> lock(seek);
+    bool ok = _lseeki64(_fd, offset, SEEK_SET) >= 0;
+    while(ok && bytes > 0)
+    {
+        const int n = _write(_fd, p, unsigned(std::min(bytes, size_t(1) << 30)));
+        ok = n > 0;
+        if(ok) { p += n; bytes -= n; }
+    }
+#else
+    bool ok = true;
+    while(bytes > 0)
+    {
+        const ssize_t n = ::pwrite(_fd, p, bytes, off_t(offset));
+        if(n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        if(!ok) break;
+        p += n;
+        offset += n;
+        bytes -= n;
+    }
+#endif
+    if(!ok && !_failed.exchange(true))
+    {
+        std::cout << "VtkWriter:: writing " << _path << " failed" << std::endl;
+    }
+}
+
+unsigned char* VtkWriter::acquire()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _freeReady.wait(lock, [this]() { return !_free.empty(); });
+    unsigned char* buffer = _free.back();
+    _free.pop_back();
+    return buffer;
+}
+
+void VtkWriter::ioLoop()
+{
+    for(;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _jobReady.wait(lock, [this]() { return _quit || !_jobs.empty(); });
+            if(_jobs.empty())
+                return;
+            job = _jobs.front();
+            _jobs.pop_front();
+        }
+        pwrite(job.buffer, job.bytes, job.offset);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _free.push_back(job.buffer);
+        }
+        _freeReady.notify_one();
+    }
+}
+
+// n host values to type, big endian, a cache sized block at a time
+template<typename S, typename T>
+static void convertTo(const T* src, unsigned char* dst, size_t n)
+{
+    S* d = (S*)dst;
+    for(size_t i = 0; i < n; i++)
+        d[i] = S(src[i]);
+}
+template<typename T>
+static void toFile(VtkIO::Type type, const T* src, unsigned char* dst, size_t n)
+{
+    const int size = VtkIO::SizeOf(type);
+    if(TypeOf<T>::value == type)
+    {
+        VtkIO::SwapToHost(src, dst, n, size);
+        return;
+    }
+    const size_t BLOCK = 4096;
+    for(size_t i = 0; i < n; i += BLOCK)
+    {
+        const size_t m = std::min(BLOCK, n - i);
+        unsigned char* d = dst + i * size;
+        switch(type)
+        {
+        case VtkIO::UINT8:   convertTo<uint8_t>(src + i, d, m); break;
+        case VtkIO::INT8:    convertTo<int8_t>(src + i, d, m); break;
+        case VtkIO::UINT16:  convertTo<uint16_t>(src + i, d, m); break;
+        case VtkIO::INT16:   convertTo<int16_t>(src + i, d, m); break;
+        case VtkIO::UINT32:  convertTo<uint32_t>(src + i, d, m); break;
+        case VtkIO::INT32:   convertTo<int32_t>(src + i, d, m); break;
+        case VtkIO::UINT64:  convertTo<uint64_t>(src + i, d, m); break;
+        case VtkIO::INT64:   convertTo<int64_t>(src + i, d, m); break;
+        case VtkIO::FLOAT32: convertTo<float>(src + i, d, m); break;
+        case VtkIO::FLOAT64: convertTo<double>(src + i, d, m); break;
+        default: memset(d, 0, m * size); break;
+        }
+        VtkIO::SwapToHost(d, d, m, size);
+    }
+}
+
+template<typename T>
+void VtkWriter::Write(int array, const T* values, size_t first, size_t count)
+{
+    if(_fd < 0 || array < 0 || array >= int(_arrays.size())) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(!_laidOut)
+            layout();
+    }
+    const Array& a = _arrays[array];
+    if(a.offset == 0)
+    {
+        std::cout << "VtkWriter:: array " << array << " has no place in " << _path << std::endl;
+        return;
+    }
+    const size_t size = VtkIO::SizeOf(a.type);
+    const size_t total = points(_dimensions) * a.components;
+    if(first >= total) return;
+    count = std::min(count, total - first);
+    const size_t perBuffer = STAGING / size;
+    for(size_t i = 0; i < count; i += perBuffer)
+    {
+        const size_t n = std::min(perBuffer, count - i);
+        unsigned char* buffer = acquire();
+        toFile(a.type, values + i, buffer, n);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(Job{ buffer, a.offset + (first + i) * size, n * size });
+        }
+        _jobReady.notify_one();
+    }
+}
+
+template<typename T>
+void VtkWriter::Write(int array, const T* values)
+{
+    if(array < 0 || array >= int(_arrays.size())) return;
+    const size_t total = points(_dimensions) * _arrays[array].components;
+    // whole staging buffers a part, so only the last write of the array is short
+    const size_t perBuffer = STAGING / VtkIO::SizeOf(_arrays[array].type);
+    const size_t buffers = (total + perBuffer - 1) / perBuffer;
+    const size_t part = std::max<size_t>(1, (buffers + _threads - 1) / _threads) * perBuffer;
+    std::vector<std::thread> workers;
+    for(size_t first = part; first < total; first += part)
+        workers.push_back(std::thread([=]() { Write(array, values + first, first, part); }));
+    Write(array, values, 0, std::min(part, total));
+    for(std::thread& w : workers)
+        w.join();
+}
+
+bool VtkWriter::Close()
+{
+    if(_fd < 0)
+        return true;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(!_laidOut)
+            layout();
+        _quit = true;
+    }
+    _jobReady.notify_all();
+    for(std::thread& t : _io)
+        t.join();
+#ifdef _WIN32
+    _close(_fd);
+#else
+    close(_fd);
+#endif
+    const bool ok = !_failed;
+    _fd = -1;
+    _io.clear();
+    _jobs.clear();
+    _free.clear();
+    _staging.clear();
+    _staging.shrink_to_fit();
+    _arrays.clear();
+    _geometry.clear();
+    _dimensions = glm::ivec3(0);
+    _laidOut = _quit = false;
+    _failed = false;
+    return ok;
+}
+
+#define VTKWRITER_INSTANTIATE(T) \
+    template void VtkWriter::Write<T>(int, const T*, size_t, size_t); \
+    template void VtkWriter::Write<T>(int, const T*);
+VTKWRITER_INSTANTIATE(uint8_t)
+VTKWRITER_INSTANTIATE(int8_t)
+VTKWRITER_INSTANTIATE(uint16_t)
+VTKWRITER_INSTANTIATE(int16_t)
+VTKWRITER_INSTANTIATE(uint32_t)
+VTKWRITER_INSTANTIATE(int32_t)
+VTKWRITER_INSTANTIATE(uint64_t)
+VTKWRITER_INSTANTIATE(int64_t)
+VTKWRITER_INSTANTIATE(float)
+VTKWRITER_INSTANTIATE(double)
+#undef VTKWRITER_INSTANTIATE
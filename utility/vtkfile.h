@@ -0,0 +1,145 @@
+#ifndef VTKFILE_H
+#define VTKFILE_H
+
+// Binary legacy VTK files (STRUCTURED_POINTS, STRUCTURED_GRID, RECTILINEAR_GRID), read
+// through a memory mapping: Open parses the header where it lies in the mapping and only
+// records where each array starts, nothing is copied. The payload stays big endian as VTK
+// stores it; values are converted when read, one at a time through Get or a range at a
+// time through Read, which swaps bytes 16 at once (SSSE3) straight into the destination.
+// Upload streams an array into a 3d texture through a pixel buffer, a slab at a time.
+// VtkWriter writes them: the layout is fixed before any value, so every array has its
+// offset in the file and ranges of it can be written from any thread in any order.
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+#include "glm/glm.hpp"
+
+namespace VtkIO {
+// swaps n values of size bytes from src to dst (which may be src), on big endian hosts
+// a copy
+void SwapToHost(const void* src, void* dst, size_t n, int size);
+
+enum Type { UINT8, INT8, UINT16, INT16, UINT32, INT32, UINT64, INT64, FLOAT32, FLOAT64, UNKNOWN };
+int SizeOf(Type type);
+Type ParseType(const char* name, size_t length); // "unsigned_char", "float", ...
+const char* TypeName(Type type);
+}
+
+class VtkFile
+{
+public:
+    // one array of the file: a typed view of its payload in the mapping
+    struct Array
+    {
+        std::string keyword;  // POINTS, X_COORDINATES, SCALARS, VECTORS, FIELD ...
+        std::string name;     // given to SCALARS, VECTORS and FIELD arrays, the keyword otherwise
+        bool cellData = false;
+        VtkIO::Type type = VtkIO::UNKNOWN;
+        int components = 1;
+        size_t tuples = 0;
+        const unsigned char* data = nullptr; // big endian
+
+        size_t Size() const { return tuples * components; } // values
+        size_t Bytes() const { return Size() * VtkIO::SizeOf(type); }
+        // value i in host order, converted to T
+        template<typename T> T Get(size_t i) const;
+        // count values from first, in host order and converted to T, into dst
+        template<typename T> void Read(T* dst, size_t first = 0, size_t count = size_t(-1)) const;
+    };
+
+    VtkFile() {}
+    ~VtkFile() { Close(); }
+    VtkFile(const VtkFile&) = delete;
+    VtkFile& operator=(const VtkFile&) = delete;
+
+    // false, saying why on cout, for files that are missing, ascii or cut short
+    bool Open(const std::string& path);
+    void Close();
+
+    std::string title, dataset;
+    glm::ivec3 dimensions = glm::ivec3(1);
+    glm::vec3 origin = glm::vec3(0), spacing = glm::vec3(1);
+    std::vector<Array> arrays; // in the file's order
+
+    const Array* Find(const std::string& name) const;
+    size_t Bytes() const { return _size; }
+
+    // the point data array as a 3d texture of dimensions on the active texture unit, one to
+    // four components: 8 and 16 bit unsigned integers keep their width (normalised), other
+    // types become 32 bit floats. Needs the GL context
+    bool Upload(const Array& array) const;
+
+private:
+    bool parse();
+
+    const unsigned char* _data = nullptr;
+    size_t _size = 0;
+    bool _mapped = false;
+};
+
+class VtkWriter
+{
+public:
+    // threads converting a whole array, and writing; <= 0 uses every core
+    explicit VtkWriter(int threads = 0);
+    ~VtkWriter() { Close(); }
+    VtkWriter(const VtkWriter&) = delete;
+    VtkWriter& operator=(const VtkWriter&) = delete;
+
+    // --- layout, before any Write: once the first Write has fixed it, these fail, saying so
+    // on cout
+    bool Open(const std::string& path, const std::string& title = "LodDemo");
+    bool StructuredPoints(const glm::ivec3& dimensions, const glm::vec3& origin = glm::vec3(0),
+                          const glm::vec3& spacing = glm::vec3(1));
+    bool StructuredGrid(const glm::ivec3& dimensions); // then AddPoints
+    // array indices for Write, one value per point and component, -1 after the layout
+    int AddPoints(VtkIO::Type type = VtkIO::FLOAT32);
+    int AddScalars(const std::string& name, VtkIO::Type type = VtkIO::FLOAT32, int components = 1);
+    int AddVectors(const std::string& name, VtkIO::Type type = VtkIO::FLOAT32);
+
+    // --- values
+    // count values of array from first, converted to its type and swapped to big endian
+    // into staging buffers, STAGING bytes each, that background threads write at their
+    // offsets while the next one fills. Any thread, any order, ranges written once
+    template<typename T> void Write(int array, const T* values, size_t first, size_t count);
+    // the whole array, one part per thread
+    template<typename T> void Write(int array, const T* values);
+    // waits for the writes, false if any failed
+    bool Close();
+
+    static const size_t STAGING = size_t(4) << 20;
+
+private:
+    struct Array { std::string header; VtkIO::Type type; int components; bool pointData; size_t offset; };
+    struct Job { unsigned char* buffer; size_t offset, bytes; };
+
+    void layout();
+    bool laidOut(const char* call);
+    void pwrite(const void* data, size_t bytes, size_t offset);
+    unsigned char* acquire();
+    void ioLoop();
+
+    int _threads;
+    int _fd = -1;
+    std::string _path, _title, _geometry;
+    glm::ivec3 _dimensions = glm::ivec3(0);
+    std::vector<Array> _arrays;
+    bool _laidOut = false;
+    std::atomic<bool> _failed{false}; // set by the io threads
+
+    // staging buffers, 4k aligned, and the writes waiting on the io threads
+    std::vector<unsigned char> _staging;
+    std::vector<unsigned char*> _free;
+    std::deque<Job> _jobs;
+    std::vector<std::thread> _io;
+    std::mutex _mutex;
+    std::condition_variable _freeReady, _jobReady;
+    bool _quit = false;
+};
+
+#endif